@@ -6,7 +6,10 @@
 
 #include "header.h"
 
-#define MAX_NUM_CELLS 438
+#define MAX_NUM_CELLS MAX_NUM_COLUMNS
+#define APPEND_STACK_BUFFER_SIZE 4096
+#define STRING_INLINE_CAPACITY 11
+#define SHORT_STRING_MAX_LENGTH UINT8_MAX
 
 
 typedef enum {
@@ -24,17 +27,35 @@ typedef enum {
 typedef enum {
     CELL_TYPE_INT = 0,
     CELL_TYPE_FLOAT = 1,
-    CELL_TYPE_STRING = 2
+    CELL_TYPE_STRING = 2,
+    CELL_TYPE_INT64 = 3,
+    CELL_TYPE_DOUBLE = 4,
+    CELL_TYPE_SHORT_STRING = 5  // Only on disk: a string with a one byte length, decoded as CELL_TYPE_STRING
 } cell_type_t;
 
-typedef struct {
-    size_t length;
-    char *string;
+// Strings of up to STRING_INLINE_CAPACITY bytes live in the cell itself, longer ones on the
+// heap. Either way they're NUL terminated, STRING_CELL_DATA gets at the bytes.
+typedef union {
+    uint32_t length;
+    struct {
+        uint32_t length;
+        char string[STRING_INLINE_CAPACITY + 1];
+    } inlined;
+    struct {
+        uint32_t length;
+        char *string;
+    } heap;
 } string_cell_t;
 
+#define STRING_CELL_DATA(cell) \
+    ((cell)->length <= STRING_INLINE_CAPACITY ? (cell)->inlined.string : (cell)->heap.string)
+
+// int_value and float_value share the first 4 bytes, int64_value and double_value the first 8
 typedef union {
     int32_t int_value;
     float float_value;
+    int64_t int64_value;
+    double double_value;
     string_cell_t string_cell;
 } cell_value_t;
 
@@ -48,10 +69,46 @@ typedef struct {
     cell_t *cells;
 } row_t;
 
+// Room for length bytes and the NUL, which is already there. NULL when the heap is out of memory.
+char *alloc_string_cell(string_cell_t *cell, size_t length);
+AppendOpStatus set_string_cell(string_cell_t *cell, const char *string, size_t length);
+void free_string_cell(string_cell_t *cell);
+// Numbers by value, strings bytewise then by length
+int compare_cell_values(uint8_t data_type, const cell_value_t *a, const cell_value_t *b);
+
+// Encoded cells are a type byte followed by 4 or 8 bytes of number in network order, or by
+// the string's length and bytes: one byte of length up to SHORT_STRING_MAX_LENGTH, 4 past it.
+size_t fixed_cell_size(uint8_t data_type);
+size_t encoded_string_size(size_t length);
+size_t encode_string(uint8_t *buffer, const string_cell_t *cell);
+// Size of the type byte and length of an encoded string, from its type byte
+size_t string_prefix_size(uint8_t tag);
+// Same, the buffer must hold them
+size_t decode_string_prefix(const uint8_t *cell, size_t *length_out);
+// The cell must be whole, see row_span
+size_t encoded_cell_size(const uint8_t *cell);
+const uint8_t *encoded_cell_value(const uint8_t *cell, size_t *length_out);
+
 void free_row(row_t *row, size_t num_cells);
+// Frees the strings and leaves the cells zeroed for the next row
+void clear_row(row_t *row, size_t num_cells);
 void print_parsed_row(row_t row, size_t num_cells);
+void print_cell(const cell_t *cell);
+void print_row_values(row_t row);
 AppendOpStatus parse_row(header_t header, char *row_in, row_t *row_out);
-AppendOpStatus write_row(int fd, row_t row);
+size_t row_encoded_size(row_t row);
+size_t encode_row(uint8_t *buffer, row_t row);
+AppendOpStatus write_row(int fd, header_t header, row_t row);
+AppendOpStatus append_row(int fd, header_t *header, row_t row);
 AppendOpStatus read_row(int fd, header_t header, row_t *row_out);
+AppendOpStatus skip_row(int fd, header_t header);
+size_t row_span(const uint8_t *buffer, size_t length, header_t header);
+AppendOpStatus decode_row(const uint8_t *buffer, header_t header, row_t *row_out);
+// Projected decode: decoded has one flag per column, NULL decodes them all. A projected row is
+// decoded into cells, the caller's num_cols zeroed cells reused from row to row, other rows
+// get their own. release_row_columns frees either.
+AppendOpStatus decode_row_columns(const uint8_t *buffer, header_t header, const uint8_t *decoded, cell_t *cells,
+                                  row_t *row_out);
+void release_row_columns(row_t *row, const cell_t *cells);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,63 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define CACHE_DEFAULT_CAPACITY (64 * 1024 * 1024)
+#define CACHE_NUM_BUCKETS 4096
+
+
+typedef enum {
+    CACHE_OP_SUCCESS = 0,
+    CACHE_OP_ERROR_INVALID_ARG = -1,
+    CACHE_OP_ERROR_MEMORY_ALLOCATION = -2,
+    CACHE_OP_TOO_LARGE = -3
+} CacheOpStatus;
+
+// The state of the table a result was computed on: appends move num_rows and data_end
+// forward, deletes add to the deleted rows, a sort or a compaction makes a new inode and
+// the server opens it again in a new epoch, an inode number can be reused.
+typedef struct {
+    uint64_t inode;
+    uint64_t epoch;
+    uint64_t generation;
+    uint64_t num_rows;
+    uint64_t data_end;
+    uint64_t deleted;
+} cache_version_t;
+
+typedef struct cache_entry {
+    uint64_t hash;
+    uint8_t *key;
+    size_t key_length;
+    cache_version_t version;
+    uint8_t *value;
+    size_t value_length;
+    struct cache_entry *bucket_next;
+    struct cache_entry *lru_prev;
+    struct cache_entry *lru_next;
+} cache_entry_t;
+
+// Results keyed on opaque bytes, the least recently used ones are evicted to stay under
+// capacity bytes of keys, values and bookkeeping. Not thread safe.
+typedef struct {
+    size_t capacity;
+    size_t used;
+    cache_entry_t **buckets;
+    cache_entry_t *lru_head;  // Most recently used
+    cache_entry_t *lru_tail;
+} result_cache_t;
+
+CacheOpStatus init_cache(size_t capacity, result_cache_t *cache_out);
+void free_cache(result_cache_t *cache);
+
+// Whatever its version, it's up to the caller to check whether the result still holds. The
+// entry is only valid until the next cache_put.
+const cache_entry_t *cache_get(result_cache_t *cache, const uint8_t *key, size_t key_length);
+
+// Replaces the entry of the same key. A result larger than the whole cache isn't kept.
+CacheOpStatus cache_put(result_cache_t *cache, const uint8_t *key, size_t key_length, cache_version_t version,
+                        const uint8_t *value, size_t value_length);
+
+#endif
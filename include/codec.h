@@ -0,0 +1,51 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "header.h"
+#include "append.h"
+
+#define CODEC_FIXED_CELL_SIZE (sizeof(uint8_t) + sizeof(uint32_t))
+#define CODEC_WIDE_CELL_SIZE (sizeof(uint8_t) + sizeof(uint64_t))
+#define CODEC_MAX_UNROLLED_COLS 8
+
+
+typedef enum {
+    CODEC_OP_SUCCESS = 0,
+    CODEC_OP_ERROR_INVALID_ARG = -1,
+    CODEC_OP_ERROR_MEMORY_ALLOCATION = -2
+} CodecOpStatus;
+
+// A run of number cells of the same width, at fixed offsets from the start of the run,
+// optionally followed by a string cell. A row is a sequence of such runs.
+typedef struct {
+    size_t first_col;
+    size_t num_fixed;
+    uint8_t wide;  // Int64 and double cells, 8 bytes, instead of int and float ones
+    uint8_t ends_with_string;
+} codec_run_t;
+
+typedef struct row_codec row_codec_t;
+typedef AppendOpStatus (*decode_fn_t)(const row_codec_t *codec, const uint8_t *buffer, row_t *row_out);
+
+// Compiled once per schema: the per-row loops follow the plan instead of looking at every cell's type
+struct row_codec {
+    size_t num_cols;
+    uint8_t *types;
+    size_t num_runs;
+    codec_run_t *runs;
+    size_t fixed_size;  // Size of every row when the schema has no string, 0 otherwise
+    decode_fn_t decode;
+};
+
+CodecOpStatus build_codec(header_t header, row_codec_t **codec_out);
+void free_codec(row_codec_t *codec);
+size_t codec_row_span(const row_codec_t *codec, const uint8_t *buffer, size_t length);
+// Only decodes the cells flagged in decoded, one flag per column, into the caller's num_cols cells
+AppendOpStatus codec_decode_columns(const row_codec_t *codec, const uint8_t *decoded, const uint8_t *buffer,
+                                    cell_t *cells, row_t *row_out);
+size_t codec_encode_row(const row_codec_t *codec, uint8_t *buffer, row_t row);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef DELETE_H
+#define DELETE_H
+
+#include <stdlib.h>
+
+#include "header.h"
+#include "predicate.h"
+
+#define COMPACT_SUFFIX ".compact"
+
+
+typedef enum {
+    DELETE_OP_SUCCESS = 0,
+    DELETE_OP_ERROR_INVALID_ARG = -1,
+    DELETE_OP_ERROR_MEMORY_ALLOCATION = -2,
+    DELETE_OP_READ_ERROR = -3,
+    DELETE_OP_WRITE_ERROR = -4,
+    DELETE_OP_TOMBSTONE_ERROR = -5,
+    DELETE_OP_RENAME_ERROR = -6
+} DeleteOpStatus;
+
+DeleteOpStatus delete_rows(const char *filepath, int fd, header_t header, const predicate_t *predicate, size_t *deleted_out);
+DeleteOpStatus compact_table(const char *filepath, int fd, header_t header, size_t *removed_out);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "header.h"
+#include "append.h"
+
+#define ARROW_BATCH_ROWS 65536
+#define ARROW_BUFFER_ALIGNMENT 64
+
+
+typedef enum {
+    EXPORT_OP_SUCCESS = 0,
+    EXPORT_OP_ERROR_INVALID_ARG = -1,
+    EXPORT_OP_ERROR_MEMORY_ALLOCATION = -2,
+    EXPORT_OP_ERROR_WRITE = -3,
+    EXPORT_OP_ERROR_UNSUPPORTED_TYPE = -4
+} ExportOpStatus;
+
+// One growable buffer per Arrow buffer of a column: values for int and float,
+// offsets + characters for strings. Reset after every record batch.
+typedef struct {
+    uint8_t data_type;
+    uint8_t *values;
+    size_t values_length;
+    size_t values_capacity;
+    int32_t *offsets;
+    size_t offsets_capacity;
+} arrow_column_t;
+
+typedef struct {
+    int out_fd;
+    header_t header;
+    arrow_column_t *columns;
+    size_t batch_rows;
+    size_t rows_in_batch;
+    size_t total_rows;
+    size_t num_batches;
+    pthread_mutex_t lock;  // Partitioned scans hand rows over from several threads
+    ExportOpStatus status;
+} arrow_writer_t;
+
+ExportOpStatus open_arrow_writer(int out_fd, header_t header, size_t batch_rows, arrow_writer_t *writer_out);
+ExportOpStatus arrow_write_row(arrow_writer_t *writer, row_t row);
+ExportOpStatus close_arrow_writer(arrow_writer_t *writer);
+int arrow_scan_callback(row_t row, size_t row_index, uint64_t offset, void *ctx);
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef FILE_H
 #define FILE_H
 
+#include <stdint.h>
+#include <sys/types.h>
 
 typedef enum {
     FILE_SUCCESS = 0,
@@ -13,5 +15,11 @@ typedef enum {
 
 FileOpStatus create_file(const char *filepath, int *fd_out);
 FileOpStatus open_file(const char *filepath, int *fd_out);
+// Makes a rename or an unlink in the file's directory durable
+int sync_parent_dir(const char *filepath);
+// pread and pwrite until the whole length is transferred, retrying on EINTR. pread_full
+// returns the bytes read, short at the end of the file, pwrite_full 0 or -1
+ssize_t pread_full(int fd, uint8_t *buffer, size_t length, uint64_t offset);
+int pwrite_full(int fd, const uint8_t *buffer, size_t length, uint64_t offset);
 
 #endif
\ No newline at end of file
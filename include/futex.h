@@ -0,0 +1,14 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stdint.h>
+
+
+// Parks the calling thread while *word still holds expected. Returns right away if it
+// already moved on; wake ups can be spurious, callers re-check their condition in a loop.
+void futex_wait(uint32_t *word, uint32_t expected);
+// Same with a time limit, returns non-zero when it ran out
+int futex_wait_for(uint32_t *word, uint32_t expected, long timeout_ns);
+void futex_wake(uint32_t *word, int num_waiters);
+
+#endif
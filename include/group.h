@@ -0,0 +1,90 @@
+#ifndef GROUP_H
+#define GROUP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "header.h"
+#include "append.h"
+#include "predicate.h"
+#include "tombstone.h"
+#include "threadpool.h"
+
+#define GROUP_SUFFIX ".group"
+#define GROUP_DEFAULT_MEMORY (64 * 1024 * 1024)
+#define GROUP_RADIX_BITS 6
+#define GROUP_RADIX_PARTITIONS (1 << GROUP_RADIX_BITS)
+#define GROUP_SPILL_BUFFER (64 * 1024)
+#define GROUP_MAX_KEYS 16
+#define GROUP_MAX_AGGREGATES 64
+
+
+typedef enum {
+    GROUP_OP_SUCCESS = 0,
+    GROUP_OP_ERROR_INVALID_ARG = -1,
+    GROUP_OP_ERROR_UNKNOWN_COLUMN = -2,
+    GROUP_OP_ERROR_TYPE_MISMATCH = -3,
+    GROUP_OP_ERROR_MEMORY_ALLOCATION = -4,
+    GROUP_OP_READ_ERROR = -5,
+    GROUP_OP_WRITE_ERROR = -6
+} GroupOpStatus;
+
+typedef enum {
+    AGG_COUNT = 0,
+    AGG_SUM = 1,
+    AGG_MIN = 2,
+    AGG_MAX = 3,
+    AGG_AVG = 4
+} agg_fn_t;
+
+typedef struct {
+    agg_fn_t fn;
+    size_t col_index;  // Unused by count
+    uint8_t data_type;
+} aggregate_t;
+
+typedef struct {
+    size_t num_keys;
+    size_t *key_cols;
+    size_t num_aggs;
+    aggregate_t *aggs;
+} group_by_t;
+
+// Running state of one aggregate: the rows folded in and their sum, min or max
+typedef struct {
+    int64_t count;
+    int64_t int_value;
+    double float_value;
+} agg_state_t;
+
+// Counts and integer sums are 64-bit, float sums and averages are doubles
+typedef struct {
+    uint8_t is_float;
+    int64_t int_value;
+    double float_value;
+} agg_result_t;
+
+// Called once per group with the key cells, in the order of the key columns, and one result per
+// aggregate. Nothing it gets outlives the call.
+typedef int (*group_callback_t)(row_t keys, const agg_result_t *results, void *ctx);
+
+// Keys are int, int64 or string columns, "region,day". Aggregates are "count", "sum(<column>)",
+// "min(<column>)", "max(<column>)" and "avg(<column>)" on numeric columns, comma separated.
+GroupOpStatus parse_aggregates(header_t header, const char *aggs_in, aggregate_t **aggs_out, size_t *num_aggs_out);
+GroupOpStatus parse_group_by(header_t header, const char *keys_in, const char *aggs_in, group_by_t *group_by_out);
+void free_group_by(group_by_t *group_by);
+
+// The row must have the aggregated columns decoded. States start zeroed.
+void fold_aggregates(const aggregate_t *aggs, size_t num_aggs, agg_state_t *states, row_t row);
+void aggregate_results(const aggregate_t *aggs, size_t num_aggs, const agg_state_t *states, agg_result_t *results_out);
+
+// Every worker aggregates its rows in its own hash tables, one per radix partition of the key
+// hash. A worker holding more than its share of memory_budget spills its partial groups to
+// unlinked temp files next to the table, one per partition. The partitions are then merged
+// independently on the pool and the groups handed to the callback from the calling thread, in
+// no particular order.
+GroupOpStatus group_rows(const char *filepath, int fd, header_t header, const tombstone_t *tombstones,
+                         const predicate_t *predicate, const group_by_t *group_by, size_t memory_budget,
+                         threadpool_t *pool, group_callback_t callback, void *ctx, size_t *num_groups_out);
+
+#endif
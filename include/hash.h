@@ -0,0 +1,10 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// FNV-1a, used for hash tables and checksums
+uint64_t hash_bytes(const uint8_t *bytes, size_t length);
+
+#endif
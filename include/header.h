@@ -5,7 +5,16 @@
 
 #include "schema.h"
 
-#define VERSION 1
+#define VERSION 3
+#define HEADER_FIXED_SIZE 36
+#define HEADER_GENERATION_OFFSET 4
+#define HEADER_NUM_ROWS_OFFSET 12
+// Tables written before the generation (v2) and the data end (v1) were in the header
+#define HEADER_V1_FIXED_SIZE 20
+#define HEADER_V2_FIXED_SIZE 28
+#define HEADER_LEGACY_NUM_ROWS_OFFSET 4
+#define HEADER_READ_CHUNK 4096
+#define SNAPSHOT_MAX_RETRIES 1000
 
 
 typedef enum {
@@ -23,16 +32,36 @@ typedef enum {
 typedef struct {
     uint8_t magic[3];
     uint8_t version;
+    uint64_t generation;  // Odd while the appender is publishing new rows
     size_t num_rows;
     size_t num_cols;
+    uint64_t data_end;  // Logical end of the rows, anything after it is preallocated space
     column_t *columns;
+    char *names;  // Column names of a loaded header live in this single allocation
+    uint32_t *col_lookup;  // Open addressing table of column index + 1, 0 marks an empty slot
+    size_t col_lookup_capacity;
+    size_t data_offset;
+    struct row_codec *codec;  // Built by read_header, NULL for headers that were never loaded
 } header_t;
 
+// The committed extent of the rows: readers decode up to it and never look further
+typedef struct {
+    uint64_t generation;
+    size_t num_rows;
+    uint64_t data_end;
+} snapshot_t;
+
 void print_header(header_t header);
+void free_header(header_t *header);
+size_t header_size(header_t header);
+void set_current_layout(header_t *header);
+HeaderOpStatus build_column_lookup(header_t *header);
+int find_column(header_t header, const char *name, size_t name_length, size_t *index_out);
 HeaderOpStatus initialize_header(column_t *columns, size_t num_cols, header_t *header_out);
 HeaderOpStatus write_columns(int fd, column_t *columns, size_t num_cols);
 HeaderOpStatus write_header(int fd, header_t header);
 HeaderOpStatus read_header(int fd, header_t *header);
-HeaderOpStatus update_header_num_rows(int fd, size_t increment, header_t *header);
+HeaderOpStatus read_snapshot(int fd, snapshot_t *snapshot_out);
+HeaderOpStatus update_header_num_rows(int fd, size_t increment, uint64_t data_end, header_t *header);
 
 #endif
\ No newline at end of file
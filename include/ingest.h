@@ -0,0 +1,72 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "append.h"
+#include "writer.h"
+
+#define INGEST_QUEUE_CAPACITY 8192
+#define INGEST_BATCH_ROWS 4096
+#define INGEST_LINGER_NS (1000 * 1000)
+
+
+typedef enum {
+    INGEST_OP_SUCCESS = 0,
+    INGEST_OP_ERROR_INVALID_ARG = -1,
+    INGEST_OP_ERROR_MEMORY_ALLOCATION = -2,
+    INGEST_OP_ERROR_THREAD = -3,
+    INGEST_OP_FULL = -4,
+    INGEST_OP_WRITE_ERROR = -5
+} IngestOpStatus;
+
+// What a producer does when the queue is full
+typedef enum {
+    INGEST_BLOCK = 0,
+    INGEST_FAIL = 1
+} IngestBackpressure;
+
+// A slot is free for the producer claiming position pos when its sequence is pos, and
+// holds a row for the flusher when it's pos + 1.
+typedef struct {
+    size_t sequence;
+    row_t row;
+} ingest_slot_t;
+
+// Bounded multi-producer single-consumer ring. Producers claim a position with a CAS on
+// enqueue_pos and publish the row through the slot's sequence, no lock is ever taken.
+// A flusher thread drains the rows into the append writer and publishes them with a
+// single header update per INGEST_BATCH_ROWS rows, or once no row came for
+// INGEST_LINGER_NS. Both sides only sleep on a futex when the ring is empty or full, and
+// producers only wake the flusher once enough rows are queued to be worth it.
+typedef struct {
+    ingest_slot_t *slots;
+    row_t *batch;  // Rows drained by the flusher, their slots are freed before they're encoded
+    size_t capacity;  // Power of two
+    size_t enqueue_pos;
+    size_t dequeue_pos;  // Only touched by the flusher
+    IngestBackpressure backpressure;
+    append_writer_t *writer;
+    pthread_t flusher;
+    uint32_t has_rows;  // Futex words, bumped when the flusher or the producers may need waking
+    uint32_t has_space;
+    uint32_t flusher_waiting;
+    size_t wake_pos;  // A producer publishing past it wakes the flusher
+    uint32_t producers_waiting;
+    int closing;
+    WriterOpStatus writer_status;  // First error of the writer, the rows queued after it are dropped
+} ingest_queue_t;
+
+// The writer must stay open and only be used by the queue until close_ingest_queue
+IngestOpStatus open_ingest_queue(append_writer_t *writer, size_t capacity, IngestBackpressure backpressure,
+                                 ingest_queue_t **queue_out);
+
+// Thread safe. The queue owns the row once it's accepted, it's freed after being written.
+IngestOpStatus ingest_enqueue(ingest_queue_t *queue, row_t row);
+
+// Every producer must be done. Drains and flushes the remaining rows and stops the flusher.
+IngestOpStatus close_ingest_queue(ingest_queue_t *queue);
+
+#endif
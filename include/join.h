@@ -0,0 +1,47 @@
+#ifndef JOIN_H
+#define JOIN_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "header.h"
+#include "append.h"
+#include "predicate.h"
+
+#define JOIN_SUFFIX ".join"
+#define JOIN_DEFAULT_MEMORY (64 * 1024 * 1024)
+#define JOIN_MIN_MEMORY (1024 * 1024)
+#define JOIN_MAX_PARTITIONS 256
+#define JOIN_PARTITION_BUFFER (64 * 1024)
+
+
+typedef enum {
+    JOIN_OP_SUCCESS = 0,
+    JOIN_OP_ERROR_INVALID_ARG = -1,
+    JOIN_OP_ERROR_UNKNOWN_COLUMN = -2,
+    JOIN_OP_ERROR_TYPE_MISMATCH = -3,
+    JOIN_OP_ERROR_MEMORY_ALLOCATION = -4,
+    JOIN_OP_READ_ERROR = -5,
+    JOIN_OP_WRITE_ERROR = -6,
+    JOIN_OP_TOMBSTONE_ERROR = -7
+} JoinOpStatus;
+
+// Returning non-zero from the callback stops the join. Both rows are freed once it returns.
+typedef int (*join_callback_t)(row_t left, row_t right, void *ctx);
+
+// "<column>=<right column>", or just "<column>" when both tables name it the same. The
+// columns must both be ints, both int64s or both strings.
+JoinOpStatus parse_join_columns(header_t left_header, header_t right_header, const char *columns_in,
+                                size_t *left_col_out, size_t *right_col_out);
+
+// Inner equi-join of the live rows of two tables, the predicate filters the left one. The
+// smaller table is loaded in a hash table and the other one streamed against it; when the
+// smaller one is larger than memory_budget both are first split by hash in partitions
+// spilled to unlinked temp files next to the left table, and joined partition by partition.
+// Rows come in no particular order.
+JoinOpStatus join_tables(const char *left_path, int left_fd, header_t left_header, size_t left_col,
+                         const predicate_t *predicate, const char *right_path, int right_fd, header_t right_header,
+                         size_t right_col, size_t memory_budget, join_callback_t callback, void *ctx,
+                         size_t *num_rows_out);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "header.h"
+#include "append.h"
+#include "predicate.h"
+#include "scan.h"
+
+#define MANIFEST_VERSION 1
+#define MANIFEST_TMP_SUFFIX ".tmp"
+
+
+typedef enum {
+    PARTITION_OP_SUCCESS = 0,
+    PARTITION_OP_ERROR_INVALID_ARG = -1,
+    PARTITION_OP_ERROR_MEMORY_ALLOCATION = -2,
+    PARTITION_OP_READ_ERROR = -3,
+    PARTITION_OP_WRITE_ERROR = -4,
+    PARTITION_OP_ERROR_SCHEMA = -5,
+    PARTITION_OP_ERROR_THREAD = -6
+} PartitionOpStatus;
+
+typedef enum {
+    PARTITION_BY_ROWS = 0,
+    PARTITION_BY_VALUE = 1
+} partition_kind_t;
+
+// By rows, [lo, hi) is the range of row numbers the partition was opened for.
+// By value, it's the range of values of the partition column it holds.
+typedef struct {
+    uint32_t id;
+    int64_t lo;
+    int64_t hi;
+} partition_t;
+
+typedef struct {
+    char *path;
+    partition_kind_t kind;
+    size_t col_index;
+    uint64_t param;  // Rows per partition or width of a value range
+    uint32_t next_id;
+    char *schema;
+    header_t header;  // Built from the schema, every partition file has the same columns
+    size_t num_partitions;
+    partition_t *partitions;
+} manifest_t;
+
+int is_manifest(int fd);
+char *partition_path(const manifest_t *manifest, uint32_t id);
+void free_manifest(manifest_t *manifest);
+PartitionOpStatus create_manifest(const char *path, char *schema, char *spec, manifest_t *manifest_out);
+PartitionOpStatus read_manifest(const char *path, manifest_t *manifest_out);
+PartitionOpStatus write_manifest(const manifest_t *manifest);
+PartitionOpStatus append_partitioned(manifest_t *manifest, row_t row);
+int partition_may_match(const manifest_t *manifest, const partition_t *partition, const predicate_t *predicate);
+PartitionOpStatus scan_partitions(const manifest_t *manifest, const predicate_t *predicate,
+                                  const projection_t *projection, scan_callback_t callback, void *ctx,
+                                  threadpool_t *pool);
+PartitionOpStatus delete_partitioned(const manifest_t *manifest, const predicate_t *predicate, size_t *deleted_out);
+PartitionOpStatus compact_partitioned(const manifest_t *manifest, size_t *removed_out);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef PREDICATE_H
+#define PREDICATE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "header.h"
+#include "append.h"
+
+
+typedef enum {
+    PREDICATE_OP_SUCCESS = 0,
+    PREDICATE_OP_ERROR_INVALID_ARG = -1,
+    PREDICATE_OP_ERROR_UNKNOWN_COLUMN = -2,
+    PREDICATE_OP_ERROR_MEMORY_ALLOCATION = -3
+} PredicateOpStatus;
+
+typedef enum {
+    PRED_EQ = 0,
+    PRED_NE = 1,
+    PRED_LT = 2,
+    PRED_LE = 3,
+    PRED_GT = 4,
+    PRED_GE = 5
+} predicate_op_t;
+
+typedef struct {
+    size_t col_index;
+    uint8_t data_type;
+    predicate_op_t op;
+    cell_value_t value;
+} predicate_t;
+
+void free_predicate(predicate_t *predicate);
+PredicateOpStatus parse_predicate(header_t header, char *predicate_in, predicate_t *predicate_out);
+int eval_predicate(const predicate_t *predicate, row_t row);
+
+#endif
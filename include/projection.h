@@ -0,0 +1,34 @@
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "header.h"
+#include "predicate.h"
+
+
+typedef enum {
+    PROJECTION_OP_SUCCESS = 0,
+    PROJECTION_OP_ERROR_INVALID_ARG = -1,
+    PROJECTION_OP_ERROR_UNKNOWN_COLUMN = -2,
+    PROJECTION_OP_ERROR_MEMORY_ALLOCATION = -3
+} ProjectionOpStatus;
+
+// The columns a scan is asked for, in the requested order. Scanned rows keep one cell per
+// column of the schema so predicates and callbacks index them as usual, but only the
+// flagged cells are decoded: the others are stepped over and left zeroed.
+typedef struct {
+    size_t num_cols;
+    size_t *columns;
+    uint8_t *decoded;  // One flag per column of the schema, NULL when every column is decoded
+} projection_t;
+
+void free_projection(projection_t *projection);
+
+// Comma separated column names, "name,score". The predicate's column, if any, is decoded
+// as well so the rows can still be filtered.
+ProjectionOpStatus parse_projection(header_t header, const char *columns_in, const predicate_t *predicate,
+                                    projection_t *projection_out);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "header.h"
+#include "scan.h"
+
+#define READAHEAD_BUFFERS 3
+#define READAHEAD_WINDOW (4 * SCAN_MORSEL_SIZE)
+
+
+// A block of whole rows, as cut by read_row_block. The last block holds no rows: its
+// status tells whether the file was read to the end or the reader failed.
+typedef struct {
+    uint8_t *buffer;
+    size_t capacity;
+    size_t length;
+    uint64_t offset;
+    size_t first_row;
+    size_t num_rows;
+    ScanOpStatus status;
+} readahead_block_t;
+
+// A reader thread filling the blocks ahead of a single consumer. The blocks go round a
+// single-producer single-consumer ring: head is only moved by the consumer and tail by
+// the reader, each side parks on the other's index with a futex when the ring is empty
+// or full.
+typedef struct {
+    int fd;
+    header_t header;
+    readahead_block_t blocks[READAHEAD_BUFFERS];
+    uint32_t head;  // Next block to hand to the consumer
+    uint32_t tail;  // Next block to fill
+    int stop;
+    pthread_t thread;
+} readahead_t;
+
+ScanOpStatus start_readahead(int fd, header_t header, readahead_t *readahead_out);
+
+// Blocks until the next block is filled. It stays valid until release_block.
+const readahead_block_t *next_block(readahead_t *readahead);
+void release_block(readahead_t *readahead);
+
+// Can be called before the last block was reached, the reader thread is stopped
+void stop_readahead(readahead_t *readahead);
+
+#endif
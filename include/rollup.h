@@ -0,0 +1,70 @@
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "header.h"
+#include "append.h"
+#include "group.h"
+
+#define ROLLUP_SUFFIX ".agg"
+
+
+typedef enum {
+    ROLLUP_OP_SUCCESS = 0,
+    ROLLUP_OP_ERROR_INVALID_ARG = -1,
+    ROLLUP_OP_ERROR_UNKNOWN_COLUMN = -2,
+    ROLLUP_OP_ERROR_TYPE_MISMATCH = -3,
+    ROLLUP_OP_ERROR_MEMORY_ALLOCATION = -4,
+    ROLLUP_OP_READ_ERROR = -5,
+    ROLLUP_OP_WRITE_ERROR = -6,
+    ROLLUP_OP_TOMBSTONE_ERROR = -7,
+    ROLLUP_OP_STALE = -8  // The sidecar was reset since the rollups were loaded, nothing was saved
+} RollupOpStatus;
+
+// Running aggregates registered on a table, over its first num_rows live rows which end at
+// data_end. Appenders fold their rows in and publish them along with the header, so that
+// reading the totals doesn't take a scan.
+typedef struct {
+    int fd;  // The sidecar, -1 when no aggregate is registered
+    uint64_t inode;  // Of the data file the states were computed on
+    uint64_t generation;  // Of the sidecar, bumped by every reset
+    size_t num_rollups;
+    aggregate_t *aggregates;
+    agg_state_t *states;
+    size_t num_rows;
+    uint64_t data_end;
+} rollups_t;
+
+char *rollup_path(const char *filepath);
+void free_rollups(rollups_t *rollups);
+
+// Without a sidecar the table has no rollup and the fd is -1. A sidecar left by another
+// incarnation of the table, rewritten by a sort or a compaction, or torn by a crash keeps its
+// aggregates but starts over from the first row.
+RollupOpStatus load_rollups(const char *filepath, int fd, header_t header, rollups_t *rollups_out);
+
+// Adds the aggregates of aggs_in, in the format of -A, to the ones already registered and
+// computes all of them over the live rows of the table.
+RollupOpStatus register_rollups(const char *filepath, int fd, header_t header, const char *aggs_in,
+                                rollups_t *rollups_out);
+
+// Folds the rows the rollups don't cover yet, those of an appender that didn't maintain them,
+// and saves them when anything changed. Nothing is read when they are up to date.
+RollupOpStatus refresh_rollups(const char *filepath, int fd, header_t header, rollups_t *rollups);
+
+// An appender folds every row it writes, then publishes once update_header_num_rows made
+// them visible: the rollups then cover the rows of the header. When a delete or a rewrite
+// reset the sidecar in the meantime the states count rows that are gone, they aren't
+// published and ROLLUP_OP_STALE is returned.
+void fold_rollups(rollups_t *rollups, row_t row);
+RollupOpStatus publish_rollups(rollups_t *rollups, header_t header);
+
+// Deleted rows can't be taken out of a min or a max, and a sort or a compaction moves the
+// rows: the next refresh starts over
+RollupOpStatus reset_rollups(const char *filepath, int fd, header_t header);
+
+void rollup_results(const rollups_t *rollups, agg_result_t *results_out);
+
+#endif
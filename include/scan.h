@@ -0,0 +1,76 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "header.h"
+#include "append.h"
+#include "predicate.h"
+#include "projection.h"
+#include "tombstone.h"
+#include "threadpool.h"
+
+#define SCAN_MORSEL_SIZE (1024 * 1024)
+#define SCAN_MORSELS_PER_THREAD 4
+
+
+typedef enum {
+    SCAN_OP_SUCCESS = 0,
+    SCAN_OP_ERROR_INVALID_FD = -1,
+    SCAN_OP_ERROR_INVALID_ARG = -2,
+    SCAN_OP_READ_ERROR = -3,
+    SCAN_OP_ERROR_MEMORY_ALLOCATION = -4,
+    SCAN_OP_ERROR_THREAD = -5
+} ScanOpStatus;
+
+// Returning non-zero from the callback stops the scan. The row is freed once the callback returns,
+// offset is where it starts in the file.
+typedef int (*scan_callback_t)(row_t row, size_t row_index, uint64_t offset, void *ctx);
+
+// A scan split in morsels: blocks of about SCAN_MORSEL_SIZE bytes holding whole rows. The
+// calling thread reads the blocks, the pool decodes, filters and hands over the rows, so
+// the callback must be thread safe and rows arrive in no particular order.
+typedef struct {
+    threadpool_t *pool;
+    const predicate_t *predicate;
+    const uint8_t *decoded;  // The projection's flags, NULL to decode every column
+    cell_t **cells;  // With a projection, the cells each worker decodes its rows into
+    scan_callback_t callback;
+    void *ctx;
+    pthread_mutex_t lock;
+    pthread_cond_t morsel_done;
+    size_t in_flight;  // Bounded, the reader doesn't get too far ahead of the workers
+    int stop;
+    ScanOpStatus status;
+    uint64_t started_ns;
+} parallel_scan_t;
+
+// Reads the block starting at offset and cuts it after its last whole row. The buffer
+// is allocated when *buffer_io is NULL and grows when a single row doesn't fit in it.
+ScanOpStatus read_row_block(int fd, header_t header, uint64_t offset, size_t rows_left,
+                            uint8_t **buffer_io, size_t *capacity_io, size_t *length_out, size_t *num_rows_out);
+
+// Tables larger than a morsel are read ahead by a background thread
+ScanOpStatus scan_rows(int fd, header_t header, const tombstone_t *tombstones, const predicate_t *predicate,
+                       const projection_t *projection, scan_callback_t callback, void *ctx);
+
+// Only the rows from first_row on, the first of them starting at offset: those appended since
+// the table was at (first_row, offset). Read on the calling thread, without readahead.
+ScanOpStatus scan_rows_from(int fd, header_t header, size_t first_row, uint64_t offset, const tombstone_t *tombstones,
+                            const predicate_t *predicate, const projection_t *projection, scan_callback_t callback,
+                            void *ctx);
+
+// Not to be called from a pool task: the caller blocks until the workers caught up. The
+// morsels use the header's codec, headers must outlive finish_parallel_scan.
+ScanOpStatus begin_parallel_scan(threadpool_t *pool, const predicate_t *predicate, const projection_t *projection,
+                                 scan_callback_t callback, void *ctx, parallel_scan_t *scan_out);
+ScanOpStatus parallel_scan_file(parallel_scan_t *scan, int fd, header_t header, const tombstone_t *tombstones);
+ScanOpStatus finish_parallel_scan(parallel_scan_t *scan);
+
+// Falls back to scan_rows without a pool, with one thread or when the rows fit in a single morsel
+ScanOpStatus scan_rows_parallel(int fd, header_t header, const tombstone_t *tombstones, const predicate_t *predicate,
+                                const projection_t *projection, scan_callback_t callback, void *ctx,
+                                threadpool_t *pool);
+
+#endif
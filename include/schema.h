@@ -6,7 +6,9 @@
 
 #define MAX_COLUMN_NAME_LENGTH 255
 #define MAX_DATA_TYPE_NAME_LENGTH 7
-#define MAX_SCHEMA_LENGTH 2631
+#define MAX_SCHEMA_LENGTH (16 * 1024 * 1024)
+#define MAX_NUM_COLUMNS 65535
+#define SCHEMA_INITIAL_COLUMNS 16
 
 
 typedef enum {
@@ -21,6 +23,7 @@ typedef struct {
     uint8_t data_type;
 } column_t;
 
+// Columns from parse_schema: their names are interned in a single allocation
 void free_columns(column_t *columns, size_t allocated_columns);
 void print_parsed_schema(column_t *columns, size_t allocated_columns);
 SchemaOpStatus parse_schema(char *schema, column_t **columns_out, size_t *allocated_columns_out);
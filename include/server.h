@@ -0,0 +1,89 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "header.h"
+#include "rollup.h"
+
+#define SERVER_MAX_TABLES 64
+#define SERVER_MAX_CLIENTS 128
+#define SERVER_MAX_FRAME (16 * 1024 * 1024)
+#define SERVER_READ_SIZE 65536
+
+
+/*
+ * Every frame is a big endian uint32 payload length followed by the payload.
+ *
+ * Request payload:  opcode (uint8), table path length (big endian uint16), table path,
+ *                   argument: the row for append, an optional predicate for scan and
+ *                   a predicate for lookup, in the same text format as -a and -w, and
+ *                   for aggregate the aggregates in the format of -A, optionally
+ *                   followed by a space and a predicate.
+ *                   Stats requests take no table, the path can be empty.
+ * Response payload: status (uint8) then
+ *                   - append: the table's row count (big endian uint64)
+ *                   - scan/lookup: the number of rows (big endian uint64) and the rows
+ *                     in the on-disk encoding (type byte + value for every cell)
+ *                   - aggregate: the number of aggregates (big endian uint32), then for
+ *                     each one whether it's a double (uint8) and its value, an int64 or
+ *                     the bits of the double (big endian uint64)
+ *                   - stats: the JSON document printed by --stats
+ *                   - errors: a message
+ *
+ * Responses come back in request order, clients may pipeline as many requests as they want.
+ * Scan, lookup and aggregate results are cached, keyed on the parsed request and the table's
+ * version, see cache_version_t.
+ */
+typedef enum {
+    SERVER_REQUEST_APPEND = 1,
+    SERVER_REQUEST_SCAN = 2,
+    SERVER_REQUEST_LOOKUP = 3,
+    SERVER_REQUEST_STATS = 4,
+    SERVER_REQUEST_AGGREGATE = 5
+} server_request_t;
+
+typedef enum {
+    SERVER_RESPONSE_OK = 0,
+    SERVER_RESPONSE_BAD_REQUEST = 1,
+    SERVER_RESPONSE_TABLE_ERROR = 2,
+    SERVER_RESPONSE_IO_ERROR = 3
+} server_response_t;
+
+typedef enum {
+    SERVER_OP_SUCCESS = 0,
+    SERVER_OP_ERROR_INVALID_ARG = -1,
+    SERVER_OP_SOCKET_ERROR = -2,
+    SERVER_OP_ERROR_MEMORY_ALLOCATION = -3
+} ServerOpStatus;
+
+// A table stays open with its schema cached for the lifetime of the server. Its row count
+// and data end are read again for every request and it's reopened once replaced by a sort
+// or a compaction, other processes must not append while the server does.
+typedef struct {
+    char *path;
+    int fd;
+    uint64_t device;
+    uint64_t inode;
+    uint64_t epoch;  // How many times the table was opened again, results of earlier ones don't hold
+    header_t header;
+    rollups_t rollups;  // Kept up to date by the appends
+} server_table_t;
+
+typedef struct {
+    int fd;
+    uint8_t *in;
+    size_t in_length;
+    size_t in_capacity;
+    uint8_t *out;
+    size_t out_offset;
+    size_t out_length;
+    size_t out_capacity;
+} server_client_t;
+
+// Serves until SIGINT or SIGTERM, then closes the tables and removes the socket. The result
+// cache holds up to cache_capacity bytes, 0 for CACHE_DEFAULT_CAPACITY.
+ServerOpStatus run_server(const char *socket_path, size_t cache_capacity);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "header.h"
+
+#define SORT_SUFFIX ".sort"
+#define SORT_DEFAULT_MEMORY (64 * 1024 * 1024)
+#define SORT_MIN_MEMORY (1024 * 1024)
+#define SORT_MIN_RUN_BUFFER (64 * 1024)
+#define SORT_OUTPUT_BUFFER (1024 * 1024)
+
+
+typedef enum {
+    SORT_OP_SUCCESS = 0,
+    SORT_OP_ERROR_INVALID_ARG = -1,
+    SORT_OP_ERROR_MEMORY_ALLOCATION = -2,
+    SORT_OP_READ_ERROR = -3,
+    SORT_OP_WRITE_ERROR = -4,
+    SORT_OP_ERROR_EXISTS = -5,
+    SORT_OP_TOMBSTONE_ERROR = -6,
+    SORT_OP_RENAME_ERROR = -7
+} SortOpStatus;
+
+// Orders the live rows by the key columns, ascending and stable, and writes them to a new
+// table at output_path, or over the table itself when output_path is NULL. The rows are
+// sorted in runs of about memory_budget bytes: when the table doesn't fit, the runs are
+// spilled to unlinked temp files next to the output and merged in one pass.
+SortOpStatus sort_table(const char *filepath, int fd, header_t header, const size_t *key_cols, size_t num_keys,
+                        const char *output_path, size_t memory_budget, size_t *num_rows_out, size_t *num_runs_out);
+
+#endif
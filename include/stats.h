@@ -0,0 +1,102 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Values below 2^STATS_SUB_BUCKET_BITS ns get a bucket each, every power of two above
+// that is split in 2^STATS_SUB_BUCKET_BITS linear buckets: about 3% of precision.
+#define STATS_SUB_BUCKET_BITS 5
+#define STATS_NUM_BUCKETS ((64 - STATS_SUB_BUCKET_BITS + 1) << STATS_SUB_BUCKET_BITS)
+
+
+typedef enum {
+    STAT_PARSE_SCHEMA = 0,
+    STAT_READ_HEADER,
+    STAT_PARSE_ROW,
+    STAT_WRITE_ROW,
+    STAT_UPDATE_HEADER,
+    STAT_READ_ROW,
+    STAT_SCAN,
+    STAT_SCAN_BLOCK,
+    STAT_NUM_TIMED_OPS
+} timed_op_t;
+
+typedef enum {
+    STAT_ROWS_READ = 0,
+    STAT_ROWS_WRITTEN,
+    STAT_NUM_COUNTERS
+} stats_counter_t;
+
+typedef enum {
+    IO_HEADER = 0,
+    IO_ROWS,
+    IO_INDEX,  // Tombstone and rollup sidecars, partition manifests
+    IO_NUM_CATEGORIES
+} io_category_t;
+
+typedef enum {
+    IO_READ = 0,  // read and pread
+    IO_WRITE,  // write and pwrite
+    IO_SEEK,
+    IO_SYNC,  // msync, its bytes are the ones written through a mapping since the last one
+    IO_NUM_SYSCALLS
+} io_syscall_t;
+
+// Physical bytes are what the syscalls moved, logical bytes what the operation needed:
+// the encoded rows scanned or appended, the header's fields and columns.
+typedef struct {
+    uint64_t syscalls[IO_NUM_SYSCALLS];
+    uint64_t physical_read;
+    uint64_t physical_written;
+    uint64_t logical_read;
+    uint64_t logical_written;
+} io_stats_t;
+
+// HDR style latency histogram, updated with relaxed atomics from any thread
+typedef struct {
+    uint64_t count;
+    uint64_t errors;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t buckets[STATS_NUM_BUCKETS];
+} histogram_t;
+
+/*
+ * The instrumentation is compiled in with -DCOLLECT_STATS (make stats). Without it the
+ * macros expand to nothing and the hot paths are left as they are.
+ *
+ *     STATS_START(start);
+ *     ...
+ *     STATS_RECORD(STAT_READ_ROW, start, status != APPEND_OP_SUCCESS);
+ */
+#ifdef COLLECT_STATS
+#define STATS_START(name) uint64_t name = stats_now()
+#define STATS_RECORD(op, name, failed) stats_record((op), stats_now() - (name), (failed))
+#define STATS_ADD(counter, value) stats_add((counter), (value))
+#define STATS_SYSCALL(category, syscall, bytes) stats_syscall((category), (syscall), (bytes))
+#define STATS_LOGICAL_READ(category, bytes) stats_logical((category), (bytes), 0)
+#define STATS_LOGICAL_WRITTEN(category, bytes) stats_logical((category), 0, (bytes))
+#else
+// sizeof keeps the arguments "used" without evaluating them
+#define STATS_START(name)
+#define STATS_RECORD(op, name, failed) ((void) sizeof(failed))
+#define STATS_ADD(counter, value) ((void) sizeof(value))
+#define STATS_SYSCALL(category, syscall, bytes) ((void) sizeof(bytes))
+#define STATS_LOGICAL_READ(category, bytes) ((void) sizeof(bytes))
+#define STATS_LOGICAL_WRITTEN(category, bytes) ((void) sizeof(bytes))
+#endif
+
+uint64_t stats_now(void);
+void stats_record(timed_op_t op, uint64_t elapsed_ns, int failed);
+void stats_add(stats_counter_t counter, uint64_t value);
+// Failed calls (negative bytes) are counted but move nothing
+void stats_syscall(io_category_t category, io_syscall_t syscall, int64_t bytes);
+void stats_logical(io_category_t category, uint64_t bytes_read, uint64_t bytes_written);
+
+// Count, errors, mean, min, max and percentiles of every operation, the counters and the
+// I/O amplification. Prints {"enabled": false} when the stats weren't compiled in.
+void write_stats_json(FILE *out);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#define TASK_DEQUE_INITIAL_CAPACITY 64
+
+
+typedef enum {
+    THREADPOOL_OP_SUCCESS = 0,
+    THREADPOOL_OP_ERROR_INVALID_ARG = -1,
+    THREADPOOL_OP_ERROR_MEMORY_ALLOCATION = -2,
+    THREADPOOL_OP_ERROR_THREAD = -3
+} ThreadPoolOpStatus;
+
+typedef void (*task_fn_t)(void *arg);
+
+typedef struct {
+    task_fn_t fn;
+    void *arg;
+} task_t;
+
+// The owner pushes and pops at the bottom (newest first, still warm in its cache),
+// thieves take from the top (oldest first, usually the biggest remaining work).
+typedef struct {
+    pthread_mutex_t lock;
+    task_t *tasks;  // Ring buffer indexed modulo capacity
+    size_t capacity;
+    size_t top;
+    size_t bottom;
+} task_deque_t;
+
+typedef struct {
+    task_deque_t *deques;  // One per worker
+    size_t num_threads;
+    pthread_t *threads;
+    pthread_mutex_t lock;  // Only guards sleeping and waiting, not the deques
+    pthread_cond_t has_work;
+    pthread_cond_t idle;
+    size_t queued;  // Tasks sitting in the deques
+    size_t pending;  // Queued plus running tasks
+    size_t next_deque;  // Round robin target for tasks submitted from outside the pool
+    int shutdown;
+} threadpool_t;
+
+size_t default_thread_count(void);
+ThreadPoolOpStatus threadpool_create(size_t num_threads, threadpool_t **pool_out);
+ThreadPoolOpStatus threadpool_submit(threadpool_t *pool, task_fn_t fn, void *arg);
+// 1 with the worker's index when called from one of the pool's workers, 0 from any other thread
+int threadpool_worker_index(const threadpool_t *pool, size_t *index_out);
+void threadpool_wait(threadpool_t *pool);
+void threadpool_destroy(threadpool_t *pool);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef TOMBSTONE_H
+#define TOMBSTONE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define TOMBSTONE_BLOCK_ROWS 4096
+#define TOMBSTONE_SUFFIX ".tomb"
+
+
+typedef enum {
+    TOMBSTONE_OP_SUCCESS = 0,
+    TOMBSTONE_OP_ERROR_INVALID_ARG = -1,
+    TOMBSTONE_OP_ERROR_MEMORY_ALLOCATION = -2,
+    TOMBSTONE_OP_READ_ERROR = -3,
+    TOMBSTONE_OP_WRITE_ERROR = -4
+} TombstoneOpStatus;
+
+// Rows are grouped in blocks of TOMBSTONE_BLOCK_ROWS, each block keeps a count
+// of deleted rows so that scans can skip the bitmap lookup for clean blocks.
+typedef struct {
+    size_t num_blocks;
+    uint32_t *deleted_counts;
+    uint8_t *bitmap;
+    uint8_t *dirty;
+    uint8_t rewrite;
+} tombstone_t;
+
+char *tombstone_path(const char *filepath);
+void free_tombstones(tombstone_t *tombstones);
+TombstoneOpStatus load_tombstones(const char *filepath, int fd, tombstone_t *tombstones_out);
+TombstoneOpStatus save_tombstones(const char *filepath, int fd, tombstone_t *tombstones);
+TombstoneOpStatus mark_tombstone(tombstone_t *tombstones, size_t row_index);
+int is_tombstoned(const tombstone_t *tombstones, size_t row_index);
+size_t count_tombstones(const tombstone_t *tombstones);
+
+#endif
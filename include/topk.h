@@ -0,0 +1,41 @@
+#ifndef TOPK_H
+#define TOPK_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "header.h"
+#include "append.h"
+#include "predicate.h"
+#include "tombstone.h"
+#include "threadpool.h"
+
+#define TOPK_MAX_K (1024 * 1024)
+
+
+typedef enum {
+    TOPK_OP_SUCCESS = 0,
+    TOPK_OP_ERROR_INVALID_ARG = -1,
+    TOPK_OP_ERROR_UNKNOWN_COLUMN = -2,
+    TOPK_OP_ERROR_MEMORY_ALLOCATION = -3,
+    TOPK_OP_READ_ERROR = -4
+} TopKOpStatus;
+
+typedef struct {
+    size_t col_index;
+    uint8_t data_type;
+    size_t k;
+    int ascending;  // The K smallest values instead of the K largest
+} topk_t;
+
+// "<column>:<k>" for the K largest values, "<column>:<k>:asc" for the K smallest
+TopKOpStatus parse_topk(header_t header, const char *topk_in, topk_t *topk_out);
+
+// Keeps one bounded heap per worker while scanning, only decoding the key and predicate
+// columns, then merges the heaps and decodes the winning rows alone. The rows come out in
+// rank order, ties in file order, and are freed with free_topk_rows.
+TopKOpStatus topk_rows(int fd, header_t header, const tombstone_t *tombstones, const predicate_t *predicate,
+                       const topk_t *topk, threadpool_t *pool, row_t **rows_out, size_t *num_rows_out);
+void free_topk_rows(row_t *rows, size_t num_rows);
+
+#endif
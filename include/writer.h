@@ -0,0 +1,50 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "header.h"
+#include "append.h"
+#include "rollup.h"
+
+#define WRITER_EXTENT_SIZE (8 * 1024 * 1024)
+#define WRITER_WINDOW_SIZE (1024 * 1024)
+#define UPGRADE_SUFFIX ".upgrade"
+
+
+typedef enum {
+    WRITER_OP_SUCCESS = 0,
+    WRITER_OP_ERROR_INVALID_ARG = -1,
+    WRITER_OP_ERROR_INVALID_FD = -2,
+    WRITER_OP_ERROR_MEMORY_ALLOCATION = -3,
+    WRITER_OP_ALLOCATE_ERROR = -4,
+    WRITER_OP_MAP_ERROR = -5,
+    WRITER_OP_WRITE_ERROR = -6,
+    WRITER_OP_HEADER_ERROR = -7,
+    WRITER_OP_ROLLUP_ERROR = -8
+} WriterOpStatus;
+
+// Rows are encoded straight into a shared mapping of space reserved ahead of time with
+// fallocate. The header only moves (num_rows, data_end) forward on flush, readers never
+// look past data_end so the preallocated tail is invisible to them.
+typedef struct {
+    int fd;
+    header_t *header;
+    uint64_t data_end;
+    uint64_t allocated;
+    uint8_t *window;
+    uint64_t window_offset;
+    size_t window_size;
+    size_t pending_rows;
+    rollups_t *rollups;  // Folded as rows are written and published with them, NULL when not maintained
+} append_writer_t;
+
+WriterOpStatus open_writer(int fd, header_t *header, append_writer_t *writer_out);
+WriterOpStatus writer_append(append_writer_t *writer, row_t row);
+WriterOpStatus writer_flush(append_writer_t *writer);
+WriterOpStatus close_writer(append_writer_t *writer);
+WriterOpStatus truncate_to_data_end(int fd, header_t header);
+WriterOpStatus upgrade_table(const char *filepath, int fd, header_t *header);
+
+#endif
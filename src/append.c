@@ -1,10 +1,14 @@
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include <unistd.h>
+#include <endian.h>
 #include <arpa/inet.h>
 
 #include "append.h"
 #include "header.h"
+#include "codec.h"
+#include "stats.h"
 
 
 uint32_t float_to_network_bytes(float value) {
@@ -21,16 +25,141 @@ float network_bytes_to_float(uint32_t net_value) {
     return result;
 }
 
+char *alloc_string_cell(string_cell_t *cell, size_t length) {
+    char *string;
+    if (length <= STRING_INLINE_CAPACITY) {
+        string = cell->inlined.string;
+    } else {
+        string = length <= UINT32_MAX ? (char *) malloc(length + 1) : NULL;
+        if (string == NULL) {
+            cell->length = 0;
+            return NULL;
+        }
+        cell->heap.string = string;
+    }
+    cell->length = (uint32_t) length;
+    string[length] = '\0';
+    return string;
+}
+
+AppendOpStatus set_string_cell(string_cell_t *cell, const char *string, size_t length) {
+    char *copy = alloc_string_cell(cell, length);
+    if (copy == NULL) {
+        return APPEND_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    memcpy(copy, string, length);
+    return APPEND_OP_SUCCESS;
+}
+
+void free_string_cell(string_cell_t *cell) {
+    if (cell->length > STRING_INLINE_CAPACITY) {
+        free(cell->heap.string);
+    }
+    cell->length = 0;
+}
+
+int compare_cell_values(uint8_t data_type, const cell_value_t *a, const cell_value_t *b) {
+    if (data_type == CELL_TYPE_INT) {
+        return (a->int_value > b->int_value) - (a->int_value < b->int_value);
+    } else if (data_type == CELL_TYPE_FLOAT) {
+        return (a->float_value > b->float_value) - (a->float_value < b->float_value);
+    } else if (data_type == CELL_TYPE_INT64) {
+        return (a->int64_value > b->int64_value) - (a->int64_value < b->int64_value);
+    } else if (data_type == CELL_TYPE_DOUBLE) {
+        return (a->double_value > b->double_value) - (a->double_value < b->double_value);
+    }
+
+    size_t a_length = a->string_cell.length;
+    size_t b_length = b->string_cell.length;
+    int cmp = memcmp(STRING_CELL_DATA(&a->string_cell), STRING_CELL_DATA(&b->string_cell),
+                     a_length < b_length ? a_length : b_length);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (a_length > b_length) - (a_length < b_length);
+}
+
+static int is_string_tag(uint8_t tag) {
+    return tag == CELL_TYPE_STRING || tag == CELL_TYPE_SHORT_STRING;
+}
+
+size_t fixed_cell_size(uint8_t data_type) {
+    if (data_type == CELL_TYPE_INT64 || data_type == CELL_TYPE_DOUBLE) {
+        return sizeof(uint8_t) + sizeof(uint64_t);
+    }
+    return sizeof(uint8_t) + sizeof(uint32_t);
+}
+
+size_t encoded_string_size(size_t length) {
+    return sizeof(uint8_t) + (length <= SHORT_STRING_MAX_LENGTH ? sizeof(uint8_t) : sizeof(uint32_t)) + length;
+}
+
+size_t encode_string(uint8_t *buffer, const string_cell_t *cell) {
+    size_t pos;
+    if (cell->length <= SHORT_STRING_MAX_LENGTH) {
+        buffer[0] = CELL_TYPE_SHORT_STRING;
+        buffer[1] = (uint8_t) cell->length;
+        pos = sizeof(uint8_t) + sizeof(uint8_t);
+    } else {
+        uint32_t length_nbo = htonl(cell->length);
+        buffer[0] = CELL_TYPE_STRING;
+        memcpy(&buffer[1], &length_nbo, sizeof(uint32_t));
+        pos = sizeof(uint8_t) + sizeof(uint32_t);
+    }
+    memcpy(&buffer[pos], STRING_CELL_DATA(cell), cell->length);
+    return pos + cell->length;
+}
+
+size_t string_prefix_size(uint8_t tag) {
+    return sizeof(uint8_t) + (tag == CELL_TYPE_SHORT_STRING ? sizeof(uint8_t) : sizeof(uint32_t));
+}
+
+size_t decode_string_prefix(const uint8_t *cell, size_t *length_out) {
+    if (cell[0] == CELL_TYPE_SHORT_STRING) {
+        *length_out = cell[1];
+        return sizeof(uint8_t) + sizeof(uint8_t);
+    }
+    uint32_t length_nbo;
+    memcpy(&length_nbo, &cell[1], sizeof(uint32_t));
+    *length_out = ntohl(length_nbo);
+    return sizeof(uint8_t) + sizeof(uint32_t);
+}
+
+size_t encoded_cell_size(const uint8_t *cell) {
+    if (!is_string_tag(cell[0])) {
+        return fixed_cell_size(cell[0]);
+    }
+    size_t length;
+    return decode_string_prefix(cell, &length) + length;
+}
+
+const uint8_t *encoded_cell_value(const uint8_t *cell, size_t *length_out) {
+    if (!is_string_tag(cell[0])) {
+        *length_out = fixed_cell_size(cell[0]) - sizeof(uint8_t);
+        return &cell[1];
+    }
+    return &cell[decode_string_prefix(cell, length_out)];
+}
+
 void free_row(row_t *row, size_t num_cells) {
     for (size_t i = 0; i < num_cells; i++) {
         uint8_t dt = row->cells[i].type;
         if (dt == CELL_TYPE_STRING) {
-            free(row->cells[i].data.string_cell.string);
+            free_string_cell(&row->cells[i].data.string_cell);
         }
     }
     free(row->cells);
 }
 
+void clear_row(row_t *row, size_t num_cells) {
+    for (size_t i = 0; i < num_cells; i++) {
+        if (row->cells[i].type == CELL_TYPE_STRING) {
+            free_string_cell(&row->cells[i].data.string_cell);
+            row->cells[i].type = CELL_TYPE_INT;
+        }
+    }
+}
+
 void print_parsed_row(row_t row, size_t num_cells) {
     for (size_t i = 0; i < num_cells; i++) {
         printf("Cell number: %ld\n", i + 1);
@@ -41,10 +170,16 @@ void print_parsed_row(row_t row, size_t num_cells) {
         } else if (dt == CELL_TYPE_FLOAT) {
             printf("\tData type: float\n");
             printf("\tValue: %f\n", row.cells[i].data.float_value);
+        } else if (dt == CELL_TYPE_INT64) {
+            printf("\tData type: int64\n");
+            printf("\tValue: %" PRId64 "\n", row.cells[i].data.int64_value);
+        } else if (dt == CELL_TYPE_DOUBLE) {
+            printf("\tData type: double\n");
+            printf("\tValue: %f\n", row.cells[i].data.double_value);
         } else if (dt == CELL_TYPE_STRING) {
             printf("\tData type: string\n");
-            printf("\tValue: %s\n", row.cells[i].data.string_cell.string);
-            printf("\tLength: %ld\n", row.cells[i].data.string_cell.length);
+            printf("\tValue: %s\n", STRING_CELL_DATA(&row.cells[i].data.string_cell));
+            printf("\tLength: %" PRIu32 "\n", row.cells[i].data.string_cell.length);
         } else {
             printf("  Unrecognized data type\n");
         }
@@ -52,26 +187,80 @@ void print_parsed_row(row_t row, size_t num_cells) {
     }
 }
 
-AppendOpStatus parse_row(header_t header, char *row_in, row_t *row_out) {
+void print_cell(const cell_t *cell) {
+    if (cell->type == CELL_TYPE_INT) {
+        printf("%d", cell->data.int_value);
+    } else if (cell->type == CELL_TYPE_FLOAT) {
+        printf("%f", cell->data.float_value);
+    } else if (cell->type == CELL_TYPE_INT64) {
+        printf("%" PRId64, cell->data.int64_value);
+    } else if (cell->type == CELL_TYPE_DOUBLE) {
+        printf("%f", cell->data.double_value);
+    } else if (cell->type == CELL_TYPE_STRING) {
+        printf("%s", STRING_CELL_DATA(&cell->data.string_cell));
+    }
+}
+
+void print_row_values(row_t row) {
+    printf("(");
+    for (size_t i = 0; i < row.num_cells; i++) {
+        if (i > 0) {
+            printf(" && ");
+        }
+        print_cell(&row.cells[i]);
+    }
+    printf(")\n");
+}
+
+// The characters of the value tell a number from a string, the column then picks the width.
+// Numbers are parsed in place, they end at the separator.
+static AppendOpStatus parse_cell(uint8_t data_type, uint8_t is_float, uint8_t is_string, const char *value,
+                                 size_t length, cell_t *cell_out) {
+    if (is_string) {
+        if (data_type != CELL_TYPE_STRING) {
+            return APPEND_OP_ERROR_COL_DT_CELL_VALUE_MISMATCH;
+        }
+        cell_out->type = CELL_TYPE_STRING;
+        return set_string_cell(&cell_out->data.string_cell, value, length);
+    }
+
+    if (is_float) {
+        if (data_type == CELL_TYPE_FLOAT) {
+            cell_out->data.float_value = atof(value);
+        } else if (data_type == CELL_TYPE_DOUBLE) {
+            cell_out->data.double_value = atof(value);
+        } else {
+            return APPEND_OP_ERROR_COL_DT_CELL_VALUE_MISMATCH;
+        }
+    } else if (data_type == CELL_TYPE_INT) {
+        cell_out->data.int_value = atol(value);
+    } else if (data_type == CELL_TYPE_INT64) {
+        cell_out->data.int64_value = atoll(value);
+    } else {
+        return APPEND_OP_ERROR_COL_DT_CELL_VALUE_MISMATCH;
+    }
+    cell_out->type = (cell_type_t) data_type;
+    return APPEND_OP_SUCCESS;
+}
+
+static AppendOpStatus parse_cells(header_t header, char *row_in, row_t *row_out) {
     if (row_in[0] != '(') {
         return APPEND_OP_ERROR_INVALID_ARG;
     }
 
+    // A valid row has exactly one cell per column, allocated once however wide the table is
     row_t row;
-    size_t initial_num_cells = 10;
-    row.cells = (cell_t *) calloc(initial_num_cells, sizeof(cell_t));
+    row.cells = (cell_t *) calloc(header.num_cols, sizeof(cell_t));
     if (row.cells == NULL) {
         return APPEND_OP_ERROR_MEMORY_ALLOCATION;
     }
 
-    size_t cell_num = 0;  // Determines when to realloc and the hard limit on cell number
-    size_t realloc_counter = 1;
+    size_t cell_num = 0;  // Hard limit on cell number
 
     size_t i = 1;
     size_t j = 1;
     uint8_t ch = (uint8_t) row_in[i];
 
-    uint8_t is_int = 1;
     uint8_t is_float = 0;
     uint8_t is_string = 0;
 
@@ -84,67 +273,15 @@ AppendOpStatus parse_row(header_t header, char *row_in, row_t *row_out) {
 
         if (ch == 32 && (uint8_t) row_in[i + 1] == 38 && (uint8_t) row_in[i + 2] == 38 && (uint8_t) row_in[i + 3] == 32) {
             // Looking for: ' && '    
-            size_t cell_value_length = i - j;
-            char *cell_value = (char *) malloc(cell_value_length + 1); 
-            if (cell_value == NULL) {
+            AppendOpStatus status = parse_cell(header.columns[cell_num].data_type, is_float, is_string, &row_in[j],
+                                               i - j, &row.cells[cell_num]);
+            if (status != APPEND_OP_SUCCESS) {
                 free_row(&row, cell_num);
-                return APPEND_OP_ERROR_MEMORY_ALLOCATION;
+                return status;
             }
-            memcpy(cell_value, &row_in[j], cell_value_length);
-            cell_value[cell_value_length] = '\0';
-
-            if (is_string) {
-                if (header.columns[cell_num].data_type == 2) {
-                    row.cells[cell_num].type = CELL_TYPE_STRING;
-                    row.cells[cell_num].data.string_cell.length = cell_value_length;
-                    row.cells[cell_num].data.string_cell.string = (char *) malloc(cell_value_length + 1);
-                    if (row.cells[cell_num].data.string_cell.string == NULL) {
-                        free_row(&row, cell_num);
-                        return APPEND_OP_ERROR_MEMORY_ALLOCATION;
-                    }
-                    memcpy(row.cells[cell_num].data.string_cell.string, cell_value, cell_value_length);
-                    row.cells[cell_num].data.string_cell.string[cell_value_length] = '\0';
-                } else {
-                    free_row(&row, cell_num);
-                    free(cell_value);
-                    return APPEND_OP_ERROR_COL_DT_CELL_VALUE_MISMATCH;
-                }
-            } else if (is_float) {
-                if (header.columns[cell_num].data_type == 1) {
-                    row.cells[cell_num].type = CELL_TYPE_FLOAT;
-                    row.cells[cell_num].data.float_value = atof(cell_value);
-                } else {
-                    free_row(&row, cell_num);
-                    free(cell_value);
-                    return APPEND_OP_ERROR_COL_DT_CELL_VALUE_MISMATCH;
-                }
-            } else if (is_int) {
-                if (header.columns[cell_num].data_type == 0) {
-                    row.cells[cell_num].type = CELL_TYPE_INT;
-                    row.cells[cell_num].data.int_value = atol(cell_value);
-                } else {
-                    free_row(&row, cell_num);
-                    free(cell_value);
-                    return APPEND_OP_ERROR_COL_DT_CELL_VALUE_MISMATCH;
-                }
-            }
-
-            free(cell_value);  // Don't forget this
-
 
             cell_num++;
-            if ((cell_num + 1) == (initial_num_cells * realloc_counter)) {
-                cell_t *temp_cells = reallocarray(row.cells, initial_num_cells * (realloc_counter + 1), sizeof(cell_t));
-                if (temp_cells == NULL) {
-                    free_row(&row, cell_num);
-                    return APPEND_OP_ERROR_MEMORY_ALLOCATION;
-                } else {
-                    row.cells = temp_cells;
-                }
-                realloc_counter++;
-            }
 
-            is_int = 1;
             is_float = 0;
             is_string = 0;
 
@@ -171,60 +308,20 @@ AppendOpStatus parse_row(header_t header, char *row_in, row_t *row_out) {
     }
 
 
-    if (MAX_NUM_CELLS <= cell_num) {
+    if (MAX_NUM_CELLS <= cell_num || cell_num >= header.num_cols) {
         free_row(&row, cell_num);
         return APPEND_OP_ERROR_INVALID_ARG;
     }
 
-
-    size_t cell_value_length = i - j;
-    char *cell_value = (char *) malloc(cell_value_length + 1);
-    if (cell_value == NULL) {
+    AppendOpStatus status = parse_cell(header.columns[cell_num].data_type, is_float, is_string, &row_in[j], i - j,
+                                       &row.cells[cell_num]);
+    if (status != APPEND_OP_SUCCESS) {
         free_row(&row, cell_num);
-        return APPEND_OP_ERROR_MEMORY_ALLOCATION;
-    }
-    memcpy(cell_value, &row_in[j], cell_value_length);
-    cell_value[cell_value_length] = '\0';
-
-    if (is_string) {
-        if (header.columns[cell_num].data_type == 2) {
-            row.cells[cell_num].type = CELL_TYPE_STRING;
-            row.cells[cell_num].data.string_cell.length = cell_value_length;
-            row.cells[cell_num].data.string_cell.string = (char *) malloc(cell_value_length + 1);
-            if (row.cells[cell_num].data.string_cell.string == NULL) {
-                free_row(&row, cell_num);
-                return APPEND_OP_ERROR_MEMORY_ALLOCATION;
-            }
-            memcpy(row.cells[cell_num].data.string_cell.string, cell_value, cell_value_length);
-            row.cells[cell_num].data.string_cell.string[cell_value_length] = '\0';
-        } else {
-            free_row(&row, cell_num);
-            free(cell_value);
-            return APPEND_OP_ERROR_COL_DT_CELL_VALUE_MISMATCH;
-        }
-    } else if (is_float) {
-        if (header.columns[cell_num].data_type == 1) {
-            row.cells[cell_num].type = CELL_TYPE_FLOAT;
-            row.cells[cell_num].data.float_value = atof(cell_value);
-        } else {
-            free_row(&row, cell_num);
-            free(cell_value);
-            return APPEND_OP_ERROR_COL_DT_CELL_VALUE_MISMATCH;
-        }
-    } else if (is_int) {
-        if (header.columns[cell_num].data_type == 0) {
-            row.cells[cell_num].type = CELL_TYPE_INT;
-            row.cells[cell_num].data.int_value = atol(cell_value);
-        } else {
-            free_row(&row, cell_num);
-            free(cell_value);
-            return APPEND_OP_ERROR_COL_DT_CELL_VALUE_MISMATCH;
-        }
+        return status;
     }
 
-    free(cell_value);
-
     if (cell_num + 1 != header.num_cols) {
+        free_row(&row, cell_num + 1);
         return APPEND_OP_ERROR_INVALID_ARG;
     }
 
@@ -233,7 +330,53 @@ AppendOpStatus parse_row(header_t header, char *row_in, row_t *row_out) {
     return APPEND_OP_SUCCESS;
 }
 
-AppendOpStatus write_row(int fd, row_t row) {
+AppendOpStatus parse_row(header_t header, char *row_in, row_t *row_out) {
+    STATS_START(start);
+    AppendOpStatus status = parse_cells(header, row_in, row_out);
+    STATS_RECORD(STAT_PARSE_ROW, start, status != APPEND_OP_SUCCESS);
+    return status;
+}
+
+size_t row_encoded_size(row_t row) {
+    size_t size = 0;
+    for (size_t i = 0; i < row.num_cells; i++) {
+        if (row.cells[i].type == CELL_TYPE_STRING) {
+            size += encoded_string_size(row.cells[i].data.string_cell.length);
+        } else {
+            size += fixed_cell_size(row.cells[i].type);
+        }
+    }
+    return size;
+}
+
+size_t encode_row(uint8_t *buffer, row_t row) {
+    // Same layout as write_row, for callers that write whole rows or batches from memory
+    size_t pos = 0;
+    for (size_t i = 0; i < row.num_cells; i++) {
+        uint8_t dt = (uint8_t) row.cells[i].type;
+        if (dt == CELL_TYPE_STRING) {
+            pos += encode_string(&buffer[pos], &row.cells[i].data.string_cell);
+            continue;
+        }
+
+        buffer[pos++] = dt;
+        if (dt == CELL_TYPE_INT64 || dt == CELL_TYPE_DOUBLE) {
+            uint64_t value;
+            memcpy(&value, &row.cells[i].data, sizeof(uint64_t));
+            value = htobe64(value);
+            memcpy(&buffer[pos], &value, sizeof(uint64_t));
+            pos += sizeof(uint64_t);
+        } else {
+            uint32_t value_nbo = dt == CELL_TYPE_INT ? htonl(row.cells[i].data.int_value)
+                                                     : float_to_network_bytes(row.cells[i].data.float_value);
+            memcpy(&buffer[pos], &value_nbo, sizeof(uint32_t));
+            pos += sizeof(uint32_t);
+        }
+    }
+    return pos;
+}
+
+static AppendOpStatus write_encoded_row(int fd, header_t header, row_t row) {
     if (fd < 0) {
         return APPEND_OP_ERROR_INVALID_FD;
     }
@@ -242,48 +385,77 @@ AppendOpStatus write_row(int fd, row_t row) {
         return APPEND_OP_INVALID_CELLS;
     }
 
-    ssize_t bytes_writen;
-
+    // Encoded in memory first: one write per row instead of one or two per cell
+    size_t size = row_encoded_size(row);
+    uint8_t stack_buffer[APPEND_STACK_BUFFER_SIZE];
+    uint8_t *buffer = size <= sizeof(stack_buffer) ? stack_buffer : (uint8_t *) malloc(size);
+    if (buffer == NULL) {
+        return APPEND_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    const row_codec_t *codec = header.codec;
+    if (codec != NULL && row.num_cells == codec->num_cols) {
+        codec_encode_row(codec, buffer, row);
+    } else {
+        encode_row(buffer, row);
+    }
 
-    for (size_t i = 0; i < row.num_cells; i++) {
-        uint8_t dt = (uint8_t) row.cells[i].type;
-        bytes_writen = write(fd, &dt, sizeof(uint8_t));
-        if (bytes_writen != sizeof(uint8_t)) {
-            return APPEND_OP_WRITE_ERROR;
+    AppendOpStatus status = APPEND_OP_SUCCESS;
+    size_t written = 0;
+    while (written < size) {
+        ssize_t bytes_written = write(fd, &buffer[written], size - written);
+        STATS_SYSCALL(IO_ROWS, IO_WRITE, bytes_written);
+        if (bytes_written <= 0) {
+            status = APPEND_OP_WRITE_ERROR;
+            break;
         }
+        written += bytes_written;
+    }
 
-        if (dt == CELL_TYPE_INT) {
-            uint32_t int_value_nbo = htonl(row.cells[i].data.int_value);
-            bytes_writen = write(fd, &int_value_nbo, sizeof(uint32_t));
-            if (bytes_writen != sizeof(uint32_t)) {
-                return APPEND_OP_WRITE_ERROR;
-            }
-        } else if (dt == CELL_TYPE_FLOAT) {
-            uint32_t float_value_nbo = float_to_network_bytes(row.cells[i].data.float_value);
-            bytes_writen = write(fd, &float_value_nbo, sizeof(uint32_t));
-            if (bytes_writen != sizeof(uint32_t)) {
-                return APPEND_OP_WRITE_ERROR;
-            }
-        } else if (dt == CELL_TYPE_STRING) {
-            uint32_t length = htonl(row.cells[i].data.string_cell.length);
-            bytes_writen = write(fd, &length, sizeof(uint32_t));
-            if (bytes_writen != sizeof(uint32_t)) {
-                return APPEND_OP_WRITE_ERROR;
-            }
-            bytes_writen = write(fd, row.cells[i].data.string_cell.string, row.cells[i].data.string_cell.length);
-            if (bytes_writen < 0) {
-                return APPEND_OP_WRITE_ERROR;
-            }
-            if ((size_t)bytes_writen != row.cells[i].data.string_cell.length) {
-                return APPEND_OP_WRITE_ERROR;
-            }
-        }
+    if (buffer != stack_buffer) {
+        free(buffer);
+    }
+    return status;
+}
+
+AppendOpStatus write_row(int fd, header_t header, row_t row) {
+    STATS_START(start);
+    AppendOpStatus status = write_encoded_row(fd, header, row);
+    STATS_RECORD(STAT_WRITE_ROW, start, status != APPEND_OP_SUCCESS);
+    if (status == APPEND_OP_SUCCESS) {
+        STATS_ADD(STAT_ROWS_WRITTEN, 1);
+        STATS_LOGICAL_WRITTEN(IO_ROWS, row_encoded_size(row));
+    }
+    return status;
+}
+
+AppendOpStatus append_row(int fd, header_t *header, row_t row) {
+    if (fd < 0) {
+        return APPEND_OP_ERROR_INVALID_FD;
+    }
+    // An older header couldn't publish the row, the table is upgraded before appending
+    if (header->version != VERSION) {
+        return APPEND_OP_WRITE_ERROR;
+    }
+
+    // Rows go right after the logical end, the file may extend past it with preallocated space
+    STATS_SYSCALL(IO_ROWS, IO_SEEK, 0);
+    if (lseek(fd, header->data_end, SEEK_SET) == (off_t)-1) {
+        return APPEND_OP_WRITE_ERROR;
+    }
+
+    AppendOpStatus aop_status = write_row(fd, *header, row);
+    if (aop_status != APPEND_OP_SUCCESS) {
+        return aop_status;
+    }
+
+    if (update_header_num_rows(fd, 1, header->data_end + row_encoded_size(row), header) != HEADER_OP_SUCCESS) {
+        return APPEND_OP_WRITE_ERROR;
     }
 
     return APPEND_OP_SUCCESS;
 }
 
-AppendOpStatus read_row(int fd, header_t header, row_t *row_out) {
+static AppendOpStatus read_cells(int fd, header_t header, row_t *row_out) {
     if (fd < 0) {
         return APPEND_OP_ERROR_INVALID_FD;
     }
@@ -293,52 +465,232 @@ AppendOpStatus read_row(int fd, header_t header, row_t *row_out) {
     row_t row;
     row.num_cells = num_cols;
     row.cells = (cell_t *) calloc(num_cols, sizeof(cell_t));
+    if (row.cells == NULL) {
+        return APPEND_OP_ERROR_MEMORY_ALLOCATION;
+    }
 
     ssize_t bytes_read;
 
     for (uint32_t cell_it = 0; cell_it < num_cols; cell_it++) {
-        bytes_read = read(fd, &row.cells[cell_it].type, sizeof(uint8_t));
-        if (row.cells[cell_it].type == CELL_TYPE_INT) {
-            bytes_read = read(fd, &row.cells[cell_it].data.int_value, sizeof(uint32_t));
+        uint8_t tag;
+        bytes_read = read(fd, &tag, sizeof(uint8_t));
+        STATS_SYSCALL(IO_ROWS, IO_READ, bytes_read);
+        if (bytes_read != sizeof(uint8_t)) {
+            free_row(&row, cell_it);
+            return APPEND_OP_READ_ERROR;
+        }
+
+        if (tag == CELL_TYPE_INT || tag == CELL_TYPE_FLOAT) {
+            uint32_t value_nbo;
+            bytes_read = read(fd, &value_nbo, sizeof(uint32_t));
+            STATS_SYSCALL(IO_ROWS, IO_READ, bytes_read);
             if (bytes_read != sizeof(uint32_t)) {
                 free_row(&row, cell_it);
                 return APPEND_OP_READ_ERROR;
             }
-            row.cells[cell_it].data.int_value = ntohl(row.cells[cell_it].data.int_value);
-        } else if (row.cells[cell_it].type == CELL_TYPE_FLOAT) {
-            uint32_t float_value_nbo;
-            bytes_read = read(fd, &float_value_nbo, sizeof(uint32_t));
-            if (bytes_read != sizeof(uint32_t)) {
+            row.cells[cell_it].type = (cell_type_t) tag;
+            if (tag == CELL_TYPE_INT) {
+                row.cells[cell_it].data.int_value = ntohl(value_nbo);
+            } else {
+                row.cells[cell_it].data.float_value = network_bytes_to_float(value_nbo);
+            }
+        } else if (tag == CELL_TYPE_INT64 || tag == CELL_TYPE_DOUBLE) {
+            uint64_t value;
+            bytes_read = read(fd, &value, sizeof(uint64_t));
+            STATS_SYSCALL(IO_ROWS, IO_READ, bytes_read);
+            if (bytes_read != sizeof(uint64_t)) {
                 free_row(&row, cell_it);
                 return APPEND_OP_READ_ERROR;
             }
-            row.cells[cell_it].data.float_value = network_bytes_to_float(float_value_nbo);
-        } else if (row.cells[cell_it].type == CELL_TYPE_STRING) {
-            bytes_read = read(fd, &row.cells[cell_it].data.string_cell.length, sizeof(uint32_t));
-            if (bytes_read != sizeof(uint32_t)) {
+            row.cells[cell_it].type = (cell_type_t) tag;
+            value = be64toh(value);
+            memcpy(&row.cells[cell_it].data, &value, sizeof(uint64_t));
+        } else if (tag == CELL_TYPE_STRING || tag == CELL_TYPE_SHORT_STRING) {
+            uint8_t prefix[sizeof(uint8_t) + sizeof(uint32_t)] = {tag};
+            size_t length_size = tag == CELL_TYPE_SHORT_STRING ? sizeof(uint8_t) : sizeof(uint32_t);
+            bytes_read = read(fd, &prefix[1], length_size);
+            STATS_SYSCALL(IO_ROWS, IO_READ, bytes_read);
+            if (bytes_read != (ssize_t) length_size) {
                 free_row(&row, cell_it);
                 return APPEND_OP_READ_ERROR;
             }
-            row.cells[cell_it].data.string_cell.length = ntohl(row.cells[cell_it].data.string_cell.length);
-            row.cells[cell_it].data.string_cell.string = (char *) malloc(row.cells[cell_it].data.string_cell.length + 1);
-            if (row.cells[cell_it].data.string_cell.string == NULL) {
+            size_t length;
+            decode_string_prefix(prefix, &length);
+
+            row.cells[cell_it].type = CELL_TYPE_STRING;
+            char *string = alloc_string_cell(&row.cells[cell_it].data.string_cell, length);
+            if (string == NULL) {
                 free_row(&row, cell_it);
                 return APPEND_OP_ERROR_MEMORY_ALLOCATION;
             }
-            bytes_read = read(fd, row.cells[cell_it].data.string_cell.string, sizeof(char) * row.cells[cell_it].data.string_cell.length);
+            bytes_read = read(fd, string, sizeof(char) * length);
+            STATS_SYSCALL(IO_ROWS, IO_READ, bytes_read);
             if (bytes_read < 0) {
-                free_row(&row, cell_it);
+                free_row(&row, cell_it + 1);
                 return APPEND_OP_WRITE_ERROR;
             }
-            if ((size_t)bytes_read != sizeof(char) * row.cells[cell_it].data.string_cell.length) {
-                free_row(&row, cell_it);
+            if ((size_t)bytes_read != sizeof(char) * length) {
+                free_row(&row, cell_it + 1);
                 return APPEND_OP_READ_ERROR;
             }
-            row.cells[cell_it].data.string_cell.string[row.cells[cell_it].data.string_cell.length] = '\0';
         }
     }
 
     *row_out = row;
 
     return APPEND_OP_SUCCESS;
-}
\ No newline at end of file
+}
+
+AppendOpStatus read_row(int fd, header_t header, row_t *row_out) {
+    STATS_START(start);
+    AppendOpStatus status = read_cells(fd, header, row_out);
+    STATS_RECORD(STAT_READ_ROW, start, status != APPEND_OP_SUCCESS);
+    if (status == APPEND_OP_SUCCESS) {
+        STATS_ADD(STAT_ROWS_READ, 1);
+        STATS_LOGICAL_READ(IO_ROWS, row_encoded_size(*row_out));
+    }
+    return status;
+}
+
+AppendOpStatus skip_row(int fd, header_t header) {
+    if (fd < 0) {
+        return APPEND_OP_ERROR_INVALID_FD;
+    }
+
+    // Runs of number cells have a known size, only strings need their length read
+    off_t pending = 0;
+    ssize_t bytes_read;
+
+    for (size_t cell_it = 0; cell_it < header.num_cols; cell_it++) {
+        if (header.columns[cell_it].data_type != CELL_TYPE_STRING) {
+            pending += fixed_cell_size(header.columns[cell_it].data_type);
+            continue;
+        }
+
+        if (pending > 0) {
+            STATS_SYSCALL(IO_ROWS, IO_SEEK, 0);
+            if (lseek(fd, pending, SEEK_CUR) == (off_t)-1) {
+                return APPEND_OP_READ_ERROR;
+            }
+        }
+
+        // Read as if the length were 4 bytes, a short string's one byte length leaves some of
+        // its characters read already
+        uint8_t prefix[sizeof(uint8_t) + sizeof(uint32_t)];
+        bytes_read = read(fd, prefix, sizeof(prefix));
+        STATS_SYSCALL(IO_ROWS, IO_READ, bytes_read);
+        if (bytes_read < (ssize_t) (sizeof(uint8_t) + sizeof(uint8_t))
+            || (prefix[0] != CELL_TYPE_SHORT_STRING && bytes_read != sizeof(prefix))) {
+            return APPEND_OP_READ_ERROR;
+        }
+        size_t length;
+        size_t prefix_size = decode_string_prefix(prefix, &length);
+        pending = (off_t) length - (bytes_read - (off_t) prefix_size);
+    }
+
+    if (pending != 0) {
+        STATS_SYSCALL(IO_ROWS, IO_SEEK, 0);
+        if (lseek(fd, pending, SEEK_CUR) == (off_t)-1) {
+            return APPEND_OP_READ_ERROR;
+        }
+    }
+
+    return APPEND_OP_SUCCESS;
+}
+
+size_t row_span(const uint8_t *buffer, size_t length, header_t header) {
+    if (header.codec != NULL) {
+        return codec_row_span(header.codec, buffer, length);
+    }
+
+    // Same walk as skip_row, over memory: 0 means the buffer ends inside the row
+    size_t pos = 0;
+    for (size_t cell_it = 0; cell_it < header.num_cols; cell_it++) {
+        if (length - pos < sizeof(uint8_t)) {
+            return 0;
+        }
+        uint8_t dt = buffer[pos];
+        if (is_string_tag(dt)) {
+            if (length - pos < string_prefix_size(dt)) {
+                return 0;
+            }
+            size_t string_length;
+            pos += decode_string_prefix(&buffer[pos], &string_length);
+            if (length - pos < string_length) {
+                return 0;
+            }
+            pos += string_length;
+        } else {
+            if (length - pos < fixed_cell_size(dt)) {
+                return 0;
+            }
+            pos += fixed_cell_size(dt);
+        }
+    }
+    return pos;
+}
+
+AppendOpStatus decode_row(const uint8_t *buffer, header_t header, row_t *row_out) {
+    // The buffer must hold the whole row, see row_span
+    if (header.codec != NULL) {
+        return header.codec->decode(header.codec, buffer, row_out);
+    }
+
+    row_t row;
+    row.num_cells = header.num_cols;
+    row.cells = (cell_t *) calloc(header.num_cols, sizeof(cell_t));
+    if (row.cells == NULL) {
+        return APPEND_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    size_t pos = 0;
+    for (size_t cell_it = 0; cell_it < header.num_cols; cell_it++) {
+        cell_t *cell = &row.cells[cell_it];
+        uint8_t tag = buffer[pos];
+        size_t value_length;
+        const uint8_t *value = encoded_cell_value(&buffer[pos], &value_length);
+        pos = value - buffer + value_length;
+
+        if (is_string_tag(tag)) {
+            cell->type = CELL_TYPE_STRING;
+            if (set_string_cell(&cell->data.string_cell, (const char *) value, value_length) != APPEND_OP_SUCCESS) {
+                free_row(&row, cell_it);
+                return APPEND_OP_ERROR_MEMORY_ALLOCATION;
+            }
+        } else if (value_length == sizeof(uint64_t)) {
+            uint64_t value_nbo;
+            memcpy(&value_nbo, value, sizeof(uint64_t));
+            uint64_t host_value = be64toh(value_nbo);
+            cell->type = (cell_type_t) tag;
+            memcpy(&cell->data, &host_value, sizeof(uint64_t));
+        } else {
+            uint32_t value_nbo;
+            memcpy(&value_nbo, value, sizeof(uint32_t));
+            cell->type = (cell_type_t) tag;
+            if (tag == CELL_TYPE_INT) {
+                cell->data.int_value = ntohl(value_nbo);
+            } else {
+                cell->data.float_value = network_bytes_to_float(value_nbo);
+            }
+        }
+    }
+
+    *row_out = row;
+    return APPEND_OP_SUCCESS;
+}
+
+AppendOpStatus decode_row_columns(const uint8_t *buffer, header_t header, const uint8_t *decoded, cell_t *cells,
+                                  row_t *row_out) {
+    if (decoded == NULL || cells == NULL || header.codec == NULL) {
+        return decode_row(buffer, header, row_out);
+    }
+    return codec_decode_columns(header.codec, decoded, buffer, cells, row_out);
+}
+
+void release_row_columns(row_t *row, const cell_t *cells) {
+    if (row->cells == cells) {
+        clear_row(row, row->num_cells);
+    } else {
+        free_row(row, row->num_cells);
+    }
+}
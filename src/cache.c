@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "cache.h"
+#include "hash.h"
+
+
+CacheOpStatus init_cache(size_t capacity, result_cache_t *cache_out) {
+    if (capacity == 0 || cache_out == NULL) {
+        return CACHE_OP_ERROR_INVALID_ARG;
+    }
+
+    cache_entry_t **buckets = (cache_entry_t **) calloc(CACHE_NUM_BUCKETS, sizeof(cache_entry_t *));
+    if (buckets == NULL) {
+        return CACHE_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    cache_out->capacity = capacity;
+    cache_out->used = 0;
+    cache_out->buckets = buckets;
+    cache_out->lru_head = NULL;
+    cache_out->lru_tail = NULL;
+    return CACHE_OP_SUCCESS;
+}
+
+static size_t entry_size(const cache_entry_t *entry) {
+    return sizeof(cache_entry_t) + entry->key_length + entry->value_length;
+}
+
+static void free_entry(cache_entry_t *entry) {
+    free(entry->key);
+    free(entry->value);
+    free(entry);
+}
+
+void free_cache(result_cache_t *cache) {
+    cache_entry_t *entry = cache->lru_head;
+    while (entry != NULL) {
+        cache_entry_t *next = entry->lru_next;
+        free_entry(entry);
+        entry = next;
+    }
+    free(cache->buckets);
+    cache->buckets = NULL;
+    cache->lru_head = NULL;
+    cache->lru_tail = NULL;
+    cache->used = 0;
+}
+
+static void lru_unlink(result_cache_t *cache, cache_entry_t *entry) {
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        cache->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        cache->lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void lru_push_front(result_cache_t *cache, cache_entry_t *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head != NULL) {
+        cache->lru_head->lru_prev = entry;
+    } else {
+        cache->lru_tail = entry;
+    }
+    cache->lru_head = entry;
+}
+
+static cache_entry_t *find_entry(const result_cache_t *cache, uint64_t hash, const uint8_t *key, size_t key_length) {
+    cache_entry_t *entry = cache->buckets[hash % CACHE_NUM_BUCKETS];
+    while (entry != NULL) {
+        if (entry->hash == hash && entry->key_length == key_length && memcmp(entry->key, key, key_length) == 0) {
+            return entry;
+        }
+        entry = entry->bucket_next;
+    }
+    return NULL;
+}
+
+static void remove_entry(result_cache_t *cache, cache_entry_t *entry) {
+    cache_entry_t **link = &cache->buckets[entry->hash % CACHE_NUM_BUCKETS];
+    while (*link != entry) {
+        link = &(*link)->bucket_next;
+    }
+    *link = entry->bucket_next;
+    lru_unlink(cache, entry);
+    cache->used -= entry_size(entry);
+    free_entry(entry);
+}
+
+const cache_entry_t *cache_get(result_cache_t *cache, const uint8_t *key, size_t key_length) {
+    if (cache == NULL || key == NULL) {
+        return NULL;
+    }
+
+    cache_entry_t *entry = find_entry(cache, hash_bytes(key, key_length), key, key_length);
+    if (entry != NULL) {
+        lru_unlink(cache, entry);
+        lru_push_front(cache, entry);
+    }
+    return entry;
+}
+
+CacheOpStatus cache_put(result_cache_t *cache, const uint8_t *key, size_t key_length, cache_version_t version,
+                        const uint8_t *value, size_t value_length) {
+    if (cache == NULL || key == NULL || (value == NULL && value_length > 0)) {
+        return CACHE_OP_ERROR_INVALID_ARG;
+    }
+
+    uint64_t hash = hash_bytes(key, key_length);
+    cache_entry_t *previous = find_entry(cache, hash, key, key_length);
+    if (previous != NULL) {
+        remove_entry(cache, previous);
+    }
+
+    size_t size = sizeof(cache_entry_t) + key_length + value_length;
+    if (size > cache->capacity) {
+        return CACHE_OP_TOO_LARGE;
+    }
+    while (cache->used + size > cache->capacity) {
+        remove_entry(cache, cache->lru_tail);
+    }
+
+    cache_entry_t *entry = (cache_entry_t *) calloc(1, sizeof(cache_entry_t));
+    uint8_t *key_copy = (uint8_t *) malloc(key_length > 0 ? key_length : 1);
+    uint8_t *value_copy = (uint8_t *) malloc(value_length > 0 ? value_length : 1);
+    if (entry == NULL || key_copy == NULL || value_copy == NULL) {
+        free(entry);
+        free(key_copy);
+        free(value_copy);
+        return CACHE_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    memcpy(key_copy, key, key_length);
+    if (value_length > 0) {
+        memcpy(value_copy, value, value_length);
+    }
+
+    entry->hash = hash;
+    entry->key = key_copy;
+    entry->key_length = key_length;
+    entry->version = version;
+    entry->value = value_copy;
+    entry->value_length = value_length;
+    entry->bucket_next = cache->buckets[hash % CACHE_NUM_BUCKETS];
+    cache->buckets[hash % CACHE_NUM_BUCKETS] = entry;
+    lru_push_front(cache, entry);
+    cache->used += size;
+    return CACHE_OP_SUCCESS;
+}
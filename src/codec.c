@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <string.h>
+#include <endian.h>
+#include <arpa/inet.h>
+
+#include "codec.h"
+
+// Int and float cells are both 4 bytes in network order, and int_value and float_value
+// share the same 4 bytes of the cell union: a single byte swap decodes either type.
+#define DECODE_FIXED_CELL(cells, types, src, i) do { \
+        uint32_t value_nbo_; \
+        memcpy(&value_nbo_, &(src)[(i) * CODEC_FIXED_CELL_SIZE + 1], sizeof(uint32_t)); \
+        uint32_t value_ = ntohl(value_nbo_); \
+        (cells)[i].type = (types)[i]; \
+        memcpy(&(cells)[i].data, &value_, sizeof(uint32_t)); \
+    } while (0)
+
+#define ENCODE_FIXED_CELL(cells, types, dst, i) do { \
+        uint32_t value_; \
+        memcpy(&value_, &(cells)[i].data, sizeof(uint32_t)); \
+        uint32_t value_nbo_ = htonl(value_); \
+        (dst)[(i) * CODEC_FIXED_CELL_SIZE] = (types)[i]; \
+        memcpy(&(dst)[(i) * CODEC_FIXED_CELL_SIZE + 1], &value_nbo_, sizeof(uint32_t)); \
+    } while (0)
+
+// Same for int64 and double cells, 8 bytes sharing the first 8 bytes of the union
+#define DECODE_WIDE_CELL(cells, types, src, i) do { \
+        uint64_t value_nbo_; \
+        memcpy(&value_nbo_, &(src)[(i) * CODEC_WIDE_CELL_SIZE + 1], sizeof(uint64_t)); \
+        uint64_t value_ = be64toh(value_nbo_); \
+        (cells)[i].type = (types)[i]; \
+        memcpy(&(cells)[i].data, &value_, sizeof(uint64_t)); \
+    } while (0)
+
+#define ENCODE_WIDE_CELL(cells, types, dst, i) do { \
+        uint64_t value_; \
+        memcpy(&value_, &(cells)[i].data, sizeof(uint64_t)); \
+        uint64_t value_nbo_ = htobe64(value_); \
+        (dst)[(i) * CODEC_WIDE_CELL_SIZE] = (types)[i]; \
+        memcpy(&(dst)[(i) * CODEC_WIDE_CELL_SIZE + 1], &value_nbo_, sizeof(uint64_t)); \
+    } while (0)
+
+// Schemas without strings and up to CODEC_MAX_UNROLLED_COLS columns of the same width get a
+// decoder where the column count is a constant, the compiler turns the loop into straight-line code
+#define DEFINE_UNROLLED_DECODER(name, decode_cell, n) \
+    static AppendOpStatus name##_##n(const row_codec_t *codec, const uint8_t *buffer, row_t *row_out) { \
+        cell_t *cells = (cell_t *) malloc((n) * sizeof(cell_t)); \
+        if (cells == NULL) { \
+            return APPEND_OP_ERROR_MEMORY_ALLOCATION; \
+        } \
+        for (size_t i = 0; i < (n); i++) { \
+            decode_cell(cells, codec->types, buffer, i); \
+        } \
+        row_out->num_cells = (n); \
+        row_out->cells = cells; \
+        return APPEND_OP_SUCCESS; \
+    }
+
+#define DEFINE_FIXED_DECODER(n) DEFINE_UNROLLED_DECODER(decode_fixed, DECODE_FIXED_CELL, n)
+#define DEFINE_WIDE_DECODER(n) DEFINE_UNROLLED_DECODER(decode_wide, DECODE_WIDE_CELL, n)
+
+DEFINE_FIXED_DECODER(1)
+DEFINE_FIXED_DECODER(2)
+DEFINE_FIXED_DECODER(3)
+DEFINE_FIXED_DECODER(4)
+DEFINE_FIXED_DECODER(5)
+DEFINE_FIXED_DECODER(6)
+DEFINE_FIXED_DECODER(7)
+DEFINE_FIXED_DECODER(8)
+
+DEFINE_WIDE_DECODER(1)
+DEFINE_WIDE_DECODER(2)
+DEFINE_WIDE_DECODER(3)
+DEFINE_WIDE_DECODER(4)
+DEFINE_WIDE_DECODER(5)
+DEFINE_WIDE_DECODER(6)
+DEFINE_WIDE_DECODER(7)
+DEFINE_WIDE_DECODER(8)
+
+static const decode_fn_t fixed_decoders[CODEC_MAX_UNROLLED_COLS + 1] = {
+    NULL, decode_fixed_1, decode_fixed_2, decode_fixed_3, decode_fixed_4,
+    decode_fixed_5, decode_fixed_6, decode_fixed_7, decode_fixed_8
+};
+
+static const decode_fn_t wide_decoders[CODEC_MAX_UNROLLED_COLS + 1] = {
+    NULL, decode_wide_1, decode_wide_2, decode_wide_3, decode_wide_4,
+    decode_wide_5, decode_wide_6, decode_wide_7, decode_wide_8
+};
+
+static AppendOpStatus decode_fixed(const row_codec_t *codec, const uint8_t *buffer, row_t *row_out) {
+    cell_t *cells = (cell_t *) malloc(codec->num_cols * sizeof(cell_t));
+    if (cells == NULL) {
+        return APPEND_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    for (size_t i = 0; i < codec->num_cols; i++) {
+        DECODE_FIXED_CELL(cells, codec->types, buffer, i);
+    }
+    row_out->num_cells = codec->num_cols;
+    row_out->cells = cells;
+    return APPEND_OP_SUCCESS;
+}
+
+static AppendOpStatus decode_wide(const row_codec_t *codec, const uint8_t *buffer, row_t *row_out) {
+    cell_t *cells = (cell_t *) malloc(codec->num_cols * sizeof(cell_t));
+    if (cells == NULL) {
+        return APPEND_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    for (size_t i = 0; i < codec->num_cols; i++) {
+        DECODE_WIDE_CELL(cells, codec->types, buffer, i);
+    }
+    row_out->num_cells = codec->num_cols;
+    row_out->cells = cells;
+    return APPEND_OP_SUCCESS;
+}
+
+static size_t run_fixed_size(const codec_run_t *run) {
+    return run->num_fixed * (run->wide ? CODEC_WIDE_CELL_SIZE : CODEC_FIXED_CELL_SIZE);
+}
+
+static AppendOpStatus decode_runs(const row_codec_t *codec, const uint8_t *buffer, row_t *row_out) {
+    cell_t *cells = (cell_t *) malloc(codec->num_cols * sizeof(cell_t));
+    if (cells == NULL) {
+        return APPEND_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    row_t row = {.num_cells = codec->num_cols, .cells = cells};
+    size_t pos = 0;
+    for (size_t r = 0; r < codec->num_runs; r++) {
+        const codec_run_t *run = &codec->runs[r];
+        cell_t *run_cells = &cells[run->first_col];
+        const uint8_t *run_types = &codec->types[run->first_col];
+        const uint8_t *src = &buffer[pos];
+        if (run->wide) {
+            for (size_t i = 0; i < run->num_fixed; i++) {
+                DECODE_WIDE_CELL(run_cells, run_types, src, i);
+            }
+        } else {
+            for (size_t i = 0; i < run->num_fixed; i++) {
+                DECODE_FIXED_CELL(run_cells, run_types, src, i);
+            }
+        }
+        pos += run_fixed_size(run);
+
+        if (run->ends_with_string) {
+            cell_t *cell = &run_cells[run->num_fixed];
+            size_t length;
+            pos += decode_string_prefix(&buffer[pos], &length);
+
+            cell->type = CELL_TYPE_STRING;
+            if (set_string_cell(&cell->data.string_cell, (const char *) &buffer[pos], length) != APPEND_OP_SUCCESS) {
+                free_row(&row, run->first_col + run->num_fixed);
+                return APPEND_OP_ERROR_MEMORY_ALLOCATION;
+            }
+            pos += length;
+        }
+    }
+
+    *row_out = row;
+    return APPEND_OP_SUCCESS;
+}
+
+AppendOpStatus codec_decode_columns(const row_codec_t *codec, const uint8_t *decoded, const uint8_t *buffer,
+                                    cell_t *cells, row_t *row_out) {
+    // The skipped cells are never written, they stay zeroed: ints that clear_row leaves alone
+    row_t row = {.num_cells = codec->num_cols, .cells = cells};
+    size_t pos = 0;
+    for (size_t r = 0; r < codec->num_runs; r++) {
+        const codec_run_t *run = &codec->runs[r];
+        cell_t *run_cells = &cells[run->first_col];
+        const uint8_t *run_types = &codec->types[run->first_col];
+        const uint8_t *run_decoded = &decoded[run->first_col];
+        const uint8_t *src = &buffer[pos];
+        if (run->wide) {
+            for (size_t i = 0; i < run->num_fixed; i++) {
+                if (run_decoded[i]) {
+                    DECODE_WIDE_CELL(run_cells, run_types, src, i);
+                }
+            }
+        } else {
+            for (size_t i = 0; i < run->num_fixed; i++) {
+                if (run_decoded[i]) {
+                    DECODE_FIXED_CELL(run_cells, run_types, src, i);
+                }
+            }
+        }
+        pos += run_fixed_size(run);
+
+        if (run->ends_with_string) {
+            size_t length;
+            pos += decode_string_prefix(&buffer[pos], &length);
+
+            // Skipped strings are jumped over, nothing is allocated or copied for them
+            if (run_decoded[run->num_fixed]) {
+                cell_t *cell = &run_cells[run->num_fixed];
+                cell->type = CELL_TYPE_STRING;
+                if (set_string_cell(&cell->data.string_cell, (const char *) &buffer[pos], length)
+                    != APPEND_OP_SUCCESS) {
+                    clear_row(&row, run->first_col + run->num_fixed);
+                    return APPEND_OP_ERROR_MEMORY_ALLOCATION;
+                }
+            }
+            pos += length;
+        }
+    }
+
+    *row_out = row;
+    return APPEND_OP_SUCCESS;
+}
+
+static int is_wide_type(uint8_t type) {
+    return type == CELL_TYPE_INT64 || type == CELL_TYPE_DOUBLE;
+}
+
+CodecOpStatus build_codec(header_t header, row_codec_t **codec_out) {
+    if (header.columns == NULL || header.num_cols == 0 || codec_out == NULL) {
+        return CODEC_OP_ERROR_INVALID_ARG;
+    }
+
+    row_codec_t *codec = (row_codec_t *) calloc(1, sizeof(row_codec_t));
+    if (codec == NULL) {
+        return CODEC_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    codec->num_cols = header.num_cols;
+    codec->types = (uint8_t *) malloc(header.num_cols);
+    // Every run holds at least one column
+    codec->runs = (codec_run_t *) calloc(header.num_cols, sizeof(codec_run_t));
+    if (codec->types == NULL || codec->runs == NULL) {
+        free_codec(codec);
+        return CODEC_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    // A run ends with a string, or where the number cells change width so that the width of
+    // its cells is decided here rather than for every cell of every row
+    size_t run_start = 0;
+    for (size_t i = 0; i < header.num_cols; i++) {
+        codec->types[i] = header.columns[i].data_type;
+        uint8_t wide = is_wide_type(codec->types[i]);
+        if (codec->types[i] == CELL_TYPE_STRING) {
+            codec->runs[codec->num_runs++] = (codec_run_t) {
+                .first_col = run_start, .num_fixed = i - run_start,
+                .wide = i > run_start && is_wide_type(codec->types[run_start]), .ends_with_string = 1
+            };
+            run_start = i + 1;
+        } else if (i > run_start && wide != is_wide_type(codec->types[run_start])) {
+            codec->runs[codec->num_runs++] = (codec_run_t) {
+                .first_col = run_start, .num_fixed = i - run_start, .wide = !wide, .ends_with_string = 0
+            };
+            run_start = i;
+        }
+    }
+    if (run_start < header.num_cols) {
+        codec->runs[codec->num_runs++] = (codec_run_t) {
+            .first_col = run_start, .num_fixed = header.num_cols - run_start,
+            .wide = is_wide_type(codec->types[run_start]), .ends_with_string = 0
+        };
+    }
+
+    // Rows of number cells only have a fixed size, whatever the widths of their runs
+    int has_string = 0;
+    for (size_t r = 0; r < codec->num_runs; r++) {
+        codec->fixed_size += run_fixed_size(&codec->runs[r]);
+        has_string |= codec->runs[r].ends_with_string;
+    }
+    if (has_string) {
+        codec->fixed_size = 0;
+        codec->decode = decode_runs;
+    } else if (codec->num_runs > 1) {
+        codec->decode = decode_runs;
+    } else if (codec->runs[0].wide) {
+        codec->decode = header.num_cols <= CODEC_MAX_UNROLLED_COLS ? wide_decoders[header.num_cols] : decode_wide;
+    } else {
+        codec->decode = header.num_cols <= CODEC_MAX_UNROLLED_COLS ? fixed_decoders[header.num_cols] : decode_fixed;
+    }
+
+    *codec_out = codec;
+    return CODEC_OP_SUCCESS;
+}
+
+void free_codec(row_codec_t *codec) {
+    if (codec == NULL) {
+        return;
+    }
+    free(codec->types);
+    free(codec->runs);
+    free(codec);
+}
+
+size_t codec_row_span(const row_codec_t *codec, const uint8_t *buffer, size_t length) {
+    if (codec->fixed_size != 0) {
+        return length < codec->fixed_size ? 0 : codec->fixed_size;
+    }
+
+    // Only the string lengths have to be looked at, the fixed runs are skipped whole
+    size_t pos = 0;
+    for (size_t r = 0; r < codec->num_runs; r++) {
+        const codec_run_t *run = &codec->runs[r];
+        size_t needed = run_fixed_size(run) + (run->ends_with_string ? sizeof(uint8_t) : 0);
+        if (length - pos < needed) {
+            return 0;
+        }
+        pos += run_fixed_size(run);
+
+        if (run->ends_with_string) {
+            if (length - pos < string_prefix_size(buffer[pos])) {
+                return 0;
+            }
+            size_t string_length;
+            pos += decode_string_prefix(&buffer[pos], &string_length);
+            if (length - pos < string_length) {
+                return 0;
+            }
+            pos += string_length;
+        }
+    }
+    return pos;
+}
+
+size_t codec_encode_row(const row_codec_t *codec, uint8_t *buffer, row_t row) {
+    size_t pos = 0;
+    for (size_t r = 0; r < codec->num_runs; r++) {
+        const codec_run_t *run = &codec->runs[r];
+        const cell_t *run_cells = &row.cells[run->first_col];
+        const uint8_t *run_types = &codec->types[run->first_col];
+        uint8_t *dst = &buffer[pos];
+        if (run->wide) {
+            for (size_t i = 0; i < run->num_fixed; i++) {
+                ENCODE_WIDE_CELL(run_cells, run_types, dst, i);
+            }
+        } else {
+            for (size_t i = 0; i < run->num_fixed; i++) {
+                ENCODE_FIXED_CELL(run_cells, run_types, dst, i);
+            }
+        }
+        pos += run_fixed_size(run);
+
+        if (run->ends_with_string) {
+            pos += encode_string(&buffer[pos], &run_cells[run->num_fixed].data.string_cell);
+        }
+    }
+    return pos;
+}
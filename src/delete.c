@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "delete.h"
+#include "file.h"
+#include "append.h"
+#include "scan.h"
+#include "tombstone.h"
+#include "rollup.h"
+#include "stats.h"
+
+
+typedef struct {
+    tombstone_t *tombstones;
+    size_t deleted;
+    TombstoneOpStatus status;
+} delete_ctx_t;
+
+static int mark_row(row_t row, size_t row_index, uint64_t offset, void *ctx) {
+    delete_ctx_t *delete_ctx = (delete_ctx_t *) ctx;
+    delete_ctx->status = mark_tombstone(delete_ctx->tombstones, row_index);
+    if (delete_ctx->status != TOMBSTONE_OP_SUCCESS) {
+        return 1;
+    }
+    delete_ctx->deleted++;
+    return 0;
+}
+
+DeleteOpStatus delete_rows(const char *filepath, int fd, header_t header, const predicate_t *predicate, size_t *deleted_out) {
+    if (filepath == NULL || predicate == NULL || deleted_out == NULL) {
+        return DELETE_OP_ERROR_INVALID_ARG;
+    }
+
+    tombstone_t tombstones;
+    if (load_tombstones(filepath, fd, &tombstones) != TOMBSTONE_OP_SUCCESS) {
+        return DELETE_OP_TOMBSTONE_ERROR;
+    }
+
+    // Rows that are already dead are skipped by the scan, so they are not counted twice
+    delete_ctx_t ctx = {.tombstones = &tombstones, .deleted = 0, .status = TOMBSTONE_OP_SUCCESS};
+    ScanOpStatus scan_status = scan_rows(fd, header, &tombstones, predicate, NULL, mark_row, &ctx);
+    if (scan_status != SCAN_OP_SUCCESS || ctx.status != TOMBSTONE_OP_SUCCESS) {
+        free_tombstones(&tombstones);
+        return scan_status == SCAN_OP_ERROR_MEMORY_ALLOCATION || ctx.status == TOMBSTONE_OP_ERROR_MEMORY_ALLOCATION
+            ? DELETE_OP_ERROR_MEMORY_ALLOCATION : DELETE_OP_READ_ERROR;
+    }
+
+    // The rollups are reset first, a crash in between leaves them to be recomputed, never stale
+    if (ctx.deleted > 0 && reset_rollups(filepath, fd, header) != ROLLUP_OP_SUCCESS) {
+        free_tombstones(&tombstones);
+        return DELETE_OP_WRITE_ERROR;
+    }
+    if (ctx.deleted > 0 && save_tombstones(filepath, fd, &tombstones) != TOMBSTONE_OP_SUCCESS) {
+        free_tombstones(&tombstones);
+        return DELETE_OP_TOMBSTONE_ERROR;
+    }
+
+    free_tombstones(&tombstones);
+    *deleted_out = ctx.deleted;
+    return DELETE_OP_SUCCESS;
+}
+
+DeleteOpStatus compact_table(const char *filepath, int fd, header_t header, size_t *removed_out) {
+    if (filepath == NULL || fd < 0 || removed_out == NULL) {
+        return DELETE_OP_ERROR_INVALID_ARG;
+    }
+
+    tombstone_t tombstones;
+    if (load_tombstones(filepath, fd, &tombstones) != TOMBSTONE_OP_SUCCESS) {
+        return DELETE_OP_TOMBSTONE_ERROR;
+    }
+
+    size_t removed = count_tombstones(&tombstones);
+    if (removed == 0) {
+        free_tombstones(&tombstones);
+        *removed_out = 0;
+        return DELETE_OP_SUCCESS;
+    }
+
+    size_t path_length = strlen(filepath);
+    char *tmp_path = (char *) malloc(path_length + sizeof(COMPACT_SUFFIX));
+    if (tmp_path == NULL) {
+        free_tombstones(&tombstones);
+        return DELETE_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    memcpy(tmp_path, filepath, path_length);
+    memcpy(&tmp_path[path_length], COMPACT_SUFFIX, sizeof(COMPACT_SUFFIX));
+
+    // A leftover from an interrupted compaction is simply overwritten
+    int tmp_fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (tmp_fd == -1) {
+        free(tmp_path);
+        free_tombstones(&tombstones);
+        return DELETE_OP_WRITE_ERROR;
+    }
+
+    DeleteOpStatus status = DELETE_OP_SUCCESS;
+
+    // The compacted file takes the place of the table, it keeps its permissions
+    struct stat table_stat;
+    if (fstat(fd, &table_stat) == -1 || fchmod(tmp_fd, table_stat.st_mode & 07777) == -1) {
+        status = DELETE_OP_WRITE_ERROR;
+        goto cleanup;
+    }
+
+    header_t new_header = header;
+    set_current_layout(&new_header);
+    new_header.num_rows = header.num_rows - removed;
+    if (write_header(tmp_fd, new_header) != HEADER_OP_SUCCESS) {
+        status = DELETE_OP_WRITE_ERROR;
+        goto cleanup;
+    }
+
+    STATS_SYSCALL(IO_ROWS, IO_SEEK, 0);
+    if (lseek(fd, header_size(header), SEEK_SET) == (off_t)-1) {
+        status = DELETE_OP_READ_ERROR;
+        goto cleanup;
+    }
+
+    // Stream the live rows one at a time, the table never has to fit in memory
+    for (size_t row_index = 0; row_index < header.num_rows; row_index++) {
+        if (is_tombstoned(&tombstones, row_index)) {
+            if (skip_row(fd, header) != APPEND_OP_SUCCESS) {
+                status = DELETE_OP_READ_ERROR;
+                goto cleanup;
+            }
+            continue;
+        }
+
+        row_t row;
+        AppendOpStatus aop_status = read_row(fd, header, &row);
+        if (aop_status != APPEND_OP_SUCCESS) {
+            status = aop_status == APPEND_OP_ERROR_MEMORY_ALLOCATION ? DELETE_OP_ERROR_MEMORY_ALLOCATION : DELETE_OP_READ_ERROR;
+            goto cleanup;
+        }
+        aop_status = write_row(tmp_fd, header, row);
+        free_row(&row, row.num_cells);
+        if (aop_status != APPEND_OP_SUCCESS) {
+            status = DELETE_OP_WRITE_ERROR;
+            goto cleanup;
+        }
+    }
+
+    off_t data_end = lseek(tmp_fd, 0, SEEK_CUR);
+    STATS_SYSCALL(IO_ROWS, IO_SEEK, 0);
+    if (data_end == (off_t)-1 || update_header_num_rows(tmp_fd, 0, data_end, &new_header) != HEADER_OP_SUCCESS) {
+        status = DELETE_OP_WRITE_ERROR;
+        goto cleanup;
+    }
+
+    if (fsync(tmp_fd) == -1) {
+        status = DELETE_OP_WRITE_ERROR;
+        goto cleanup;
+    }
+
+    // The rows move, the rollups start over once the new file is in place
+    if (reset_rollups(filepath, fd, header) != ROLLUP_OP_SUCCESS) {
+        status = DELETE_OP_WRITE_ERROR;
+        goto cleanup;
+    }
+    if (rename(tmp_path, filepath) == -1) {
+        status = DELETE_OP_RENAME_ERROR;
+        goto cleanup;
+    }
+
+    // The sidecar is bound to the old inode, so even if this unlink never happens it won't be applied again
+    char *tomb_path = tombstone_path(filepath);
+    if (tomb_path != NULL) {
+        if (unlink(tomb_path) == -1 && errno != ENOENT) {
+            status = DELETE_OP_TOMBSTONE_ERROR;
+        }
+        free(tomb_path);
+    }
+    sync_parent_dir(filepath);
+
+cleanup:
+    if (close(tmp_fd) == -1 && status == DELETE_OP_SUCCESS) {
+        status = DELETE_OP_WRITE_ERROR;
+    }
+    if (status != DELETE_OP_SUCCESS && status != DELETE_OP_TOMBSTONE_ERROR) {
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+    free_tombstones(&tombstones);
+
+    if (status == DELETE_OP_SUCCESS) {
+        *removed_out = removed;
+    }
+    return status;
+}
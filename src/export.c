@@ -0,0 +1,528 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+
+#include "export.h"
+
+/*
+ * Arrow IPC streaming format: a Schema message, one RecordBatch message per batch of
+ * rows and an end-of-stream marker. Each message is a 0xFFFFFFFF continuation marker,
+ * the metadata length, a flatbuffer-encoded Message padded to 8 bytes and the body.
+ *
+ * The flatbuffers are small and always have the same shape, so instead of pulling in
+ * the flatbuffers library they are laid out front to back by hand: every table is
+ * preceded by its vtable and followed by its children, which keeps all the unsigned
+ * offsets pointing forward as the format requires.
+ */
+#define ARROW_METADATA_V5 4
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_FLOATING_POINT 3
+#define ARROW_TYPE_UTF8 5
+#define ARROW_PRECISION_SINGLE 1
+#define ARROW_PRECISION_DOUBLE 2
+#define ARROW_CONTINUATION 0xFFFFFFFFu
+
+
+typedef struct {
+    uint8_t *data;
+    size_t length;
+    size_t capacity;
+    int failed;
+} fb_builder_t;
+
+typedef struct {
+    uint8_t size;  // 0 when the field is absent
+    uint8_t is_offset;
+    uint64_t value;
+} fb_field_t;
+
+static size_t fb_alloc(fb_builder_t *fb, size_t size, size_t align) {
+    size_t pos = (fb->length + align - 1) & ~(align - 1);
+    if (fb->failed) {
+        return 0;
+    }
+
+    if (pos + size > fb->capacity) {
+        size_t capacity = fb->capacity == 0 ? 1024 : fb->capacity;
+        while (pos + size > capacity) {
+            capacity *= 2;
+        }
+        uint8_t *data = (uint8_t *) realloc(fb->data, capacity);
+        if (data == NULL) {
+            fb->failed = 1;
+            return 0;
+        }
+        fb->data = data;
+        fb->capacity = capacity;
+    }
+
+    memset(&fb->data[fb->length], 0, pos + size - fb->length);
+    fb->length = pos + size;
+    return pos;
+}
+
+static void fb_put(fb_builder_t *fb, size_t pos, uint64_t value, size_t size) {
+    if (fb->failed) {
+        return;
+    }
+    // Flatbuffers are little endian
+    uint64_t value_le = htole64(value);
+    if (size == 1) {
+        fb->data[pos] = (uint8_t) value;
+    } else if (size == 2) {
+        uint16_t v = htole16((uint16_t) value);
+        memcpy(&fb->data[pos], &v, 2);
+    } else if (size == 4) {
+        uint32_t v = htole32((uint32_t) value);
+        memcpy(&fb->data[pos], &v, 4);
+    } else {
+        memcpy(&fb->data[pos], &value_le, 8);
+    }
+}
+
+static void fb_patch(fb_builder_t *fb, size_t pos, size_t target) {
+    fb_put(fb, pos, target - pos, sizeof(uint32_t));
+}
+
+static size_t fb_table(fb_builder_t *fb, const fb_field_t *fields, size_t num_fields, size_t *positions) {
+    uint16_t offsets[8] = {0};
+    size_t table_size = sizeof(int32_t);
+    for (size_t i = 0; i < num_fields; i++) {
+        if (fields[i].size == 0) {
+            continue;
+        }
+        table_size = (table_size + fields[i].size - 1) & ~((size_t) fields[i].size - 1);
+        offsets[i] = (uint16_t) table_size;
+        table_size += fields[i].size;
+    }
+
+    size_t vtable_size = sizeof(uint16_t) * (2 + num_fields);
+    size_t vtable_pos = fb_alloc(fb, vtable_size, sizeof(uint16_t));
+    size_t table_pos = fb_alloc(fb, table_size, 8);
+    if (fb->failed) {
+        return 0;
+    }
+
+    fb_put(fb, vtable_pos, vtable_size, 2);
+    fb_put(fb, vtable_pos + 2, table_size, 2);
+    for (size_t i = 0; i < num_fields; i++) {
+        fb_put(fb, vtable_pos + 4 + 2 * i, offsets[i], 2);
+    }
+
+    fb_put(fb, table_pos, table_pos - vtable_pos, sizeof(int32_t));
+    for (size_t i = 0; i < num_fields; i++) {
+        if (positions != NULL) {
+            positions[i] = table_pos + offsets[i];
+        }
+        if (fields[i].size != 0 && !fields[i].is_offset) {
+            fb_put(fb, table_pos + offsets[i], fields[i].value, fields[i].size);
+        }
+    }
+    return table_pos;
+}
+
+static size_t fb_string(fb_builder_t *fb, const char *string, size_t length) {
+    size_t pos = fb_alloc(fb, sizeof(uint32_t) + length + 1, sizeof(uint32_t));
+    if (fb->failed) {
+        return 0;
+    }
+    fb_put(fb, pos, length, sizeof(uint32_t));
+    memcpy(&fb->data[pos + sizeof(uint32_t)], string, length);
+    return pos;
+}
+
+static size_t fb_struct_vector(fb_builder_t *fb, const int64_t *values, size_t count) {
+    // Elements are pairs of longs, they must start on an 8 byte boundary right after the count
+    size_t pos = fb_alloc(fb, sizeof(uint32_t), sizeof(uint32_t));
+    if ((pos + sizeof(uint32_t)) % 8 != 0) {
+        pos = fb_alloc(fb, sizeof(uint32_t), sizeof(uint32_t));
+    }
+    fb_put(fb, pos, count, sizeof(uint32_t));
+    size_t elements = fb_alloc(fb, count * 2 * sizeof(int64_t), 8);
+    for (size_t i = 0; i < count * 2; i++) {
+        fb_put(fb, elements + i * sizeof(int64_t), (uint64_t) values[i], sizeof(int64_t));
+    }
+    return pos;
+}
+
+static size_t fb_message(fb_builder_t *fb, uint8_t header_type, int64_t body_length, size_t *header_field_out) {
+    size_t root = fb_alloc(fb, sizeof(uint32_t), sizeof(uint32_t));
+    fb_field_t fields[] = {
+        {.size = 2, .value = ARROW_METADATA_V5},
+        {.size = 1, .value = header_type},
+        {.size = 4, .is_offset = 1},
+        {.size = 8, .value = (uint64_t) body_length}
+    };
+    size_t positions[4];
+    size_t message = fb_table(fb, fields, 4, positions);
+    fb_patch(fb, root, message);
+    *header_field_out = positions[2];
+    return message;
+}
+
+static ExportOpStatus write_all(int fd, const void *buffer, size_t length) {
+    const uint8_t *bytes = (const uint8_t *) buffer;
+    while (length > 0) {
+        ssize_t bytes_written = write(fd, bytes, length);
+        if (bytes_written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return EXPORT_OP_ERROR_WRITE;
+        }
+        bytes += bytes_written;
+        length -= bytes_written;
+    }
+    return EXPORT_OP_SUCCESS;
+}
+
+static ExportOpStatus write_padding(int fd, size_t length) {
+    static const uint8_t zeros[ARROW_BUFFER_ALIGNMENT] = {0};
+    return write_all(fd, zeros, length);
+}
+
+static size_t pad_length(size_t length, size_t alignment) {
+    return (alignment - length % alignment) % alignment;
+}
+
+static ExportOpStatus write_message(int fd, fb_builder_t *fb) {
+    if (fb->failed) {
+        return EXPORT_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    size_t padding = pad_length(fb->length, 8);
+    uint32_t prefix[2] = {htole32(ARROW_CONTINUATION), htole32((uint32_t) (fb->length + padding))};
+    ExportOpStatus status = write_all(fd, prefix, sizeof(prefix));
+    if (status == EXPORT_OP_SUCCESS) {
+        status = write_all(fd, fb->data, fb->length);
+    }
+    if (status == EXPORT_OP_SUCCESS) {
+        status = write_padding(fd, padding);
+    }
+    return status;
+}
+
+static ExportOpStatus write_schema(arrow_writer_t *writer) {
+    fb_builder_t fb = {0};
+    size_t header_field;
+    fb_message(&fb, ARROW_HEADER_SCHEMA, 0, &header_field);
+
+    fb_field_t schema_fields[] = {
+        {.size = 0},  // endianness, little is the default
+        {.size = 4, .is_offset = 1}
+    };
+    size_t schema_positions[2];
+    size_t schema = fb_table(&fb, schema_fields, 2, schema_positions);
+    fb_patch(&fb, header_field, schema);
+
+    size_t num_cols = writer->header.num_cols;
+    size_t vector = fb_alloc(&fb, sizeof(uint32_t) * (1 + num_cols), sizeof(uint32_t));
+    fb_put(&fb, vector, num_cols, sizeof(uint32_t));
+    fb_patch(&fb, schema_positions[1], vector);
+
+    for (size_t i = 0; i < num_cols && !fb.failed; i++) {
+        column_t column = writer->header.columns[i];
+        uint8_t type_type = column.data_type == CELL_TYPE_INT || column.data_type == CELL_TYPE_INT64 ? ARROW_TYPE_INT
+                          : column.data_type == CELL_TYPE_STRING ? ARROW_TYPE_UTF8 : ARROW_TYPE_FLOATING_POINT;
+        int wide = column.data_type == CELL_TYPE_INT64 || column.data_type == CELL_TYPE_DOUBLE;
+
+        fb_field_t field_fields[] = {
+            {.size = 4, .is_offset = 1},  // name
+            {.size = 1, .value = 0},  // nullable
+            {.size = 1, .value = type_type},
+            {.size = 4, .is_offset = 1},  // type
+            {.size = 0},  // dictionary
+            {.size = 4, .is_offset = 1}  // children
+        };
+        size_t field_positions[6];
+        size_t field = fb_table(&fb, field_fields, 6, field_positions);
+        fb_patch(&fb, vector + sizeof(uint32_t) * (1 + i), field);
+
+        size_t name = fb_string(&fb, column.name, column.name_length);
+        fb_patch(&fb, field_positions[0], name);
+
+        size_t type;
+        if (type_type == ARROW_TYPE_INT) {
+            fb_field_t int_fields[] = {{.size = 4, .value = wide ? 64 : 32}, {.size = 1, .value = 1}};
+            type = fb_table(&fb, int_fields, 2, NULL);
+        } else if (type_type == ARROW_TYPE_FLOATING_POINT) {
+            fb_field_t float_fields[] = {{.size = 2, .value = wide ? ARROW_PRECISION_DOUBLE : ARROW_PRECISION_SINGLE}};
+            type = fb_table(&fb, float_fields, 1, NULL);
+        } else {
+            type = fb_table(&fb, NULL, 0, NULL);
+        }
+        fb_patch(&fb, field_positions[3], type);
+
+        size_t children = fb_alloc(&fb, sizeof(uint32_t), sizeof(uint32_t));
+        fb_patch(&fb, field_positions[5], children);
+    }
+
+    ExportOpStatus status = write_message(writer->out_fd, &fb);
+    free(fb.data);
+    return status;
+}
+
+static size_t column_num_buffers(const arrow_column_t *column) {
+    // Validity bitmap (always empty, nothing is null) + values, + offsets for strings
+    return column->data_type == CELL_TYPE_STRING ? 3 : 2;
+}
+
+static ExportOpStatus write_batch(arrow_writer_t *writer) {
+    if (writer->rows_in_batch == 0) {
+        return EXPORT_OP_SUCCESS;
+    }
+
+    size_t num_cols = writer->header.num_cols;
+    size_t rows = writer->rows_in_batch;
+
+    size_t num_buffers = 0;
+    for (size_t i = 0; i < num_cols; i++) {
+        num_buffers += column_num_buffers(&writer->columns[i]);
+    }
+
+    int64_t *nodes = (int64_t *) calloc(num_cols * 2, sizeof(int64_t));
+    int64_t *buffers = (int64_t *) calloc(num_buffers * 2, sizeof(int64_t));
+    if (nodes == NULL || buffers == NULL) {
+        free(nodes);
+        free(buffers);
+        return EXPORT_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    // Lay the body out: every buffer starts on an ARROW_BUFFER_ALIGNMENT boundary
+    size_t body_length = 0;
+    size_t b = 0;
+    for (size_t i = 0; i < num_cols; i++) {
+        arrow_column_t *column = &writer->columns[i];
+        nodes[i * 2] = (int64_t) rows;
+        nodes[i * 2 + 1] = 0;
+
+        buffers[b * 2] = (int64_t) body_length;
+        buffers[b * 2 + 1] = 0;
+        b++;
+
+        if (column->data_type == CELL_TYPE_STRING) {
+            size_t offsets_length = (rows + 1) * sizeof(int32_t);
+            buffers[b * 2] = (int64_t) body_length;
+            buffers[b * 2 + 1] = (int64_t) offsets_length;
+            body_length += offsets_length + pad_length(offsets_length, ARROW_BUFFER_ALIGNMENT);
+            b++;
+        }
+
+        buffers[b * 2] = (int64_t) body_length;
+        buffers[b * 2 + 1] = (int64_t) column->values_length;
+        body_length += column->values_length + pad_length(column->values_length, ARROW_BUFFER_ALIGNMENT);
+        b++;
+    }
+
+    fb_builder_t fb = {0};
+    size_t header_field;
+    fb_message(&fb, ARROW_HEADER_RECORD_BATCH, (int64_t) body_length, &header_field);
+
+    fb_field_t batch_fields[] = {
+        {.size = 8, .value = rows},
+        {.size = 4, .is_offset = 1},  // nodes
+        {.size = 4, .is_offset = 1}  // buffers
+    };
+    size_t batch_positions[3];
+    size_t batch = fb_table(&fb, batch_fields, 3, batch_positions);
+    fb_patch(&fb, header_field, batch);
+    fb_patch(&fb, batch_positions[1], fb_struct_vector(&fb, nodes, num_cols));
+    fb_patch(&fb, batch_positions[2], fb_struct_vector(&fb, buffers, num_buffers));
+    free(nodes);
+    free(buffers);
+
+    ExportOpStatus status = write_message(writer->out_fd, &fb);
+    free(fb.data);
+
+    for (size_t i = 0; i < num_cols && status == EXPORT_OP_SUCCESS; i++) {
+        arrow_column_t *column = &writer->columns[i];
+        if (column->data_type == CELL_TYPE_STRING) {
+            size_t offsets_length = (rows + 1) * sizeof(int32_t);
+            status = write_all(writer->out_fd, column->offsets, offsets_length);
+            if (status == EXPORT_OP_SUCCESS) {
+                status = write_padding(writer->out_fd, pad_length(offsets_length, ARROW_BUFFER_ALIGNMENT));
+            }
+        }
+        if (status == EXPORT_OP_SUCCESS) {
+            status = write_all(writer->out_fd, column->values, column->values_length);
+        }
+        if (status == EXPORT_OP_SUCCESS) {
+            status = write_padding(writer->out_fd, pad_length(column->values_length, ARROW_BUFFER_ALIGNMENT));
+        }
+        column->values_length = 0;
+    }
+
+    writer->num_batches++;
+    writer->rows_in_batch = 0;
+    return status;
+}
+
+static void free_arrow_columns(arrow_column_t *columns, size_t num_cols) {
+    for (size_t i = 0; i < num_cols; i++) {
+        free(columns[i].values);
+        free(columns[i].offsets);
+    }
+    free(columns);
+}
+
+ExportOpStatus open_arrow_writer(int out_fd, header_t header, size_t batch_rows, arrow_writer_t *writer_out) {
+    if (out_fd < 0 || writer_out == NULL || header.columns == NULL) {
+        return EXPORT_OP_ERROR_INVALID_ARG;
+    }
+    if (batch_rows == 0) {
+        batch_rows = ARROW_BATCH_ROWS;
+    }
+
+    arrow_writer_t writer = {
+        .out_fd = out_fd,
+        .header = header,
+        .columns = NULL,
+        .batch_rows = batch_rows,
+        .rows_in_batch = 0,
+        .total_rows = 0,
+        .num_batches = 0,
+        .status = EXPORT_OP_SUCCESS
+    };
+
+    writer.columns = (arrow_column_t *) calloc(header.num_cols, sizeof(arrow_column_t));
+    if (writer.columns == NULL) {
+        return EXPORT_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    for (size_t i = 0; i < header.num_cols; i++) {
+        arrow_column_t *column = &writer.columns[i];
+        column->data_type = header.columns[i].data_type;
+        if (column->data_type > CELL_TYPE_DOUBLE) {
+            free_arrow_columns(writer.columns, header.num_cols);
+            return EXPORT_OP_ERROR_UNSUPPORTED_TYPE;
+        }
+        if (column->data_type == CELL_TYPE_STRING) {
+            column->offsets = (int32_t *) malloc((batch_rows + 1) * sizeof(int32_t));
+            if (column->offsets == NULL) {
+                free_arrow_columns(writer.columns, header.num_cols);
+                return EXPORT_OP_ERROR_MEMORY_ALLOCATION;
+            }
+            column->offsets[0] = 0;
+            column->offsets_capacity = batch_rows + 1;
+        }
+    }
+
+    ExportOpStatus status = write_schema(&writer);
+    if (status != EXPORT_OP_SUCCESS) {
+        free_arrow_columns(writer.columns, header.num_cols);
+        return status;
+    }
+
+    pthread_mutex_init(&writer.lock, NULL);
+    *writer_out = writer;
+    return EXPORT_OP_SUCCESS;
+}
+
+static ExportOpStatus column_reserve(arrow_column_t *column, size_t additional) {
+    if (column->values_length + additional <= column->values_capacity) {
+        return EXPORT_OP_SUCCESS;
+    }
+    size_t capacity = column->values_capacity == 0 ? 4096 : column->values_capacity;
+    while (column->values_length + additional > capacity) {
+        capacity *= 2;
+    }
+    uint8_t *values = (uint8_t *) realloc(column->values, capacity);
+    if (values == NULL) {
+        return EXPORT_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    column->values = values;
+    column->values_capacity = capacity;
+    return EXPORT_OP_SUCCESS;
+}
+
+ExportOpStatus arrow_write_row(arrow_writer_t *writer, row_t row) {
+    if (writer == NULL || row.num_cells != writer->header.num_cols) {
+        return EXPORT_OP_ERROR_INVALID_ARG;
+    }
+
+    // Utf8 offsets are 32 bits, close the batch early rather than overflow them
+    for (size_t i = 0; i < row.num_cells; i++) {
+        if (row.cells[i].type == CELL_TYPE_STRING
+            && writer->columns[i].values_length + row.cells[i].data.string_cell.length > INT32_MAX) {
+            ExportOpStatus status = write_batch(writer);
+            if (status != EXPORT_OP_SUCCESS) {
+                return status;
+            }
+            break;
+        }
+    }
+
+    size_t r = writer->rows_in_batch;
+    for (size_t i = 0; i < row.num_cells; i++) {
+        arrow_column_t *column = &writer->columns[i];
+        cell_t cell = row.cells[i];
+        if (cell.type != column->data_type) {
+            return EXPORT_OP_ERROR_INVALID_ARG;
+        }
+
+        size_t length = cell.type == CELL_TYPE_STRING ? cell.data.string_cell.length
+                      : fixed_cell_size(cell.type) - sizeof(uint8_t);
+        if (column_reserve(column, length) != EXPORT_OP_SUCCESS) {
+            return EXPORT_OP_ERROR_MEMORY_ALLOCATION;
+        }
+
+        // The 4 and 8 byte numbers sit at the start of the cell union
+        if (cell.type == CELL_TYPE_STRING) {
+            memcpy(&column->values[column->values_length], STRING_CELL_DATA(&cell.data.string_cell), length);
+            column->offsets[r + 1] = htole32((int32_t) (column->values_length + length));
+        } else if (length == sizeof(uint64_t)) {
+            uint64_t value_le;
+            memcpy(&value_le, &cell.data, sizeof(uint64_t));
+            value_le = htole64(value_le);
+            memcpy(&column->values[column->values_length], &value_le, sizeof(uint64_t));
+        } else {
+            uint32_t value_le;
+            memcpy(&value_le, &cell.data, sizeof(uint32_t));
+            value_le = htole32(value_le);
+            memcpy(&column->values[column->values_length], &value_le, sizeof(uint32_t));
+        }
+        column->values_length += length;
+    }
+
+    writer->rows_in_batch++;
+    writer->total_rows++;
+    if (writer->rows_in_batch == writer->batch_rows) {
+        return write_batch(writer);
+    }
+    return EXPORT_OP_SUCCESS;
+}
+
+int arrow_scan_callback(row_t row, size_t row_index, uint64_t offset, void *ctx) {
+    arrow_writer_t *writer = (arrow_writer_t *) ctx;
+    pthread_mutex_lock(&writer->lock);
+    if (writer->status == EXPORT_OP_SUCCESS) {
+        writer->status = arrow_write_row(writer, row);
+    }
+    int stop = writer->status != EXPORT_OP_SUCCESS;
+    pthread_mutex_unlock(&writer->lock);
+    return stop;
+}
+
+ExportOpStatus close_arrow_writer(arrow_writer_t *writer) {
+    if (writer == NULL) {
+        return EXPORT_OP_ERROR_INVALID_ARG;
+    }
+
+    ExportOpStatus status = writer->status;
+    if (status == EXPORT_OP_SUCCESS) {
+        status = write_batch(writer);
+    }
+    if (status == EXPORT_OP_SUCCESS) {
+        uint32_t end_of_stream[2] = {htole32(ARROW_CONTINUATION), 0};
+        status = write_all(writer->out_fd, end_of_stream, sizeof(end_of_stream));
+    }
+
+    free_arrow_columns(writer->columns, writer->header.num_cols);
+    writer->columns = NULL;
+    pthread_mutex_destroy(&writer->lock);
+    return status;
+}
@@ -1,8 +1,13 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
 
 #include "file.h"
+#include "stats.h"
 
 
 FileOpStatus create_file(const char *filepath, int *fd_out) {
@@ -36,4 +41,53 @@ FileOpStatus open_file(const char *filepath, int *fd_out) {
 
     *fd_out = fd;
     return FILE_SUCCESS;
-}
\ No newline at end of file
+}
+int sync_parent_dir(const char *filepath) {
+    char *copy = strdup(filepath);
+    if (copy == NULL) {
+        return -1;
+    }
+    int dir_fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+    free(copy);
+    if (dir_fd == -1) {
+        return -1;
+    }
+    int ret = fsync(dir_fd);
+    close(dir_fd);
+    return ret;
+}
+
+ssize_t pread_full(int fd, uint8_t *buffer, size_t length, uint64_t offset) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t bytes_read = pread(fd, &buffer[total], length - total, offset + total);
+        STATS_SYSCALL(IO_ROWS, IO_READ, bytes_read);
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        total += bytes_read;
+    }
+    return total;
+}
+
+int pwrite_full(int fd, const uint8_t *buffer, size_t length, uint64_t offset) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t bytes_written = pwrite(fd, &buffer[total], length - total, offset + total);
+        STATS_SYSCALL(IO_ROWS, IO_WRITE, bytes_written);
+        if (bytes_written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        total += bytes_written;
+    }
+    return 0;
+}
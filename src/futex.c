@@ -0,0 +1,21 @@
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "futex.h"
+
+
+void futex_wait(uint32_t *word, uint32_t expected) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+int futex_wait_for(uint32_t *word, uint32_t expected, long timeout_ns) {
+    struct timespec timeout = { .tv_sec = timeout_ns / 1000000000L, .tv_nsec = timeout_ns % 1000000000L };
+    return syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, &timeout, NULL, 0) == -1 && errno == ETIMEDOUT;
+}
+
+void futex_wake(uint32_t *word, int num_waiters) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, num_waiters, NULL, NULL, 0);
+}
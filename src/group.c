@@ -0,0 +1,800 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "group.h"
+#include "file.h"
+#include "hash.h"
+#include "projection.h"
+#include "scan.h"
+#include "stats.h"
+
+#define GROUP_RADIX_SHIFT (64 - GROUP_RADIX_BITS)
+#define GROUP_RECORD_HEADER (sizeof(uint64_t) + sizeof(uint32_t))
+
+
+typedef struct {
+    uint64_t hash;
+    size_t key_offset;
+    size_t key_length;
+} group_entry_t;
+
+// Keys are packed cell after cell: the type byte, then the int, or the uint32 length, the bytes
+// and a terminating NUL of a string, so the key cells can point straight into the arena
+typedef struct {
+    uint8_t *keys;
+    size_t keys_length;
+    size_t keys_capacity;
+    group_entry_t *groups;
+    agg_state_t *states;  // num_aggs per group
+    size_t num_groups;
+    size_t groups_capacity;
+    size_t *slots;  // Open addressing table of group index + 1, 0 marks an empty slot
+    size_t slots_capacity;
+} group_table_t;
+
+// Records of hash, key length, key and states, appended by any worker under the lock
+typedef struct {
+    pthread_mutex_t lock;
+    int fd;  // -1 until the partition's first spill
+    uint64_t length;
+} group_spill_t;
+
+typedef struct {
+    group_table_t tables[GROUP_RADIX_PARTITIONS];  // Picked by the top bits of the hash
+    uint8_t *key_buffer;
+    size_t key_capacity;
+    uint8_t *spill_buffer;
+    size_t bytes;  // Held by the groups, checked against the worker's share of the budget
+    GroupOpStatus status;
+} group_partial_t;
+
+typedef struct {
+    const group_by_t *group_by;
+    threadpool_t *pool;
+    group_partial_t *partials;  // One per worker, the last one for the calling thread
+    size_t num_partials;
+    size_t partial_budget;
+    group_spill_t spills[GROUP_RADIX_PARTITIONS];
+    char *spill_path;
+    size_t spill_path_length;  // Without the partition number
+} group_scan_t;
+
+typedef struct {
+    group_scan_t *scan;
+    size_t partition;
+    GroupOpStatus status;
+} merge_task_t;
+
+void free_group_by(group_by_t *group_by) {
+    free(group_by->key_cols);
+    free(group_by->aggs);
+    group_by->key_cols = NULL;
+    group_by->aggs = NULL;
+    group_by->num_keys = 0;
+    group_by->num_aggs = 0;
+}
+
+static GroupOpStatus parse_aggregate(header_t header, const char *agg_in, size_t length, aggregate_t *agg_out) {
+    const char *paren = (const char *) memchr(agg_in, '(', length);
+    size_t name_length = paren != NULL ? (size_t) (paren - agg_in) : length;
+    const char *column = NULL;
+    size_t column_length = 0;
+    if (paren != NULL) {
+        if (agg_in[length - 1] != ')') {
+            return GROUP_OP_ERROR_INVALID_ARG;
+        }
+        column = paren + 1;
+        column_length = &agg_in[length - 1] - column;
+    }
+
+    static const char *names[] = {"count", "sum", "min", "max", "avg"};
+    static const agg_fn_t fns[] = {AGG_COUNT, AGG_SUM, AGG_MIN, AGG_MAX, AGG_AVG};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strlen(names[i]) != name_length || memcmp(names[i], agg_in, name_length) != 0) {
+            continue;
+        }
+
+        agg_out->fn = fns[i];
+        if (fns[i] == AGG_COUNT) {
+            // count, count() and count(*) all count the rows
+            if (column_length > 1 || (column_length == 1 && *column != '*')) {
+                return GROUP_OP_ERROR_INVALID_ARG;
+            }
+            agg_out->col_index = 0;
+            agg_out->data_type = CELL_TYPE_INT;
+            return GROUP_OP_SUCCESS;
+        }
+
+        if (column_length == 0) {
+            return GROUP_OP_ERROR_INVALID_ARG;
+        }
+        if (!find_column(header, column, column_length, &agg_out->col_index)) {
+            return GROUP_OP_ERROR_UNKNOWN_COLUMN;
+        }
+        agg_out->data_type = header.columns[agg_out->col_index].data_type;
+        return agg_out->data_type == CELL_TYPE_STRING ? GROUP_OP_ERROR_TYPE_MISMATCH : GROUP_OP_SUCCESS;
+    }
+    return GROUP_OP_ERROR_INVALID_ARG;
+}
+
+GroupOpStatus parse_aggregates(header_t header, const char *aggs_in, aggregate_t **aggs_out, size_t *num_aggs_out) {
+    if (aggs_in == NULL || aggs_out == NULL || num_aggs_out == NULL) {
+        return GROUP_OP_ERROR_INVALID_ARG;
+    }
+
+    size_t capacity = 1;
+    for (const char *ch = aggs_in; *ch != '\0'; ch++) {
+        capacity += *ch == ',';
+    }
+    if (capacity > GROUP_MAX_AGGREGATES) {
+        return GROUP_OP_ERROR_INVALID_ARG;
+    }
+    aggregate_t *aggs = (aggregate_t *) malloc(capacity * sizeof(aggregate_t));
+    if (aggs == NULL) {
+        return GROUP_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    size_t num_aggs = 0;
+    const char *agg = aggs_in;
+    for (;;) {
+        const char *end = strchr(agg, ',');
+        size_t length = end != NULL ? (size_t) (end - agg) : strlen(agg);
+        GroupOpStatus status = length > 0 ? parse_aggregate(header, agg, length, &aggs[num_aggs])
+                                          : GROUP_OP_ERROR_INVALID_ARG;
+        if (status != GROUP_OP_SUCCESS) {
+            free(aggs);
+            return status;
+        }
+        num_aggs++;
+        if (end == NULL) {
+            break;
+        }
+        agg = end + 1;
+    }
+
+    *aggs_out = aggs;
+    *num_aggs_out = num_aggs;
+    return GROUP_OP_SUCCESS;
+}
+
+GroupOpStatus parse_group_by(header_t header, const char *keys_in, const char *aggs_in, group_by_t *group_by_out) {
+    if (keys_in == NULL || group_by_out == NULL) {
+        return GROUP_OP_ERROR_INVALID_ARG;
+    }
+    if (aggs_in == NULL) {
+        aggs_in = "count";
+    }
+
+    projection_t keys;
+    ProjectionOpStatus pop_status = parse_projection(header, keys_in, NULL, &keys);
+    if (pop_status != PROJECTION_OP_SUCCESS) {
+        return pop_status == PROJECTION_OP_ERROR_UNKNOWN_COLUMN ? GROUP_OP_ERROR_UNKNOWN_COLUMN
+             : pop_status == PROJECTION_OP_ERROR_MEMORY_ALLOCATION ? GROUP_OP_ERROR_MEMORY_ALLOCATION
+             : GROUP_OP_ERROR_INVALID_ARG;
+    }
+    if (keys.num_cols > GROUP_MAX_KEYS) {
+        free_projection(&keys);
+        return GROUP_OP_ERROR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < keys.num_cols; i++) {
+        uint8_t data_type = header.columns[keys.columns[i]].data_type;
+        if (data_type == CELL_TYPE_FLOAT || data_type == CELL_TYPE_DOUBLE) {
+            free_projection(&keys);
+            return GROUP_OP_ERROR_TYPE_MISMATCH;
+        }
+    }
+
+    group_by_t group_by = {.num_keys = keys.num_cols, .key_cols = keys.columns, .num_aggs = 0, .aggs = NULL};
+    keys.columns = NULL;
+    free_projection(&keys);
+
+    GroupOpStatus status = parse_aggregates(header, aggs_in, &group_by.aggs, &group_by.num_aggs);
+    if (status != GROUP_OP_SUCCESS) {
+        free_group_by(&group_by);
+        return status;
+    }
+
+    *group_by_out = group_by;
+    return GROUP_OP_SUCCESS;
+}
+
+static GroupOpStatus grow_slots(group_table_t *table) {
+    size_t capacity = table->slots_capacity == 0 ? 16 : table->slots_capacity * 2;
+    size_t *slots = (size_t *) calloc(capacity, sizeof(size_t));
+    if (slots == NULL) {
+        return GROUP_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < table->num_groups; i++) {
+        size_t slot = table->groups[i].hash & mask;
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = i + 1;
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->slots_capacity = capacity;
+    return GROUP_OP_SUCCESS;
+}
+
+// Kept at most half full. added_bytes_out is what a new group costs, 0 when it already existed.
+static GroupOpStatus find_or_add_group(group_table_t *table, size_t num_aggs, uint64_t hash, const uint8_t *key,
+                                       size_t key_length, agg_state_t **states_out, size_t *added_bytes_out) {
+    if ((table->num_groups + 1) * 2 > table->slots_capacity && grow_slots(table) != GROUP_OP_SUCCESS) {
+        return GROUP_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    size_t mask = table->slots_capacity - 1;
+    size_t slot = hash & mask;
+    while (table->slots[slot] != 0) {
+        size_t index = table->slots[slot] - 1;
+        const group_entry_t *group = &table->groups[index];
+        if (group->hash == hash && group->key_length == key_length
+            && memcmp(&table->keys[group->key_offset], key, key_length) == 0) {
+            *states_out = &table->states[index * num_aggs];
+            *added_bytes_out = 0;
+            return GROUP_OP_SUCCESS;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if (table->keys_length + key_length > table->keys_capacity) {
+        size_t capacity = table->keys_capacity == 0 ? 4096 : table->keys_capacity * 2;
+        while (capacity < table->keys_length + key_length) {
+            capacity *= 2;
+        }
+        uint8_t *keys = (uint8_t *) realloc(table->keys, capacity);
+        if (keys == NULL) {
+            return GROUP_OP_ERROR_MEMORY_ALLOCATION;
+        }
+        table->keys = keys;
+        table->keys_capacity = capacity;
+    }
+    if (table->num_groups == table->groups_capacity) {
+        size_t capacity = table->groups_capacity == 0 ? 64 : table->groups_capacity * 2;
+        group_entry_t *groups = (group_entry_t *) realloc(table->groups, capacity * sizeof(group_entry_t));
+        if (groups == NULL) {
+            return GROUP_OP_ERROR_MEMORY_ALLOCATION;
+        }
+        table->groups = groups;
+        agg_state_t *states = (agg_state_t *) realloc(table->states, capacity * num_aggs * sizeof(agg_state_t));
+        if (states == NULL) {
+            return GROUP_OP_ERROR_MEMORY_ALLOCATION;
+        }
+        table->states = states;
+        table->groups_capacity = capacity;
+    }
+
+    size_t index = table->num_groups++;
+    memcpy(&table->keys[table->keys_length], key, key_length);
+    table->groups[index] = (group_entry_t) {.hash = hash, .key_offset = table->keys_length, .key_length = key_length};
+    table->keys_length += key_length;
+    memset(&table->states[index * num_aggs], 0, num_aggs * sizeof(agg_state_t));
+    table->slots[slot] = index + 1;
+
+    *states_out = &table->states[index * num_aggs];
+    *added_bytes_out = key_length + sizeof(group_entry_t) + num_aggs * sizeof(agg_state_t) + 2 * sizeof(size_t);
+    return GROUP_OP_SUCCESS;
+}
+
+static void reset_group_table(group_table_t *table) {
+    table->keys_length = 0;
+    table->num_groups = 0;
+    if (table->slots != NULL) {
+        memset(table->slots, 0, table->slots_capacity * sizeof(size_t));
+    }
+}
+
+static void free_group_table(group_table_t *table) {
+    free(table->keys);
+    free(table->groups);
+    free(table->states);
+    free(table->slots);
+    memset(table, 0, sizeof(group_table_t));
+}
+
+// Ints and int64s fold into the int states, floats and doubles into the float ones
+static int is_integer_type(uint8_t data_type) {
+    return data_type == CELL_TYPE_INT || data_type == CELL_TYPE_INT64;
+}
+
+void fold_aggregates(const aggregate_t *aggs, size_t num_aggs, agg_state_t *states, row_t row) {
+    for (size_t i = 0; i < num_aggs; i++) {
+        const aggregate_t *agg = &aggs[i];
+        agg_state_t *state = &states[i];
+        if (agg->fn == AGG_COUNT) {
+            state->count++;
+            continue;
+        }
+
+        const cell_value_t *cell = &row.cells[agg->col_index].data;
+        if (is_integer_type(agg->data_type)) {
+            int64_t value = agg->data_type == CELL_TYPE_INT ? cell->int_value : cell->int64_value;
+            if (agg->fn == AGG_SUM || agg->fn == AGG_AVG) {
+                state->int_value += value;
+            } else if (state->count == 0 || (agg->fn == AGG_MIN ? value < state->int_value : value > state->int_value)) {
+                state->int_value = value;
+            }
+        } else {
+            double value = agg->data_type == CELL_TYPE_FLOAT ? cell->float_value : cell->double_value;
+            if (agg->fn == AGG_SUM || agg->fn == AGG_AVG) {
+                state->float_value += value;
+            } else if (state->count == 0 || (agg->fn == AGG_MIN ? value < state->float_value
+                                                                 : value > state->float_value)) {
+                state->float_value = value;
+            }
+        }
+        state->count++;
+    }
+}
+
+static void merge_states(const group_by_t *group_by, agg_state_t *states, const agg_state_t *other) {
+    for (size_t i = 0; i < group_by->num_aggs; i++) {
+        agg_fn_t fn = group_by->aggs[i].fn;
+        agg_state_t *state = &states[i];
+        if (other[i].count == 0) {
+            continue;
+        }
+        if (fn == AGG_MIN || fn == AGG_MAX) {
+            int takes_other = state->count == 0;
+            if (!takes_other && is_integer_type(group_by->aggs[i].data_type)) {
+                takes_other = fn == AGG_MIN ? other[i].int_value < state->int_value : other[i].int_value > state->int_value;
+            } else if (!takes_other) {
+                takes_other = fn == AGG_MIN ? other[i].float_value < state->float_value
+                                            : other[i].float_value > state->float_value;
+            }
+            if (takes_other) {
+                state->int_value = other[i].int_value;
+                state->float_value = other[i].float_value;
+            }
+        } else {
+            state->int_value += other[i].int_value;
+            state->float_value += other[i].float_value;
+        }
+        state->count += other[i].count;
+    }
+}
+
+// Copies through the buffer, flushing it to the end of the spill file whenever it fills up
+static GroupOpStatus spill_append(group_spill_t *spill, uint8_t *buffer, size_t *buffered_io, const void *data,
+                                  size_t length) {
+    const uint8_t *bytes = (const uint8_t *) data;
+    while (length > 0) {
+        size_t chunk = GROUP_SPILL_BUFFER - *buffered_io < length ? GROUP_SPILL_BUFFER - *buffered_io : length;
+        memcpy(&buffer[*buffered_io], bytes, chunk);
+        *buffered_io += chunk;
+        bytes += chunk;
+        length -= chunk;
+        if (*buffered_io == GROUP_SPILL_BUFFER) {
+            if (pwrite_full(spill->fd, buffer, *buffered_io, spill->length) == -1) {
+                return GROUP_OP_WRITE_ERROR;
+            }
+            spill->length += *buffered_io;
+            *buffered_io = 0;
+        }
+    }
+    return GROUP_OP_SUCCESS;
+}
+
+static GroupOpStatus spill_table(group_scan_t *scan, group_partial_t *partial, size_t partition) {
+    group_table_t *table = &partial->tables[partition];
+    group_spill_t *spill = &scan->spills[partition];
+    size_t num_aggs = scan->group_by->num_aggs;
+    GroupOpStatus status = GROUP_OP_SUCCESS;
+
+    pthread_mutex_lock(&spill->lock);
+    if (spill->fd == -1) {
+        // The files are unlinked as soon as they're created, they never outlive the query
+        snprintf(&scan->spill_path[scan->spill_path_length], 8, "%zu", partition);
+        spill->fd = open(scan->spill_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (spill->fd == -1) {
+            pthread_mutex_unlock(&spill->lock);
+            return GROUP_OP_WRITE_ERROR;
+        }
+        unlink(scan->spill_path);
+    }
+
+    size_t buffered = 0;
+    for (size_t i = 0; i < table->num_groups && status == GROUP_OP_SUCCESS; i++) {
+        const group_entry_t *group = &table->groups[i];
+        uint32_t key_length = (uint32_t) group->key_length;
+        status = spill_append(spill, partial->spill_buffer, &buffered, &group->hash, sizeof(uint64_t));
+        if (status == GROUP_OP_SUCCESS) {
+            status = spill_append(spill, partial->spill_buffer, &buffered, &key_length, sizeof(uint32_t));
+        }
+        if (status == GROUP_OP_SUCCESS) {
+            status = spill_append(spill, partial->spill_buffer, &buffered, &table->keys[group->key_offset],
+                                  group->key_length);
+        }
+        if (status == GROUP_OP_SUCCESS) {
+            status = spill_append(spill, partial->spill_buffer, &buffered, &table->states[i * num_aggs],
+                                  num_aggs * sizeof(agg_state_t));
+        }
+    }
+    if (status == GROUP_OP_SUCCESS && buffered > 0) {
+        if (pwrite_full(spill->fd, partial->spill_buffer, buffered, spill->length) == -1) {
+            status = GROUP_OP_WRITE_ERROR;
+        } else {
+            spill->length += buffered;
+        }
+    }
+    pthread_mutex_unlock(&spill->lock);
+
+    reset_group_table(table);
+    return status;
+}
+
+static GroupOpStatus spill_partial(group_scan_t *scan, group_partial_t *partial) {
+    if (partial->spill_buffer == NULL) {
+        partial->spill_buffer = (uint8_t *) malloc(GROUP_SPILL_BUFFER);
+        if (partial->spill_buffer == NULL) {
+            return GROUP_OP_ERROR_MEMORY_ALLOCATION;
+        }
+    }
+    for (size_t p = 0; p < GROUP_RADIX_PARTITIONS; p++) {
+        if (partial->tables[p].num_groups == 0) {
+            continue;
+        }
+        GroupOpStatus status = spill_table(scan, partial, p);
+        if (status != GROUP_OP_SUCCESS) {
+            return status;
+        }
+    }
+    partial->bytes = 0;
+    return GROUP_OP_SUCCESS;
+}
+
+static size_t encode_key(const group_by_t *group_by, row_t row, uint8_t *buffer) {
+    size_t pos = 0;
+    for (size_t i = 0; i < group_by->num_keys; i++) {
+        const cell_t *cell = &row.cells[group_by->key_cols[i]];
+        buffer[pos++] = (uint8_t) cell->type;
+        if (cell->type == CELL_TYPE_STRING) {
+            uint32_t length = cell->data.string_cell.length;
+            memcpy(&buffer[pos], &length, sizeof(uint32_t));
+            pos += sizeof(uint32_t);
+            memcpy(&buffer[pos], STRING_CELL_DATA(&cell->data.string_cell), length);
+            pos += length;
+            buffer[pos++] = '\0';
+        } else if (cell->type == CELL_TYPE_INT64) {
+            memcpy(&buffer[pos], &cell->data.int64_value, sizeof(int64_t));
+            pos += sizeof(int64_t);
+        } else {
+            memcpy(&buffer[pos], &cell->data.int_value, sizeof(int32_t));
+            pos += sizeof(int32_t);
+        }
+    }
+    return pos;
+}
+
+static int group_row(row_t row, size_t row_index, uint64_t offset, void *ctx) {
+    group_scan_t *scan = (group_scan_t *) ctx;
+    const group_by_t *group_by = scan->group_by;
+
+    // Every worker has its own tables, nothing is shared until the merge
+    size_t worker;
+    group_partial_t *partial = &scan->partials[threadpool_worker_index(scan->pool, &worker) ? worker
+                                                                                             : scan->num_partials - 1];
+
+    size_t key_size = 0;
+    for (size_t i = 0; i < group_by->num_keys; i++) {
+        const cell_t *cell = &row.cells[group_by->key_cols[i]];
+        key_size += cell->type == CELL_TYPE_STRING ? 1 + sizeof(uint32_t) + cell->data.string_cell.length + 1
+                                                   : fixed_cell_size(cell->type);
+    }
+    if (key_size > partial->key_capacity) {
+        uint8_t *key_buffer = (uint8_t *) realloc(partial->key_buffer, key_size);
+        if (key_buffer == NULL) {
+            partial->status = GROUP_OP_ERROR_MEMORY_ALLOCATION;
+            return 1;
+        }
+        partial->key_buffer = key_buffer;
+        partial->key_capacity = key_size;
+    }
+
+    size_t key_length = encode_key(group_by, row, partial->key_buffer);
+    uint64_t hash = hash_bytes(partial->key_buffer, key_length);
+    agg_state_t *states;
+    size_t added_bytes;
+    partial->status = find_or_add_group(&partial->tables[hash >> GROUP_RADIX_SHIFT], group_by->num_aggs, hash,
+                                        partial->key_buffer, key_length, &states, &added_bytes);
+    if (partial->status != GROUP_OP_SUCCESS) {
+        return 1;
+    }
+    fold_aggregates(group_by->aggs, group_by->num_aggs, states, row);
+
+    partial->bytes += added_bytes;
+    if (partial->bytes > scan->partial_budget) {
+        partial->status = spill_partial(scan, partial);
+        if (partial->status != GROUP_OP_SUCCESS) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static GroupOpStatus merge_spill(const group_by_t *group_by, const group_spill_t *spill, group_table_t *target) {
+    if (spill->fd == -1) {
+        return GROUP_OP_SUCCESS;
+    }
+
+    size_t states_size = group_by->num_aggs * sizeof(agg_state_t);
+    size_t capacity = GROUP_SPILL_BUFFER * 16;
+    uint8_t *buffer = (uint8_t *) malloc(capacity);
+    agg_state_t *states_copy = (agg_state_t *) malloc(states_size);
+    if (buffer == NULL || states_copy == NULL) {
+        free(buffer);
+        free(states_copy);
+        return GROUP_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    GroupOpStatus status = GROUP_OP_SUCCESS;
+    uint64_t offset = 0;
+    size_t length = 0;
+    size_t pos = 0;
+    for (;;) {
+        // Whole records are merged, a record cut by the end of the buffer waits for the next read
+        size_t needed = GROUP_RECORD_HEADER;
+        while (length - pos >= GROUP_RECORD_HEADER) {
+            uint64_t hash;
+            uint32_t key_length;
+            memcpy(&hash, &buffer[pos], sizeof(uint64_t));
+            memcpy(&key_length, &buffer[pos + sizeof(uint64_t)], sizeof(uint32_t));
+            needed = GROUP_RECORD_HEADER + key_length + states_size;
+            if (length - pos < needed) {
+                break;
+            }
+
+            agg_state_t *states;
+            size_t added_bytes;
+            status = find_or_add_group(target, group_by->num_aggs, hash, &buffer[pos + GROUP_RECORD_HEADER],
+                                       key_length, &states, &added_bytes);
+            if (status != GROUP_OP_SUCCESS) {
+                break;
+            }
+            memcpy(states_copy, &buffer[pos + GROUP_RECORD_HEADER + key_length], states_size);
+            merge_states(group_by, states, states_copy);
+            pos += needed;
+            needed = GROUP_RECORD_HEADER;
+        }
+        if (status != GROUP_OP_SUCCESS) {
+            break;
+        }
+        if (offset == spill->length) {
+            if (pos != length) {
+                status = GROUP_OP_READ_ERROR;
+            }
+            break;
+        }
+
+        memmove(buffer, &buffer[pos], length - pos);
+        length -= pos;
+        pos = 0;
+        if (needed > capacity) {
+            uint8_t *grown = (uint8_t *) realloc(buffer, needed);
+            if (grown == NULL) {
+                status = GROUP_OP_ERROR_MEMORY_ALLOCATION;
+                break;
+            }
+            buffer = grown;
+            capacity = needed;
+        }
+        size_t chunk = capacity - length < spill->length - offset ? capacity - length : spill->length - offset;
+        if (pread_full(spill->fd, &buffer[length], chunk, offset) != (ssize_t) chunk) {
+            status = GROUP_OP_READ_ERROR;
+            break;
+        }
+        offset += chunk;
+        length += chunk;
+    }
+
+    free(buffer);
+    free(states_copy);
+    return status;
+}
+
+// Partitions hold disjoint keys, so each one is merged on its own: into the first worker's
+// table, from the other workers' tables and the partition's spill file
+static void merge_partition(void *arg) {
+    merge_task_t *task = (merge_task_t *) arg;
+    group_scan_t *scan = task->scan;
+    const group_by_t *group_by = scan->group_by;
+    group_table_t *target = &scan->partials[0].tables[task->partition];
+
+    for (size_t w = 1; w < scan->num_partials && task->status == GROUP_OP_SUCCESS; w++) {
+        group_table_t *source = &scan->partials[w].tables[task->partition];
+        for (size_t i = 0; i < source->num_groups; i++) {
+            const group_entry_t *group = &source->groups[i];
+            agg_state_t *states;
+            size_t added_bytes;
+            task->status = find_or_add_group(target, group_by->num_aggs, group->hash, &source->keys[group->key_offset],
+                                             group->key_length, &states, &added_bytes);
+            if (task->status != GROUP_OP_SUCCESS) {
+                break;
+            }
+            merge_states(group_by, states, &source->states[i * group_by->num_aggs]);
+        }
+        free_group_table(source);
+    }
+
+    if (task->status == GROUP_OP_SUCCESS) {
+        task->status = merge_spill(group_by, &scan->spills[task->partition], target);
+    }
+}
+
+void aggregate_results(const aggregate_t *aggs, size_t num_aggs, const agg_state_t *states, agg_result_t *results_out) {
+    for (size_t i = 0; i < num_aggs; i++) {
+        const aggregate_t *agg = &aggs[i];
+        agg_result_t *result = &results_out[i];
+        if (agg->fn == AGG_COUNT) {
+            *result = (agg_result_t) {.is_float = 0, .int_value = states[i].count};
+        } else if (agg->fn == AGG_AVG) {
+            double sum = is_integer_type(agg->data_type) ? (double) states[i].int_value : states[i].float_value;
+            *result = (agg_result_t) {.is_float = 1, .float_value = states[i].count > 0 ? sum / states[i].count : 0};
+        } else if (is_integer_type(agg->data_type)) {
+            *result = (agg_result_t) {.is_float = 0, .int_value = states[i].int_value};
+        } else {
+            *result = (agg_result_t) {.is_float = 1, .float_value = states[i].float_value};
+        }
+    }
+}
+
+static void decode_key(const group_by_t *group_by, const uint8_t *key, cell_t *cells_out) {
+    size_t pos = 0;
+    for (size_t i = 0; i < group_by->num_keys; i++) {
+        cell_t *cell = &cells_out[i];
+        cell->type = (cell_type_t) key[pos++];
+        if (cell->type == CELL_TYPE_STRING) {
+            uint32_t length;
+            memcpy(&length, &key[pos], sizeof(uint32_t));
+            pos += sizeof(uint32_t);
+            // Long strings point into the key rather than being copied, the cells are never freed
+            cell->data.string_cell.length = length;
+            if (length <= STRING_INLINE_CAPACITY) {
+                memcpy(cell->data.string_cell.inlined.string, &key[pos], length + 1);
+            } else {
+                cell->data.string_cell.heap.string = (char *) &key[pos];
+            }
+            pos += length + 1;
+        } else if (cell->type == CELL_TYPE_INT64) {
+            memcpy(&cell->data.int64_value, &key[pos], sizeof(int64_t));
+            pos += sizeof(int64_t);
+        } else {
+            memcpy(&cell->data.int_value, &key[pos], sizeof(int32_t));
+            pos += sizeof(int32_t);
+        }
+    }
+}
+
+static size_t emit_groups(group_scan_t *scan, group_callback_t callback, void *ctx) {
+    const group_by_t *group_by = scan->group_by;
+    cell_t cells[GROUP_MAX_KEYS];
+    agg_result_t results[GROUP_MAX_AGGREGATES];
+    row_t keys = {.num_cells = group_by->num_keys, .cells = cells};
+
+    size_t num_groups = 0;
+    for (size_t p = 0; p < GROUP_RADIX_PARTITIONS; p++) {
+        const group_table_t *table = &scan->partials[0].tables[p];
+        for (size_t i = 0; i < table->num_groups; i++) {
+            decode_key(group_by, &table->keys[table->groups[i].key_offset], cells);
+            aggregate_results(group_by->aggs, group_by->num_aggs, &table->states[i * group_by->num_aggs], results);
+            num_groups++;
+            if (callback(keys, results, ctx)) {
+                return num_groups;
+            }
+        }
+    }
+    return num_groups;
+}
+
+GroupOpStatus group_rows(const char *filepath, int fd, header_t header, const tombstone_t *tombstones,
+                         const predicate_t *predicate, const group_by_t *group_by, size_t memory_budget,
+                         threadpool_t *pool, group_callback_t callback, void *ctx, size_t *num_groups_out) {
+    if (filepath == NULL || fd < 0 || group_by == NULL || group_by->num_keys == 0 || group_by->num_keys > GROUP_MAX_KEYS
+        || group_by->num_aggs == 0 || group_by->num_aggs > GROUP_MAX_AGGREGATES || callback == NULL
+        || num_groups_out == NULL) {
+        return GROUP_OP_ERROR_INVALID_ARG;
+    }
+    if (memory_budget == 0) {
+        memory_budget = GROUP_DEFAULT_MEMORY;
+    }
+
+    // Only the keys, the aggregated columns and the predicate's column are decoded
+    uint8_t *decoded = (uint8_t *) calloc(header.num_cols, sizeof(uint8_t));
+    size_t num_partials = (pool != NULL ? pool->num_threads : 0) + 1;
+    group_scan_t scan = {
+        .group_by = group_by,
+        .pool = pool,
+        .partials = (group_partial_t *) calloc(num_partials, sizeof(group_partial_t)),
+        .num_partials = num_partials,
+        .partial_budget = memory_budget / num_partials,
+        .spill_path_length = strlen(filepath) + strlen(GROUP_SUFFIX)
+    };
+    scan.spill_path = (char *) malloc(scan.spill_path_length + 8);
+    if (decoded == NULL || scan.partials == NULL || scan.spill_path == NULL) {
+        free(decoded);
+        free(scan.partials);
+        free(scan.spill_path);
+        return GROUP_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    snprintf(scan.spill_path, scan.spill_path_length + 1, "%s%s", filepath, GROUP_SUFFIX);
+    for (size_t p = 0; p < GROUP_RADIX_PARTITIONS; p++) {
+        pthread_mutex_init(&scan.spills[p].lock, NULL);
+        scan.spills[p].fd = -1;
+        scan.spills[p].length = 0;
+    }
+    for (size_t i = 0; i < group_by->num_keys; i++) {
+        decoded[group_by->key_cols[i]] = 1;
+    }
+    for (size_t i = 0; i < group_by->num_aggs; i++) {
+        if (group_by->aggs[i].fn != AGG_COUNT) {
+            decoded[group_by->aggs[i].col_index] = 1;
+        }
+    }
+    if (predicate != NULL) {
+        decoded[predicate->col_index] = 1;
+    }
+    projection_t projection = {.num_cols = group_by->num_keys, .columns = group_by->key_cols, .decoded = decoded};
+
+    GroupOpStatus status = GROUP_OP_SUCCESS;
+    ScanOpStatus scan_status = scan_rows_parallel(fd, header, tombstones, predicate, &projection, group_row, &scan,
+                                                  pool);
+    for (size_t i = 0; i < num_partials; i++) {
+        if (scan.partials[i].status != GROUP_OP_SUCCESS) {
+            status = scan.partials[i].status;
+        }
+    }
+    if (status == GROUP_OP_SUCCESS && scan_status != SCAN_OP_SUCCESS) {
+        status = scan_status == SCAN_OP_ERROR_MEMORY_ALLOCATION ? GROUP_OP_ERROR_MEMORY_ALLOCATION : GROUP_OP_READ_ERROR;
+    }
+
+    if (status == GROUP_OP_SUCCESS) {
+        merge_task_t tasks[GROUP_RADIX_PARTITIONS];
+        for (size_t p = 0; p < GROUP_RADIX_PARTITIONS; p++) {
+            tasks[p] = (merge_task_t) {.scan = &scan, .partition = p, .status = GROUP_OP_SUCCESS};
+            if (pool == NULL || threadpool_submit(pool, merge_partition, &tasks[p]) != THREADPOOL_OP_SUCCESS) {
+                merge_partition(&tasks[p]);
+            }
+        }
+        if (pool != NULL) {
+            threadpool_wait(pool);
+        }
+        for (size_t p = 0; p < GROUP_RADIX_PARTITIONS; p++) {
+            if (tasks[p].status != GROUP_OP_SUCCESS) {
+                status = tasks[p].status;
+            }
+        }
+    }
+
+    size_t num_groups = 0;
+    if (status == GROUP_OP_SUCCESS) {
+        num_groups = emit_groups(&scan, callback, ctx);
+    }
+
+    for (size_t i = 0; i < num_partials; i++) {
+        for (size_t p = 0; p < GROUP_RADIX_PARTITIONS; p++) {
+            free_group_table(&scan.partials[i].tables[p]);
+        }
+        free(scan.partials[i].key_buffer);
+        free(scan.partials[i].spill_buffer);
+    }
+    for (size_t p = 0; p < GROUP_RADIX_PARTITIONS; p++) {
+        if (scan.spills[p].fd != -1) {
+            close(scan.spills[p].fd);
+        }
+        pthread_mutex_destroy(&scan.spills[p].lock);
+    }
+    free(scan.partials);
+    free(scan.spill_path);
+    free(decoded);
+
+    if (status == GROUP_OP_SUCCESS) {
+        *num_groups_out = num_groups;
+    }
+    return status;
+}
@@ -2,22 +2,46 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <endian.h>
 #include <arpa/inet.h>
 
 #include "header.h"
+#include "codec.h"
+#include "stats.h"
 
 
 void print_header(header_t header) {
     printf("Magic: %s\n", header.magic);
     printf("Version: %u\n", header.version);
+    printf("Generation: %lu\n", (unsigned long) header.generation);
     printf("Number of rows: %zu\n", header.num_rows);
     printf("Number of columns: %zu\n", header.num_cols);
+    printf("Data end: %lu\n", (unsigned long) header.data_end);
 
     print_parsed_schema(header.columns, header.num_cols);
 }
 
+void free_header(header_t *header) {
+    if (header->names != NULL) {
+        // Loaded headers: every name points into the names buffer
+        free(header->columns);
+        free(header->names);
+    } else if (header->columns != NULL) {
+        free_columns(header->columns, header->num_cols);
+    }
+    free(header->col_lookup);
+    free_codec(header->codec);
+    header->codec = NULL;
+    header->columns = NULL;
+    header->names = NULL;
+    header->col_lookup = NULL;
+    header->col_lookup_capacity = 0;
+}
+
 int validate_magic(uint8_t magic[3], ssize_t bytes_read) {
-    if (bytes_read != sizeof(uint8_t) * 3) {
+    if (bytes_read < (ssize_t) (sizeof(uint8_t) * 3)) {
         return 0;
     }
 
@@ -29,17 +53,104 @@ int validate_magic(uint8_t magic[3], ssize_t bytes_read) {
 }
 
 int validate_version(uint8_t version, ssize_t bytes_read) {
-    if (bytes_read != sizeof(uint8_t)) {
+    if (bytes_read < (ssize_t) sizeof(uint8_t)) {
         return 0;
     }
 
-    if (version != VERSION) {
+    if (version == 0 || version > VERSION) {
         return 0;
     }
 
     return 1;
 }
 
+static size_t fixed_size(uint8_t version) {
+    return version == 1 ? HEADER_V1_FIXED_SIZE : version == 2 ? HEADER_V2_FIXED_SIZE : HEADER_FIXED_SIZE;
+}
+
+size_t header_size(header_t header) {
+    if (header.data_offset != 0) {
+        return header.data_offset;
+    }
+
+    size_t size = HEADER_FIXED_SIZE;
+    for (size_t i = 0; i < header.num_cols; i++) {
+        size += sizeof(uint16_t) + header.columns[i].name_length + sizeof(uint8_t);
+    }
+    return size;
+}
+
+// Headers copied from a loaded table into a new file are written with the current fixed fields
+void set_current_layout(header_t *header) {
+    header->version = VERSION;
+    header->data_offset = 0;
+    header->data_offset = header_size(*header);
+}
+
+static uint32_t hash_name(const char *name, size_t name_length) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < name_length; i++) {
+        hash ^= (uint8_t) name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+HeaderOpStatus build_column_lookup(header_t *header) {
+    if (header == NULL || header->columns == NULL) {
+        return HEADER_OP_ERROR_INVALID_ARG;
+    }
+
+    // Power of two capacity, kept at most half full so probe sequences stay short
+    size_t capacity = 16;
+    while (capacity < header->num_cols * 2) {
+        capacity *= 2;
+    }
+
+    uint32_t *lookup = (uint32_t *) calloc(capacity, sizeof(uint32_t));
+    if (lookup == NULL) {
+        return HEADER_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    for (size_t i = 0; i < header->num_cols; i++) {
+        size_t slot = hash_name(header->columns[i].name, header->columns[i].name_length) & (capacity - 1);
+        while (lookup[slot] != 0) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        lookup[slot] = (uint32_t) (i + 1);
+    }
+
+    free(header->col_lookup);
+    header->col_lookup = lookup;
+    header->col_lookup_capacity = capacity;
+    return HEADER_OP_SUCCESS;
+}
+
+int find_column(header_t header, const char *name, size_t name_length, size_t *index_out) {
+    if (header.col_lookup == NULL) {
+        for (size_t i = 0; i < header.num_cols; i++) {
+            if (header.columns[i].name_length == name_length && memcmp(header.columns[i].name, name, name_length) == 0) {
+                *index_out = i;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    size_t mask = header.col_lookup_capacity - 1;
+    size_t slot = hash_name(name, name_length) & mask;
+    while (header.col_lookup[slot] != 0) {
+        size_t i = header.col_lookup[slot] - 1;
+        if (header.columns[i].name_length == name_length && memcmp(header.columns[i].name, name, name_length) == 0) {
+            *index_out = i;
+            return 1;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return 0;
+}
+
 HeaderOpStatus initialize_header(column_t *columns, size_t num_cols, header_t *header_out) {
     if (columns == NULL || num_cols == 0) {
         return HEADER_OP_INVALID_COLUMNS;
@@ -47,11 +158,20 @@ HeaderOpStatus initialize_header(column_t *columns, size_t num_cols, header_t *h
 
     header_t header = {
         .magic = {0x72, 0x66, 0x6b},  // 'r', 'f', 'k'
-        .version = 1,
+        .version = VERSION,
+        .generation = 0,
         .num_rows = 0,
         .num_cols = num_cols,
-        .columns = columns
+        .data_end = 0,
+        .columns = columns,
+        .names = NULL,
+        .col_lookup = NULL,
+        .col_lookup_capacity = 0,
+        .data_offset = 0,
+        .codec = NULL
     };
+    header.data_offset = header_size(header);
+    header.data_end = header.data_offset;
     *header_out = header;
     return HEADER_OP_SUCCESS;
 }
@@ -72,10 +192,12 @@ HeaderOpStatus write_columns(int fd, column_t *columns, size_t num_cols) {
     for (size_t i = 0; i < num_cols; i++) {
         uint16_t name_length_nbo = htons(columns[i].name_length);
         bytes_written = write(fd, &name_length_nbo, sizeof(uint16_t));
+        STATS_SYSCALL(IO_HEADER, IO_WRITE, bytes_written);
         if (bytes_written != sizeof(uint16_t)) {
             return HEADER_WRITE_ERROR;
         }
         bytes_written = write(fd, columns[i].name, sizeof(char) * columns[i].name_length);
+        STATS_SYSCALL(IO_HEADER, IO_WRITE, bytes_written);
         if (bytes_written < 0) {
             return HEADER_WRITE_ERROR;
         }
@@ -83,6 +205,7 @@ HeaderOpStatus write_columns(int fd, column_t *columns, size_t num_cols) {
             return HEADER_WRITE_ERROR;
         }
         bytes_written = write(fd, &columns[i].data_type, sizeof(uint8_t));
+        STATS_SYSCALL(IO_HEADER, IO_WRITE, bytes_written);
         if (bytes_written != sizeof(uint8_t)) {
             return HEADER_WRITE_ERROR;
         }
@@ -91,50 +214,49 @@ HeaderOpStatus write_columns(int fd, column_t *columns, size_t num_cols) {
     return HEADER_OP_SUCCESS;
 }
 
-HeaderOpStatus read_columns(int fd, size_t num_cols, column_t **columns_out) {
-    if (num_cols == 0) {
-        return HEADER_OP_INVALID_COLUMNS;
-    }
+static HeaderOpStatus parse_columns(const uint8_t *buffer, size_t length, size_t offset, header_t *header) {
+    size_t num_cols = header->num_cols;
 
-    ssize_t bytes_read;
-    
-    column_t *columns = NULL; 
-    columns = (column_t *) calloc(num_cols, sizeof(column_t));
-    if (columns == NULL) {
+    // Names are at most length bytes in total, plus one null terminator each
+    column_t *columns = (column_t *) calloc(num_cols, sizeof(column_t));
+    char *names = (char *) malloc(length + num_cols);
+    if (columns == NULL || names == NULL) {
+        free(columns);
+        free(names);
         return HEADER_OP_ERROR_MEMORY_ALLOCATION;
     }
 
+    size_t pos = 0;
+    size_t names_pos = 0;
     for (size_t i = 0; i < num_cols; i++) {
-        bytes_read = read(fd, &columns[i].name_length, sizeof(uint16_t));
-        if (bytes_read != sizeof(uint16_t)) {
-            free_columns(columns, i);
-            return HEADER_OP_READ_COLUMNS;
-        }
-        columns[i].name_length = ntohs(columns[i].name_length);
-
-        columns[i].name = (char *) malloc(columns[i].name_length + 1);  // Pay attention to the null termination symbol here
-        if (columns[i].name == NULL) {
-            free_columns(columns, i);
-            return HEADER_OP_ERROR_MEMORY_ALLOCATION;
-        }
-        bytes_read = read(fd, columns[i].name, sizeof(char) * columns[i].name_length);
-        if (bytes_read < 0) {
-            free_columns(columns, i);
-            return HEADER_READ_ERROR;
-        }
-        if ((size_t)bytes_read != sizeof(char) * columns[i].name_length) {
-            free_columns(columns, i);
+        if (length - pos < sizeof(uint16_t)) {
+            free(columns);
+            free(names);
             return HEADER_OP_READ_COLUMNS;
         }
-
-        bytes_read = read(fd, &columns[i].data_type, sizeof(uint8_t));
-        if (bytes_read != sizeof(uint8_t)) {
-            free_columns(columns, i);
+        uint16_t name_length_nbo;
+        memcpy(&name_length_nbo, &buffer[pos], sizeof(uint16_t));
+        columns[i].name_length = ntohs(name_length_nbo);
+        pos += sizeof(uint16_t);
+
+        if (columns[i].name_length > MAX_COLUMN_NAME_LENGTH || length - pos < columns[i].name_length + sizeof(uint8_t)) {
+            free(columns);
+            free(names);
             return HEADER_OP_READ_COLUMNS;
         }
+        columns[i].name = &names[names_pos];
+        memcpy(columns[i].name, &buffer[pos], columns[i].name_length);
+        columns[i].name[columns[i].name_length] = '\0';  // Pay attention to the null termination symbol here
+        names_pos += columns[i].name_length + 1;
+        pos += columns[i].name_length;
+
+        columns[i].data_type = buffer[pos];
+        pos += sizeof(uint8_t);
     }
 
-    *columns_out = columns;
+    header->columns = columns;
+    header->names = names;
+    header->data_offset = offset + pos;
     return HEADER_OP_SUCCESS;
 }
 
@@ -150,67 +272,165 @@ HeaderOpStatus write_header(int fd, header_t header) {
     ssize_t bytes_written;
 
     bytes_written = write(fd, header.magic, sizeof(header.magic));
+    STATS_SYSCALL(IO_HEADER, IO_WRITE, bytes_written);
     if (bytes_written != sizeof(header.magic)) {
         return HEADER_WRITE_ERROR;
     }
 
     bytes_written = write(fd, &header.version, sizeof(header.version));
+    STATS_SYSCALL(IO_HEADER, IO_WRITE, bytes_written);
     if (bytes_written != sizeof(header.version)) {
         return HEADER_WRITE_ERROR;
     }
 
+    uint64_t generation_nbo = htobe64(header.generation);
+    bytes_written = write(fd, &generation_nbo, sizeof(uint64_t));
+    STATS_SYSCALL(IO_HEADER, IO_WRITE, bytes_written);
+    if (bytes_written != sizeof(uint64_t)) {
+        return HEADER_WRITE_ERROR;
+    }
+
     size_t num_rows_nbo = htonl(header.num_rows);
     bytes_written = write(fd, &num_rows_nbo, sizeof(header.num_rows));
+    STATS_SYSCALL(IO_HEADER, IO_WRITE, bytes_written);
     if (bytes_written != sizeof(header.num_rows)) {
         return HEADER_WRITE_ERROR;
     }
 
     size_t num_cols_nbo = htonl(header.num_cols);
     bytes_written = write(fd, &num_cols_nbo, sizeof(header.num_cols));
+    STATS_SYSCALL(IO_HEADER, IO_WRITE, bytes_written);
     if (bytes_written != sizeof(header.num_rows)) {
         return HEADER_WRITE_ERROR;
     }
 
+    uint64_t data_end_nbo = htobe64(header.data_end);
+    bytes_written = write(fd, &data_end_nbo, sizeof(uint64_t));
+    STATS_SYSCALL(IO_HEADER, IO_WRITE, bytes_written);
+    if (bytes_written != sizeof(uint64_t)) {
+        return HEADER_WRITE_ERROR;
+    }
+
     HeaderOpStatus write_cols_status;
     write_cols_status = write_columns(fd, header.columns, header.num_cols);
 
+    if (write_cols_status == HEADER_OP_SUCCESS) {
+        STATS_LOGICAL_WRITTEN(IO_HEADER, header_size(header));
+    }
     return write_cols_status;
 }
 
-HeaderOpStatus read_header(int fd, header_t *header_out) {
+static HeaderOpStatus read_header_fields(int fd, header_t *header_out) {
     if (fd < 0) {
         return HEADER_OP_ERROR_INVALID_FD;
     }
 
-    ssize_t bytes_read;
-    header_t header;
-    
-    bytes_read = read(fd, header.magic, sizeof(uint8_t) * 3);
-    if (!validate_magic(header.magic, bytes_read)) {
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    STATS_SYSCALL(IO_HEADER, IO_SEEK, 0);
+    if (start == (off_t)-1) {
         return HEADER_READ_ERROR;
     }
 
-    bytes_read = read(fd, &header.version, sizeof(uint8_t));
-    if (!validate_version(header.version, bytes_read)) {
+    // One read covers the fixed fields and, for most schemas, every column
+    size_t capacity = HEADER_READ_CHUNK;
+    uint8_t *buffer = (uint8_t *) malloc(capacity);
+    if (buffer == NULL) {
+        return HEADER_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    ssize_t bytes_read = read(fd, buffer, capacity);
+    STATS_SYSCALL(IO_HEADER, IO_READ, bytes_read);
+    if (bytes_read < HEADER_V1_FIXED_SIZE) {
+        free(buffer);
         return HEADER_READ_ERROR;
     }
+    size_t length = bytes_read;
 
-    bytes_read = read(fd, &header.num_rows, sizeof(size_t));
-    if (bytes_read != sizeof(size_t)) {
+    header_t header = {0};
+    memcpy(header.magic, buffer, sizeof(header.magic));
+    if (!validate_magic(header.magic, bytes_read)) {
+        free(buffer);
         return HEADER_READ_ERROR;
     }
-    header.num_rows = ntohl(header.num_rows);
 
-    bytes_read = read(fd, &header.num_cols, sizeof(size_t));
-    if (bytes_read != sizeof(size_t)) {
+    header.version = buffer[3];
+    size_t fixed = fixed_size(header.version);
+    if (!validate_version(header.version, bytes_read - 3) || (size_t) bytes_read < fixed) {
+        free(buffer);
         return HEADER_READ_ERROR;
     }
+
+    // num_rows and data_end are taken from a consistent snapshot below, the buffer may hold a torn update
+    size_t num_rows_offset = header.version == VERSION ? HEADER_NUM_ROWS_OFFSET : HEADER_LEGACY_NUM_ROWS_OFFSET;
+    memcpy(&header.num_cols, &buffer[num_rows_offset + sizeof(size_t)], sizeof(size_t));
     header.num_cols = ntohl(header.num_cols);
 
-    HeaderOpStatus read_cols_status;
-    read_cols_status = read_columns(fd, header.num_cols, &header.columns);
-    if (read_cols_status != HEADER_OP_SUCCESS) {
-        return read_cols_status;
+    if (header.num_cols == 0) {
+        free(buffer);
+        return HEADER_OP_INVALID_COLUMNS;
+    }
+
+    // Wide schemas: one more read, sized for the longest possible column metadata
+    size_t max_size = fixed + header.num_cols * (sizeof(uint16_t) + MAX_COLUMN_NAME_LENGTH + sizeof(uint8_t));
+    if (length == capacity && max_size > capacity) {
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) == -1) {
+            free(buffer);
+            return HEADER_READ_ERROR;
+        }
+        if ((off_t) max_size > file_stat.st_size - start) {
+            max_size = file_stat.st_size - start;
+        }
+    }
+    if (length == capacity && max_size > capacity) {
+        uint8_t *temp_buffer = (uint8_t *) realloc(buffer, max_size);
+        if (temp_buffer == NULL) {
+            free(buffer);
+            return HEADER_OP_ERROR_MEMORY_ALLOCATION;
+        }
+        buffer = temp_buffer;
+
+        bytes_read = read(fd, &buffer[length], max_size - length);
+        STATS_SYSCALL(IO_HEADER, IO_READ, bytes_read);
+        if (bytes_read < 0) {
+            free(buffer);
+            return HEADER_READ_ERROR;
+        }
+        length += bytes_read;
+    }
+
+    HeaderOpStatus parse_cols_status = parse_columns(&buffer[fixed], length - fixed, fixed, &header);
+    free(buffer);
+    if (parse_cols_status != HEADER_OP_SUCCESS) {
+        return parse_cols_status;
+    }
+
+    snapshot_t snapshot;
+    HeaderOpStatus snapshot_status = read_snapshot(fd, &snapshot);
+    if (snapshot_status != HEADER_OP_SUCCESS) {
+        free_header(&header);
+        return snapshot_status;
+    }
+    header.generation = snapshot.generation;
+    header.num_rows = snapshot.num_rows;
+    header.data_end = snapshot.data_end;
+
+    HeaderOpStatus lookup_status = build_column_lookup(&header);
+    if (lookup_status != HEADER_OP_SUCCESS) {
+        free_header(&header);
+        return lookup_status;
+    }
+
+    if (build_codec(header, &header.codec) != CODEC_OP_SUCCESS) {
+        free_header(&header);
+        return HEADER_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    // Leave the offset where the rows start, like the field by field reads used to
+    STATS_SYSCALL(IO_HEADER, IO_SEEK, 0);
+    if (lseek(fd, start + header.data_offset, SEEK_SET) == (off_t)-1) {
+        free_header(&header);
+        return HEADER_READ_ERROR;
     }
 
     *header_out = header;
@@ -218,33 +438,164 @@ HeaderOpStatus read_header(int fd, header_t *header_out) {
     return HEADER_OP_SUCCESS;
 }
 
-HeaderOpStatus update_header_num_rows(int fd, size_t increment, header_t *header) {
-    if (fd < 0 || header == NULL) {
+HeaderOpStatus read_header(int fd, header_t *header_out) {
+    STATS_START(start);
+    HeaderOpStatus status = read_header_fields(fd, header_out);
+    STATS_RECORD(STAT_READ_HEADER, start, status != HEADER_OP_SUCCESS);
+    if (status == HEADER_OP_SUCCESS) {
+        STATS_LOGICAL_READ(IO_HEADER, header_size(*header_out));
+    }
+    return status;
+}
+
+static HeaderOpStatus read_generation(int fd, uint64_t *generation_out) {
+    uint64_t generation_nbo;
+    STATS_SYSCALL(IO_HEADER, IO_READ, sizeof(uint64_t));
+    if (pread(fd, &generation_nbo, sizeof(uint64_t), HEADER_GENERATION_OFFSET) != sizeof(uint64_t)) {
+        return HEADER_READ_ERROR;
+    }
+    *generation_out = be64toh(generation_nbo);
+    return HEADER_OP_SUCCESS;
+}
+
+static HeaderOpStatus write_generation(int fd, uint64_t generation) {
+    uint64_t generation_nbo = htobe64(generation);
+    STATS_SYSCALL(IO_HEADER, IO_WRITE, sizeof(uint64_t));
+    if (pwrite(fd, &generation_nbo, sizeof(uint64_t), HEADER_GENERATION_OFFSET) != sizeof(uint64_t)) {
+        return HEADER_OP_UPDATE_ERROR;
+    }
+    return HEADER_OP_SUCCESS;
+}
+
+// v1 and v2 headers have no generation: only appends move their fields and they upgrade the table first
+static HeaderOpStatus read_legacy_snapshot(int fd, uint8_t version, snapshot_t *snapshot_out) {
+    uint8_t fields[sizeof(size_t) * 2 + sizeof(uint64_t)];
+    size_t length = version == 1 ? sizeof(size_t) : sizeof(fields);
+    STATS_SYSCALL(IO_HEADER, IO_READ, length);
+    if (pread(fd, fields, length, HEADER_LEGACY_NUM_ROWS_OFFSET) != (ssize_t) length) {
+        return HEADER_READ_ERROR;
+    }
+
+    size_t num_rows_nbo;
+    uint64_t data_end_nbo;
+    memcpy(&num_rows_nbo, fields, sizeof(size_t));
+    if (version == 1) {
+        // Nothing was preallocated yet, the rows run to the end of the file
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) == -1) {
+            return HEADER_READ_ERROR;
+        }
+        data_end_nbo = htobe64((uint64_t) file_stat.st_size);
+    } else {
+        memcpy(&data_end_nbo, &fields[sizeof(size_t) * 2], sizeof(uint64_t));
+    }
+    snapshot_out->generation = 0;
+    snapshot_out->num_rows = ntohl(num_rows_nbo);
+    snapshot_out->data_end = be64toh(data_end_nbo);
+    return HEADER_OP_SUCCESS;
+}
+
+/*
+ * The generation is a seqlock: the appender makes it odd, writes num_rows and data_end,
+ * and makes it even again. A reader that sees the same even generation before and after
+ * reading the fields got a committed snapshot. The fields are written with a single
+ * pwrite, so a generation that stays odd (the appender died in between) still comes
+ * with untorn fields and is accepted after SNAPSHOT_MAX_RETRIES.
+ */
+HeaderOpStatus read_snapshot(int fd, snapshot_t *snapshot_out) {
+    if (fd < 0 || snapshot_out == NULL) {
         return HEADER_OP_ERROR_INVALID_ARG;
     }
 
-    ssize_t bytes_written;
+    uint8_t prefix[HEADER_GENERATION_OFFSET + sizeof(uint64_t)];
+    uint8_t fields[sizeof(size_t) * 2 + sizeof(uint64_t)];
+    for (size_t attempt = 0; ; attempt++) {
+        // The version comes with the first read of the generation
+        STATS_SYSCALL(IO_HEADER, IO_READ, sizeof(prefix));
+        if (pread(fd, prefix, sizeof(prefix), 0) != sizeof(prefix)) {
+            return HEADER_READ_ERROR;
+        }
+        if (prefix[3] != VERSION) {
+            return read_legacy_snapshot(fd, prefix[3], snapshot_out);
+        }
+        uint64_t before, after;
+        memcpy(&before, &prefix[HEADER_GENERATION_OFFSET], sizeof(uint64_t));
+        before = be64toh(before);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        STATS_SYSCALL(IO_HEADER, IO_READ, sizeof(fields));
+        if (pread(fd, fields, sizeof(fields), HEADER_NUM_ROWS_OFFSET) != sizeof(fields)) {
+            return HEADER_READ_ERROR;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (read_generation(fd, &after) != HEADER_OP_SUCCESS) {
+            return HEADER_READ_ERROR;
+        }
+
+        if (before == after && (before % 2 == 0 || attempt >= SNAPSHOT_MAX_RETRIES)) {
+            size_t num_rows_nbo;
+            uint64_t data_end_nbo;
+            memcpy(&num_rows_nbo, fields, sizeof(size_t));
+            memcpy(&data_end_nbo, &fields[sizeof(size_t) * 2], sizeof(uint64_t));
+            snapshot_out->generation = before;
+            snapshot_out->num_rows = ntohl(num_rows_nbo);
+            snapshot_out->data_end = be64toh(data_end_nbo);
+            return HEADER_OP_SUCCESS;
+        }
+        sched_yield();
+    }
+}
 
-    off_t current_offset = lseek(fd, 0, SEEK_CUR);
-    if (current_offset == (off_t)-1) {
+static HeaderOpStatus publish_num_rows(int fd, size_t increment, uint64_t data_end, header_t *header) {
+    if (fd < 0 || header == NULL) {
+        return HEADER_OP_ERROR_INVALID_ARG;
+    }
+    // Older layouts have nowhere to put the generation, their tables are upgraded before appending
+    if (header->version != VERSION) {
         return HEADER_OP_UPDATE_ERROR;
     }
 
-    off_t new_offset = lseek(fd, sizeof(header->magic) + sizeof(header->version), SEEK_SET);
-    if (new_offset == (off_t)-1) {
+    // num_rows, num_cols and data_end are contiguous: one positioned write commits the
+    // new rows and leaves the file offset alone, no need to seek back and forth.
+    uint8_t fields[sizeof(size_t) * 2 + sizeof(uint64_t)];
+    size_t num_rows_nbo = htonl(header->num_rows + increment);
+    size_t num_cols_nbo = htonl(header->num_cols);
+    uint64_t data_end_nbo = htobe64(data_end);
+    memcpy(fields, &num_rows_nbo, sizeof(size_t));
+    memcpy(&fields[sizeof(size_t)], &num_cols_nbo, sizeof(size_t));
+    memcpy(&fields[sizeof(size_t) * 2], &data_end_nbo, sizeof(uint64_t));
+
+    // The rows must be in place before a reader can see the new extent
+    uint64_t publishing = (header->generation + 1) | 1;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (write_generation(fd, publishing) != HEADER_OP_SUCCESS) {
         return HEADER_OP_UPDATE_ERROR;
     }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
 
-    size_t num_rows_nbo = htonl(header->num_rows);
-    bytes_written = write(fd, &num_rows_nbo, sizeof(size_t));
-    if (bytes_written != sizeof(size_t)) {
+    ssize_t bytes_written = pwrite(fd, fields, sizeof(fields), HEADER_NUM_ROWS_OFFSET);
+    STATS_SYSCALL(IO_HEADER, IO_WRITE, bytes_written);
+    if (bytes_written != sizeof(fields)) {
         return HEADER_OP_UPDATE_ERROR;
     }
 
-    if (lseek(fd, current_offset, SEEK_SET) == (off_t)-1) {
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (write_generation(fd, publishing + 1) != HEADER_OP_SUCCESS) {
         return HEADER_OP_UPDATE_ERROR;
     }
 
+    header->generation = publishing + 1;
     header->num_rows = header->num_rows + increment;
+    header->data_end = data_end;
     return HEADER_OP_SUCCESS;
-}
\ No newline at end of file
+}
+
+HeaderOpStatus update_header_num_rows(int fd, size_t increment, uint64_t data_end, header_t *header) {
+    STATS_START(start);
+    HeaderOpStatus status = publish_num_rows(fd, increment, data_end, header);
+    STATS_RECORD(STAT_UPDATE_HEADER, start, status != HEADER_OP_SUCCESS);
+    if (status == HEADER_OP_SUCCESS) {
+        // Only the row count and the data end change, the generation bumps are overhead
+        STATS_LOGICAL_WRITTEN(IO_HEADER, sizeof(size_t) + sizeof(uint64_t));
+    }
+    return status;
+}
@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "ingest.h"
+#include "futex.h"
+
+
+static int ring_has_rows(ingest_queue_t *queue) {
+    ingest_slot_t *slot = &queue->slots[queue->dequeue_pos & (queue->capacity - 1)];
+    return __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) == queue->dequeue_pos + 1;
+}
+
+// Moves up to INGEST_BATCH_ROWS rows out of the ring and frees their slots
+static size_t drain_batch(ingest_queue_t *queue) {
+    size_t num_rows = 0;
+    while (num_rows < INGEST_BATCH_ROWS && ring_has_rows(queue)) {
+        ingest_slot_t *slot = &queue->slots[queue->dequeue_pos & (queue->capacity - 1)];
+        queue->batch[num_rows++] = slot->row;
+        __atomic_store_n(&slot->sequence, queue->dequeue_pos + queue->capacity, __ATOMIC_RELEASE);
+        queue->dequeue_pos++;
+    }
+    return num_rows;
+}
+
+static void append_batch(ingest_queue_t *queue, size_t num_rows) {
+    WriterOpStatus status = __atomic_load_n(&queue->writer_status, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < num_rows; i++) {
+        if (status == WRITER_OP_SUCCESS) {
+            status = writer_append(queue->writer, queue->batch[i]);
+        }
+        free_row(&queue->batch[i], queue->batch[i].num_cells);
+    }
+    if (status != WRITER_OP_SUCCESS) {
+        __atomic_store_n(&queue->writer_status, status, __ATOMIC_RELAXED);
+    }
+}
+
+static void publish(ingest_queue_t *queue) {
+    if (__atomic_load_n(&queue->writer_status, __ATOMIC_RELAXED) != WRITER_OP_SUCCESS) {
+        return;
+    }
+    WriterOpStatus status = writer_flush(queue->writer);
+    if (status != WRITER_OP_SUCCESS) {
+        __atomic_store_n(&queue->writer_status, status, __ATOMIC_RELAXED);
+    }
+}
+
+static void *flusher_thread(void *arg) {
+    ingest_queue_t *queue = (ingest_queue_t *) arg;
+    size_t pending = 0;  // Rows written but not yet counted in the header
+
+    for (;;) {
+        size_t num_rows = drain_batch(queue);
+        if (num_rows > 0) {
+            // Producers blocked on a full ring can go on while the batch is encoded
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&queue->producers_waiting, __ATOMIC_RELAXED) > 0) {
+                __atomic_add_fetch(&queue->has_space, 1, __ATOMIC_RELEASE);
+                futex_wake(&queue->has_space, INT_MAX);
+            }
+            append_batch(queue, num_rows);
+            pending += num_rows;
+            if (pending >= INGEST_BATCH_ROWS) {
+                publish(queue);
+                pending = 0;
+            }
+            continue;
+        }
+
+        if (__atomic_load_n(&queue->closing, __ATOMIC_ACQUIRE)) {
+            if (ring_has_rows(queue)) {
+                continue;
+            }
+            publish(queue);
+            return NULL;
+        }
+
+        // Announce the nap before checking the ring one last time, a producer publishing
+        // in between sees flusher_waiting and bumps has_rows, so the futex doesn't sleep.
+        // An idle flusher wants the first row, one with a partial batch waits for it to
+        // fill up, or publishes what it has when the rows stop coming. The ring is empty here,
+        // so no more than its capacity can arrive before the producers block.
+        uint32_t key = __atomic_load_n(&queue->has_rows, __ATOMIC_ACQUIRE);
+        size_t wanted = pending == 0 ? 1 : INGEST_BATCH_ROWS - pending;
+        if (wanted > queue->capacity) {
+            wanted = queue->capacity;
+        }
+        __atomic_store_n(&queue->wake_pos, queue->dequeue_pos + wanted, __ATOMIC_RELAXED);
+        __atomic_store_n(&queue->flusher_waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int timed_out = 0;
+        if (!ring_has_rows(queue) && !__atomic_load_n(&queue->closing, __ATOMIC_ACQUIRE)) {
+            if (pending == 0) {
+                futex_wait(&queue->has_rows, key);
+            } else {
+                timed_out = futex_wait_for(&queue->has_rows, key, INGEST_LINGER_NS);
+            }
+        }
+        __atomic_store_n(&queue->flusher_waiting, 0, __ATOMIC_RELAXED);
+
+        if (timed_out) {
+            publish(queue);
+            pending = 0;
+        }
+    }
+}
+
+IngestOpStatus open_ingest_queue(append_writer_t *writer, size_t capacity, IngestBackpressure backpressure,
+                                 ingest_queue_t **queue_out) {
+    if (writer == NULL || capacity == 0 || queue_out == NULL) {
+        return INGEST_OP_ERROR_INVALID_ARG;
+    }
+
+    ingest_queue_t *queue = (ingest_queue_t *) calloc(1, sizeof(ingest_queue_t));
+    if (queue == NULL) {
+        return INGEST_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    // Positions are mapped to slots with a mask
+    queue->capacity = 2;
+    while (queue->capacity < capacity) {
+        queue->capacity *= 2;
+    }
+    queue->slots = (ingest_slot_t *) calloc(queue->capacity, sizeof(ingest_slot_t));
+    queue->batch = (row_t *) calloc(INGEST_BATCH_ROWS, sizeof(row_t));
+    if (queue->slots == NULL || queue->batch == NULL) {
+        free(queue->slots);
+        free(queue->batch);
+        free(queue);
+        return INGEST_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    for (size_t i = 0; i < queue->capacity; i++) {
+        queue->slots[i].sequence = i;
+    }
+    queue->backpressure = backpressure;
+    queue->writer = writer;
+    queue->writer_status = WRITER_OP_SUCCESS;
+
+    if (pthread_create(&queue->flusher, NULL, flusher_thread, queue) != 0) {
+        free(queue->slots);
+        free(queue->batch);
+        free(queue);
+        return INGEST_OP_ERROR_THREAD;
+    }
+
+    *queue_out = queue;
+    return INGEST_OP_SUCCESS;
+}
+
+static void wait_for_space(ingest_queue_t *queue, ingest_slot_t *slot, size_t pos) {
+    uint32_t key = __atomic_load_n(&queue->has_space, __ATOMIC_ACQUIRE);
+    __atomic_add_fetch(&queue->producers_waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if ((intptr_t) (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - pos) < 0) {
+        futex_wait(&queue->has_space, key);
+    }
+    __atomic_sub_fetch(&queue->producers_waiting, 1, __ATOMIC_RELAXED);
+}
+
+IngestOpStatus ingest_enqueue(ingest_queue_t *queue, row_t row) {
+    if (queue == NULL || row.cells == NULL) {
+        return INGEST_OP_ERROR_INVALID_ARG;
+    }
+    if (__atomic_load_n(&queue->writer_status, __ATOMIC_RELAXED) != WRITER_OP_SUCCESS) {
+        return INGEST_OP_WRITE_ERROR;
+    }
+
+    size_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    ingest_slot_t *slot;
+    for (;;) {
+        slot = &queue->slots[pos & (queue->capacity - 1)];
+        intptr_t diff = (intptr_t) (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            // On failure the CAS reloads pos with the position another producer left
+            if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The slot still holds the row from one lap ago: the ring is full
+            if (queue->backpressure == INGEST_FAIL) {
+                return INGEST_OP_FULL;
+            }
+            wait_for_space(queue, slot, pos);
+            if (__atomic_load_n(&queue->writer_status, __ATOMIC_RELAXED) != WRITER_OP_SUCCESS) {
+                return INGEST_OP_WRITE_ERROR;
+            }
+            pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+        } else {
+            pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->row = row;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&queue->flusher_waiting, __ATOMIC_RELAXED) &&
+        pos + 1 >= __atomic_load_n(&queue->wake_pos, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&queue->has_rows, 1, __ATOMIC_RELEASE);
+        futex_wake(&queue->has_rows, 1);
+    }
+    return INGEST_OP_SUCCESS;
+}
+
+IngestOpStatus close_ingest_queue(ingest_queue_t *queue) {
+    if (queue == NULL) {
+        return INGEST_OP_ERROR_INVALID_ARG;
+    }
+
+    __atomic_store_n(&queue->closing, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&queue->has_rows, 1, __ATOMIC_RELEASE);
+    futex_wake(&queue->has_rows, 1);
+    pthread_join(queue->flusher, NULL);
+
+    IngestOpStatus status = queue->writer_status == WRITER_OP_SUCCESS ? INGEST_OP_SUCCESS : INGEST_OP_WRITE_ERROR;
+    free(queue->slots);
+    free(queue->batch);
+    free(queue);
+    return status;
+}
@@ -0,0 +1,533 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "join.h"
+#include "file.h"
+#include "hash.h"
+#include "append.h"
+#include "scan.h"
+#include "tombstone.h"
+#include "stats.h"
+
+#define JOIN_STOPPED 1  // Internal, the callback asked to stop
+
+
+// A table or one of its spilled partitions, read a block at a time
+typedef struct {
+    int fd;
+    header_t header;  // Its row count and data end bound the rows read
+    uint64_t offset;  // Of the first row
+    const tombstone_t *tombstones;
+    const predicate_t *predicate;
+    const uint8_t *decoded;  // Only the predicate's column is decoded to filter the rows
+    size_t key_col;
+    int is_left;
+} join_side_t;
+
+typedef struct {
+    uint64_t hash;
+    size_t offset;  // Of the row in the arena
+    size_t length;
+    size_t key_offset;  // Of the key cell in the row
+} join_entry_t;
+
+// The build side, kept encoded: rows are only decoded when they match
+typedef struct {
+    uint8_t *arena;
+    size_t arena_length;
+    size_t arena_capacity;
+    join_entry_t *entries;
+    size_t num_entries;
+    size_t entries_capacity;
+    size_t *slots;  // Open addressing table of entry index + 1, 0 marks an empty slot
+    size_t slots_capacity;
+} join_table_t;
+
+typedef struct {
+    int fd;
+    uint8_t *buffer;
+    size_t buffered;
+    uint64_t length;
+    size_t num_rows;
+} join_partition_t;
+
+typedef struct {
+    join_partition_t *partitions;
+    unsigned shift;  // The partition is picked by the top bits of the hash, the slots use the low ones
+} partitioner_t;
+
+typedef struct {
+    join_table_t *table;
+    header_t build_header;
+    header_t probe_header;
+    int probe_is_left;
+    join_callback_t callback;
+    void *ctx;
+    size_t num_rows;
+} probe_ctx_t;
+
+typedef JoinOpStatus (*row_visitor_t)(const uint8_t *row, size_t length, size_t key_offset, uint64_t hash,
+                                      void *ctx);
+
+JoinOpStatus parse_join_columns(header_t left_header, header_t right_header, const char *columns_in,
+                                size_t *left_col_out, size_t *right_col_out) {
+    if (columns_in == NULL || left_col_out == NULL || right_col_out == NULL) {
+        return JOIN_OP_ERROR_INVALID_ARG;
+    }
+
+    const char *equals = strchr(columns_in, '=');
+    size_t left_length = equals != NULL ? (size_t) (equals - columns_in) : strlen(columns_in);
+    const char *right_name = equals != NULL ? equals + 1 : columns_in;
+    size_t right_length = equals != NULL ? strlen(right_name) : left_length;
+    if (left_length == 0 || right_length == 0) {
+        return JOIN_OP_ERROR_INVALID_ARG;
+    }
+
+    size_t left_col;
+    size_t right_col;
+    if (!find_column(left_header, columns_in, left_length, &left_col)
+        || !find_column(right_header, right_name, right_length, &right_col)) {
+        return JOIN_OP_ERROR_UNKNOWN_COLUMN;
+    }
+
+    // Float equality is rarely what's meant, only ints and strings are joined on
+    uint8_t data_type = left_header.columns[left_col].data_type;
+    if (data_type != right_header.columns[right_col].data_type || data_type == CELL_TYPE_FLOAT
+        || data_type == CELL_TYPE_DOUBLE) {
+        return JOIN_OP_ERROR_TYPE_MISMATCH;
+    }
+
+    *left_col_out = left_col;
+    *right_col_out = right_col;
+    return JOIN_OP_SUCCESS;
+}
+
+// Rows were checked by row_span already, the walk doesn't have to guard the lengths
+static size_t locate_key(const uint8_t *row, size_t key_col) {
+    size_t pos = 0;
+    for (size_t col = 0; col < key_col; col++) {
+        pos += encoded_cell_size(&row[pos]);
+    }
+    return pos;
+}
+
+// FNV-1a over the encoded value without its type and length, a string is the same whether
+// it was written with a short or a long length
+static uint64_t hash_key(const uint8_t *cell) {
+    size_t length;
+    const uint8_t *value = encoded_cell_value(cell, &length);
+    return hash_bytes(value, length);
+}
+
+static int keys_equal(const uint8_t *a, const uint8_t *b) {
+    size_t a_length;
+    size_t b_length;
+    const uint8_t *a_value = encoded_cell_value(a, &a_length);
+    const uint8_t *b_value = encoded_cell_value(b, &b_length);
+    return a_length == b_length && memcmp(a_value, b_value, a_length) == 0;
+}
+
+static JoinOpStatus visit_rows(const join_side_t *side, row_visitor_t visitor, void *ctx) {
+    cell_t *cells = NULL;
+    if (side->predicate != NULL && side->decoded != NULL
+        && (cells = (cell_t *) calloc(side->header.num_cols, sizeof(cell_t))) == NULL) {
+        return JOIN_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    JoinOpStatus status = JOIN_OP_SUCCESS;
+    uint8_t *buffer = NULL;
+    size_t capacity = SCAN_MORSEL_SIZE;
+    uint64_t offset = side->offset;
+    size_t row_index = 0;
+    while (row_index < side->header.num_rows && status == JOIN_OP_SUCCESS) {
+        size_t length;
+        size_t num_rows;
+        ScanOpStatus scan_status = read_row_block(side->fd, side->header, offset, side->header.num_rows - row_index,
+                                                  &buffer, &capacity, &length, &num_rows);
+        if (scan_status != SCAN_OP_SUCCESS) {
+            status = scan_status == SCAN_OP_ERROR_MEMORY_ALLOCATION ? JOIN_OP_ERROR_MEMORY_ALLOCATION : JOIN_OP_READ_ERROR;
+            break;
+        }
+
+        size_t pos = 0;
+        for (size_t i = 0; i < num_rows && status == JOIN_OP_SUCCESS; i++, row_index++) {
+            const uint8_t *row = &buffer[pos];
+            size_t span = row_span(row, length - pos, side->header);
+            pos += span;
+            if (is_tombstoned(side->tombstones, row_index)) {
+                continue;
+            }
+
+            if (side->predicate != NULL) {
+                row_t filter_row;
+                if (decode_row_columns(row, side->header, side->decoded, cells, &filter_row) != APPEND_OP_SUCCESS) {
+                    status = JOIN_OP_ERROR_MEMORY_ALLOCATION;
+                    break;
+                }
+                int matches = eval_predicate(side->predicate, filter_row);
+                release_row_columns(&filter_row, cells);
+                if (!matches) {
+                    continue;
+                }
+            }
+
+            size_t key_offset = locate_key(row, side->key_col);
+            status = visitor(row, span, key_offset, hash_key(&row[key_offset]), ctx);
+        }
+        offset += length;
+    }
+    free(buffer);
+    free(cells);
+    return status;
+}
+
+static JoinOpStatus table_add(const uint8_t *row, size_t length, size_t key_offset, uint64_t hash, void *ctx) {
+    join_table_t *table = (join_table_t *) ctx;
+    if (table->arena_length + length > table->arena_capacity) {
+        size_t capacity = table->arena_capacity == 0 ? JOIN_PARTITION_BUFFER : table->arena_capacity * 2;
+        while (capacity < table->arena_length + length) {
+            capacity *= 2;
+        }
+        uint8_t *arena = (uint8_t *) realloc(table->arena, capacity);
+        if (arena == NULL) {
+            return JOIN_OP_ERROR_MEMORY_ALLOCATION;
+        }
+        table->arena = arena;
+        table->arena_capacity = capacity;
+    }
+    if (table->num_entries == table->entries_capacity) {
+        size_t capacity = table->entries_capacity == 0 ? 1024 : table->entries_capacity * 2;
+        join_entry_t *entries = (join_entry_t *) realloc(table->entries, capacity * sizeof(join_entry_t));
+        if (entries == NULL) {
+            return JOIN_OP_ERROR_MEMORY_ALLOCATION;
+        }
+        table->entries = entries;
+        table->entries_capacity = capacity;
+    }
+
+    memcpy(&table->arena[table->arena_length], row, length);
+    table->entries[table->num_entries++] = (join_entry_t) {
+        .hash = hash, .offset = table->arena_length, .length = length, .key_offset = key_offset
+    };
+    table->arena_length += length;
+    return JOIN_OP_SUCCESS;
+}
+
+// Built once every row is in, at most half full. Linear probing keeps equal keys in arrival order.
+static JoinOpStatus build_slots(join_table_t *table) {
+    size_t capacity = 16;
+    while (capacity < table->num_entries * 2) {
+        capacity *= 2;
+    }
+    if (capacity > table->slots_capacity) {
+        free(table->slots);
+        table->slots = (size_t *) malloc(capacity * sizeof(size_t));
+        if (table->slots == NULL) {
+            table->slots_capacity = 0;
+            return JOIN_OP_ERROR_MEMORY_ALLOCATION;
+        }
+        table->slots_capacity = capacity;
+    }
+    memset(table->slots, 0, table->slots_capacity * sizeof(size_t));
+
+    size_t mask = table->slots_capacity - 1;
+    for (size_t i = 0; i < table->num_entries; i++) {
+        size_t slot = table->entries[i].hash & mask;
+        while (table->slots[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        table->slots[slot] = i + 1;
+    }
+    return JOIN_OP_SUCCESS;
+}
+
+static void free_join_table(join_table_t *table) {
+    free(table->arena);
+    free(table->entries);
+    free(table->slots);
+}
+
+static JoinOpStatus probe_row(const uint8_t *row, size_t length, size_t key_offset, uint64_t hash, void *ctx) {
+    probe_ctx_t *probe = (probe_ctx_t *) ctx;
+    join_table_t *table = probe->table;
+    size_t mask = table->slots_capacity - 1;
+
+    // The probing row is decoded on its first match only, most rows of a selective join never are
+    JoinOpStatus status = JOIN_OP_SUCCESS;
+    row_t probe_decoded;
+    int decoded = 0;
+    for (size_t slot = hash & mask; table->slots[slot] != 0; slot = (slot + 1) & mask) {
+        const join_entry_t *entry = &table->entries[table->slots[slot] - 1];
+        const uint8_t *build_row = &table->arena[entry->offset];
+        if (entry->hash != hash || !keys_equal(&build_row[entry->key_offset], &row[key_offset])) {
+            continue;
+        }
+
+        if (!decoded) {
+            if (decode_row(row, probe->probe_header, &probe_decoded) != APPEND_OP_SUCCESS) {
+                return JOIN_OP_ERROR_MEMORY_ALLOCATION;
+            }
+            decoded = 1;
+        }
+        row_t build_decoded;
+        if (decode_row(build_row, probe->build_header, &build_decoded) != APPEND_OP_SUCCESS) {
+            status = JOIN_OP_ERROR_MEMORY_ALLOCATION;
+            break;
+        }
+        int stop = probe->probe_is_left ? probe->callback(probe_decoded, build_decoded, probe->ctx)
+                                        : probe->callback(build_decoded, probe_decoded, probe->ctx);
+        free_row(&build_decoded, build_decoded.num_cells);
+        probe->num_rows++;
+        if (stop) {
+            status = JOIN_STOPPED;
+            break;
+        }
+    }
+
+    if (decoded) {
+        free_row(&probe_decoded, probe_decoded.num_cells);
+    }
+    return status;
+}
+
+static JoinOpStatus hash_join(const join_side_t *build, const join_side_t *probe, join_table_t *table,
+                              probe_ctx_t *probe_ctx) {
+    table->arena_length = 0;
+    table->num_entries = 0;
+    JoinOpStatus status = visit_rows(build, table_add, table);
+    if (status != JOIN_OP_SUCCESS) {
+        return status;
+    }
+    if (table->num_entries == 0) {
+        return JOIN_OP_SUCCESS;
+    }
+    status = build_slots(table);
+    if (status != JOIN_OP_SUCCESS) {
+        return status;
+    }
+
+    probe_ctx->table = table;
+    probe_ctx->build_header = build->header;
+    probe_ctx->probe_header = probe->header;
+    probe_ctx->probe_is_left = probe->is_left;
+    return visit_rows(probe, probe_row, probe_ctx);
+}
+
+static JoinOpStatus flush_partition(join_partition_t *partition) {
+    if (partition->buffered > 0
+        && pwrite_full(partition->fd, partition->buffer, partition->buffered, partition->length) == -1) {
+        return JOIN_OP_WRITE_ERROR;
+    }
+    partition->length += partition->buffered;
+    partition->buffered = 0;
+    return JOIN_OP_SUCCESS;
+}
+
+static JoinOpStatus partition_row(const uint8_t *row, size_t length, size_t key_offset, uint64_t hash, void *ctx) {
+    partitioner_t *partitioner = (partitioner_t *) ctx;
+    join_partition_t *partition = &partitioner->partitions[hash >> partitioner->shift];
+    partition->num_rows++;
+
+    if (partition->buffered + length > JOIN_PARTITION_BUFFER) {
+        JoinOpStatus status = flush_partition(partition);
+        if (status != JOIN_OP_SUCCESS) {
+            return status;
+        }
+        if (length > JOIN_PARTITION_BUFFER) {
+            if (pwrite_full(partition->fd, row, length, partition->length) == -1) {
+                return JOIN_OP_WRITE_ERROR;
+            }
+            partition->length += length;
+            return JOIN_OP_SUCCESS;
+        }
+    }
+    memcpy(&partition->buffer[partition->buffered], row, length);
+    partition->buffered += length;
+    return JOIN_OP_SUCCESS;
+}
+
+static void close_partitions(join_partition_t *partitions, size_t num_partitions) {
+    for (size_t i = 0; i < num_partitions; i++) {
+        if (partitions[i].fd != -1) {
+            close(partitions[i].fd);
+        }
+        free(partitions[i].buffer);
+    }
+    free(partitions);
+}
+
+// The files are unlinked as soon as they're created, the partitions never outlive the join
+static JoinOpStatus spill_partitions(const join_side_t *side, const char *spill_path, size_t num_partitions,
+                                     unsigned shift, join_partition_t **partitions_out) {
+    join_partition_t *partitions = (join_partition_t *) calloc(num_partitions, sizeof(join_partition_t));
+    if (partitions == NULL) {
+        return JOIN_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    for (size_t i = 0; i < num_partitions; i++) {
+        partitions[i].fd = -1;
+    }
+
+    JoinOpStatus status = JOIN_OP_SUCCESS;
+    for (size_t i = 0; i < num_partitions && status == JOIN_OP_SUCCESS; i++) {
+        partitions[i].buffer = (uint8_t *) malloc(JOIN_PARTITION_BUFFER);
+        partitions[i].fd = open(spill_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (partitions[i].buffer == NULL) {
+            status = JOIN_OP_ERROR_MEMORY_ALLOCATION;
+        } else if (partitions[i].fd == -1) {
+            status = JOIN_OP_WRITE_ERROR;
+        } else {
+            unlink(spill_path);
+        }
+    }
+
+    if (status == JOIN_OP_SUCCESS) {
+        partitioner_t partitioner = {.partitions = partitions, .shift = shift};
+        status = visit_rows(side, partition_row, &partitioner);
+    }
+    for (size_t i = 0; i < num_partitions && status == JOIN_OP_SUCCESS; i++) {
+        status = flush_partition(&partitions[i]);
+        // The write buffers aren't needed once spilled, only the build table is in memory while joining
+        free(partitions[i].buffer);
+        partitions[i].buffer = NULL;
+    }
+
+    if (status != JOIN_OP_SUCCESS) {
+        close_partitions(partitions, num_partitions);
+        return status;
+    }
+    *partitions_out = partitions;
+    return JOIN_OP_SUCCESS;
+}
+
+// The rows of a partition are already filtered, only its extent differs from the table's
+static join_side_t partition_side(const join_side_t *side, const join_partition_t *partition) {
+    join_side_t partition_side = *side;
+    partition_side.fd = partition->fd;
+    partition_side.header.num_rows = partition->num_rows;
+    partition_side.header.data_end = partition->length;
+    partition_side.offset = 0;
+    partition_side.tombstones = NULL;
+    partition_side.predicate = NULL;
+    return partition_side;
+}
+
+static JoinOpStatus grace_join(const join_side_t *build, const join_side_t *probe, size_t num_partitions,
+                               const char *spill_path, join_table_t *table, probe_ctx_t *probe_ctx) {
+    unsigned shift = 64;
+    for (size_t n = num_partitions; n > 1; n /= 2) {
+        shift--;
+    }
+
+    join_partition_t *build_partitions;
+    JoinOpStatus status = spill_partitions(build, spill_path, num_partitions, shift, &build_partitions);
+    if (status != JOIN_OP_SUCCESS) {
+        return status;
+    }
+    join_partition_t *probe_partitions;
+    status = spill_partitions(probe, spill_path, num_partitions, shift, &probe_partitions);
+    if (status != JOIN_OP_SUCCESS) {
+        close_partitions(build_partitions, num_partitions);
+        return status;
+    }
+
+    // Matching keys always land in partitions with the same number
+    for (size_t i = 0; i < num_partitions && status == JOIN_OP_SUCCESS; i++) {
+        if (build_partitions[i].num_rows == 0 || probe_partitions[i].num_rows == 0) {
+            continue;
+        }
+        join_side_t build_partition = partition_side(build, &build_partitions[i]);
+        join_side_t probe_partition = partition_side(probe, &probe_partitions[i]);
+        status = hash_join(&build_partition, &probe_partition, table, probe_ctx);
+    }
+
+    close_partitions(build_partitions, num_partitions);
+    close_partitions(probe_partitions, num_partitions);
+    return status;
+}
+
+JoinOpStatus join_tables(const char *left_path, int left_fd, header_t left_header, size_t left_col,
+                         const predicate_t *predicate, const char *right_path, int right_fd, header_t right_header,
+                         size_t right_col, size_t memory_budget, join_callback_t callback, void *ctx,
+                         size_t *num_rows_out) {
+    if (left_path == NULL || right_path == NULL || left_fd < 0 || right_fd < 0 || callback == NULL
+        || num_rows_out == NULL || left_col >= left_header.num_cols || right_col >= right_header.num_cols) {
+        return JOIN_OP_ERROR_INVALID_ARG;
+    }
+    if (memory_budget == 0) {
+        memory_budget = JOIN_DEFAULT_MEMORY;
+    } else if (memory_budget < JOIN_MIN_MEMORY) {
+        memory_budget = JOIN_MIN_MEMORY;
+    }
+
+    tombstone_t left_tombstones;
+    tombstone_t right_tombstones;
+    if (load_tombstones(left_path, left_fd, &left_tombstones) != TOMBSTONE_OP_SUCCESS) {
+        return JOIN_OP_TOMBSTONE_ERROR;
+    }
+    if (load_tombstones(right_path, right_fd, &right_tombstones) != TOMBSTONE_OP_SUCCESS) {
+        free_tombstones(&left_tombstones);
+        return JOIN_OP_TOMBSTONE_ERROR;
+    }
+
+    size_t spill_path_length = strlen(left_path);
+    char *spill_path = (char *) malloc(spill_path_length + sizeof(JOIN_SUFFIX));
+    uint8_t *decoded = (uint8_t *) calloc(left_header.num_cols, sizeof(uint8_t));
+    if (spill_path == NULL || decoded == NULL) {
+        free(spill_path);
+        free(decoded);
+        free_tombstones(&left_tombstones);
+        free_tombstones(&right_tombstones);
+        return JOIN_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    memcpy(spill_path, left_path, spill_path_length);
+    memcpy(&spill_path[spill_path_length], JOIN_SUFFIX, sizeof(JOIN_SUFFIX));
+    if (predicate != NULL) {
+        decoded[predicate->col_index] = 1;
+    }
+
+    join_side_t left = {
+        .fd = left_fd, .header = left_header, .offset = header_size(left_header), .tombstones = &left_tombstones,
+        .predicate = predicate, .decoded = decoded, .key_col = left_col, .is_left = 1
+    };
+    join_side_t right = {
+        .fd = right_fd, .header = right_header, .offset = header_size(right_header), .tombstones = &right_tombstones,
+        .predicate = NULL, .decoded = NULL, .key_col = right_col, .is_left = 0
+    };
+
+    // The smaller table is the one held in memory
+    uint64_t left_bytes = left_header.data_end - left.offset;
+    uint64_t right_bytes = right_header.data_end - right.offset;
+    const join_side_t *build = right_bytes <= left_bytes ? &right : &left;
+    const join_side_t *probe = right_bytes <= left_bytes ? &left : &right;
+    uint64_t build_bytes = build == &left ? left_bytes : right_bytes;
+
+    join_table_t table = {0};
+    probe_ctx_t probe_ctx = {.callback = callback, .ctx = ctx, .num_rows = 0};
+    JoinOpStatus status;
+    if (build_bytes <= memory_budget) {
+        status = hash_join(build, probe, &table, &probe_ctx);
+    } else {
+        // Enough partitions for each one's table to fit in the budget, with some room for skew
+        size_t num_partitions = 2;
+        while (num_partitions < JOIN_MAX_PARTITIONS && build_bytes / num_partitions > memory_budget / 2) {
+            num_partitions *= 2;
+        }
+        status = grace_join(build, probe, num_partitions, spill_path, &table, &probe_ctx);
+    }
+    if (status == JOIN_STOPPED) {
+        status = JOIN_OP_SUCCESS;
+    }
+
+    free_join_table(&table);
+    free(spill_path);
+    free(decoded);
+    free_tombstones(&left_tombstones);
+    free_tombstones(&right_tombstones);
+
+    if (status == JOIN_OP_SUCCESS) {
+        *num_rows_out = probe_ctx.num_rows;
+    }
+    return status;
+}
@@ -1,21 +1,820 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <string.h>
+#include <pthread.h>
+#include <inttypes.h>
 
 #include "file.h"
 #include "schema.h"
 #include "header.h"
 #include "append.h"
+#include "predicate.h"
+#include "projection.h"
+#include "tombstone.h"
+#include "scan.h"
+#include "delete.h"
+#include "sort.h"
+#include "topk.h"
+#include "join.h"
+#include "group.h"
+#include "rollup.h"
+#include "partition.h"
+#include "writer.h"
+#include "ingest.h"
+#include "export.h"
+#include "server.h"
+#include "threadpool.h"
+#include "stats.h"
 
+#define OPTION_STATS 256  // Long options only, out of the range of the short ones
+
+
+typedef struct {
+    pthread_mutex_t lock;  // Partitioned scans print from several threads
+    size_t matched;
+    const projection_t *projection;  // NULL prints every column
+} print_ctx_t;
+
+// Registered with atexit, the stats cover the whole command whichever way it ends
+static void dump_stats(void) {
+    write_stats_json(stderr);
+}
+
+// Same format as print_row_values, restricted to the projected columns in their order
+static void print_projected_row(row_t row, const projection_t *projection) {
+    printf("(");
+    for (size_t i = 0; i < projection->num_cols; i++) {
+        if (i > 0) {
+            printf(" && ");
+        }
+        print_cell(&row.cells[projection->columns[i]]);
+    }
+    printf(")\n");
+}
+
+static int print_scanned_row(row_t row, size_t row_index, uint64_t offset, void *ctx) {
+    print_ctx_t *print_ctx = (print_ctx_t *) ctx;
+    pthread_mutex_lock(&print_ctx->lock);
+    print_ctx->matched++;
+    if (print_ctx->projection != NULL) {
+        print_projected_row(row, print_ctx->projection);
+    } else {
+        print_row_values(row);
+    }
+    pthread_mutex_unlock(&print_ctx->lock);
+    return 0;
+}
+
+static int parse_where(header_t header, char *where, predicate_t *predicate_out) {
+    PredicateOpStatus pop_status = parse_predicate(header, where, predicate_out);
+    switch (pop_status) {
+        case PREDICATE_OP_SUCCESS:
+            return 0;
+        case PREDICATE_OP_ERROR_UNKNOWN_COLUMN:
+            fprintf(stderr, "The predicate refers to an unknown column.\n");
+            break;
+        case PREDICATE_OP_ERROR_MEMORY_ALLOCATION:
+            fprintf(stderr, "Couldn't allocate memory when parsing the predicate.\n");
+            break;
+        default:
+            fprintf(stderr, "The provided predicate is malformatted, expected \"<column> <op> <value>\".\n");
+            break;
+    }
+    return -1;
+}
+
+static int parse_select(header_t header, const char *columns, const predicate_t *predicate,
+                        projection_t *projection_out) {
+    ProjectionOpStatus pop_status = parse_projection(header, columns, predicate, projection_out);
+    switch (pop_status) {
+        case PROJECTION_OP_SUCCESS:
+            return 0;
+        case PROJECTION_OP_ERROR_UNKNOWN_COLUMN:
+            fprintf(stderr, "The column list refers to an unknown column.\n");
+            break;
+        case PROJECTION_OP_ERROR_MEMORY_ALLOCATION:
+            fprintf(stderr, "Couldn't allocate memory when parsing the column list.\n");
+            break;
+        default:
+            fprintf(stderr, "The provided column list is malformatted, expected \"<column>,<column>,...\".\n");
+            break;
+    }
+    return -1;
+}
+
+static int run_scan(int fd, const char *filepath, header_t header, char *where, const char *columns,
+                    threadpool_t *pool) {
+    predicate_t predicate;
+    if (where && parse_where(header, where, &predicate) != 0) {
+        return -1;
+    }
+
+    projection_t projection;
+    if (columns && parse_select(header, columns, where ? &predicate : NULL, &projection) != 0) {
+        if (where) {
+            free_predicate(&predicate);
+        }
+        return -1;
+    }
+
+    tombstone_t tombstones;
+    if (load_tombstones(filepath, fd, &tombstones) != TOMBSTONE_OP_SUCCESS) {
+        fprintf(stderr, "Failed to load the tombstones.\n");
+        if (columns) {
+            free_projection(&projection);
+        }
+        if (where) {
+            free_predicate(&predicate);
+        }
+        return -1;
+    }
+
+    print_ctx_t print_ctx = {.lock = PTHREAD_MUTEX_INITIALIZER, .matched = 0, .projection = columns ? &projection : NULL};
+    ScanOpStatus scan_status = scan_rows_parallel(fd, header, &tombstones, where ? &predicate : NULL,
+                                                  print_ctx.projection, print_scanned_row, &print_ctx, pool);
+
+    free_tombstones(&tombstones);
+    if (columns) {
+        free_projection(&projection);
+    }
+    if (where) {
+        free_predicate(&predicate);
+    }
+
+    if (scan_status != SCAN_OP_SUCCESS) {
+        fprintf(stderr, "Failed to scan the rows.\n");
+        return -1;
+    }
+
+    printf("%zu row(s)\n", print_ctx.matched);
+    return 0;
+}
+
+static int run_topk(int fd, const char *filepath, header_t header, char *where, const char *columns,
+                    const char *topk_spec, threadpool_t *pool) {
+    topk_t topk;
+    TopKOpStatus top_status = parse_topk(header, topk_spec, &topk);
+    if (top_status != TOPK_OP_SUCCESS) {
+        fprintf(stderr, top_status == TOPK_OP_ERROR_UNKNOWN_COLUMN ? "The top-K query refers to an unknown column.\n"
+                        : "The provided top-K query is malformatted, expected \"<column>:<k>[:asc|:desc]\".\n");
+        return -1;
+    }
+
+    predicate_t predicate;
+    if (where && parse_where(header, where, &predicate) != 0) {
+        return -1;
+    }
+
+    projection_t projection;
+    if (columns && parse_select(header, columns, NULL, &projection) != 0) {
+        if (where) {
+            free_predicate(&predicate);
+        }
+        return -1;
+    }
+
+    tombstone_t tombstones;
+    row_t *rows = NULL;
+    size_t num_rows = 0;
+    if (load_tombstones(filepath, fd, &tombstones) != TOMBSTONE_OP_SUCCESS) {
+        fprintf(stderr, "Failed to load the tombstones.\n");
+        top_status = TOPK_OP_READ_ERROR;
+    } else {
+        top_status = topk_rows(fd, header, &tombstones, where ? &predicate : NULL, &topk, pool, &rows, &num_rows);
+        free_tombstones(&tombstones);
+        if (top_status != TOPK_OP_SUCCESS) {
+            fprintf(stderr, "Failed to run the top-K query.\n");
+        }
+    }
+
+    // Ranked rows, printed in order whatever the number of threads
+    for (size_t i = 0; i < num_rows; i++) {
+        if (columns) {
+            print_projected_row(rows[i], &projection);
+        } else {
+            print_row_values(rows[i]);
+        }
+    }
+    free_topk_rows(rows, num_rows);
+    if (columns) {
+        free_projection(&projection);
+    }
+    if (where) {
+        free_predicate(&predicate);
+    }
+
+    if (top_status != TOPK_OP_SUCCESS) {
+        return -1;
+    }
+    printf("%zu row(s)\n", num_rows);
+    return 0;
+}
+
+// Same format as print_row_values, the left row's cells followed by the right one's
+static int print_joined_row(row_t left, row_t right, void *ctx) {
+    printf("(");
+    for (size_t i = 0; i < left.num_cells + right.num_cells; i++) {
+        if (i > 0) {
+            printf(" && ");
+        }
+        print_cell(i < left.num_cells ? &left.cells[i] : &right.cells[i - left.num_cells]);
+    }
+    printf(")\n");
+    return 0;
+}
+
+// "<right file>:<column>[=<right column>]", column names can't hold a colon so the last one splits
+static int run_join(int fd, const char *filepath, header_t header, char *where, char *join_spec,
+                    size_t memory_budget) {
+    char *colon = strrchr(join_spec, ':');
+    if (colon == NULL || colon == join_spec) {
+        fprintf(stderr, "The provided join is malformatted, expected \"<file>:<column>[=<column>]\".\n");
+        return -1;
+    }
+    *colon = '\0';
+    const char *right_path = join_spec;
+    const char *join_columns = colon + 1;
+
+    int right_fd;
+    if (open_file(right_path, &right_fd) != FILE_SUCCESS) {
+        fprintf(stderr, "Failed to open the table to join with.\n");
+        return -1;
+    }
+    header_t right_header;
+    int ret = -1;
+    if (is_manifest(right_fd)) {
+        fprintf(stderr, "Joins aren't supported on partitioned tables.\n");
+    } else if (lseek(right_fd, 0, SEEK_SET) == -1 || read_header(right_fd, &right_header) != HEADER_OP_SUCCESS) {
+        fprintf(stderr, "Failed to read the header of the table to join with.\n");
+    } else {
+        ret = 0;
+    }
+    if (ret != 0) {
+        close(right_fd);
+        return -1;
+    }
+
+    size_t left_col;
+    size_t right_col;
+    predicate_t predicate;
+    JoinOpStatus jop_status = parse_join_columns(header, right_header, join_columns, &left_col, &right_col);
+    if (jop_status == JOIN_OP_ERROR_UNKNOWN_COLUMN) {
+        fprintf(stderr, "The join refers to an unknown column.\n");
+        ret = -1;
+    } else if (jop_status == JOIN_OP_ERROR_TYPE_MISMATCH) {
+        fprintf(stderr, "Tables can only be joined on two int, two int64 or two string columns.\n");
+        ret = -1;
+    } else if (jop_status != JOIN_OP_SUCCESS) {
+        fprintf(stderr, "The provided join is malformatted, expected \"<file>:<column>[=<column>]\".\n");
+        ret = -1;
+    } else if (where && parse_where(header, where, &predicate) != 0) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        size_t joined = 0;
+        jop_status = join_tables(filepath, fd, header, left_col, where ? &predicate : NULL, right_path, right_fd,
+                                 right_header, right_col, memory_budget, print_joined_row, NULL, &joined);
+        if (where) {
+            free_predicate(&predicate);
+        }
+        if (jop_status != JOIN_OP_SUCCESS) {
+            fprintf(stderr, "Failed to join the tables.\n");
+            ret = -1;
+        } else {
+            printf("%zu row(s)\n", joined);
+        }
+    }
+
+    free_header(&right_header);
+    if (close(right_fd) == -1) {
+        fprintf(stderr, "Failed to close the table to join with.\n");
+        ret = -1;
+    }
+    return ret;
+}
+
+// Same format as print_row_values, the key cells followed by the aggregates
+static int print_group(row_t keys, const agg_result_t *results, void *ctx) {
+    size_t num_aggs = *(const size_t *) ctx;
+    printf("(");
+    for (size_t i = 0; i < keys.num_cells + num_aggs; i++) {
+        if (i > 0) {
+            printf(" && ");
+        }
+        if (i >= keys.num_cells) {
+            const agg_result_t *result = &results[i - keys.num_cells];
+            if (result->is_float) {
+                printf("%f", result->float_value);
+            } else {
+                printf("%" PRId64, result->int_value);
+            }
+        } else {
+            print_cell(&keys.cells[i]);
+        }
+    }
+    printf(")\n");
+    return 0;
+}
+
+static int run_group(int fd, const char *filepath, header_t header, char *where, const char *group_keys,
+                     const char *aggregates, size_t memory_budget, threadpool_t *pool) {
+    group_by_t group_by;
+    GroupOpStatus gop_status = parse_group_by(header, group_keys, aggregates, &group_by);
+    if (gop_status == GROUP_OP_ERROR_UNKNOWN_COLUMN) {
+        fprintf(stderr, "The grouping refers to an unknown column.\n");
+        return -1;
+    } else if (gop_status == GROUP_OP_ERROR_TYPE_MISMATCH) {
+        fprintf(stderr, "Groups are keyed on int, int64 or string columns and aggregate numeric columns.\n");
+        return -1;
+    } else if (gop_status != GROUP_OP_SUCCESS) {
+        fprintf(stderr, "The provided grouping is malformatted, expected \"<column>[,<column>...]\" and "
+                        "\"count|sum(<column>)|min(<column>)|max(<column>)|avg(<column>)[,...]\".\n");
+        return -1;
+    }
+
+    predicate_t predicate;
+    if (where && parse_where(header, where, &predicate) != 0) {
+        free_group_by(&group_by);
+        return -1;
+    }
+
+    tombstone_t tombstones;
+    size_t num_groups = 0;
+    if (load_tombstones(filepath, fd, &tombstones) != TOMBSTONE_OP_SUCCESS) {
+        fprintf(stderr, "Failed to load the tombstones.\n");
+        gop_status = GROUP_OP_READ_ERROR;
+    } else {
+        gop_status = group_rows(filepath, fd, header, &tombstones, where ? &predicate : NULL, &group_by, memory_budget,
+                                pool, print_group, &group_by.num_aggs, &num_groups);
+        free_tombstones(&tombstones);
+        if (gop_status != GROUP_OP_SUCCESS) {
+            fprintf(stderr, "Failed to group the rows.\n");
+        }
+    }
+    free_group_by(&group_by);
+    if (where) {
+        free_predicate(&predicate);
+    }
+
+    if (gop_status != GROUP_OP_SUCCESS) {
+        return -1;
+    }
+    printf("%zu group(s)\n", num_groups);
+    return 0;
+}
+
+// Registers the aggregates of register_aggs, if any, then prints every registered one, only
+// reading the rows appended since they were last brought up to date
+static int run_rollups(int fd, const char *filepath, header_t header, const char *register_aggs) {
+    rollups_t rollups;
+    RollupOpStatus rop_status;
+    if (register_aggs) {
+        rop_status = register_rollups(filepath, fd, header, register_aggs, &rollups);
+    } else {
+        rop_status = load_rollups(filepath, fd, header, &rollups);
+        if (rop_status == ROLLUP_OP_SUCCESS) {
+            rop_status = refresh_rollups(filepath, fd, header, &rollups);
+            if (rop_status != ROLLUP_OP_SUCCESS) {
+                free_rollups(&rollups);
+            }
+        }
+    }
+    if (rop_status == ROLLUP_OP_ERROR_UNKNOWN_COLUMN) {
+        fprintf(stderr, "The aggregates refer to an unknown column.\n");
+        return -1;
+    } else if (rop_status == ROLLUP_OP_ERROR_TYPE_MISMATCH) {
+        fprintf(stderr, "Only numeric columns can be aggregated.\n");
+        return -1;
+    } else if (rop_status == ROLLUP_OP_ERROR_INVALID_ARG) {
+        fprintf(stderr, "The provided aggregates are malformatted, expected "
+                        "\"count|sum(<column>)|min(<column>)|max(<column>)|avg(<column>)[,...]\".\n");
+        return -1;
+    } else if (rop_status != ROLLUP_OP_SUCCESS) {
+        fprintf(stderr, "Failed to compute the rollups.\n");
+        return -1;
+    }
+    if (rollups.fd == -1) {
+        fprintf(stderr, "No aggregate is registered on the table, use -R.\n");
+        return -1;
+    }
+
+    static const char *names[] = {"count", "sum", "min", "max", "avg"};
+    agg_result_t results[GROUP_MAX_AGGREGATES];
+    rollup_results(&rollups, results);
+    for (size_t i = 0; i < rollups.num_rollups; i++) {
+        const aggregate_t *agg = &rollups.aggregates[i];
+        if (agg->fn == AGG_COUNT) {
+            printf("count: ");
+        } else {
+            const column_t *column = &header.columns[agg->col_index];
+            printf("%s(%.*s): ", names[agg->fn], (int) column->name_length, column->name);
+        }
+        if (results[i].is_float) {
+            printf("%f\n", results[i].float_value);
+        } else {
+            printf("%" PRId64 "\n", results[i].int_value);
+        }
+    }
+    printf("%zu aggregate(s)\n", rollups.num_rollups);
+    free_rollups(&rollups);
+    return 0;
+}
+
+static int run_delete(int fd, const char *filepath, header_t header, char *where) {
+    predicate_t predicate;
+    if (parse_where(header, where, &predicate) != 0) {
+        return -1;
+    }
+
+    size_t deleted = 0;
+    DeleteOpStatus dop_status = delete_rows(filepath, fd, header, &predicate, &deleted);
+    free_predicate(&predicate);
+    if (dop_status != DELETE_OP_SUCCESS) {
+        fprintf(stderr, "Failed to delete rows.\n");
+        return -1;
+    }
+
+    printf("Deleted %zu row(s)\n", deleted);
+    return 0;
+}
+
+static int run_compact(int fd, const char *filepath, header_t header) {
+    size_t removed = 0;
+    DeleteOpStatus dop_status = compact_table(filepath, fd, header, &removed);
+    switch (dop_status) {
+        case DELETE_OP_SUCCESS:
+            printf("Compaction removed %zu row(s)\n", removed);
+            return 0;
+        case DELETE_OP_RENAME_ERROR:
+            fprintf(stderr, "Failed to move the compacted file into place.\n");
+            break;
+        case DELETE_OP_TOMBSTONE_ERROR:
+            fprintf(stderr, "Compaction succeeded but the tombstones couldn't be cleared.\n");
+            break;
+        default:
+            fprintf(stderr, "Failed to compact the file.\n");
+            break;
+    }
+    return -1;
+}
+
+static int run_sort(int fd, const char *filepath, header_t header, const char *sort_keys, const char *output_path,
+                    size_t memory_budget) {
+    projection_t keys;
+    if (parse_select(header, sort_keys, NULL, &keys) != 0) {
+        return -1;
+    }
+
+    size_t num_rows = 0;
+    size_t num_runs = 0;
+    SortOpStatus sop_status = sort_table(filepath, fd, header, keys.columns, keys.num_cols, output_path, memory_budget,
+                                         &num_rows, &num_runs);
+    free_projection(&keys);
+    switch (sop_status) {
+        case SORT_OP_SUCCESS:
+            printf("Sorted %zu row(s) in %zu run(s)\n", num_rows, num_runs);
+            return 0;
+        case SORT_OP_ERROR_EXISTS:
+            fprintf(stderr, "The output file already exists.\n");
+            break;
+        case SORT_OP_RENAME_ERROR:
+            fprintf(stderr, "Failed to move the sorted file into place.\n");
+            break;
+        case SORT_OP_TOMBSTONE_ERROR:
+            fprintf(stderr, "Sorting succeeded but the tombstones couldn't be cleared.\n");
+            break;
+        default:
+            fprintf(stderr, "Failed to sort the file.\n");
+            break;
+    }
+    return -1;
+}
+
+// "-" exports to stdout, so everything but the stream goes to stderr
+static int open_export(const char *export_path, header_t header, arrow_writer_t *writer_out) {
+    int out_fd = STDOUT_FILENO;
+    if (strcmp(export_path, "-") != 0) {
+        out_fd = open(export_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd == -1) {
+            fprintf(stderr, "Failed to open the export file.\n");
+            return -1;
+        }
+    }
+
+    if (open_arrow_writer(out_fd, header, ARROW_BATCH_ROWS, writer_out) != EXPORT_OP_SUCCESS) {
+        fprintf(stderr, "Failed to write the Arrow schema.\n");
+        if (out_fd != STDOUT_FILENO) {
+            close(out_fd);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+static int close_export(arrow_writer_t *writer) {
+    int out_fd = writer->out_fd;
+    size_t total_rows = writer->total_rows;
+    ExportOpStatus eop_status = close_arrow_writer(writer);
+    size_t num_batches = writer->num_batches;
+
+    int ret = 0;
+    if (out_fd != STDOUT_FILENO && close(out_fd) == -1) {
+        ret = -1;
+    }
+    if (eop_status != EXPORT_OP_SUCCESS || ret != 0) {
+        fprintf(stderr, "Failed to write the Arrow stream.\n");
+        return -1;
+    }
+
+    fprintf(stderr, "Exported %zu row(s) in %zu record batch(es)\n", total_rows, num_batches);
+    return 0;
+}
+
+static int run_export(int fd, const char *filepath, header_t header, char *where, const char *export_path,
+                      threadpool_t *pool) {
+    predicate_t predicate;
+    if (where && parse_where(header, where, &predicate) != 0) {
+        return -1;
+    }
+
+    tombstone_t tombstones;
+    if (load_tombstones(filepath, fd, &tombstones) != TOMBSTONE_OP_SUCCESS) {
+        fprintf(stderr, "Failed to load the tombstones.\n");
+        if (where) {
+            free_predicate(&predicate);
+        }
+        return -1;
+    }
+
+    int ret = 0;
+    arrow_writer_t writer;
+    if (open_export(export_path, header, &writer) != 0) {
+        ret = -1;
+    } else {
+        ScanOpStatus scan_status = scan_rows_parallel(fd, header, &tombstones, where ? &predicate : NULL, NULL,
+                                                      arrow_scan_callback, &writer, pool);
+        if (scan_status != SCAN_OP_SUCCESS) {
+            fprintf(stderr, "Failed to scan the rows.\n");
+            ret = -1;
+        }
+        if (close_export(&writer) != 0) {
+            ret = -1;
+        }
+    }
+
+    free_tombstones(&tombstones);
+    if (where) {
+        free_predicate(&predicate);
+    }
+    return ret;
+}
+
+static int run_ingest(int fd, const char *filepath, header_t *header, size_t num_threads) {
+    if (upgrade_table(filepath, fd, header) != WRITER_OP_SUCCESS) {
+        fprintf(stderr, "Failed to upgrade the table to the current header.\n");
+        return -1;
+    }
+
+    // Registered aggregates are folded by the writer and published with every batch
+    rollups_t rollups;
+    if (load_rollups(filepath, fd, *header, &rollups) != ROLLUP_OP_SUCCESS) {
+        fprintf(stderr, "Failed to load the rollups.\n");
+        return -1;
+    }
+    if (refresh_rollups(filepath, fd, *header, &rollups) != ROLLUP_OP_SUCCESS) {
+        fprintf(stderr, "Failed to refresh the rollups.\n");
+        free_rollups(&rollups);
+        return -1;
+    }
+
+    append_writer_t writer;
+    if (open_writer(fd, header, &writer) != WRITER_OP_SUCCESS) {
+        fprintf(stderr, "Failed to open the append writer.\n");
+        free_rollups(&rollups);
+        return -1;
+    }
+    writer.rollups = &rollups;
+
+    // With a spare core, lines are parsed here while the flusher thread encodes and writes the previous ones
+    ingest_queue_t *queue = NULL;
+    if (num_threads > 1 && open_ingest_queue(&writer, INGEST_QUEUE_CAPACITY, INGEST_BLOCK, &queue) != INGEST_OP_SUCCESS) {
+        fprintf(stderr, "Failed to start the ingest queue.\n");
+        close_writer(&writer);
+        free_rollups(&rollups);
+        return -1;
+    }
+
+    // One row per line, in the same format as -a
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t line_length;
+    size_t line_num = 0;
+    size_t appended = 0;
+    int ret = 0;
+
+    while ((line_length = getline(&line, &line_capacity, stdin)) != -1) {
+        line_num++;
+        if (line_length > 0 && line[line_length - 1] == '\n') {
+            line[--line_length] = '\0';
+        }
+        if (line_length == 0) {
+            continue;
+        }
+
+        row_t parsed_row;
+        if (parse_row(*header, line, &parsed_row) != APPEND_OP_SUCCESS) {
+            fprintf(stderr, "Failed to parse row on line %zu.\n", line_num);
+            ret = -1;
+            break;
+        }
+        int failed;
+        if (queue != NULL) {
+            failed = ingest_enqueue(queue, parsed_row) != INGEST_OP_SUCCESS;
+            if (failed) {
+                free_row(&parsed_row, parsed_row.num_cells);
+            }
+        } else {
+            failed = writer_append(&writer, parsed_row) != WRITER_OP_SUCCESS;
+            free_row(&parsed_row, parsed_row.num_cells);
+        }
+        if (failed) {
+            fprintf(stderr, "Failed to write row on line %zu.\n", line_num);
+            ret = -1;
+            break;
+        }
+        appended++;
+    }
+    free(line);
+
+    if (queue != NULL && close_ingest_queue(queue) != INGEST_OP_SUCCESS) {
+        fprintf(stderr, "Failed to write the rows.\n");
+        close_writer(&writer);
+        free_rollups(&rollups);
+        return -1;
+    }
+
+    // Rows parsed before an error are kept, like separate -a calls would have done
+    WriterOpStatus wop_status = close_writer(&writer);
+    free_rollups(&rollups);
+    if (wop_status != WRITER_OP_SUCCESS) {
+        fprintf(stderr, "Failed to close the append writer.\n");
+        return -1;
+    }
+
+    printf("Appended %zu row(s)\n", appended);
+    return ret;
+}
+
+static int run_partitioned(const char *filepath, char *row, int scan, char *where, const char *columns,
+                           char *delete_where, int compact, const char *export_path, threadpool_t *pool) {
+    manifest_t manifest;
+    if (read_manifest(filepath, &manifest) != PARTITION_OP_SUCCESS) {
+        fprintf(stderr, "Failed to read the partition manifest.\n");
+        return -1;
+    }
+
+    int ret = 0;
+    PartitionOpStatus pop_status;
+
+    if (row) {
+        row_t parsed_row;
+        if (parse_row(manifest.header, row, &parsed_row) != APPEND_OP_SUCCESS) {
+            fprintf(stderr, "Failed to parse row.\n");
+            ret = -1;
+        } else {
+            pop_status = append_partitioned(&manifest, parsed_row);
+            free_row(&parsed_row, parsed_row.num_cells);
+            if (pop_status != PARTITION_OP_SUCCESS) {
+                fprintf(stderr, "Failed to append the row to its partition.\n");
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0 && delete_where) {
+        predicate_t predicate;
+        if (parse_where(manifest.header, delete_where, &predicate) != 0) {
+            ret = -1;
+        } else {
+            size_t deleted = 0;
+            pop_status = delete_partitioned(&manifest, &predicate, &deleted);
+            free_predicate(&predicate);
+            if (pop_status != PARTITION_OP_SUCCESS) {
+                fprintf(stderr, "Failed to delete rows.\n");
+                ret = -1;
+            } else {
+                printf("Deleted %zu row(s)\n", deleted);
+            }
+        }
+    }
+
+    if (ret == 0 && scan) {
+        predicate_t predicate;
+        projection_t projection;
+        if (where && parse_where(manifest.header, where, &predicate) != 0) {
+            ret = -1;
+        } else if (columns && parse_select(manifest.header, columns, where ? &predicate : NULL, &projection) != 0) {
+            if (where) {
+                free_predicate(&predicate);
+            }
+            ret = -1;
+        } else {
+            print_ctx_t print_ctx = {
+                .lock = PTHREAD_MUTEX_INITIALIZER, .matched = 0, .projection = columns ? &projection : NULL
+            };
+            pop_status = scan_partitions(&manifest, where ? &predicate : NULL, print_ctx.projection, print_scanned_row,
+                                         &print_ctx, pool);
+            if (columns) {
+                free_projection(&projection);
+            }
+            if (where) {
+                free_predicate(&predicate);
+            }
+            if (pop_status != PARTITION_OP_SUCCESS) {
+                fprintf(stderr, "Failed to scan the partitions.\n");
+                ret = -1;
+            } else {
+                printf("%zu row(s)\n", print_ctx.matched);
+            }
+        }
+    }
+
+    if (ret == 0 && export_path) {
+        predicate_t predicate;
+        arrow_writer_t writer;
+        if (where && parse_where(manifest.header, where, &predicate) != 0) {
+            ret = -1;
+        } else {
+            if (open_export(export_path, manifest.header, &writer) != 0) {
+                ret = -1;
+            } else {
+                // Rows arrive from the workers in no particular order
+                pop_status = scan_partitions(&manifest, where ? &predicate : NULL, NULL, arrow_scan_callback, &writer,
+                                             pool);
+                if (pop_status != PARTITION_OP_SUCCESS) {
+                    fprintf(stderr, "Failed to scan the partitions.\n");
+                    ret = -1;
+                }
+                if (close_export(&writer) != 0) {
+                    ret = -1;
+                }
+            }
+            if (where) {
+                free_predicate(&predicate);
+            }
+        }
+    }
+
+    if (ret == 0 && compact) {
+        size_t removed = 0;
+        if (compact_partitioned(&manifest, &removed) != PARTITION_OP_SUCCESS) {
+            fprintf(stderr, "Failed to compact the partitions.\n");
+            ret = -1;
+        } else {
+            printf("Compaction removed %zu row(s)\n", removed);
+        }
+    }
+
+    free_manifest(&manifest);
+    return ret;
+}
 
 int main(int argc, char *argv[]) {
     int newfile = 0;
     char *filepath = NULL;
     char *schema = NULL;
     char *row = NULL;
+    int scan = 0;
+    char *where = NULL;
+    char *columns = NULL;
+    char *delete_where = NULL;
+    int compact = 0;
+    char *topk_spec = NULL;
+    char *sort_keys = NULL;
+    char *output_path = NULL;
+    char *join_spec = NULL;
+    char *group_keys = NULL;
+    char *aggregates = NULL;
+    char *register_aggs = NULL;
+    int query_rollups = 0;
+    size_t memory_budget = 0;
+    char *partition_spec = NULL;
+    int ingest = 0;
+    char *export_path = NULL;
+    char *socket_path = NULL;
+    size_t num_threads = default_thread_count();
     
     int opt;
-    char *optstring = ":f:ns:a:";
-    while ((opt = getopt(argc, argv, optstring)) != -1) {
+    char *optstring = ":f:ns:a:rw:p:t:J:g:A:R:qd:ck:o:m:P:ie:S:j:";
+    struct option long_options[] = {
+        {"stats", no_argument, NULL, OPTION_STATS},
+        {NULL, 0, NULL, 0}
+    };
+    while ((opt = getopt_long(argc, argv, optstring, long_options, NULL)) != -1) {
         switch (opt) {
             case 'f':
                 filepath = optarg;
@@ -29,6 +828,80 @@ int main(int argc, char *argv[]) {
             case 'a':
                 row = optarg;
                 break;
+            case 'r':
+                scan = 1;
+                break;
+            case 'w':
+                where = optarg;
+                break;
+            case 'p':
+                columns = optarg;
+                break;
+            case 't':
+                topk_spec = optarg;
+                break;
+            case 'J':
+                join_spec = optarg;
+                break;
+            case 'g':
+                group_keys = optarg;
+                break;
+            case 'A':
+                aggregates = optarg;
+                break;
+            case 'R':
+                register_aggs = optarg;
+                break;
+            case 'q':
+                query_rollups = 1;
+                break;
+            case 'd':
+                delete_where = optarg;
+                break;
+            case 'c':
+                compact = 1;
+                break;
+            case 'k':
+                sort_keys = optarg;
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'm': {
+                char *end;
+                unsigned long value = strtoul(optarg, &end, 10);
+                if (*end != '\0' || value == 0) {
+                    fprintf(stderr, "The memory budget must be a positive number of MiB.\n");
+                    return -1;
+                }
+                memory_budget = value * 1024 * 1024;
+                break;
+            }
+            case 'P':
+                partition_spec = optarg;
+                break;
+            case 'i':
+                ingest = 1;
+                break;
+            case 'e':
+                export_path = optarg;
+                break;
+            case 'S':
+                socket_path = optarg;
+                break;
+            case 'j': {
+                char *end;
+                unsigned long value = strtoul(optarg, &end, 10);
+                if (*end != '\0' || value == 0) {
+                    fprintf(stderr, "The number of threads must be a positive integer.\n");
+                    return -1;
+                }
+                num_threads = value;
+                break;
+            }
+            case OPTION_STATS:
+                atexit(dump_stats);
+                break;
             case ':':
                 fprintf(stderr, "Missing argument for option: -%c\n", optopt);
                 return -1;
@@ -38,6 +911,16 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (socket_path) {
+        // Tables are named by the requests, not on the command line
+        ServerOpStatus sop_status = run_server(socket_path, memory_budget);
+        if (sop_status != SERVER_OP_SUCCESS) {
+            fprintf(stderr, sop_status == SERVER_OP_SOCKET_ERROR ? "Failed to listen on the socket.\n" : "The server failed.\n");
+            return -1;
+        }
+        return 0;
+    }
+
     if (!filepath) {
         fprintf(stderr, "File path is missing\n");
         return -1;
@@ -79,6 +962,79 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
+    if (partition_spec && !(schema && newfile)) {
+        fprintf(stderr, "Partitioning can only be chosen when creating a file with a schema.\n");
+        if (close(fd) == -1) {
+            fprintf(stderr, "Failed to close the file..\n");
+        }
+        return -1;
+    }
+
+    if (partition_spec) {
+        // The file becomes a manifest, the rows live in <file_path>.p<id>
+        manifest_t manifest;
+        PartitionOpStatus pop_status = create_manifest(filepath, schema, partition_spec, &manifest);
+        if (close(fd) == -1) {
+            fprintf(stderr, "Failed to close the file..\n");
+        }
+        if (pop_status != PARTITION_OP_SUCCESS) {
+            fprintf(stderr, "Failed to create the partitioned table, check the schema and the partitioning.\n");
+            unlink(filepath);
+            return -1;
+        }
+
+        printf("Parsed schema:\n\n");
+        print_parsed_schema(manifest.header.columns, manifest.header.num_cols);
+        free_manifest(&manifest);
+        return 0;
+    }
+
+    if (output_path && !sort_keys) {
+        fprintf(stderr, "An output file is only written when sorting, see -k.\n");
+        if (close(fd) == -1) {
+            fprintf(stderr, "Failed to close the file..\n");
+        }
+        return -1;
+    }
+
+    if (columns && (join_spec || export_path)) {
+        fprintf(stderr, "Joins and exports always output every column, -p only applies to -r and -t.\n");
+        if (close(fd) == -1) {
+            fprintf(stderr, "Failed to close the file..\n");
+        }
+        return -1;
+    }
+
+    if (!newfile && is_manifest(fd)) {
+        if (sort_keys || topk_spec || join_spec || group_keys || register_aggs || query_rollups) {
+            fprintf(stderr, "Sorting, top-K queries, joins, groupings and rollups aren't supported on partitioned tables.\n");
+            if (close(fd) == -1) {
+                fprintf(stderr, "Failed to close the file.\n");
+            }
+            return -1;
+        }
+        if (ingest) {
+            fprintf(stderr, "Ingesting from stdin isn't supported on partitioned tables, use -a.\n");
+            if (close(fd) == -1) {
+                fprintf(stderr, "Failed to close the file.\n");
+            }
+            return -1;
+        }
+        threadpool_t *pool = NULL;
+        if ((scan || export_path) && num_threads > 1 && threadpool_create(num_threads, &pool) != THREADPOOL_OP_SUCCESS) {
+            fprintf(stderr, "Failed to start the worker threads.\n");
+            close(fd);
+            return -1;
+        }
+        int ret = run_partitioned(filepath, row, scan, where, columns, delete_where, compact, export_path, pool);
+        threadpool_destroy(pool);
+        if (close(fd) == -1) {
+            fprintf(stderr, "Failed to close the file.\n");
+            return -1;
+        }
+        return ret;
+    }
+
     if (schema && newfile) {
         // Schema parsing
         SchemaOpStatus sop_status;
@@ -157,7 +1113,7 @@ int main(int argc, char *argv[]) {
         printf("Read header:\n\n");
         print_header(rheader);
 
-        free_columns(rheader.columns, rheader.num_cols);
+        free_header(&rheader);
 #endif // VERIFY_HEADER
 
         if (row) {
@@ -190,7 +1146,7 @@ int main(int argc, char *argv[]) {
             aop_status = parse_row(header, row, &parsed_row);
             if (aop_status != APPEND_OP_SUCCESS) {
                 fprintf(stderr, "Failed to parse row.\n");
-                free_columns(header.columns, header.num_cols);
+                free_header(&header);
                 if (close(fd) == -1) {
                     fprintf(stderr, "File closing failed.\n");
                 }
@@ -200,11 +1156,46 @@ int main(int argc, char *argv[]) {
             printf("Parsed row:\n\n");
             print_parsed_row(parsed_row, parsed_row.num_cells);
 
-            // For safety, let's get to the end of the file, should have used O_APPEND...
-            if (lseek(fd, 0, SEEK_END) == -1) {
+            // Tables written by older versions get the current header before their first append
+            if (upgrade_table(filepath, fd, &header) != WRITER_OP_SUCCESS) {
+                fprintf(stderr, "Failed to upgrade the table to the current header.\n");
+                free_row(&parsed_row, parsed_row.num_cells);
+                free_header(&header);
+                if (close(fd) == -1) {
+                    fprintf(stderr, "File closing failed.\n");
+                }
+                return -1;
+            }
+
+            // Registered aggregates are brought up to date first, so the row can simply be folded in
+            rollups_t rollups;
+            if (load_rollups(filepath, fd, header, &rollups) != ROLLUP_OP_SUCCESS) {
+                fprintf(stderr, "Failed to load the rollups.\n");
+                free_row(&parsed_row, parsed_row.num_cells);
+                free_header(&header);
+                if (close(fd) == -1) {
+                    fprintf(stderr, "File closing failed.\n");
+                }
+                return -1;
+            }
+            if (refresh_rollups(filepath, fd, header, &rollups) != ROLLUP_OP_SUCCESS) {
+                fprintf(stderr, "Failed to refresh the rollups.\n");
+                free_rollups(&rollups);
+                free_row(&parsed_row, parsed_row.num_cells);
+                free_header(&header);
+                if (close(fd) == -1) {
+                    fprintf(stderr, "File closing failed.\n");
+                }
+                return -1;
+            }
+
+            // Rows start at the logical end, the file may be longer because of preallocated space
+            STATS_SYSCALL(IO_ROWS, IO_SEEK, 0);
+            if (lseek(fd, header.data_end, SEEK_SET) == -1) {
                 fprintf(stderr, "Failed to seek to end of file.\n");
+                free_rollups(&rollups);
                 free_row(&parsed_row, parsed_row.num_cells);
-                free_columns(header.columns, header.num_cols);
+                free_header(&header);
                 if (close(fd) == -1) {
                     fprintf(stderr, "File closing failed.\n");
                 }
@@ -212,11 +1203,12 @@ int main(int argc, char *argv[]) {
             }
 
             // Write row
-            aop_status = write_row(fd, parsed_row);
+            aop_status = write_row(fd, header, parsed_row);
             if (aop_status != APPEND_OP_SUCCESS) {
                 fprintf(stderr, "Failed to write row.\n");
+                free_rollups(&rollups);
                 free_row(&parsed_row, parsed_row.num_cells);
-                free_columns(header.columns, header.num_cols);
+                free_header(&header);
                 if (close(fd) == -1) {
                     fprintf(stderr, "File closing failed.\n");
                 }
@@ -225,11 +1217,27 @@ int main(int argc, char *argv[]) {
 
             // Update the header: both in-memory and also on disk.
             HeaderOpStatus huop_status;
-            huop_status = update_header_num_rows(fd, 1, &header);
+            huop_status = update_header_num_rows(fd, 1, header.data_end + row_encoded_size(parsed_row), &header);
             if (huop_status != HEADER_OP_SUCCESS) {
                 fprintf(stderr, "Failed to update the header.\n");
+                free_rollups(&rollups);
                 free_row(&parsed_row, parsed_row.num_cells);
-                free_columns(header.columns, header.num_cols);
+                free_header(&header);
+                if (close(fd) == -1) {
+                    fprintf(stderr, "File closing failed.\n");
+                }
+                return -1;
+            }
+
+            // The header made the row visible, the rollups now cover it too
+            fold_rollups(&rollups, parsed_row);
+            // Unless a delete reset them meanwhile, then the next reader recomputes them
+            RollupOpStatus rop_status = publish_rollups(&rollups, header);
+            free_rollups(&rollups);
+            if (rop_status != ROLLUP_OP_SUCCESS && rop_status != ROLLUP_OP_STALE) {
+                fprintf(stderr, "Failed to update the rollups.\n");
+                free_row(&parsed_row, parsed_row.num_cells);
+                free_header(&header);
                 if (close(fd) == -1) {
                     fprintf(stderr, "File closing failed.\n");
                 }
@@ -237,7 +1245,7 @@ int main(int argc, char *argv[]) {
             }
 
             free_row(&parsed_row, parsed_row.num_cells);
-            free_columns(header.columns, header.num_cols);
+            free_header(&header);
 
 #ifdef VERIFY_ROW
             // Seek to start of file to read the header and the first row
@@ -255,7 +1263,7 @@ int main(int argc, char *argv[]) {
             if (verify_row_hop_status != HEADER_OP_SUCCESS) {
                 fprintf(stderr, "Failed to read header when verifying row.\n");
                 free_row(&parsed_row, parsed_row.num_cells);
-                free_columns(header.columns, header.num_cols);
+                free_header(&header);
                 if (close(fd) == -1) {
                     fprintf(stderr, "File closing failed.\n");
                 }
@@ -268,7 +1276,7 @@ int main(int argc, char *argv[]) {
             if (aop_read_first_row_status != APPEND_OP_SUCCESS) {
                 fprintf(stderr, "Failed to read row for verification.\n");
                 free_row(&parsed_row, parsed_row.num_cells);
-                free_columns(verify_row_header.columns, verify_row_header.num_cols);
+                free_header(&verify_row_header);
                 if (close(fd) == -1) {
                     fprintf(stderr, "File closing failed.\n");
                 }
@@ -279,9 +1287,81 @@ int main(int argc, char *argv[]) {
             print_parsed_row(first_row, first_row.num_cells);
 
             free_row(&first_row, first_row.num_cells);
-            free_columns(verify_row_header.columns, verify_row_header.num_cols);
+            free_header(&verify_row_header);
 #endif // VERIFY_ROW
         }
+
+        if (ingest || delete_where || scan || topk_spec || join_spec || group_keys || register_aggs || query_rollups
+            || export_path || sort_keys || compact) {
+            STATS_SYSCALL(IO_HEADER, IO_SEEK, 0);
+            if (lseek(fd, 0, SEEK_SET) == -1) {
+                fprintf(stderr, "Failed to seek in file.\n");
+                if (close(fd) == -1) {
+                    fprintf(stderr, "File closing failed.\n");
+                }
+                return -1;
+            }
+
+            HeaderOpStatus hop_status;
+            header_t header;
+            hop_status = read_header(fd, &header);
+            if (hop_status != HEADER_OP_SUCCESS) {
+                fprintf(stderr, "Failed to read header.\n");
+                if (close(fd) == -1) {
+                    fprintf(stderr, "File closing failed.\n");
+                }
+                return -1;
+            }
+
+            // Workers are only started for the operations that scan
+            threadpool_t *pool = NULL;
+            int ret = 0;
+            if ((scan || topk_spec || group_keys || export_path) && num_threads > 1
+                && threadpool_create(num_threads, &pool) != THREADPOOL_OP_SUCCESS) {
+                fprintf(stderr, "Failed to start the worker threads.\n");
+                ret = -1;
+            }
+            if (ret == 0 && ingest) {
+                ret = run_ingest(fd, filepath, &header, num_threads);
+            }
+            if (ret == 0 && delete_where) {
+                ret = run_delete(fd, filepath, header, delete_where);
+            }
+            if (ret == 0 && scan) {
+                ret = run_scan(fd, filepath, header, where, columns, pool);
+            }
+            if (ret == 0 && topk_spec) {
+                ret = run_topk(fd, filepath, header, where, columns, topk_spec, pool);
+            }
+            if (ret == 0 && join_spec) {
+                ret = run_join(fd, filepath, header, where, join_spec, memory_budget);
+            }
+            if (ret == 0 && group_keys) {
+                ret = run_group(fd, filepath, header, where, group_keys, aggregates, memory_budget, pool);
+            }
+            if (ret == 0 && (register_aggs || query_rollups)) {
+                ret = run_rollups(fd, filepath, header, register_aggs);
+            }
+            if (ret == 0 && export_path) {
+                ret = run_export(fd, filepath, header, where, export_path, pool);
+            }
+            if (ret == 0 && sort_keys) {
+                ret = run_sort(fd, filepath, header, sort_keys, output_path,
+                               memory_budget != 0 ? memory_budget : SORT_DEFAULT_MEMORY);
+            }
+            if (ret == 0 && compact) {
+                ret = run_compact(fd, filepath, header);
+            }
+
+            threadpool_destroy(pool);
+            free_header(&header);
+            if (ret != 0) {
+                if (close(fd) == -1) {
+                    fprintf(stderr, "File closing failed.\n");
+                }
+                return -1;
+            }
+        }
     }
 
     if (close(fd) == -1) {
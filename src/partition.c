@@ -0,0 +1,633 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <endian.h>
+#include <sys/stat.h>
+
+#include "partition.h"
+#include "file.h"
+#include "schema.h"
+#include "tombstone.h"
+#include "delete.h"
+#include "writer.h"
+#include "threadpool.h"
+#include "stats.h"
+
+/*
+ * Manifest layout, integers are big endian:
+ * "rfkm", version (uint8), kind (uint8), partition column (uint32), rows per partition or
+ * value width (uint64), next partition id (uint32), schema length (uint32) + schema text,
+ * number of partitions (uint32) and for each one: id (uint32), lo (int64), hi (int64).
+ */
+#define MANIFEST_FIXED_SIZE (4 + 1 + 1 + 4 + 8 + 4 + 4 + 4)
+#define MANIFEST_PARTITION_SIZE (4 + 8 + 8)
+
+
+int is_manifest(int fd) {
+    uint8_t magic[4];
+    STATS_SYSCALL(IO_INDEX, IO_READ, sizeof(magic));
+    if (pread(fd, magic, sizeof(magic), 0) != sizeof(magic)) {
+        return 0;
+    }
+    return memcmp(magic, "rfkm", sizeof(magic)) == 0;
+}
+
+char *partition_path(const manifest_t *manifest, uint32_t id) {
+    // Partitions sit next to the manifest: <manifest>.p<id>
+    size_t length = strlen(manifest->path) + 16;
+    char *path = (char *) malloc(length);
+    if (path == NULL) {
+        return NULL;
+    }
+    snprintf(path, length, "%s.p%u", manifest->path, id);
+    return path;
+}
+
+void free_manifest(manifest_t *manifest) {
+    free_header(&manifest->header);
+    free(manifest->path);
+    free(manifest->schema);
+    free(manifest->partitions);
+    manifest->path = NULL;
+    manifest->schema = NULL;
+    manifest->partitions = NULL;
+    manifest->num_partitions = 0;
+}
+
+static PartitionOpStatus build_schema_header(manifest_t *manifest) {
+    column_t *columns = NULL;
+    size_t num_cols;
+    if (parse_schema(manifest->schema, &columns, &num_cols) != SCHEMA_OP_SUCCESS) {
+        return PARTITION_OP_ERROR_SCHEMA;
+    }
+    if (initialize_header(columns, num_cols, &manifest->header) != HEADER_OP_SUCCESS) {
+        free_columns(columns, num_cols);
+        return PARTITION_OP_ERROR_SCHEMA;
+    }
+    if (build_column_lookup(&manifest->header) != HEADER_OP_SUCCESS) {
+        free_header(&manifest->header);
+        return PARTITION_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    return PARTITION_OP_SUCCESS;
+}
+
+static PartitionOpStatus parse_spec(manifest_t *manifest, char *spec) {
+    // "rows:<count>" or "value:<int or int64 column>:<width>"
+    char *end = NULL;
+    if (strncmp(spec, "rows:", 5) == 0) {
+        errno = 0;
+        unsigned long long rows = strtoull(&spec[5], &end, 10);
+        if (end == &spec[5] || *end != '\0' || errno == ERANGE || rows == 0) {
+            return PARTITION_OP_ERROR_INVALID_ARG;
+        }
+        manifest->kind = PARTITION_BY_ROWS;
+        manifest->col_index = 0;
+        manifest->param = rows;
+        return PARTITION_OP_SUCCESS;
+    }
+
+    if (strncmp(spec, "value:", 6) == 0) {
+        char *name = &spec[6];
+        char *colon = strchr(name, ':');
+        if (colon == NULL) {
+            return PARTITION_OP_ERROR_INVALID_ARG;
+        }
+        size_t col_index;
+        if (!find_column(manifest->header, name, colon - name, &col_index)
+            || (manifest->header.columns[col_index].data_type != CELL_TYPE_INT
+                && manifest->header.columns[col_index].data_type != CELL_TYPE_INT64)) {
+            return PARTITION_OP_ERROR_INVALID_ARG;
+        }
+        errno = 0;
+        unsigned long long width = strtoull(colon + 1, &end, 10);
+        if (end == colon + 1 || *end != '\0' || errno == ERANGE || width == 0) {
+            return PARTITION_OP_ERROR_INVALID_ARG;
+        }
+        manifest->kind = PARTITION_BY_VALUE;
+        manifest->col_index = col_index;
+        manifest->param = width;
+        return PARTITION_OP_SUCCESS;
+    }
+
+    return PARTITION_OP_ERROR_INVALID_ARG;
+}
+
+PartitionOpStatus create_manifest(const char *path, char *schema, char *spec, manifest_t *manifest_out) {
+    if (path == NULL || schema == NULL || spec == NULL || manifest_out == NULL) {
+        return PARTITION_OP_ERROR_INVALID_ARG;
+    }
+
+    manifest_t manifest = {0};
+    manifest.path = strdup(path);
+    manifest.schema = strdup(schema);
+    if (manifest.path == NULL || manifest.schema == NULL) {
+        free_manifest(&manifest);
+        return PARTITION_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    PartitionOpStatus status = build_schema_header(&manifest);
+    if (status == PARTITION_OP_SUCCESS) {
+        status = parse_spec(&manifest, spec);
+    }
+    if (status == PARTITION_OP_SUCCESS) {
+        status = write_manifest(&manifest);
+    }
+    if (status != PARTITION_OP_SUCCESS) {
+        free_manifest(&manifest);
+        return status;
+    }
+
+    *manifest_out = manifest;
+    return PARTITION_OP_SUCCESS;
+}
+
+static void put_u32(uint8_t *buffer, size_t *pos, uint32_t value) {
+    value = htobe32(value);
+    memcpy(&buffer[*pos], &value, sizeof(value));
+    *pos += sizeof(value);
+}
+
+static void put_u64(uint8_t *buffer, size_t *pos, uint64_t value) {
+    value = htobe64(value);
+    memcpy(&buffer[*pos], &value, sizeof(value));
+    *pos += sizeof(value);
+}
+
+static uint32_t get_u32(const uint8_t *buffer, size_t *pos) {
+    uint32_t value;
+    memcpy(&value, &buffer[*pos], sizeof(value));
+    *pos += sizeof(value);
+    return be32toh(value);
+}
+
+static uint64_t get_u64(const uint8_t *buffer, size_t *pos) {
+    uint64_t value;
+    memcpy(&value, &buffer[*pos], sizeof(value));
+    *pos += sizeof(value);
+    return be64toh(value);
+}
+
+PartitionOpStatus write_manifest(const manifest_t *manifest) {
+    if (manifest == NULL) {
+        return PARTITION_OP_ERROR_INVALID_ARG;
+    }
+
+    size_t schema_length = strlen(manifest->schema);
+    size_t size = MANIFEST_FIXED_SIZE + schema_length + manifest->num_partitions * MANIFEST_PARTITION_SIZE;
+    uint8_t *buffer = (uint8_t *) malloc(size);
+    if (buffer == NULL) {
+        return PARTITION_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    size_t pos = 0;
+    memcpy(buffer, "rfkm", 4);
+    pos += 4;
+    buffer[pos++] = MANIFEST_VERSION;
+    buffer[pos++] = (uint8_t) manifest->kind;
+    put_u32(buffer, &pos, (uint32_t) manifest->col_index);
+    put_u64(buffer, &pos, manifest->param);
+    put_u32(buffer, &pos, manifest->next_id);
+    put_u32(buffer, &pos, (uint32_t) schema_length);
+    memcpy(&buffer[pos], manifest->schema, schema_length);
+    pos += schema_length;
+    put_u32(buffer, &pos, (uint32_t) manifest->num_partitions);
+    for (size_t i = 0; i < manifest->num_partitions; i++) {
+        put_u32(buffer, &pos, manifest->partitions[i].id);
+        put_u64(buffer, &pos, (uint64_t) manifest->partitions[i].lo);
+        put_u64(buffer, &pos, (uint64_t) manifest->partitions[i].hi);
+    }
+
+    size_t path_length = strlen(manifest->path);
+    char *tmp_path = (char *) malloc(path_length + sizeof(MANIFEST_TMP_SUFFIX));
+    if (tmp_path == NULL) {
+        free(buffer);
+        return PARTITION_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    memcpy(tmp_path, manifest->path, path_length);
+    memcpy(&tmp_path[path_length], MANIFEST_TMP_SUFFIX, sizeof(MANIFEST_TMP_SUFFIX));
+
+    // Readers either see the old manifest or the new one, never a partial write
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        free(tmp_path);
+        free(buffer);
+        return PARTITION_OP_WRITE_ERROR;
+    }
+    // The new manifest keeps the permissions of the one it replaces
+    struct stat manifest_stat;
+    if (stat(manifest->path, &manifest_stat) == 0 && fchmod(fd, manifest_stat.st_mode & 07777) == -1) {
+        close(fd);
+        unlink(tmp_path);
+        free(tmp_path);
+        free(buffer);
+        return PARTITION_OP_WRITE_ERROR;
+    }
+    ssize_t bytes_written = write(fd, buffer, size);
+    STATS_SYSCALL(IO_INDEX, IO_WRITE, bytes_written);
+    free(buffer);
+    if (bytes_written < 0 || (size_t) bytes_written != size || fsync(fd) == -1) {
+        close(fd);
+        unlink(tmp_path);
+        free(tmp_path);
+        return PARTITION_OP_WRITE_ERROR;
+    }
+    if (close(fd) == -1 || rename(tmp_path, manifest->path) == -1) {
+        unlink(tmp_path);
+        free(tmp_path);
+        return PARTITION_OP_WRITE_ERROR;
+    }
+
+    free(tmp_path);
+    return PARTITION_OP_SUCCESS;
+}
+
+PartitionOpStatus read_manifest(const char *path, manifest_t *manifest_out) {
+    if (path == NULL || manifest_out == NULL) {
+        return PARTITION_OP_ERROR_INVALID_ARG;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return PARTITION_OP_READ_ERROR;
+    }
+    struct stat manifest_stat;
+    if (fstat(fd, &manifest_stat) == -1 || manifest_stat.st_size < MANIFEST_FIXED_SIZE) {
+        close(fd);
+        return PARTITION_OP_READ_ERROR;
+    }
+
+    size_t size = manifest_stat.st_size;
+    uint8_t *buffer = (uint8_t *) malloc(size);
+    if (buffer == NULL) {
+        close(fd);
+        return PARTITION_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    ssize_t bytes_read = read(fd, buffer, size);
+    STATS_SYSCALL(IO_INDEX, IO_READ, bytes_read);
+    close(fd);
+    if (bytes_read < 0 || (size_t) bytes_read != size || memcmp(buffer, "rfkm", 4) != 0 || buffer[4] != MANIFEST_VERSION) {
+        free(buffer);
+        return PARTITION_OP_READ_ERROR;
+    }
+
+    manifest_t manifest = {0};
+    size_t pos = 5;
+    manifest.kind = (partition_kind_t) buffer[pos++];
+    manifest.col_index = get_u32(buffer, &pos);
+    manifest.param = get_u64(buffer, &pos);
+    manifest.next_id = get_u32(buffer, &pos);
+    size_t schema_length = get_u32(buffer, &pos);
+    if (size - pos < schema_length + sizeof(uint32_t)) {
+        free(buffer);
+        return PARTITION_OP_READ_ERROR;
+    }
+
+    manifest.path = strdup(path);
+    manifest.schema = (char *) malloc(schema_length + 1);
+    if (manifest.path == NULL || manifest.schema == NULL) {
+        free(buffer);
+        free_manifest(&manifest);
+        return PARTITION_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    memcpy(manifest.schema, &buffer[pos], schema_length);
+    manifest.schema[schema_length] = '\0';
+    pos += schema_length;
+
+    manifest.num_partitions = get_u32(buffer, &pos);
+    if ((size - pos) / MANIFEST_PARTITION_SIZE < manifest.num_partitions) {
+        free(buffer);
+        free_manifest(&manifest);
+        return PARTITION_OP_READ_ERROR;
+    }
+    if (manifest.num_partitions > 0) {
+        manifest.partitions = (partition_t *) calloc(manifest.num_partitions, sizeof(partition_t));
+        if (manifest.partitions == NULL) {
+            free(buffer);
+            free_manifest(&manifest);
+            return PARTITION_OP_ERROR_MEMORY_ALLOCATION;
+        }
+    }
+    for (size_t i = 0; i < manifest.num_partitions; i++) {
+        manifest.partitions[i].id = get_u32(buffer, &pos);
+        manifest.partitions[i].lo = (int64_t) get_u64(buffer, &pos);
+        manifest.partitions[i].hi = (int64_t) get_u64(buffer, &pos);
+    }
+    free(buffer);
+
+    PartitionOpStatus status = build_schema_header(&manifest);
+    if (status != PARTITION_OP_SUCCESS) {
+        free_manifest(&manifest);
+        return status;
+    }
+    if (manifest.col_index >= manifest.header.num_cols) {
+        free_manifest(&manifest);
+        return PARTITION_OP_READ_ERROR;
+    }
+
+    *manifest_out = manifest;
+    return PARTITION_OP_SUCCESS;
+}
+
+static PartitionOpStatus open_partition(const manifest_t *manifest, const partition_t *partition, char **path_out,
+                                        int *fd_out, header_t *header_out) {
+    char *path = partition_path(manifest, partition->id);
+    if (path == NULL) {
+        return PARTITION_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    if (open_file(path, fd_out) != FILE_SUCCESS) {
+        free(path);
+        return PARTITION_OP_READ_ERROR;
+    }
+    if (read_header(*fd_out, header_out) != HEADER_OP_SUCCESS) {
+        close(*fd_out);
+        free(path);
+        return PARTITION_OP_READ_ERROR;
+    }
+    *path_out = path;
+    return PARTITION_OP_SUCCESS;
+}
+
+static PartitionOpStatus add_partition(manifest_t *manifest, int64_t lo, int64_t hi, size_t *index_out) {
+    partition_t *partitions = reallocarray(manifest->partitions, manifest->num_partitions + 1, sizeof(partition_t));
+    if (partitions == NULL) {
+        return PARTITION_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    manifest->partitions = partitions;
+
+    char *path = partition_path(manifest, manifest->next_id);
+    if (path == NULL) {
+        return PARTITION_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    // An orphan left by a crash before the manifest was updated is simply reused
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    free(path);
+    if (fd == -1) {
+        return PARTITION_OP_WRITE_ERROR;
+    }
+    HeaderOpStatus hop_status = write_header(fd, manifest->header);
+    if (close(fd) == -1 || hop_status != HEADER_OP_SUCCESS) {
+        return PARTITION_OP_WRITE_ERROR;
+    }
+
+    // The data file exists before the manifest refers to it
+    partitions[manifest->num_partitions].id = manifest->next_id;
+    partitions[manifest->num_partitions].lo = lo;
+    partitions[manifest->num_partitions].hi = hi;
+    manifest->num_partitions++;
+    manifest->next_id++;
+
+    PartitionOpStatus status = write_manifest(manifest);
+    if (status != PARTITION_OP_SUCCESS) {
+        manifest->num_partitions--;
+        manifest->next_id--;
+        return status;
+    }
+
+    *index_out = manifest->num_partitions - 1;
+    return PARTITION_OP_SUCCESS;
+}
+
+static PartitionOpStatus append_to_partition(const manifest_t *manifest, const partition_t *partition, row_t row) {
+    char *path;
+    int fd;
+    header_t header;
+    PartitionOpStatus status = open_partition(manifest, partition, &path, &fd, &header);
+    if (status != PARTITION_OP_SUCCESS) {
+        return status;
+    }
+
+    // Partitions written by older versions get the current header first
+    if (upgrade_table(path, fd, &header) != WRITER_OP_SUCCESS || append_row(fd, &header, row) != APPEND_OP_SUCCESS) {
+        status = PARTITION_OP_WRITE_ERROR;
+    }
+
+    free_header(&header);
+    free(path);
+    if (close(fd) == -1 && status == PARTITION_OP_SUCCESS) {
+        status = PARTITION_OP_WRITE_ERROR;
+    }
+    return status;
+}
+
+static PartitionOpStatus partition_num_rows(const manifest_t *manifest, const partition_t *partition, size_t *num_rows_out) {
+    char *path;
+    int fd;
+    header_t header;
+    PartitionOpStatus status = open_partition(manifest, partition, &path, &fd, &header);
+    if (status != PARTITION_OP_SUCCESS) {
+        return status;
+    }
+
+    *num_rows_out = header.num_rows;
+    free_header(&header);
+    free(path);
+    close(fd);
+    return PARTITION_OP_SUCCESS;
+}
+
+PartitionOpStatus append_partitioned(manifest_t *manifest, row_t row) {
+    if (manifest == NULL || row.cells == NULL) {
+        return PARTITION_OP_ERROR_INVALID_ARG;
+    }
+
+    size_t target = manifest->num_partitions;
+    PartitionOpStatus status;
+
+    if (manifest->kind == PARTITION_BY_ROWS) {
+        // Rows go to the newest partition until it's full
+        int64_t lo = 0;
+        if (manifest->num_partitions > 0) {
+            partition_t *last = &manifest->partitions[manifest->num_partitions - 1];
+            size_t num_rows;
+            status = partition_num_rows(manifest, last, &num_rows);
+            if (status != PARTITION_OP_SUCCESS) {
+                return status;
+            }
+            if (num_rows < manifest->param) {
+                target = manifest->num_partitions - 1;
+            }
+            lo = last->hi;
+        }
+        if (target == manifest->num_partitions) {
+            status = add_partition(manifest, lo, lo + (int64_t) manifest->param, &target);
+            if (status != PARTITION_OP_SUCCESS) {
+                return status;
+            }
+        }
+    } else {
+        const cell_t *cell = &row.cells[manifest->col_index];
+        int64_t value = cell->type == CELL_TYPE_INT ? cell->data.int_value : cell->data.int64_value;
+        int64_t width = (int64_t) manifest->param;
+        int64_t lo = value - (((value % width) + width) % width);
+        for (size_t i = 0; i < manifest->num_partitions; i++) {
+            if (manifest->partitions[i].lo == lo) {
+                target = i;
+                break;
+            }
+        }
+        if (target == manifest->num_partitions) {
+            status = add_partition(manifest, lo, lo + width, &target);
+            if (status != PARTITION_OP_SUCCESS) {
+                return status;
+            }
+        }
+    }
+
+    return append_to_partition(manifest, &manifest->partitions[target], row);
+}
+
+int partition_may_match(const manifest_t *manifest, const partition_t *partition, const predicate_t *predicate) {
+    if (predicate == NULL || manifest->kind != PARTITION_BY_VALUE || predicate->col_index != manifest->col_index) {
+        return 1;
+    }
+
+    int64_t value = predicate->data_type == CELL_TYPE_INT ? predicate->value.int_value : predicate->value.int64_value;
+    int64_t min = partition->lo;
+    int64_t max = partition->hi - 1;
+    switch (predicate->op) {
+        case PRED_EQ:
+            return min <= value && value <= max;
+        case PRED_NE:
+            return !(min == value && max == value);
+        case PRED_LT:
+            return min < value;
+        case PRED_LE:
+            return min <= value;
+        case PRED_GT:
+            return max > value;
+        case PRED_GE:
+            return max >= value;
+    }
+    return 1;
+}
+
+PartitionOpStatus scan_partitions(const manifest_t *manifest, const predicate_t *predicate,
+                                  const projection_t *projection, scan_callback_t callback, void *ctx,
+                                  threadpool_t *pool) {
+    if (manifest == NULL || callback == NULL) {
+        return PARTITION_OP_ERROR_INVALID_ARG;
+    }
+    if (manifest->num_partitions == 0) {
+        return PARTITION_OP_SUCCESS;
+    }
+
+    // Morsels still in flight decode with their partition's header, they're freed at the end
+    header_t *headers = (header_t *) calloc(manifest->num_partitions, sizeof(header_t));
+    if (headers == NULL) {
+        return PARTITION_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    // All the partitions feed morsels to the same scan, a big partition keeps every worker
+    // busy instead of being left to a single thread once the small ones are done
+    parallel_scan_t scan;
+    if (pool != NULL && begin_parallel_scan(pool, predicate, projection, callback, ctx, &scan) != SCAN_OP_SUCCESS) {
+        free(headers);
+        return PARTITION_OP_ERROR_INVALID_ARG;
+    }
+
+    PartitionOpStatus status = PARTITION_OP_SUCCESS;
+    for (size_t i = 0; i < manifest->num_partitions && status == PARTITION_OP_SUCCESS; i++) {
+        if (!partition_may_match(manifest, &manifest->partitions[i], predicate)) {
+            continue;
+        }
+
+        char *path;
+        int fd;
+        status = open_partition(manifest, &manifest->partitions[i], &path, &fd, &headers[i]);
+        if (status != PARTITION_OP_SUCCESS) {
+            break;
+        }
+
+        tombstone_t tombstones;
+        if (load_tombstones(path, fd, &tombstones) != TOMBSTONE_OP_SUCCESS) {
+            status = PARTITION_OP_READ_ERROR;
+        } else {
+            ScanOpStatus scan_status = pool != NULL
+                ? parallel_scan_file(&scan, fd, headers[i], &tombstones)
+                : scan_rows(fd, headers[i], &tombstones, predicate, projection, callback, ctx);
+            if (scan_status != SCAN_OP_SUCCESS) {
+                status = scan_status == SCAN_OP_ERROR_MEMORY_ALLOCATION ? PARTITION_OP_ERROR_MEMORY_ALLOCATION
+                       : scan_status == SCAN_OP_ERROR_THREAD ? PARTITION_OP_ERROR_THREAD : PARTITION_OP_READ_ERROR;
+            }
+            free_tombstones(&tombstones);
+        }
+
+        free(path);
+        close(fd);
+    }
+
+    if (pool != NULL && finish_parallel_scan(&scan) != SCAN_OP_SUCCESS && status == PARTITION_OP_SUCCESS) {
+        status = PARTITION_OP_READ_ERROR;
+    }
+    for (size_t i = 0; i < manifest->num_partitions; i++) {
+        free_header(&headers[i]);
+    }
+    free(headers);
+    return status;
+}
+
+PartitionOpStatus delete_partitioned(const manifest_t *manifest, const predicate_t *predicate, size_t *deleted_out) {
+    if (manifest == NULL || predicate == NULL || deleted_out == NULL) {
+        return PARTITION_OP_ERROR_INVALID_ARG;
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < manifest->num_partitions; i++) {
+        if (!partition_may_match(manifest, &manifest->partitions[i], predicate)) {
+            continue;
+        }
+
+        char *path;
+        int fd;
+        header_t header;
+        PartitionOpStatus status = open_partition(manifest, &manifest->partitions[i], &path, &fd, &header);
+        if (status != PARTITION_OP_SUCCESS) {
+            return status;
+        }
+
+        size_t deleted = 0;
+        DeleteOpStatus dop_status = delete_rows(path, fd, header, predicate, &deleted);
+        free_header(&header);
+        close(fd);
+        free(path);
+        if (dop_status != DELETE_OP_SUCCESS) {
+            return PARTITION_OP_WRITE_ERROR;
+        }
+        total += deleted;
+    }
+
+    *deleted_out = total;
+    return PARTITION_OP_SUCCESS;
+}
+
+PartitionOpStatus compact_partitioned(const manifest_t *manifest, size_t *removed_out) {
+    if (manifest == NULL || removed_out == NULL) {
+        return PARTITION_OP_ERROR_INVALID_ARG;
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < manifest->num_partitions; i++) {
+        char *path;
+        int fd;
+        header_t header;
+        PartitionOpStatus status = open_partition(manifest, &manifest->partitions[i], &path, &fd, &header);
+        if (status != PARTITION_OP_SUCCESS) {
+            return status;
+        }
+
+        size_t removed = 0;
+        DeleteOpStatus dop_status = compact_table(path, fd, header, &removed);
+        free_header(&header);
+        close(fd);
+        free(path);
+        if (dop_status != DELETE_OP_SUCCESS) {
+            return PARTITION_OP_WRITE_ERROR;
+        }
+        total += removed;
+    }
+
+    *removed_out = total;
+    return PARTITION_OP_SUCCESS;
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "predicate.h"
+
+
+void free_predicate(predicate_t *predicate) {
+    if (predicate->data_type == CELL_TYPE_STRING) {
+        free_string_cell(&predicate->value.string_cell);
+    }
+}
+
+static int parse_operator(const char *op, size_t op_length, predicate_op_t *op_out) {
+    if (op_length == 2 && memcmp(op, "==", 2) == 0) {
+        *op_out = PRED_EQ;
+    } else if (op_length == 2 && memcmp(op, "!=", 2) == 0) {
+        *op_out = PRED_NE;
+    } else if (op_length == 1 && op[0] == '<') {
+        *op_out = PRED_LT;
+    } else if (op_length == 2 && memcmp(op, "<=", 2) == 0) {
+        *op_out = PRED_LE;
+    } else if (op_length == 1 && op[0] == '>') {
+        *op_out = PRED_GT;
+    } else if (op_length == 2 && memcmp(op, ">=", 2) == 0) {
+        *op_out = PRED_GE;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+PredicateOpStatus parse_predicate(header_t header, char *predicate_in, predicate_t *predicate_out) {
+    // Expected form: "<column> <op> <value>", the value runs until the end of the string
+    if (predicate_in == NULL || predicate_out == NULL) {
+        return PREDICATE_OP_ERROR_INVALID_ARG;
+    }
+
+    size_t i = 0;
+    while (predicate_in[i] != ' ' && predicate_in[i] != '\0') {
+        i++;
+    }
+    if (i == 0 || predicate_in[i] != ' ') {
+        return PREDICATE_OP_ERROR_INVALID_ARG;
+    }
+    size_t name_length = i;
+
+    size_t col_index;
+    if (!find_column(header, predicate_in, name_length, &col_index)) {
+        return PREDICATE_OP_ERROR_UNKNOWN_COLUMN;
+    }
+
+    size_t j = ++i;
+    while (predicate_in[i] != ' ' && predicate_in[i] != '\0') {
+        i++;
+    }
+    if (predicate_in[i] != ' ') {
+        return PREDICATE_OP_ERROR_INVALID_ARG;
+    }
+
+    predicate_t predicate;
+    if (!parse_operator(&predicate_in[j], i - j, &predicate.op)) {
+        return PREDICATE_OP_ERROR_INVALID_ARG;
+    }
+    predicate.col_index = col_index;
+    predicate.data_type = header.columns[col_index].data_type;
+
+    char *value = &predicate_in[i + 1];
+    char *end = NULL;
+    errno = 0;
+    if (predicate.data_type == CELL_TYPE_INT) {
+        long parsed = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || errno == ERANGE || parsed < INT32_MIN || parsed > INT32_MAX) {
+            return PREDICATE_OP_ERROR_INVALID_ARG;
+        }
+        predicate.value.int_value = (int32_t) parsed;
+    } else if (predicate.data_type == CELL_TYPE_FLOAT) {
+        predicate.value.float_value = strtof(value, &end);
+        if (end == value || *end != '\0' || errno == ERANGE) {
+            return PREDICATE_OP_ERROR_INVALID_ARG;
+        }
+    } else if (predicate.data_type == CELL_TYPE_INT64) {
+        long long parsed = strtoll(value, &end, 10);
+        if (end == value || *end != '\0' || errno == ERANGE) {
+            return PREDICATE_OP_ERROR_INVALID_ARG;
+        }
+        predicate.value.int64_value = (int64_t) parsed;
+    } else if (predicate.data_type == CELL_TYPE_DOUBLE) {
+        predicate.value.double_value = strtod(value, &end);
+        if (end == value || *end != '\0' || errno == ERANGE) {
+            return PREDICATE_OP_ERROR_INVALID_ARG;
+        }
+    } else if (predicate.data_type == CELL_TYPE_STRING) {
+        if (set_string_cell(&predicate.value.string_cell, value, strlen(value)) != APPEND_OP_SUCCESS) {
+            return PREDICATE_OP_ERROR_MEMORY_ALLOCATION;
+        }
+    } else {
+        return PREDICATE_OP_ERROR_INVALID_ARG;
+    }
+
+    *predicate_out = predicate;
+    return PREDICATE_OP_SUCCESS;
+}
+
+int eval_predicate(const predicate_t *predicate, row_t row) {
+    if (predicate->col_index >= row.num_cells) {
+        return 0;
+    }
+
+    int cmp = compare_cell_values(predicate->data_type, &row.cells[predicate->col_index].data, &predicate->value);
+    switch (predicate->op) {
+        case PRED_EQ:
+            return cmp == 0;
+        case PRED_NE:
+            return cmp != 0;
+        case PRED_LT:
+            return cmp < 0;
+        case PRED_LE:
+            return cmp <= 0;
+        case PRED_GT:
+            return cmp > 0;
+        case PRED_GE:
+            return cmp >= 0;
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "projection.h"
+
+
+void free_projection(projection_t *projection) {
+    free(projection->columns);
+    free(projection->decoded);
+    projection->columns = NULL;
+    projection->decoded = NULL;
+    projection->num_cols = 0;
+}
+
+ProjectionOpStatus parse_projection(header_t header, const char *columns_in, const predicate_t *predicate,
+                                    projection_t *projection_out) {
+    if (columns_in == NULL || projection_out == NULL || header.num_cols == 0) {
+        return PROJECTION_OP_ERROR_INVALID_ARG;
+    }
+
+    size_t capacity = 1;
+    for (const char *ch = columns_in; *ch != '\0'; ch++) {
+        capacity += *ch == ',';
+    }
+
+    projection_t projection;
+    projection.num_cols = 0;
+    projection.columns = (size_t *) malloc(capacity * sizeof(size_t));
+    projection.decoded = (uint8_t *) calloc(header.num_cols, sizeof(uint8_t));
+    if (projection.columns == NULL || projection.decoded == NULL) {
+        free_projection(&projection);
+        return PROJECTION_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    size_t num_decoded = 0;
+    const char *name = columns_in;
+    for (;;) {
+        const char *end = strchr(name, ',');
+        size_t name_length = end != NULL ? (size_t) (end - name) : strlen(name);
+        size_t col_index;
+        if (name_length == 0) {
+            free_projection(&projection);
+            return PROJECTION_OP_ERROR_INVALID_ARG;
+        }
+        if (!find_column(header, name, name_length, &col_index)) {
+            free_projection(&projection);
+            return PROJECTION_OP_ERROR_UNKNOWN_COLUMN;
+        }
+
+        // A column can be asked for twice, it's only decoded once
+        projection.columns[projection.num_cols++] = col_index;
+        num_decoded += !projection.decoded[col_index];
+        projection.decoded[col_index] = 1;
+
+        if (end == NULL) {
+            break;
+        }
+        name = end + 1;
+    }
+
+    if (predicate != NULL && predicate->col_index < header.num_cols) {
+        num_decoded += !projection.decoded[predicate->col_index];
+        projection.decoded[predicate->col_index] = 1;
+    }
+    if (num_decoded == header.num_cols) {
+        // Nothing to skip, the full decoders are faster
+        free(projection.decoded);
+        projection.decoded = NULL;
+    }
+
+    *projection_out = projection;
+    return PROJECTION_OP_SUCCESS;
+}
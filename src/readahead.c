@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "readahead.h"
+#include "futex.h"
+
+
+static void *readahead_thread(void *arg) {
+    readahead_t *readahead = (readahead_t *) arg;
+    header_t header = readahead->header;
+    uint64_t offset = header_size(header);
+    size_t row_index = 0;
+
+    for (;;) {
+        uint32_t tail = __atomic_load_n(&readahead->tail, __ATOMIC_RELAXED);
+        uint32_t head;
+        while (tail - (head = __atomic_load_n(&readahead->head, __ATOMIC_ACQUIRE)) == READAHEAD_BUFFERS) {
+            if (__atomic_load_n(&readahead->stop, __ATOMIC_RELAXED)) {
+                return NULL;
+            }
+            futex_wait(&readahead->head, head);
+        }
+        if (__atomic_load_n(&readahead->stop, __ATOMIC_RELAXED)) {
+            return NULL;
+        }
+
+        readahead_block_t *block = &readahead->blocks[tail % READAHEAD_BUFFERS];
+        block->length = 0;
+        block->offset = offset;
+        block->first_row = row_index;
+        block->num_rows = 0;
+        block->status = SCAN_OP_SUCCESS;
+        if (row_index < header.num_rows) {
+            // The kernel already fetches the following blocks while this one is read and cut
+            uint64_t next = offset + block->capacity;
+            if (next < header.data_end) {
+                posix_fadvise(readahead->fd, next, READAHEAD_WINDOW, POSIX_FADV_WILLNEED);
+            }
+            block->status = read_row_block(readahead->fd, header, offset, header.num_rows - row_index, &block->buffer,
+                                           &block->capacity, &block->length, &block->num_rows);
+            if (block->status != SCAN_OP_SUCCESS) {
+                block->num_rows = 0;
+            }
+        }
+        int last = block->num_rows == 0;
+        offset += block->length;
+        row_index += block->num_rows;
+
+        __atomic_store_n(&readahead->tail, tail + 1, __ATOMIC_RELEASE);
+        futex_wake(&readahead->tail, 1);
+        if (last) {
+            return NULL;
+        }
+    }
+}
+
+ScanOpStatus start_readahead(int fd, header_t header, readahead_t *readahead_out) {
+    if (fd < 0) {
+        return SCAN_OP_ERROR_INVALID_FD;
+    }
+    if (readahead_out == NULL) {
+        return SCAN_OP_ERROR_INVALID_ARG;
+    }
+
+    readahead_out->fd = fd;
+    readahead_out->header = header;
+    for (size_t i = 0; i < READAHEAD_BUFFERS; i++) {
+        readahead_out->blocks[i].buffer = NULL;  // Allocated by the reader thread on first use
+        readahead_out->blocks[i].capacity = SCAN_MORSEL_SIZE;
+    }
+    readahead_out->head = 0;
+    readahead_out->tail = 0;
+    readahead_out->stop = 0;
+
+    uint64_t start = header_size(header);
+    posix_fadvise(fd, start, header.data_end - start, POSIX_FADV_SEQUENTIAL);
+
+    if (pthread_create(&readahead_out->thread, NULL, readahead_thread, readahead_out) != 0) {
+        return SCAN_OP_ERROR_THREAD;
+    }
+    return SCAN_OP_SUCCESS;
+}
+
+const readahead_block_t *next_block(readahead_t *readahead) {
+    uint32_t head = __atomic_load_n(&readahead->head, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&readahead->tail, __ATOMIC_ACQUIRE) == head) {
+        futex_wait(&readahead->tail, head);
+    }
+    return &readahead->blocks[head % READAHEAD_BUFFERS];
+}
+
+void release_block(readahead_t *readahead) {
+    __atomic_add_fetch(&readahead->head, 1, __ATOMIC_RELEASE);
+    futex_wake(&readahead->head, 1);
+}
+
+void stop_readahead(readahead_t *readahead) {
+    __atomic_store_n(&readahead->stop, 1, __ATOMIC_RELAXED);
+    // Moving head frees every block and changes the futex word, so a reader about to
+    // park on a full ring can't miss the stop
+    __atomic_add_fetch(&readahead->head, READAHEAD_BUFFERS, __ATOMIC_RELEASE);
+    futex_wake(&readahead->head, 1);
+    pthread_join(readahead->thread, NULL);
+
+    for (size_t i = 0; i < READAHEAD_BUFFERS; i++) {
+        free(readahead->blocks[i].buffer);
+    }
+}
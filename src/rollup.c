@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <endian.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "rollup.h"
+#include "hash.h"
+#include "scan.h"
+#include "tombstone.h"
+#include "stats.h"
+
+/*
+ * Sidecar layout: "rfka", a checksum (big endian uint64, FNV-1a over everything after it),
+ * the inode of the data file, the generation, the row count and data end the states cover
+ * (big endian uint64 each), the number of aggregates (big endian uint32), then one record
+ * per aggregate: function, data type, column (big endian uint32), count, int value and the
+ * bits of the float value (big endian uint64 each). The whole file is rewritten in place
+ * by a single pwrite, the checksum catches one torn by a crash.
+ */
+#define ROLLUP_CHECKSUM_OFFSET 4
+#define ROLLUP_BODY_OFFSET (ROLLUP_CHECKSUM_OFFSET + sizeof(uint64_t))
+#define ROLLUP_GENERATION_OFFSET (ROLLUP_BODY_OFFSET + sizeof(uint64_t))
+#define ROLLUP_ROWS_OFFSET (ROLLUP_GENERATION_OFFSET + sizeof(uint64_t))
+#define ROLLUP_HEADER_SIZE (ROLLUP_ROWS_OFFSET + 2 * sizeof(uint64_t) + sizeof(uint32_t))
+#define ROLLUP_RECORD_SIZE (2 + sizeof(uint32_t) + 3 * sizeof(uint64_t))
+#define ROLLUP_MAX_SIZE (ROLLUP_HEADER_SIZE + GROUP_MAX_AGGREGATES * ROLLUP_RECORD_SIZE)
+
+
+char *rollup_path(const char *filepath) {
+    size_t length = strlen(filepath);
+    char *path = (char *) malloc(length + sizeof(ROLLUP_SUFFIX));
+    if (path == NULL) {
+        return NULL;
+    }
+    memcpy(path, filepath, length);
+    memcpy(&path[length], ROLLUP_SUFFIX, sizeof(ROLLUP_SUFFIX));
+    return path;
+}
+
+void free_rollups(rollups_t *rollups) {
+    if (rollups->fd != -1) {
+        close(rollups->fd);
+    }
+    free(rollups->aggregates);
+    free(rollups->states);
+    rollups->fd = -1;
+    rollups->aggregates = NULL;
+    rollups->states = NULL;
+    rollups->num_rollups = 0;
+}
+
+static void put_be64(uint8_t *buffer, uint64_t value) {
+    uint64_t value_nbo = htobe64(value);
+    memcpy(buffer, &value_nbo, sizeof(uint64_t));
+}
+
+static uint64_t get_be64(const uint8_t *buffer) {
+    uint64_t value_nbo;
+    memcpy(&value_nbo, buffer, sizeof(uint64_t));
+    return be64toh(value_nbo);
+}
+
+static void clear_states(rollups_t *rollups) {
+    if (rollups->num_rollups > 0) {
+        memset(rollups->states, 0, rollups->num_rollups * sizeof(agg_state_t));
+    }
+    rollups->num_rows = 0;
+    rollups->data_end = 0;
+}
+
+static RollupOpStatus save_rollups(const rollups_t *rollups) {
+    uint8_t buffer[ROLLUP_MAX_SIZE];
+    memcpy(buffer, "rfka", 4);
+    put_be64(&buffer[ROLLUP_BODY_OFFSET], rollups->inode);
+    put_be64(&buffer[ROLLUP_GENERATION_OFFSET], rollups->generation);
+    put_be64(&buffer[ROLLUP_ROWS_OFFSET], rollups->num_rows);
+    put_be64(&buffer[ROLLUP_ROWS_OFFSET + sizeof(uint64_t)], rollups->data_end);
+    uint32_t num_rollups_nbo = htobe32((uint32_t) rollups->num_rollups);
+    memcpy(&buffer[ROLLUP_ROWS_OFFSET + 2 * sizeof(uint64_t)], &num_rollups_nbo, sizeof(uint32_t));
+    uint8_t *pos = &buffer[ROLLUP_HEADER_SIZE];
+
+    for (size_t i = 0; i < rollups->num_rollups; i++) {
+        const aggregate_t *agg = &rollups->aggregates[i];
+        const agg_state_t *state = &rollups->states[i];
+        uint32_t col_nbo = htobe32((uint32_t) agg->col_index);
+        uint64_t float_bits;
+        memcpy(&float_bits, &state->float_value, sizeof(uint64_t));
+        pos[0] = (uint8_t) agg->fn;
+        pos[1] = agg->data_type;
+        memcpy(&pos[2], &col_nbo, sizeof(uint32_t));
+        put_be64(&pos[2 + sizeof(uint32_t)], (uint64_t) state->count);
+        put_be64(&pos[2 + sizeof(uint32_t) + sizeof(uint64_t)], (uint64_t) state->int_value);
+        put_be64(&pos[2 + sizeof(uint32_t) + 2 * sizeof(uint64_t)], float_bits);
+        pos += ROLLUP_RECORD_SIZE;
+    }
+
+    size_t size = pos - buffer;
+    put_be64(&buffer[ROLLUP_CHECKSUM_OFFSET], hash_bytes(&buffer[ROLLUP_BODY_OFFSET], size - ROLLUP_BODY_OFFSET));
+    ssize_t bytes_written = pwrite(rollups->fd, buffer, size, 0);
+    STATS_SYSCALL(IO_INDEX, IO_WRITE, bytes_written);
+    return bytes_written == (ssize_t) size ? ROLLUP_OP_SUCCESS : ROLLUP_OP_WRITE_ERROR;
+}
+
+static RollupOpStatus read_generation(int rfd, uint64_t *generation_out) {
+    uint8_t generation[sizeof(uint64_t)];
+    ssize_t bytes_read = pread(rfd, generation, sizeof(generation), ROLLUP_GENERATION_OFFSET);
+    STATS_SYSCALL(IO_INDEX, IO_READ, bytes_read);
+    if (bytes_read != (ssize_t) sizeof(generation)) {
+        return ROLLUP_OP_READ_ERROR;
+    }
+    *generation_out = get_be64(generation);
+    return ROLLUP_OP_SUCCESS;
+}
+
+// Readers and appenders of other processes save their states too: the sidecar is locked while
+// it's checked and the states are written, so a reset can't slip in between. One that was
+// unlinked, or reset since the rollups were loaded, is left alone.
+static RollupOpStatus save_current_rollups(const rollups_t *rollups) {
+    if (flock(rollups->fd, LOCK_EX) == -1) {
+        return ROLLUP_OP_WRITE_ERROR;
+    }
+    struct stat sidecar_stat;
+    uint64_t generation;
+    RollupOpStatus status;
+    if (fstat(rollups->fd, &sidecar_stat) == -1) {
+        status = ROLLUP_OP_READ_ERROR;
+    } else if (sidecar_stat.st_nlink == 0) {
+        status = ROLLUP_OP_STALE;
+    } else {
+        status = read_generation(rollups->fd, &generation);
+        if (status == ROLLUP_OP_SUCCESS) {
+            status = generation == rollups->generation ? save_rollups(rollups) : ROLLUP_OP_STALE;
+        }
+    }
+    flock(rollups->fd, LOCK_UN);
+    return status;
+}
+
+RollupOpStatus load_rollups(const char *filepath, int fd, header_t header, rollups_t *rollups_out) {
+    if (filepath == NULL || fd < 0 || rollups_out == NULL) {
+        return ROLLUP_OP_ERROR_INVALID_ARG;
+    }
+
+    rollups_t rollups = {.fd = -1};
+    struct stat data_stat;
+    if (fstat(fd, &data_stat) == -1) {
+        return ROLLUP_OP_READ_ERROR;
+    }
+    rollups.inode = (uint64_t) data_stat.st_ino;
+
+    char *path = rollup_path(filepath);
+    if (path == NULL) {
+        return ROLLUP_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    int rfd = open(path, O_RDWR);
+    free(path);
+    if (rfd == -1) {
+        if (errno == ENOENT) {
+            *rollups_out = rollups;
+            return ROLLUP_OP_SUCCESS;
+        }
+        return ROLLUP_OP_READ_ERROR;
+    }
+
+    uint8_t buffer[ROLLUP_MAX_SIZE];
+    ssize_t bytes_read = pread(rfd, buffer, sizeof(buffer), 0);
+    STATS_SYSCALL(IO_INDEX, IO_READ, bytes_read);
+    uint32_t num_rollups_nbo = 0;
+    if (bytes_read >= (ssize_t) ROLLUP_HEADER_SIZE) {
+        memcpy(&num_rollups_nbo, &buffer[ROLLUP_ROWS_OFFSET + 2 * sizeof(uint64_t)], sizeof(uint32_t));
+    }
+    size_t num_rollups = be32toh(num_rollups_nbo);
+    if (bytes_read < (ssize_t) ROLLUP_HEADER_SIZE || memcmp(buffer, "rfka", 4) != 0 || num_rollups == 0
+        || num_rollups > GROUP_MAX_AGGREGATES || (size_t) bytes_read != ROLLUP_HEADER_SIZE + num_rollups * ROLLUP_RECORD_SIZE) {
+        close(rfd);
+        return ROLLUP_OP_READ_ERROR;
+    }
+
+    rollups.aggregates = (aggregate_t *) malloc(num_rollups * sizeof(aggregate_t));
+    rollups.states = (agg_state_t *) calloc(num_rollups, sizeof(agg_state_t));
+    if (rollups.aggregates == NULL || rollups.states == NULL) {
+        free(rollups.aggregates);
+        free(rollups.states);
+        close(rfd);
+        return ROLLUP_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    rollups.num_rollups = num_rollups;
+    rollups.fd = rfd;
+    rollups.generation = get_be64(&buffer[ROLLUP_GENERATION_OFFSET]);
+
+    // A torn write leaves the aggregates alone, they are rewritten with the same bytes every time
+    int current = get_be64(&buffer[ROLLUP_CHECKSUM_OFFSET]) == hash_bytes(&buffer[ROLLUP_BODY_OFFSET],
+                                                                         bytes_read - ROLLUP_BODY_OFFSET)
+               && get_be64(&buffer[ROLLUP_BODY_OFFSET]) == rollups.inode;
+    const uint8_t *pos = &buffer[ROLLUP_HEADER_SIZE];
+    for (size_t i = 0; i < num_rollups; i++, pos += ROLLUP_RECORD_SIZE) {
+        aggregate_t *agg = &rollups.aggregates[i];
+        uint32_t col_nbo;
+        memcpy(&col_nbo, &pos[2], sizeof(uint32_t));
+        agg->fn = (agg_fn_t) pos[0];
+        agg->data_type = pos[1];
+        agg->col_index = be32toh(col_nbo);
+        if (agg->fn > AGG_AVG || agg->col_index >= header.num_cols
+            || (agg->fn != AGG_COUNT && agg->data_type != header.columns[agg->col_index].data_type)) {
+            free_rollups(&rollups);
+            return ROLLUP_OP_READ_ERROR;
+        }
+
+        if (current) {
+            agg_state_t *state = &rollups.states[i];
+            uint64_t float_bits = get_be64(&pos[2 + sizeof(uint32_t) + 2 * sizeof(uint64_t)]);
+            state->count = (int64_t) get_be64(&pos[2 + sizeof(uint32_t)]);
+            state->int_value = (int64_t) get_be64(&pos[2 + sizeof(uint32_t) + sizeof(uint64_t)]);
+            memcpy(&state->float_value, &float_bits, sizeof(double));
+        }
+    }
+    if (current) {
+        rollups.num_rows = get_be64(&buffer[ROLLUP_ROWS_OFFSET]);
+        rollups.data_end = get_be64(&buffer[ROLLUP_ROWS_OFFSET + sizeof(uint64_t)]);
+    }
+
+    *rollups_out = rollups;
+    return ROLLUP_OP_SUCCESS;
+}
+
+static int fold_row(row_t row, size_t row_index, uint64_t offset, void *ctx) {
+    rollups_t *rollups = (rollups_t *) ctx;
+    fold_aggregates(rollups->aggregates, rollups->num_rollups, rollups->states, row);
+    return 0;
+}
+
+// Folds the live rows past the ones already covered
+static RollupOpStatus fold_tail(const char *filepath, int fd, header_t header, rollups_t *rollups) {
+    if (rollups->num_rows > header.num_rows || rollups->data_end > header.data_end
+        || (rollups->num_rows > 0 && rollups->data_end < header_size(header))) {
+        // The states don't describe this table, they can only be rebuilt
+        clear_states(rollups);
+    }
+
+    tombstone_t tombstones;
+    if (load_tombstones(filepath, fd, &tombstones) != TOMBSTONE_OP_SUCCESS) {
+        return ROLLUP_OP_TOMBSTONE_ERROR;
+    }
+    uint8_t *decoded = (uint8_t *) calloc(header.num_cols, sizeof(uint8_t));
+    if (decoded == NULL) {
+        free_tombstones(&tombstones);
+        return ROLLUP_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    for (size_t i = 0; i < rollups->num_rollups; i++) {
+        if (rollups->aggregates[i].fn != AGG_COUNT) {
+            decoded[rollups->aggregates[i].col_index] = 1;
+        }
+    }
+
+    projection_t projection = {.num_cols = 0, .columns = NULL, .decoded = decoded};
+    uint64_t offset = rollups->num_rows > 0 ? rollups->data_end : header_size(header);
+    ScanOpStatus scan_status = scan_rows_from(fd, header, rollups->num_rows, offset, &tombstones, NULL, &projection,
+                                              fold_row, rollups);
+    free(decoded);
+    free_tombstones(&tombstones);
+    if (scan_status != SCAN_OP_SUCCESS) {
+        return scan_status == SCAN_OP_ERROR_MEMORY_ALLOCATION ? ROLLUP_OP_ERROR_MEMORY_ALLOCATION : ROLLUP_OP_READ_ERROR;
+    }
+
+    rollups->num_rows = header.num_rows;
+    rollups->data_end = header.data_end;
+    return ROLLUP_OP_SUCCESS;
+}
+
+RollupOpStatus register_rollups(const char *filepath, int fd, header_t header, const char *aggs_in,
+                                rollups_t *rollups_out) {
+    if (filepath == NULL || fd < 0 || aggs_in == NULL || rollups_out == NULL) {
+        return ROLLUP_OP_ERROR_INVALID_ARG;
+    }
+
+    aggregate_t *aggs;
+    size_t num_aggs;
+    GroupOpStatus gop_status = parse_aggregates(header, aggs_in, &aggs, &num_aggs);
+    if (gop_status != GROUP_OP_SUCCESS) {
+        return gop_status == GROUP_OP_ERROR_UNKNOWN_COLUMN ? ROLLUP_OP_ERROR_UNKNOWN_COLUMN
+             : gop_status == GROUP_OP_ERROR_TYPE_MISMATCH ? ROLLUP_OP_ERROR_TYPE_MISMATCH
+             : gop_status == GROUP_OP_ERROR_MEMORY_ALLOCATION ? ROLLUP_OP_ERROR_MEMORY_ALLOCATION
+             : ROLLUP_OP_ERROR_INVALID_ARG;
+    }
+
+    rollups_t rollups;
+    RollupOpStatus status = load_rollups(filepath, fd, header, &rollups);
+    if (status != ROLLUP_OP_SUCCESS) {
+        free(aggs);
+        return status;
+    }
+
+    aggregate_t *merged = (aggregate_t *) realloc(rollups.aggregates, (rollups.num_rollups + num_aggs) * sizeof(aggregate_t));
+    if (merged == NULL) {
+        free(aggs);
+        free_rollups(&rollups);
+        return ROLLUP_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    rollups.aggregates = merged;
+    size_t num_rollups = rollups.num_rollups;
+    for (size_t i = 0; i < num_aggs; i++) {
+        // Registering an aggregate twice keeps a single copy of it
+        int registered = 0;
+        for (size_t j = 0; j < num_rollups && !registered; j++) {
+            registered = merged[j].fn == aggs[i].fn
+                      && (aggs[i].fn == AGG_COUNT || merged[j].col_index == aggs[i].col_index);
+        }
+        if (!registered) {
+            merged[num_rollups++] = aggs[i];
+        }
+    }
+    free(aggs);
+    if (num_rollups > GROUP_MAX_AGGREGATES) {
+        free_rollups(&rollups);
+        return ROLLUP_OP_ERROR_INVALID_ARG;
+    }
+
+    free(rollups.states);
+    rollups.states = (agg_state_t *) calloc(num_rollups, sizeof(agg_state_t));
+    rollups.num_rollups = num_rollups;
+    if (rollups.states == NULL) {
+        free_rollups(&rollups);
+        return ROLLUP_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    if (rollups.fd == -1) {
+        char *path = rollup_path(filepath);
+        if (path == NULL) {
+            free_rollups(&rollups);
+            return ROLLUP_OP_ERROR_MEMORY_ALLOCATION;
+        }
+        rollups.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        free(path);
+        if (rollups.fd == -1) {
+            free_rollups(&rollups);
+            return ROLLUP_OP_WRITE_ERROR;
+        }
+    }
+
+    // The new aggregates have never seen a row, every one is computed again in one pass
+    clear_states(&rollups);
+    status = fold_tail(filepath, fd, header, &rollups);
+    if (status == ROLLUP_OP_SUCCESS) {
+        status = save_rollups(&rollups);
+    }
+    if (status != ROLLUP_OP_SUCCESS) {
+        free_rollups(&rollups);
+        return status;
+    }
+
+    *rollups_out = rollups;
+    return ROLLUP_OP_SUCCESS;
+}
+
+RollupOpStatus refresh_rollups(const char *filepath, int fd, header_t header, rollups_t *rollups) {
+    if (filepath == NULL || fd < 0 || rollups == NULL) {
+        return ROLLUP_OP_ERROR_INVALID_ARG;
+    }
+    if (rollups->fd == -1 || (rollups->num_rows == header.num_rows && rollups->data_end == header.data_end)) {
+        return ROLLUP_OP_SUCCESS;
+    }
+
+    RollupOpStatus status = fold_tail(filepath, fd, header, rollups);
+    if (status != ROLLUP_OP_SUCCESS) {
+        return status;
+    }
+    // Reset in the meantime, the states still answer for the rows this reader saw
+    status = save_current_rollups(rollups);
+    return status == ROLLUP_OP_STALE ? ROLLUP_OP_SUCCESS : status;
+}
+
+void fold_rollups(rollups_t *rollups, row_t row) {
+    if (rollups != NULL && rollups->fd != -1) {
+        fold_aggregates(rollups->aggregates, rollups->num_rollups, rollups->states, row);
+    }
+}
+
+RollupOpStatus publish_rollups(rollups_t *rollups, header_t header) {
+    if (rollups == NULL || rollups->fd == -1) {
+        return ROLLUP_OP_SUCCESS;
+    }
+    rollups->num_rows = header.num_rows;
+    rollups->data_end = header.data_end;
+    return save_current_rollups(rollups);
+}
+
+RollupOpStatus reset_rollups(const char *filepath, int fd, header_t header) {
+    rollups_t rollups;
+    RollupOpStatus status = load_rollups(filepath, fd, header, &rollups);
+    if (status != ROLLUP_OP_SUCCESS || rollups.fd == -1) {
+        return status;
+    }
+
+    // The generation is read again under the lock, another reset may have bumped it since the load
+    if (flock(rollups.fd, LOCK_EX) == -1) {
+        free_rollups(&rollups);
+        return ROLLUP_OP_WRITE_ERROR;
+    }
+    read_generation(rollups.fd, &rollups.generation);
+    rollups.generation++;
+    clear_states(&rollups);
+    status = save_rollups(&rollups);
+    flock(rollups.fd, LOCK_UN);
+    free_rollups(&rollups);
+    return status;
+}
+
+void rollup_results(const rollups_t *rollups, agg_result_t *results_out) {
+    aggregate_results(rollups->aggregates, rollups->num_rollups, rollups->states, results_out);
+}
@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "scan.h"
+#include "file.h"
+#include "readahead.h"
+#include "stats.h"
+
+
+ScanOpStatus read_row_block(int fd, header_t header, uint64_t offset, size_t rows_left,
+                            uint8_t **buffer_io, size_t *capacity_io, size_t *length_out, size_t *num_rows_out) {
+    for (;;) {
+        if (*buffer_io == NULL) {
+            *buffer_io = (uint8_t *) malloc(*capacity_io);
+            if (*buffer_io == NULL) {
+                return SCAN_OP_ERROR_MEMORY_ALLOCATION;
+            }
+        }
+
+        // Only the rows of the snapshot taken with the header are read, up to its data end
+        size_t length = header.data_end - offset < *capacity_io ? header.data_end - offset : *capacity_io;
+        if (pread_full(fd, *buffer_io, length, offset) != (ssize_t) length) {
+            return SCAN_OP_READ_ERROR;
+        }
+
+        size_t pos = 0;
+        size_t num_rows = 0;
+        while (num_rows < rows_left) {
+            size_t span = row_span(&(*buffer_io)[pos], length - pos, header);
+            if (span == 0) {
+                break;
+            }
+            pos += span;
+            num_rows++;
+        }
+
+        if (num_rows > 0) {
+            *length_out = pos;
+            *num_rows_out = num_rows;
+            return SCAN_OP_SUCCESS;
+        }
+        if (length < *capacity_io) {
+            // The data end cuts a row in half
+            return SCAN_OP_READ_ERROR;
+        }
+
+        uint8_t *buffer = (uint8_t *) realloc(*buffer_io, *capacity_io * 2);
+        if (buffer == NULL) {
+            return SCAN_OP_ERROR_MEMORY_ALLOCATION;
+        }
+        *buffer_io = buffer;
+        *capacity_io *= 2;
+    }
+}
+
+static ScanOpStatus scan_block(const uint8_t *buffer, size_t length, uint64_t offset, size_t first_row,
+                               size_t num_rows, header_t header, const tombstone_t *tombstones,
+                               const predicate_t *predicate, const uint8_t *decoded, cell_t *cells,
+                               scan_callback_t callback, void *ctx, int *stop_out) {
+    STATS_START(start);
+    ScanOpStatus status = SCAN_OP_SUCCESS;
+    size_t pos = 0;
+    size_t rows_decoded = 0;
+    size_t decoded_bytes = 0;
+    for (size_t i = 0; i < num_rows && !*stop_out; i++) {
+        size_t span = row_span(&buffer[pos], length - pos, header);
+        if (is_tombstoned(tombstones, first_row + i)) {
+            // Dead rows are stepped over without decoding or allocating their cells
+            pos += span;
+            continue;
+        }
+
+        row_t row;
+        if (decode_row_columns(&buffer[pos], header, decoded, cells, &row) != APPEND_OP_SUCCESS) {
+            status = SCAN_OP_ERROR_MEMORY_ALLOCATION;
+            break;
+        }
+        rows_decoded++;
+        decoded_bytes += span;
+        if (predicate == NULL || eval_predicate(predicate, row)) {
+            *stop_out = callback(row, first_row + i, offset + pos, ctx);
+        }
+        release_row_columns(&row, cells);
+        pos += span;
+    }
+    STATS_RECORD(STAT_SCAN_BLOCK, start, status != SCAN_OP_SUCCESS);
+    STATS_ADD(STAT_ROWS_READ, rows_decoded);
+    STATS_LOGICAL_READ(IO_ROWS, decoded_bytes);
+    return status;
+}
+
+// Larger tables are read by a readahead thread, so the disk and the decoding overlap
+static ScanOpStatus scan_rows_readahead(int fd, header_t header, const tombstone_t *tombstones,
+                                        const predicate_t *predicate, const uint8_t *decoded,
+                                        scan_callback_t callback, void *ctx) {
+    cell_t *cells = NULL;
+    if (decoded != NULL && (cells = (cell_t *) calloc(header.num_cols, sizeof(cell_t))) == NULL) {
+        return SCAN_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    readahead_t readahead;
+    ScanOpStatus status = start_readahead(fd, header, &readahead);
+    if (status != SCAN_OP_SUCCESS) {
+        free(cells);
+        return status;
+    }
+
+    int stop = 0;
+    for (;;) {
+        const readahead_block_t *block = next_block(&readahead);
+        if (block->num_rows == 0) {
+            status = block->status;
+            break;
+        }
+
+        status = scan_block(block->buffer, block->length, block->offset, block->first_row, block->num_rows, header,
+                            tombstones, predicate, decoded, cells, callback, ctx, &stop);
+        release_block(&readahead);
+        if (status != SCAN_OP_SUCCESS || stop) {
+            break;
+        }
+    }
+
+    stop_readahead(&readahead);
+    free(cells);
+    return status;
+}
+
+static ScanOpStatus scan_rows_buffered(int fd, header_t header, size_t first_row, uint64_t offset,
+                                       const tombstone_t *tombstones, const predicate_t *predicate,
+                                       const uint8_t *decoded, scan_callback_t callback, void *ctx) {
+    // Rows are read a block at a time and decoded from memory, with the schema's codec. A
+    // projection decodes every row into the same cells.
+    cell_t *cells = NULL;
+    if (decoded != NULL && (cells = (cell_t *) calloc(header.num_cols, sizeof(cell_t))) == NULL) {
+        return SCAN_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    uint8_t *buffer = NULL;
+    size_t capacity = SCAN_MORSEL_SIZE;
+    size_t row_index = first_row;
+    ScanOpStatus status = SCAN_OP_SUCCESS;
+    int stop = 0;
+
+    while (row_index < header.num_rows && !stop) {
+        size_t length, num_rows;
+        status = read_row_block(fd, header, offset, header.num_rows - row_index, &buffer, &capacity, &length,
+                                &num_rows);
+        if (status != SCAN_OP_SUCCESS) {
+            break;
+        }
+
+        status = scan_block(buffer, length, offset, row_index, num_rows, header, tombstones, predicate, decoded,
+                            cells, callback, ctx, &stop);
+        if (status != SCAN_OP_SUCCESS) {
+            break;
+        }
+
+        offset += length;
+        row_index += num_rows;
+    }
+
+    free(buffer);
+    free(cells);
+    return status;
+}
+
+ScanOpStatus scan_rows(int fd, header_t header, const tombstone_t *tombstones, const predicate_t *predicate,
+                       const projection_t *projection, scan_callback_t callback, void *ctx) {
+    if (fd < 0) {
+        return SCAN_OP_ERROR_INVALID_FD;
+    }
+
+    if (callback == NULL) {
+        return SCAN_OP_ERROR_INVALID_ARG;
+    }
+
+    const uint8_t *decoded = projection != NULL ? projection->decoded : NULL;
+    STATS_START(start);
+    ScanOpStatus status;
+    if (header.data_end - header_size(header) > SCAN_MORSEL_SIZE) {
+        status = scan_rows_readahead(fd, header, tombstones, predicate, decoded, callback, ctx);
+    } else {
+        status = scan_rows_buffered(fd, header, 0, header_size(header), tombstones, predicate, decoded, callback, ctx);
+    }
+    STATS_RECORD(STAT_SCAN, start, status != SCAN_OP_SUCCESS);
+    return status;
+}
+
+ScanOpStatus scan_rows_from(int fd, header_t header, size_t first_row, uint64_t offset, const tombstone_t *tombstones,
+                            const predicate_t *predicate, const projection_t *projection, scan_callback_t callback,
+                            void *ctx) {
+    if (fd < 0) {
+        return SCAN_OP_ERROR_INVALID_FD;
+    }
+    if (callback == NULL || first_row > header.num_rows || offset < header_size(header) || offset > header.data_end) {
+        return SCAN_OP_ERROR_INVALID_ARG;
+    }
+
+    STATS_START(start);
+    ScanOpStatus status = scan_rows_buffered(fd, header, first_row, offset, tombstones, predicate,
+                                             projection != NULL ? projection->decoded : NULL, callback, ctx);
+    STATS_RECORD(STAT_SCAN, start, status != SCAN_OP_SUCCESS);
+    return status;
+}
+
+typedef struct {
+    parallel_scan_t *scan;
+    uint8_t *buffer;
+    size_t length;
+    uint64_t offset;
+    size_t first_row;
+    size_t num_rows;
+    header_t header;  // Shallow copy, the caller keeps the header alive until the scan is finished
+    uint8_t *deleted;  // One bit per row of the morsel, NULL when none is deleted
+} morsel_t;
+
+static void stop_scan(parallel_scan_t *scan, ScanOpStatus status) {
+    pthread_mutex_lock(&scan->lock);
+    if (scan->status == SCAN_OP_SUCCESS) {
+        scan->status = status;
+    }
+    __atomic_store_n(&scan->stop, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&scan->lock);
+}
+
+static void scan_morsel_task(void *arg) {
+    morsel_t *morsel = (morsel_t *) arg;
+    parallel_scan_t *scan = morsel->scan;
+    header_t header = morsel->header;
+    STATS_START(start);
+    int failed = 0;
+    size_t rows_decoded = 0;
+    size_t decoded_bytes = 0;
+
+    // Allocated by the worker's first morsel, the workers all scan tables of the same schema
+    cell_t *cells = NULL;
+    size_t worker;
+    if (scan->cells != NULL && threadpool_worker_index(scan->pool, &worker)) {
+        if (scan->cells[worker] == NULL) {
+            scan->cells[worker] = (cell_t *) calloc(header.num_cols, sizeof(cell_t));
+        }
+        cells = scan->cells[worker];
+    }
+
+    size_t pos = 0;
+    for (size_t i = 0; i < morsel->num_rows; i++) {
+        if (__atomic_load_n(&scan->stop, __ATOMIC_RELAXED)) {
+            break;
+        }
+
+        size_t span = row_span(&morsel->buffer[pos], morsel->length - pos, header);
+        if (morsel->deleted != NULL && (morsel->deleted[i / 8] & (1u << (i % 8)))) {
+            pos += span;
+            continue;
+        }
+
+        row_t row;
+        if (decode_row_columns(&morsel->buffer[pos], header, scan->decoded, cells, &row) != APPEND_OP_SUCCESS) {
+            stop_scan(scan, SCAN_OP_ERROR_MEMORY_ALLOCATION);
+            failed = 1;
+            break;
+        }
+        rows_decoded++;
+        decoded_bytes += span;
+        if (scan->predicate == NULL || eval_predicate(scan->predicate, row)) {
+            if (scan->callback(row, morsel->first_row + i, morsel->offset + pos, scan->ctx)) {
+                stop_scan(scan, SCAN_OP_SUCCESS);
+            }
+        }
+        release_row_columns(&row, cells);
+        pos += span;
+    }
+    STATS_RECORD(STAT_SCAN_BLOCK, start, failed);
+    STATS_ADD(STAT_ROWS_READ, rows_decoded);
+    STATS_LOGICAL_READ(IO_ROWS, decoded_bytes);
+
+    free(morsel->buffer);
+    free(morsel->deleted);
+    free(morsel);
+
+    pthread_mutex_lock(&scan->lock);
+    scan->in_flight--;
+    pthread_cond_signal(&scan->morsel_done);
+    pthread_mutex_unlock(&scan->lock);
+}
+
+ScanOpStatus begin_parallel_scan(threadpool_t *pool, const predicate_t *predicate, const projection_t *projection,
+                                 scan_callback_t callback, void *ctx, parallel_scan_t *scan_out) {
+    if (pool == NULL || callback == NULL || scan_out == NULL) {
+        return SCAN_OP_ERROR_INVALID_ARG;
+    }
+
+    scan_out->cells = NULL;
+    if (projection != NULL && projection->decoded != NULL) {
+        scan_out->cells = (cell_t **) calloc(pool->num_threads, sizeof(cell_t *));
+        if (scan_out->cells == NULL) {
+            return SCAN_OP_ERROR_MEMORY_ALLOCATION;
+        }
+    }
+    scan_out->pool = pool;
+    scan_out->predicate = predicate;
+    scan_out->decoded = projection != NULL ? projection->decoded : NULL;
+    scan_out->callback = callback;
+    scan_out->ctx = ctx;
+    pthread_mutex_init(&scan_out->lock, NULL);
+    pthread_cond_init(&scan_out->morsel_done, NULL);
+    scan_out->in_flight = 0;
+    scan_out->stop = 0;
+    scan_out->status = SCAN_OP_SUCCESS;
+    scan_out->started_ns = stats_now();
+    return SCAN_OP_SUCCESS;
+}
+
+ScanOpStatus parallel_scan_file(parallel_scan_t *scan, int fd, header_t header, const tombstone_t *tombstones) {
+    if (fd < 0) {
+        return SCAN_OP_ERROR_INVALID_FD;
+    }
+    if (scan == NULL) {
+        return SCAN_OP_ERROR_INVALID_ARG;
+    }
+
+    size_t max_in_flight = scan->pool->num_threads * SCAN_MORSELS_PER_THREAD;
+    size_t capacity = SCAN_MORSEL_SIZE;
+    uint64_t offset = header_size(header);
+    size_t row_index = 0;
+    posix_fadvise(fd, offset, header.data_end - offset, POSIX_FADV_SEQUENTIAL);
+
+    while (row_index < header.num_rows && !__atomic_load_n(&scan->stop, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&scan->lock);
+        while (scan->in_flight >= max_in_flight) {
+            pthread_cond_wait(&scan->morsel_done, &scan->lock);
+        }
+        pthread_mutex_unlock(&scan->lock);
+
+        uint8_t *buffer = NULL;
+        size_t length, num_rows;
+        ScanOpStatus status = read_row_block(fd, header, offset, header.num_rows - row_index, &buffer, &capacity,
+                                             &length, &num_rows);
+        if (status != SCAN_OP_SUCCESS) {
+            free(buffer);
+            stop_scan(scan, status);
+            break;
+        }
+
+        morsel_t *morsel = (morsel_t *) calloc(1, sizeof(morsel_t));
+        if (morsel == NULL) {
+            free(buffer);
+            stop_scan(scan, SCAN_OP_ERROR_MEMORY_ALLOCATION);
+            break;
+        }
+        morsel->scan = scan;
+        morsel->buffer = buffer;
+        morsel->length = length;
+        morsel->offset = offset;
+        morsel->first_row = row_index;
+        morsel->num_rows = num_rows;
+        morsel->header = header;
+
+        // Tombstones are resolved here so the morsel doesn't depend on the caller's state
+        int failed = 0;
+        for (size_t i = 0; i < num_rows; i++) {
+            if (!is_tombstoned(tombstones, row_index + i)) {
+                continue;
+            }
+            if (morsel->deleted == NULL) {
+                morsel->deleted = (uint8_t *) calloc((num_rows + 7) / 8, sizeof(uint8_t));
+                failed = morsel->deleted == NULL;
+                if (failed) {
+                    break;
+                }
+            }
+            morsel->deleted[i / 8] |= (uint8_t) (1u << (i % 8));
+        }
+        if (failed) {
+            free(buffer);
+            free(morsel);
+            stop_scan(scan, SCAN_OP_ERROR_MEMORY_ALLOCATION);
+            break;
+        }
+
+        pthread_mutex_lock(&scan->lock);
+        scan->in_flight++;
+        pthread_mutex_unlock(&scan->lock);
+        if (threadpool_submit(scan->pool, scan_morsel_task, morsel) != THREADPOOL_OP_SUCCESS) {
+            pthread_mutex_lock(&scan->lock);
+            scan->in_flight--;
+            pthread_mutex_unlock(&scan->lock);
+            free(buffer);
+            free(morsel->deleted);
+            free(morsel);
+            stop_scan(scan, SCAN_OP_ERROR_THREAD);
+            break;
+        }
+
+        offset += length;
+        row_index += num_rows;
+    }
+
+    return scan->status;
+}
+
+ScanOpStatus finish_parallel_scan(parallel_scan_t *scan) {
+    pthread_mutex_lock(&scan->lock);
+    while (scan->in_flight > 0) {
+        pthread_cond_wait(&scan->morsel_done, &scan->lock);
+    }
+    pthread_mutex_unlock(&scan->lock);
+
+    pthread_mutex_destroy(&scan->lock);
+    pthread_cond_destroy(&scan->morsel_done);
+    if (scan->cells != NULL) {
+        for (size_t i = 0; i < scan->pool->num_threads; i++) {
+            free(scan->cells[i]);
+        }
+        free(scan->cells);
+    }
+    STATS_RECORD(STAT_SCAN, scan->started_ns, scan->status != SCAN_OP_SUCCESS);
+    return scan->status;
+}
+
+ScanOpStatus scan_rows_parallel(int fd, header_t header, const tombstone_t *tombstones, const predicate_t *predicate,
+                                const projection_t *projection, scan_callback_t callback, void *ctx,
+                                threadpool_t *pool) {
+    if (pool == NULL || pool->num_threads == 1 || header.data_end - header_size(header) <= SCAN_MORSEL_SIZE) {
+        return scan_rows(fd, header, tombstones, predicate, projection, callback, ctx);
+    }
+
+    parallel_scan_t scan;
+    ScanOpStatus status = begin_parallel_scan(pool, predicate, projection, callback, ctx, &scan);
+    if (status != SCAN_OP_SUCCESS) {
+        return status;
+    }
+    parallel_scan_file(&scan, fd, header, tombstones);
+    return finish_parallel_scan(&scan);
+}
@@ -4,11 +4,13 @@
 #include <string.h> 
 
 #include "schema.h"
+#include "stats.h"
 
 
 void free_columns(column_t *columns, size_t allocated_columns) {
-    for (size_t i = 0; i < allocated_columns; i++) {
-        free(columns[i].name);
+    // The names are interned, the first one starts the buffer holding them all
+    if (allocated_columns > 0) {
+        free(columns[0].name);
     }
     free(columns);
 }
@@ -23,6 +25,10 @@ void print_parsed_schema(column_t *columns, size_t allocated_columns) {
             printf("  Data type: float\n");
         } else if (dt == 2) {
             printf("  Data type: string\n");
+        } else if (dt == 3) {
+            printf("  Data type: int64\n");
+        } else if (dt == 4) {
+            printf("  Data type: double\n");
         } else {
             printf("  Unrecognized data type\n");
         }
@@ -30,139 +36,135 @@ void print_parsed_schema(column_t *columns, size_t allocated_columns) {
     }
 }
 
-SchemaOpStatus parse_schema(char *schema, column_t **columns_out, size_t *allocated_columns_out) {
+static int is_name_start(uint8_t ch) {
+    return (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || ch == '_';
+}
+
+static int is_name_char(uint8_t ch) {
+    return is_name_start(ch) || (ch >= '0' && ch <= '9');
+}
+
+static int parse_data_type(const char *data_type, size_t length) {
+    if (length == 3 && memcmp(data_type, "int", 3) == 0) {
+        return 0;
+    } else if (length == 5 && memcmp(data_type, "float", 5) == 0) {
+        return 1;
+    } else if (length == 6 && memcmp(data_type, "string", 6) == 0) {
+        return 2;
+    } else if (length == 5 && memcmp(data_type, "int64", 5) == 0) {
+        return 3;
+    } else if (length == 6 && memcmp(data_type, "double", 6) == 0) {
+        return 4;
+    }
+    return -1;
+}
+
+// Single pass over the schema. The columns and the interned names grow geometrically,
+// names only get their address once the buffer stopped moving.
+static SchemaOpStatus parse_columns(char *schema, column_t **columns_out, size_t *allocated_columns_out) {
     if (schema[0] != '(') {
         return SCHEMA_OP_ERROR_INVALID_ARG;
     }
 
-    column_t *columns = NULL; 
-    size_t num_columns = 10; 
-    columns = (column_t *) calloc(num_columns, sizeof(column_t)); 
-    if (columns == NULL) {
+    size_t capacity = SCHEMA_INITIAL_COLUMNS;
+    size_t names_capacity = SCHEMA_INITIAL_COLUMNS * 16;
+    column_t *columns = (column_t *) malloc(capacity * sizeof(column_t));
+    char *names = (char *) malloc(names_capacity);
+    if (columns == NULL || names == NULL) {
+        free(columns);
+        free(names);
         return SCHEMA_OP_ERROR_MEMORY_ALLOCATION;
     }
 
-    size_t col_num = 0;  // Determines when to realloc
-    size_t realloc_counter = 1;
-
+    SchemaOpStatus status = SCHEMA_OP_SUCCESS;
+    size_t col_num = 0;
+    size_t names_length = 0;
     size_t i = 1;
-    size_t j = 1;
-    uint8_t ch = (uint8_t) schema[1];
-    char column_name_start = 1;
-    char data_type_start = 0;
-
-    while (ch != 41 && ch != '\0' && i < MAX_SCHEMA_LENGTH) {
-        if (column_name_start) {
-            if (ch < 65 || (ch > 90 && ch < 97 && ch != 95) || ch > 122 ) {
-                // First character of a column name should only be letters or underscore
-                free_columns(columns, col_num);
-                return SCHEMA_OP_ERROR_INVALID_ARG;
-            }
+    for (;;) {
+        // "name:type", the name starts with a letter or an underscore
+        size_t name_start = i;
+        if (!is_name_start((uint8_t) schema[i])) {
+            status = SCHEMA_OP_ERROR_INVALID_ARG;
+            break;
+        }
+        while (is_name_char((uint8_t) schema[i])) {
+            i++;
+        }
+        size_t name_length = i - name_start;
+        if (schema[i] != ':' || (name_length + 1) > MAX_COLUMN_NAME_LENGTH) {
+            status = SCHEMA_OP_ERROR_INVALID_ARG;
+            break;
+        }
 
-            column_name_start = 0;
+        size_t data_type_start = ++i;
+        while ((schema[i] >= 'a' && schema[i] <= 'z') || (schema[i] >= '0' && schema[i] <= '9')) {
             i++;
-            ch = (uint8_t) schema[i];
-        } else {
-            if (!data_type_start) {
-                if (ch < 48 || (ch > 57 && ch < 65 && ch != 58) || (ch > 90 && ch < 97 && ch != 95) || ch > 122) {
-                    free_columns(columns, col_num);
-                    return SCHEMA_OP_ERROR_INVALID_ARG; 
-                }
-
-                if (ch == 58) {
-                    size_t column_name_length = i - j;
-                    if ((column_name_length + 1) > MAX_COLUMN_NAME_LENGTH) {
-                        free_columns(columns, col_num);
-                        return SCHEMA_OP_ERROR_INVALID_ARG; 
-                    }
-
-                    columns[col_num].name_length = column_name_length;
-                    columns[col_num].name = (char *) malloc(columns[col_num].name_length + 1);  // Pay attention to the null termination symbol here
-                    if (columns[col_num].name == NULL) {
-                        free_columns(columns, col_num);
-                        return SCHEMA_OP_ERROR_MEMORY_ALLOCATION;
-                    }
-                    memcpy(columns[col_num].name, &schema[j], column_name_length);
-                    columns[col_num].name[column_name_length] = '\0';   // Pay attention and null-terminate the string
-                    
-                    j = i + 1;  // j is start of data type
-                    data_type_start = 1;
-                }
-
-                i++;
-                ch = (uint8_t) schema[i];
-            } else {
-                if (ch == 32) {
-                    size_t data_type_length = i - j;
-                    if ((data_type_length + 1) > MAX_DATA_TYPE_NAME_LENGTH) {
-                        free_columns(columns, col_num);
-                        return SCHEMA_OP_ERROR_INVALID_ARG; 
-                    }
-
-                    if (data_type_length == 3 && memcmp(&schema[j], "int", 3) == 0) {
-                        columns[col_num].data_type = 0;
-                    } else if (data_type_length == 5 && memcmp(&schema[j], "float", 5) == 0) {
-                        columns[col_num].data_type = 1;
-                    } else if (data_type_length == 6 && memcmp(&schema[j], "string", 6) == 0) {
-                        columns[col_num].data_type = 2;
-                    } else {
-                        free_columns(columns, col_num);
-                        return SCHEMA_OP_ERROR_INVALID_ARG; 
-                    }
-
-                    col_num++;
-                    if ((col_num + 1) == (num_columns * realloc_counter)) {
-                        column_t *temp_columns = reallocarray(columns, num_columns * (realloc_counter + 1), sizeof(column_t));
-                        if (temp_columns == NULL) {
-                            free_columns(columns, col_num - 1);
-                            return SCHEMA_OP_ERROR_MEMORY_ALLOCATION;
-                        } else {
-                            columns = temp_columns;
-                        }
-                        realloc_counter++;
-                    }
-
-                    data_type_start = 0;
-                    column_name_start = 1;
-                    j = i + 1;  // j is the start of column name
-                } else {
-                    if (ch < 97 || ch > 122) {
-                        free_columns(columns, col_num);
-                        return SCHEMA_OP_ERROR_INVALID_ARG; 
-                    }
-                }
-
-                i++;
-                ch = (uint8_t) schema[i];
+        }
+        int data_type = parse_data_type(&schema[data_type_start], i - data_type_start);
+        if (data_type < 0 || (schema[i] != ' ' && schema[i] != ')' && schema[i] != '\0')
+            || i >= MAX_SCHEMA_LENGTH || col_num == MAX_NUM_COLUMNS) {
+            status = SCHEMA_OP_ERROR_INVALID_ARG;
+            break;
+        }
+
+        if (col_num == capacity) {
+            column_t *temp_columns = reallocarray(columns, capacity * 2, sizeof(column_t));
+            if (temp_columns == NULL) {
+                status = SCHEMA_OP_ERROR_MEMORY_ALLOCATION;
+                break;
             }
+            columns = temp_columns;
+            capacity *= 2;
+        }
+        if (names_length + name_length + 1 > names_capacity) {
+            size_t new_capacity = names_capacity * 2;
+            while (names_length + name_length + 1 > new_capacity) {
+                new_capacity *= 2;
+            }
+            char *temp_names = (char *) realloc(names, new_capacity);
+            if (temp_names == NULL) {
+                status = SCHEMA_OP_ERROR_MEMORY_ALLOCATION;
+                break;
+            }
+            names = temp_names;
+            names_capacity = new_capacity;
         }
-    }
 
-    if (MAX_SCHEMA_LENGTH <= i) {
-        free_columns(columns, col_num);
-        return SCHEMA_OP_ERROR_INVALID_ARG;
+        memcpy(&names[names_length], &schema[name_start], name_length);
+        names[names_length + name_length] = '\0';
+        names_length += name_length + 1;
+        columns[col_num].name_length = name_length;
+        columns[col_num].data_type = data_type;
+        col_num++;
+
+        // A single space separates the columns, anything after the closing parenthesis is ignored
+        if (schema[i] != ' ') {
+            break;
+        }
+        i++;
     }
 
-    // Case not handled within loop because of termination
-    size_t data_type_length = i - j;
-    if ((data_type_length + 1) > MAX_DATA_TYPE_NAME_LENGTH) {
-        free_columns(columns, col_num);
-        return SCHEMA_OP_ERROR_INVALID_ARG; 
+    if (status != SCHEMA_OP_SUCCESS) {
+        free(columns);
+        free(names);
+        return status;
     }
 
-    if (data_type_length == 3 && memcmp(&schema[j], "int", 3) == 0) {
-        columns[col_num].data_type = 0;
-    } else if (data_type_length == 5 && memcmp(&schema[j], "float", 5) == 0) {
-        columns[col_num].data_type = 1;
-    } else if (data_type_length == 6 && memcmp(&schema[j], "string", 6) == 0) {
-        columns[col_num].data_type = 2;
-    } else {
-        free_columns(columns, col_num);
-        return SCHEMA_OP_ERROR_INVALID_ARG; 
+    size_t offset = 0;
+    for (size_t c = 0; c < col_num; c++) {
+        columns[c].name = &names[offset];
+        offset += columns[c].name_length + 1;
     }
 
     *columns_out = columns;
-    *allocated_columns_out = col_num + 1;  // "Actual" number of allocated columns
+    *allocated_columns_out = col_num;
     return SCHEMA_OP_SUCCESS;
 }
 
+SchemaOpStatus parse_schema(char *schema, column_t **columns_out, size_t *allocated_columns_out) {
+    STATS_START(start);
+    SchemaOpStatus status = parse_columns(schema, columns_out, allocated_columns_out);
+    STATS_RECORD(STAT_PARSE_SCHEMA, start, status != SCHEMA_OP_SUCCESS);
+    return status;
+}
+
@@ -0,0 +1,750 @@
+#define _GNU_SOURCE  // accept4
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "file.h"
+#include "append.h"
+#include "predicate.h"
+#include "tombstone.h"
+#include "scan.h"
+#include "partition.h"
+#include "group.h"
+#include "cache.h"
+#include "writer.h"
+#include "stats.h"
+
+#define REQUEST_FIXED_SIZE (sizeof(uint8_t) + sizeof(uint16_t))
+#define RESPONSE_PREFIX_SIZE (sizeof(uint32_t) + sizeof(uint8_t))
+
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int signum) {
+    stop_requested = 1;
+}
+
+static int reserve(uint8_t **buffer, size_t *capacity, size_t needed) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+    size_t new_capacity = *capacity == 0 ? SERVER_READ_SIZE : *capacity;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    uint8_t *new_buffer = (uint8_t *) realloc(*buffer, new_capacity);
+    if (new_buffer == NULL) {
+        return -1;
+    }
+    *buffer = new_buffer;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static void free_client(server_client_t *client) {
+    close(client->fd);
+    free(client->in);
+    free(client->out);
+    memset(client, 0, sizeof(server_client_t));
+    client->fd = -1;
+}
+
+// Responses are built in place in the output buffer, the length is patched once the payload is complete
+static int begin_response(server_client_t *client, uint8_t status, size_t *start_out) {
+    if (reserve(&client->out, &client->out_capacity, client->out_length + RESPONSE_PREFIX_SIZE) != 0) {
+        return -1;
+    }
+    *start_out = client->out_length;
+    client->out[client->out_length + sizeof(uint32_t)] = status;
+    client->out_length += RESPONSE_PREFIX_SIZE;
+    return 0;
+}
+
+static void end_response(server_client_t *client, size_t start) {
+    uint32_t length = htobe32((uint32_t) (client->out_length - start - sizeof(uint32_t)));
+    memcpy(&client->out[start], &length, sizeof(uint32_t));
+}
+
+static int respond(server_client_t *client, uint8_t status, const void *payload, size_t length) {
+    size_t start;
+    if (begin_response(client, status, &start) != 0
+        || reserve(&client->out, &client->out_capacity, client->out_length + length) != 0) {
+        return -1;
+    }
+    memcpy(&client->out[client->out_length], payload, length);
+    client->out_length += length;
+    end_response(client, start);
+    return 0;
+}
+
+static int respond_error(server_client_t *client, uint8_t status, const char *message) {
+    return respond(client, status, message, strlen(message));
+}
+
+static void close_tables(server_table_t *tables, size_t num_tables) {
+    for (size_t i = 0; i < num_tables; i++) {
+        close(tables[i].fd);
+        free_rollups(&tables[i].rollups);
+        free_header(&tables[i].header);
+        free(tables[i].path);
+    }
+}
+
+// Other processes append and delete rows too, their appends move the states forward in the
+// sidecar and their deletes reset them
+static int reload_rollups(server_table_t *table) {
+    rollups_t rollups;
+    if (load_rollups(table->path, table->fd, table->header, &rollups) != ROLLUP_OP_SUCCESS) {
+        return -1;
+    }
+    if (refresh_rollups(table->path, table->fd, table->header, &rollups) != ROLLUP_OP_SUCCESS) {
+        free_rollups(&rollups);
+        return -1;
+    }
+    free_rollups(&table->rollups);
+    table->rollups = rollups;
+    return 0;
+}
+
+static int open_table(const char *path, server_table_t *table_out) {
+    server_table_t table = {.path = strdup(path), .fd = -1, .rollups = {.fd = -1}};
+    if (table.path == NULL) {
+        return -1;
+    }
+    if (open_file(path, &table.fd) != FILE_SUCCESS) {
+        free(table.path);
+        return -1;
+    }
+    struct stat fd_stat;
+    if (fstat(table.fd, &fd_stat) == -1 || is_manifest(table.fd)
+        || read_header(table.fd, &table.header) != HEADER_OP_SUCCESS) {
+        close(table.fd);
+        free(table.path);
+        return -1;
+    }
+    table.device = (uint64_t) fd_stat.st_dev;
+    table.inode = (uint64_t) fd_stat.st_ino;
+    if (reload_rollups(&table) != 0) {
+        free_header(&table.header);
+        close(table.fd);
+        free(table.path);
+        return -1;
+    }
+
+    *table_out = table;
+    return 0;
+}
+
+// A sort or a compaction renames a new file over the table, which is then opened again. The
+// row count and data end are read again before every request, other processes may have appended.
+static int refresh_table(server_table_t *table) {
+    struct stat path_stat;
+    if (stat(table->path, &path_stat) == -1) {
+        return -1;
+    }
+    if ((uint64_t) path_stat.st_dev != table->device || (uint64_t) path_stat.st_ino != table->inode) {
+        server_table_t reopened;
+        if (open_table(table->path, &reopened) != 0) {
+            return -1;
+        }
+        reopened.epoch = table->epoch + 1;
+        close_tables(table, 1);
+        *table = reopened;
+        return 0;
+    }
+
+    snapshot_t snapshot;
+    if (read_snapshot(table->fd, &snapshot) != HEADER_OP_SUCCESS) {
+        return -1;
+    }
+    table->header.generation = snapshot.generation;
+    table->header.num_rows = snapshot.num_rows;
+    table->header.data_end = snapshot.data_end;
+    return 0;
+}
+
+static server_table_t *get_table(server_table_t *tables, size_t *num_tables, const char *path) {
+    for (size_t i = 0; i < *num_tables; i++) {
+        if (strcmp(tables[i].path, path) == 0) {
+            return refresh_table(&tables[i]) == 0 ? &tables[i] : NULL;
+        }
+    }
+
+    if (*num_tables == SERVER_MAX_TABLES || open_table(path, &tables[*num_tables]) != 0) {
+        return NULL;
+    }
+    return &tables[(*num_tables)++];
+}
+
+typedef struct {
+    server_client_t *client;
+    size_t num_rows;
+    int limit;
+    int failed;
+} send_ctx_t;
+
+static int send_scanned_row(row_t row, size_t row_index, uint64_t offset, void *ctx) {
+    send_ctx_t *send_ctx = (send_ctx_t *) ctx;
+    server_client_t *client = send_ctx->client;
+
+    size_t length = row_encoded_size(row);
+    if (reserve(&client->out, &client->out_capacity, client->out_length + length) != 0) {
+        send_ctx->failed = 1;
+        return 1;
+    }
+    client->out_length += encode_row(&client->out[client->out_length], row);
+    send_ctx->num_rows++;
+    return send_ctx->limit && send_ctx->num_rows == 1;
+}
+
+static cache_version_t table_version(const server_table_t *table, const tombstone_t *tombstones) {
+    return (cache_version_t) {
+        .inode = table->inode, .epoch = table->epoch, .generation = table->header.generation, .num_rows = table->header.num_rows,
+        .data_end = table->header.data_end, .deleted = count_tombstones(tombstones)
+    };
+}
+
+// Queries are keyed on what they were parsed into rather than on their text, "a>1" and
+// "a > 1" share an entry
+static uint8_t *query_key(uint8_t opcode, const char *path, const predicate_t *predicate, const aggregate_t *aggs,
+                         size_t num_aggs, size_t *length_out) {
+    size_t path_length = strlen(path);
+    size_t length = sizeof(uint8_t) + path_length + 1 + sizeof(uint8_t) + num_aggs * (sizeof(uint8_t) + sizeof(uint32_t));
+    if (predicate != NULL) {
+        length += sizeof(uint32_t) + sizeof(uint8_t) + (predicate->data_type == CELL_TYPE_STRING
+                  ? sizeof(uint64_t) + predicate->value.string_cell.length
+                  : fixed_cell_size(predicate->data_type) - sizeof(uint8_t));
+    }
+    uint8_t *key = (uint8_t *) malloc(length);
+    if (key == NULL) {
+        return NULL;
+    }
+
+    uint8_t *pos = key;
+    *pos++ = opcode;
+    memcpy(pos, path, path_length + 1);
+    pos += path_length + 1;
+    *pos++ = predicate != NULL;
+    if (predicate != NULL) {
+        uint32_t col_index = (uint32_t) predicate->col_index;
+        memcpy(pos, &col_index, sizeof(uint32_t));
+        pos += sizeof(uint32_t);
+        *pos++ = (uint8_t) predicate->op;
+        if (predicate->data_type == CELL_TYPE_STRING) {
+            uint64_t string_length = predicate->value.string_cell.length;
+            memcpy(pos, &string_length, sizeof(uint64_t));
+            memcpy(&pos[sizeof(uint64_t)], STRING_CELL_DATA(&predicate->value.string_cell), string_length);
+            pos += sizeof(uint64_t) + string_length;
+        } else {
+            // Numbers sit at the start of the union, 4 or 8 bytes of it
+            size_t value_size = fixed_cell_size(predicate->data_type) - sizeof(uint8_t);
+            memcpy(pos, &predicate->value, value_size);
+            pos += value_size;
+        }
+    }
+    for (size_t i = 0; i < num_aggs; i++) {
+        uint32_t col_index = (uint32_t) aggs[i].col_index;
+        *pos++ = (uint8_t) aggs[i].fn;
+        memcpy(pos, &col_index, sizeof(uint32_t));
+        pos += sizeof(uint32_t);
+    }
+
+    *length_out = length;
+    return key;
+}
+
+static int handle_append(server_client_t *client, server_table_t *table, char *argument) {
+    row_t row;
+    if (parse_row(table->header, argument, &row) != APPEND_OP_SUCCESS) {
+        return respond_error(client, SERVER_RESPONSE_BAD_REQUEST, "Failed to parse row.");
+    }
+
+    if (table->header.version != VERSION) {
+        // The table moves to a new inode, the next refresh must not take that for someone else's rewrite
+        struct stat fd_stat;
+        if (upgrade_table(table->path, table->fd, &table->header) != WRITER_OP_SUCCESS
+            || fstat(table->fd, &fd_stat) == -1) {
+            free_row(&row, row.num_cells);
+            return respond_error(client, SERVER_RESPONSE_IO_ERROR, "Failed to upgrade the table's header.");
+        }
+        table->inode = (uint64_t) fd_stat.st_ino;
+    }
+    if (table->rollups.fd != -1 && reload_rollups(table) != 0) {
+        free_row(&row, row.num_cells);
+        return respond_error(client, SERVER_RESPONSE_IO_ERROR, "Failed to load the rollups.");
+    }
+    AppendOpStatus aop_status = append_row(table->fd, &table->header, row);
+    if (aop_status == APPEND_OP_SUCCESS) {
+        fold_rollups(&table->rollups, row);
+    }
+    free_row(&row, row.num_cells);
+    if (aop_status != APPEND_OP_SUCCESS) {
+        return respond_error(client, SERVER_RESPONSE_IO_ERROR, "Failed to write row.");
+    }
+    // A delete reset the rollups since they were reloaded: they are computed again
+    RollupOpStatus rop_status = publish_rollups(&table->rollups, table->header);
+    if (rop_status == ROLLUP_OP_STALE ? reload_rollups(table) != 0 : rop_status != ROLLUP_OP_SUCCESS) {
+        return respond_error(client, SERVER_RESPONSE_IO_ERROR, "Failed to update the rollups.");
+    }
+
+    uint64_t num_rows = htobe64(table->header.num_rows);
+    return respond(client, SERVER_RESPONSE_OK, &num_rows, sizeof(num_rows));
+}
+
+static int handle_scan(server_client_t *client, server_table_t *table, char *argument, int lookup,
+                       result_cache_t *cache) {
+    predicate_t predicate;
+    int filtered = argument[0] != '\0';
+    if (lookup && !filtered) {
+        return respond_error(client, SERVER_RESPONSE_BAD_REQUEST, "A lookup needs a predicate.");
+    }
+    if (filtered && parse_predicate(table->header, argument, &predicate) != PREDICATE_OP_SUCCESS) {
+        return respond_error(client, SERVER_RESPONSE_BAD_REQUEST, "Failed to parse the predicate.");
+    }
+
+    // Deletes may come from other processes, the sidecar is reloaded for every scan
+    tombstone_t tombstones;
+    if (load_tombstones(table->path, table->fd, &tombstones) != TOMBSTONE_OP_SUCCESS) {
+        if (filtered) {
+            free_predicate(&predicate);
+        }
+        return respond_error(client, SERVER_RESPONSE_IO_ERROR, "Failed to load the tombstones.");
+    }
+
+    // A cached response only holds for the exact version of the table it was read from
+    cache_version_t version = table_version(table, &tombstones);
+    size_t key_length;
+    uint8_t *key = query_key(lookup ? SERVER_REQUEST_LOOKUP : SERVER_REQUEST_SCAN, table->path,
+                             filtered ? &predicate : NULL, NULL, 0, &key_length);
+    const cache_entry_t *entry = key != NULL ? cache_get(cache, key, key_length) : NULL;
+    if (entry != NULL && memcmp(&entry->version, &version, sizeof(cache_version_t)) == 0) {
+        free(key);
+        free_tombstones(&tombstones);
+        if (filtered) {
+            free_predicate(&predicate);
+        }
+        return respond(client, SERVER_RESPONSE_OK, entry->value, entry->value_length);
+    }
+
+    size_t start;
+    if (begin_response(client, SERVER_RESPONSE_OK, &start) != 0
+        || reserve(&client->out, &client->out_capacity, client->out_length + sizeof(uint64_t)) != 0) {
+        free(key);
+        free_tombstones(&tombstones);
+        if (filtered) {
+            free_predicate(&predicate);
+        }
+        return -1;
+    }
+    size_t count_offset = client->out_length;
+    client->out_length += sizeof(uint64_t);
+
+    send_ctx_t send_ctx = {.client = client, .num_rows = 0, .limit = lookup, .failed = 0};
+    ScanOpStatus scan_status = scan_rows(table->fd, table->header, &tombstones, filtered ? &predicate : NULL, NULL,
+                                         send_scanned_row, &send_ctx);
+    free_tombstones(&tombstones);
+    if (filtered) {
+        free_predicate(&predicate);
+    }
+
+    if (scan_status != SCAN_OP_SUCCESS || send_ctx.failed) {
+        // Drop the partial rows and answer with an error instead
+        free(key);
+        client->out_length = start;
+        return respond_error(client, SERVER_RESPONSE_IO_ERROR, "Failed to scan the rows.");
+    }
+
+    uint64_t num_rows = htobe64(send_ctx.num_rows);
+    memcpy(&client->out[count_offset], &num_rows, sizeof(uint64_t));
+    if (key != NULL) {
+        // Failing to cache it doesn't fail the request, nor does a result larger than the cache
+        cache_put(cache, key, key_length, version, &client->out[count_offset], client->out_length - count_offset);
+        free(key);
+    }
+    end_response(client, start);
+    return 0;
+}
+
+typedef struct {
+    const aggregate_t *aggs;
+    size_t num_aggs;
+    agg_state_t *states;
+} aggregate_ctx_t;
+
+static int fold_scanned_row(row_t row, size_t row_index, uint64_t offset, void *ctx) {
+    aggregate_ctx_t *aggregate_ctx = (aggregate_ctx_t *) ctx;
+    fold_aggregates(aggregate_ctx->aggs, aggregate_ctx->num_aggs, aggregate_ctx->states, row);
+    return 0;
+}
+
+static int respond_aggregates(server_client_t *client, const aggregate_t *aggs, size_t num_aggs,
+                              const agg_state_t *states) {
+    agg_result_t results[GROUP_MAX_AGGREGATES];
+    aggregate_results(aggs, num_aggs, states, results);
+
+    uint8_t payload[sizeof(uint32_t) + GROUP_MAX_AGGREGATES * (sizeof(uint8_t) + sizeof(uint64_t))];
+    uint32_t num_aggs_nbo = htobe32((uint32_t) num_aggs);
+    memcpy(payload, &num_aggs_nbo, sizeof(uint32_t));
+    uint8_t *pos = &payload[sizeof(uint32_t)];
+    for (size_t i = 0; i < num_aggs; i++) {
+        uint64_t bits;
+        if (results[i].is_float) {
+            memcpy(&bits, &results[i].float_value, sizeof(uint64_t));
+        } else {
+            bits = (uint64_t) results[i].int_value;
+        }
+        bits = htobe64(bits);
+        *pos++ = results[i].is_float;
+        memcpy(pos, &bits, sizeof(uint64_t));
+        pos += sizeof(uint64_t);
+    }
+    return respond(client, SERVER_RESPONSE_OK, payload, pos - payload);
+}
+
+// "<aggregates>[ <predicate>]", the aggregates in the format of -A. A cached result of an
+// earlier version of the table only has the appended rows folded in.
+static int handle_aggregate(server_client_t *client, server_table_t *table, char *argument, result_cache_t *cache) {
+    char *space = strchr(argument, ' ');
+    if (space != NULL) {
+        *space = '\0';
+    }
+    aggregate_t *aggs;
+    size_t num_aggs;
+    if (parse_aggregates(table->header, argument, &aggs, &num_aggs) != GROUP_OP_SUCCESS) {
+        return respond_error(client, SERVER_RESPONSE_BAD_REQUEST, "Failed to parse the aggregates.");
+    }
+    predicate_t predicate;
+    int filtered = space != NULL;
+    if (filtered && parse_predicate(table->header, space + 1, &predicate) != PREDICATE_OP_SUCCESS) {
+        free(aggs);
+        return respond_error(client, SERVER_RESPONSE_BAD_REQUEST, "Failed to parse the predicate.");
+    }
+
+    tombstone_t tombstones;
+    agg_state_t *states = (agg_state_t *) calloc(num_aggs, sizeof(agg_state_t));
+    uint8_t *decoded = (uint8_t *) calloc(table->header.num_cols, sizeof(uint8_t));
+    size_t key_length;
+    uint8_t *key = query_key(SERVER_REQUEST_AGGREGATE, table->path, filtered ? &predicate : NULL, aggs, num_aggs,
+                             &key_length);
+    int ret;
+    if (states == NULL || decoded == NULL || key == NULL) {
+        ret = -1;
+    } else if (load_tombstones(table->path, table->fd, &tombstones) != TOMBSTONE_OP_SUCCESS) {
+        ret = respond_error(client, SERVER_RESPONSE_IO_ERROR, "Failed to load the tombstones.");
+    } else {
+        cache_version_t version = table_version(table, &tombstones);
+        size_t first_row = 0;
+        uint64_t offset = header_size(table->header);
+        const cache_entry_t *entry = cache_get(cache, key, key_length);
+        // Rows only ever get appended to a file while the count of deleted rows stays the same
+        if (entry != NULL && entry->value_length == num_aggs * sizeof(agg_state_t)
+            && entry->version.inode == version.inode && entry->version.epoch == version.epoch
+            && entry->version.deleted == version.deleted
+            && entry->version.num_rows <= version.num_rows && entry->version.data_end <= version.data_end) {
+            memcpy(states, entry->value, entry->value_length);
+            first_row = entry->version.num_rows;
+            offset = entry->version.data_end;
+        }
+
+        for (size_t i = 0; i < num_aggs; i++) {
+            if (aggs[i].fn != AGG_COUNT) {
+                decoded[aggs[i].col_index] = 1;
+            }
+        }
+        if (filtered) {
+            decoded[predicate.col_index] = 1;
+        }
+        projection_t projection = {.num_cols = 0, .columns = NULL, .decoded = decoded};
+        aggregate_ctx_t ctx = {.aggs = aggs, .num_aggs = num_aggs, .states = states};
+        ScanOpStatus scan_status = SCAN_OP_SUCCESS;
+        if (first_row < version.num_rows) {
+            scan_status = scan_rows_from(table->fd, table->header, first_row, offset, &tombstones,
+                                         filtered ? &predicate : NULL, &projection, fold_scanned_row, &ctx);
+        }
+        free_tombstones(&tombstones);
+
+        if (scan_status != SCAN_OP_SUCCESS) {
+            ret = respond_error(client, SERVER_RESPONSE_IO_ERROR, "Failed to scan the rows.");
+        } else {
+            if (first_row < version.num_rows || entry == NULL) {
+                cache_put(cache, key, key_length, version, (const uint8_t *) states, num_aggs * sizeof(agg_state_t));
+            }
+            ret = respond_aggregates(client, aggs, num_aggs, states);
+        }
+    }
+
+    free(key);
+    free(decoded);
+    free(states);
+    free(aggs);
+    if (filtered) {
+        free_predicate(&predicate);
+    }
+    return ret;
+}
+
+static int handle_stats(server_client_t *client) {
+    char *json = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&json, &length);
+    if (out == NULL) {
+        return -1;
+    }
+    write_stats_json(out);
+    if (fclose(out) != 0) {
+        free(json);
+        return -1;
+    }
+
+    int ret = respond(client, SERVER_RESPONSE_OK, json, length);
+    free(json);
+    return ret;
+}
+
+static int handle_request(server_client_t *client, server_table_t *tables, size_t *num_tables, result_cache_t *cache,
+                          const uint8_t *payload, size_t length) {
+    if (length < REQUEST_FIXED_SIZE) {
+        return respond_error(client, SERVER_RESPONSE_BAD_REQUEST, "Truncated request.");
+    }
+
+    uint8_t opcode = payload[0];
+    if (opcode == SERVER_REQUEST_STATS) {
+        return handle_stats(client);
+    }
+    uint16_t path_length;
+    memcpy(&path_length, &payload[1], sizeof(uint16_t));
+    path_length = be16toh(path_length);
+    if (path_length == 0 || REQUEST_FIXED_SIZE + path_length > length) {
+        return respond_error(client, SERVER_RESPONSE_BAD_REQUEST, "Invalid table path.");
+    }
+
+    // Both strings are copied to get null terminated copies the parsers can work with
+    size_t argument_length = length - REQUEST_FIXED_SIZE - path_length;
+    char *strings = (char *) malloc(path_length + 1 + argument_length + 1);
+    if (strings == NULL) {
+        return -1;
+    }
+    char *path = strings;
+    char *argument = &strings[path_length + 1];
+    memcpy(path, &payload[REQUEST_FIXED_SIZE], path_length);
+    path[path_length] = '\0';
+    memcpy(argument, &payload[REQUEST_FIXED_SIZE + path_length], argument_length);
+    argument[argument_length] = '\0';
+
+    int ret;
+    server_table_t *table = get_table(tables, num_tables, path);
+    if (table == NULL) {
+        ret = respond_error(client, SERVER_RESPONSE_TABLE_ERROR, "Failed to open the table.");
+    } else if (opcode == SERVER_REQUEST_APPEND) {
+        ret = handle_append(client, table, argument);
+    } else if (opcode == SERVER_REQUEST_SCAN || opcode == SERVER_REQUEST_LOOKUP) {
+        ret = handle_scan(client, table, argument, opcode == SERVER_REQUEST_LOOKUP, cache);
+    } else if (opcode == SERVER_REQUEST_AGGREGATE) {
+        ret = handle_aggregate(client, table, argument, cache);
+    } else {
+        ret = respond_error(client, SERVER_RESPONSE_BAD_REQUEST, "Unknown request.");
+    }
+
+    free(strings);
+    return ret;
+}
+
+// Handles every complete frame in the input buffer, in order. Returns -1 if the client must be dropped.
+static int handle_frames(server_client_t *client, server_table_t *tables, size_t *num_tables, result_cache_t *cache) {
+    size_t consumed = 0;
+    while (client->in_length - consumed >= sizeof(uint32_t)) {
+        uint32_t length;
+        memcpy(&length, &client->in[consumed], sizeof(uint32_t));
+        length = be32toh(length);
+        if (length > SERVER_MAX_FRAME) {
+            return -1;
+        }
+        if (client->in_length - consumed - sizeof(uint32_t) < length) {
+            break;
+        }
+        if (handle_request(client, tables, num_tables, cache, &client->in[consumed + sizeof(uint32_t)], length) != 0) {
+            return -1;
+        }
+        consumed += sizeof(uint32_t) + length;
+    }
+
+    memmove(client->in, &client->in[consumed], client->in_length - consumed);
+    client->in_length -= consumed;
+    return 0;
+}
+
+static int read_client(server_client_t *client, server_table_t *tables, size_t *num_tables, result_cache_t *cache) {
+    if (reserve(&client->in, &client->in_capacity, client->in_length + SERVER_READ_SIZE) != 0) {
+        return -1;
+    }
+    ssize_t bytes_read = read(client->fd, &client->in[client->in_length], SERVER_READ_SIZE);
+    if (bytes_read == -1 && (errno == EAGAIN || errno == EINTR)) {
+        return 0;
+    }
+    if (bytes_read <= 0) {
+        return -1;
+    }
+    client->in_length += bytes_read;
+    return handle_frames(client, tables, num_tables, cache);
+}
+
+static int write_client(server_client_t *client) {
+    while (client->out_offset < client->out_length) {
+        ssize_t bytes_written = write(client->fd, &client->out[client->out_offset],
+                                      client->out_length - client->out_offset);
+        if (bytes_written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN ? 0 : -1;
+        }
+        client->out_offset += bytes_written;
+    }
+    client->out_offset = 0;
+    client->out_length = 0;
+    return 0;
+}
+
+static int open_socket(const char *socket_path) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    // A socket file nobody listens on is left over from a server that didn't shut down cleanly
+    if (connect(fd, (struct sockaddr *) &address, sizeof(address)) == 0) {
+        close(fd);
+        errno = EADDRINUSE;
+        return -1;
+    }
+    if (errno == ECONNREFUSED) {
+        unlink(socket_path);
+    }
+
+    // Only the owner may connect, requests can name any table the server can open
+    mode_t old_umask = umask(0077);
+    int ret = bind(fd, (struct sockaddr *) &address, sizeof(address));
+    umask(old_umask);
+    if (ret == -1 || listen(fd, SOMAXCONN) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+ServerOpStatus run_server(const char *socket_path, size_t cache_capacity) {
+    if (socket_path == NULL) {
+        return SERVER_OP_ERROR_INVALID_ARG;
+    }
+
+    result_cache_t cache;
+    if (init_cache(cache_capacity != 0 ? cache_capacity : CACHE_DEFAULT_CAPACITY, &cache) != CACHE_OP_SUCCESS) {
+        return SERVER_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    int listen_fd = open_socket(socket_path);
+    if (listen_fd == -1) {
+        free_cache(&cache);
+        return SERVER_OP_SOCKET_ERROR;
+    }
+
+    // No SA_RESTART: poll has to return so the loop notices the stop request
+    struct sigaction action = {.sa_handler = request_stop};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    server_table_t tables[SERVER_MAX_TABLES];
+    size_t num_tables = 0;
+    server_client_t clients[SERVER_MAX_CLIENTS];
+    for (size_t i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        memset(&clients[i], 0, sizeof(server_client_t));
+        clients[i].fd = -1;
+    }
+    struct pollfd fds[1 + SERVER_MAX_CLIENTS];
+    ServerOpStatus status = SERVER_OP_SUCCESS;
+
+    while (!stop_requested) {
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < SERVER_MAX_CLIENTS; i++) {
+            // A client that doesn't read its responses stops being read from
+            fds[1 + i].fd = clients[i].fd;
+            fds[1 + i].events = clients[i].out_length > SERVER_MAX_FRAME ? 0 : POLLIN;
+            if (clients[i].out_length > 0) {
+                fds[1 + i].events |= POLLOUT;
+            }
+        }
+
+        if (poll(fds, 1 + SERVER_MAX_CLIENTS, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            status = SERVER_OP_SOCKET_ERROR;
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int client_fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client_fd != -1) {
+                size_t slot = 0;
+                while (slot < SERVER_MAX_CLIENTS && clients[slot].fd != -1) {
+                    slot++;
+                }
+                if (slot == SERVER_MAX_CLIENTS) {
+                    close(client_fd);
+                } else {
+                    clients[slot].fd = client_fd;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < SERVER_MAX_CLIENTS; i++) {
+            server_client_t *client = &clients[i];
+            short revents = fds[1 + i].revents;
+            if (client->fd == -1 || fds[1 + i].fd != client->fd || revents == 0) {
+                continue;
+            }
+
+            int ret = 0;
+            if (revents & POLLIN) {
+                ret = read_client(client, tables, &num_tables, &cache);
+            } else if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                ret = -1;
+            }
+            // Write right away, most responses fit in the socket buffer
+            if (ret == 0 && client->out_length > 0) {
+                ret = write_client(client);
+            }
+            if (ret != 0) {
+                free_client(client);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        if (clients[i].fd != -1) {
+            free_client(&clients[i]);
+        }
+    }
+    close_tables(tables, num_tables);
+    free_cache(&cache);
+    close(listen_fd);
+    unlink(socket_path);
+    return status;
+}
@@ -0,0 +1,639 @@
+#define _GNU_SOURCE  // qsort_r
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+
+#include "sort.h"
+#include "file.h"
+#include "append.h"
+#include "scan.h"
+#include "tombstone.h"
+#include "rollup.h"
+#include "stats.h"
+
+
+typedef struct {
+    const size_t *key_cols;
+    size_t num_keys;
+    size_t max_key_col;
+    size_t *cell_offsets;  // Scratch, one per column up to the last key column
+} sort_keys_t;
+
+typedef struct {
+    size_t offset;  // Of the row in the arena
+    size_t length;
+    size_t slot;  // Arrival order in the run, ties keep it
+} sort_entry_t;
+
+// The rows of one run, kept encoded in a single arena with their key cells located once
+typedef struct {
+    const sort_keys_t *keys;
+    uint8_t *arena;
+    size_t arena_length;
+    size_t arena_capacity;
+    sort_entry_t *entries;
+    size_t *key_offsets;  // num_keys per slot
+    size_t num_entries;
+    size_t entries_capacity;
+} sort_buffer_t;
+
+typedef struct {
+    int fd;
+    uint8_t *buffer;
+    size_t length;
+    uint64_t offset;  // Where the buffer lands in the file
+} sort_output_t;
+
+typedef struct {
+    int fd;
+    uint64_t length;
+    size_t num_rows;
+} sort_run_t;
+
+typedef struct {
+    int fd;
+    header_t header;  // The table's, with the run's length as data end
+    uint64_t offset;
+    size_t rows_left;  // Not read into a block yet
+    uint8_t *buffer;
+    size_t capacity;
+    size_t length;
+    size_t pos;
+    size_t block_rows;
+    const uint8_t *row;  // NULL once the run is exhausted
+    size_t row_length;
+    size_t *key_offsets;
+} run_cursor_t;
+
+// Rows were checked by row_span already, the walk doesn't have to guard the lengths
+static void locate_keys(const sort_keys_t *keys, const uint8_t *row, size_t *key_offsets_out) {
+    size_t pos = 0;
+    for (size_t col = 0; col <= keys->max_key_col; col++) {
+        keys->cell_offsets[col] = pos;
+        pos += encoded_cell_size(&row[pos]);
+    }
+    for (size_t i = 0; i < keys->num_keys; i++) {
+        key_offsets_out[i] = keys->cell_offsets[keys->key_cols[i]];
+    }
+}
+
+// Same order as the predicates: numbers by value, strings bytewise then by length
+static int compare_encoded_cells(const uint8_t *a, const uint8_t *b) {
+    size_t a_length;
+    size_t b_length;
+    const uint8_t *a_value = encoded_cell_value(a, &a_length);
+    const uint8_t *b_value = encoded_cell_value(b, &b_length);
+
+    if (a[0] == CELL_TYPE_INT || a[0] == CELL_TYPE_FLOAT) {
+        uint32_t a_nbo;
+        uint32_t b_nbo;
+        memcpy(&a_nbo, a_value, sizeof(uint32_t));
+        memcpy(&b_nbo, b_value, sizeof(uint32_t));
+        uint32_t a_bits = ntohl(a_nbo);
+        uint32_t b_bits = ntohl(b_nbo);
+        if (a[0] == CELL_TYPE_INT) {
+            int32_t a_int = (int32_t) a_bits;
+            int32_t b_int = (int32_t) b_bits;
+            return (a_int > b_int) - (a_int < b_int);
+        }
+        float a_float;
+        float b_float;
+        memcpy(&a_float, &a_bits, sizeof(float));
+        memcpy(&b_float, &b_bits, sizeof(float));
+        return (a_float > b_float) - (a_float < b_float);
+    } else if (a[0] == CELL_TYPE_INT64 || a[0] == CELL_TYPE_DOUBLE) {
+        uint64_t a_bits;
+        uint64_t b_bits;
+        memcpy(&a_bits, a_value, sizeof(uint64_t));
+        memcpy(&b_bits, b_value, sizeof(uint64_t));
+        a_bits = be64toh(a_bits);
+        b_bits = be64toh(b_bits);
+        if (a[0] == CELL_TYPE_INT64) {
+            int64_t a_int = (int64_t) a_bits;
+            int64_t b_int = (int64_t) b_bits;
+            return (a_int > b_int) - (a_int < b_int);
+        }
+        double a_double;
+        double b_double;
+        memcpy(&a_double, &a_bits, sizeof(double));
+        memcpy(&b_double, &b_bits, sizeof(double));
+        return (a_double > b_double) - (a_double < b_double);
+    }
+
+    int cmp = memcmp(a_value, b_value, a_length < b_length ? a_length : b_length);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (a_length > b_length) - (a_length < b_length);
+}
+
+static int compare_rows(const sort_keys_t *keys, const uint8_t *a, const size_t *a_offsets, const uint8_t *b,
+                        const size_t *b_offsets) {
+    for (size_t i = 0; i < keys->num_keys; i++) {
+        int cmp = compare_encoded_cells(&a[a_offsets[i]], &b[b_offsets[i]]);
+        if (cmp != 0) {
+            return cmp;
+        }
+    }
+    return 0;
+}
+
+static int compare_entries(const void *a, const void *b, void *ctx) {
+    const sort_buffer_t *buffer = (const sort_buffer_t *) ctx;
+    const sort_entry_t *entry_a = (const sort_entry_t *) a;
+    const sort_entry_t *entry_b = (const sort_entry_t *) b;
+    size_t num_keys = buffer->keys->num_keys;
+    int cmp = compare_rows(buffer->keys, &buffer->arena[entry_a->offset], &buffer->key_offsets[entry_a->slot * num_keys],
+                           &buffer->arena[entry_b->offset], &buffer->key_offsets[entry_b->slot * num_keys]);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (entry_a->slot > entry_b->slot) - (entry_a->slot < entry_b->slot);
+}
+
+static size_t entry_footprint(const sort_keys_t *keys) {
+    return sizeof(sort_entry_t) + keys->num_keys * sizeof(size_t);
+}
+
+// A run holds at least one row, however large
+static int buffer_full(const sort_buffer_t *buffer, size_t row_length, size_t memory_budget) {
+    size_t needed = buffer->arena_length + row_length + (buffer->num_entries + 1) * entry_footprint(buffer->keys);
+    return buffer->num_entries > 0 && needed > memory_budget;
+}
+
+static SortOpStatus buffer_add(sort_buffer_t *buffer, const uint8_t *row, size_t row_length, size_t memory_budget) {
+    if (buffer->arena_length + row_length > buffer->arena_capacity) {
+        size_t capacity = buffer->arena_capacity * 2;
+        if (capacity > memory_budget) {
+            capacity = memory_budget;
+        }
+        if (capacity < buffer->arena_length + row_length) {
+            capacity = buffer->arena_length + row_length;
+        }
+        uint8_t *arena = (uint8_t *) realloc(buffer->arena, capacity);
+        if (arena == NULL) {
+            return SORT_OP_ERROR_MEMORY_ALLOCATION;
+        }
+        buffer->arena = arena;
+        buffer->arena_capacity = capacity;
+    }
+
+    if (buffer->num_entries == buffer->entries_capacity) {
+        size_t capacity = buffer->entries_capacity * 2;
+        sort_entry_t *entries = (sort_entry_t *) realloc(buffer->entries, capacity * sizeof(sort_entry_t));
+        if (entries == NULL) {
+            return SORT_OP_ERROR_MEMORY_ALLOCATION;
+        }
+        buffer->entries = entries;
+        size_t *key_offsets = (size_t *) realloc(buffer->key_offsets,
+                                                 capacity * buffer->keys->num_keys * sizeof(size_t));
+        if (key_offsets == NULL) {
+            return SORT_OP_ERROR_MEMORY_ALLOCATION;
+        }
+        buffer->key_offsets = key_offsets;
+        buffer->entries_capacity = capacity;
+    }
+
+    size_t slot = buffer->num_entries++;
+    memcpy(&buffer->arena[buffer->arena_length], row, row_length);
+    buffer->entries[slot] = (sort_entry_t) {.offset = buffer->arena_length, .length = row_length, .slot = slot};
+    locate_keys(buffer->keys, row, &buffer->key_offsets[slot * buffer->keys->num_keys]);
+    buffer->arena_length += row_length;
+    return SORT_OP_SUCCESS;
+}
+
+static void free_sort_buffer(sort_buffer_t *buffer) {
+    free(buffer->arena);
+    free(buffer->entries);
+    free(buffer->key_offsets);
+    buffer->arena = NULL;
+    buffer->entries = NULL;
+    buffer->key_offsets = NULL;
+}
+
+static SortOpStatus flush_output(sort_output_t *output) {
+    if (output->length > 0 && pwrite_full(output->fd, output->buffer, output->length, output->offset) == -1) {
+        return SORT_OP_WRITE_ERROR;
+    }
+    output->offset += output->length;
+    output->length = 0;
+    return SORT_OP_SUCCESS;
+}
+
+static SortOpStatus output_row(sort_output_t *output, const uint8_t *row, size_t row_length) {
+    if (output->length + row_length > SORT_OUTPUT_BUFFER) {
+        SortOpStatus status = flush_output(output);
+        if (status != SORT_OP_SUCCESS) {
+            return status;
+        }
+        if (row_length > SORT_OUTPUT_BUFFER) {
+            // Too large to be buffered, written on its own
+            if (pwrite_full(output->fd, row, row_length, output->offset) == -1) {
+                return SORT_OP_WRITE_ERROR;
+            }
+            output->offset += row_length;
+            return SORT_OP_SUCCESS;
+        }
+    }
+    memcpy(&output->buffer[output->length], row, row_length);
+    output->length += row_length;
+    return SORT_OP_SUCCESS;
+}
+
+static SortOpStatus output_sorted_buffer(sort_buffer_t *buffer, sort_output_t *output) {
+    qsort_r(buffer->entries, buffer->num_entries, sizeof(sort_entry_t), compare_entries, buffer);
+    for (size_t i = 0; i < buffer->num_entries; i++) {
+        const sort_entry_t *entry = &buffer->entries[i];
+        SortOpStatus status = output_row(output, &buffer->arena[entry->offset], entry->length);
+        if (status != SORT_OP_SUCCESS) {
+            return status;
+        }
+    }
+    return flush_output(output);
+}
+
+// The file is unlinked as soon as it's created, the runs never outlive the sort
+static SortOpStatus spill_run(sort_buffer_t *buffer, const char *run_path, uint8_t *output_buffer, sort_run_t *run_out) {
+    int run_fd = open(run_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (run_fd == -1) {
+        return SORT_OP_WRITE_ERROR;
+    }
+    unlink(run_path);
+
+    sort_output_t output = {.fd = run_fd, .buffer = output_buffer, .length = 0, .offset = 0};
+    SortOpStatus status = output_sorted_buffer(buffer, &output);
+    if (status != SORT_OP_SUCCESS) {
+        close(run_fd);
+        return status;
+    }
+
+    *run_out = (sort_run_t) {.fd = run_fd, .length = output.offset, .num_rows = buffer->num_entries};
+    buffer->arena_length = 0;
+    buffer->num_entries = 0;
+    return SORT_OP_SUCCESS;
+}
+
+static SortOpStatus advance_cursor(run_cursor_t *cursor, const sort_keys_t *keys) {
+    if (cursor->block_rows == 0) {
+        if (cursor->rows_left == 0) {
+            cursor->row = NULL;
+            return SORT_OP_SUCCESS;
+        }
+        size_t num_rows;
+        ScanOpStatus status = read_row_block(cursor->fd, cursor->header, cursor->offset, cursor->rows_left,
+                                             &cursor->buffer, &cursor->capacity, &cursor->length, &num_rows);
+        if (status != SCAN_OP_SUCCESS) {
+            return status == SCAN_OP_ERROR_MEMORY_ALLOCATION ? SORT_OP_ERROR_MEMORY_ALLOCATION : SORT_OP_READ_ERROR;
+        }
+        cursor->offset += cursor->length;
+        cursor->rows_left -= num_rows;
+        cursor->block_rows = num_rows;
+        cursor->pos = 0;
+    }
+
+    cursor->row = &cursor->buffer[cursor->pos];
+    cursor->row_length = row_span(cursor->row, cursor->length - cursor->pos, cursor->header);
+    cursor->pos += cursor->row_length;
+    cursor->block_rows--;
+    locate_keys(keys, cursor->row, cursor->key_offsets);
+    return SORT_OP_SUCCESS;
+}
+
+// Exhausted runs lose to everything, equal keys go to the earlier run so the merge stays stable
+static int beats(const run_cursor_t *cursors, const sort_keys_t *keys, size_t a, size_t b) {
+    if (cursors[a].row == NULL) {
+        return 0;
+    }
+    if (cursors[b].row == NULL) {
+        return 1;
+    }
+    int cmp = compare_rows(keys, cursors[a].row, cursors[a].key_offsets, cursors[b].row, cursors[b].key_offsets);
+    return cmp != 0 ? cmp < 0 : a < b;
+}
+
+// Node i has children 2i and 2i + 1, the leaves k..2k-1 are the runs. Every internal
+// node keeps the loser of its match and the overall winner goes to node 0.
+static size_t build_loser_tree(size_t *tree, size_t num_runs, const run_cursor_t *cursors, const sort_keys_t *keys,
+                               size_t node) {
+    if (node >= num_runs) {
+        return node - num_runs;
+    }
+    size_t left = build_loser_tree(tree, num_runs, cursors, keys, 2 * node);
+    size_t right = build_loser_tree(tree, num_runs, cursors, keys, 2 * node + 1);
+    if (beats(cursors, keys, left, right)) {
+        tree[node] = right;
+        return left;
+    }
+    tree[node] = left;
+    return right;
+}
+
+// Only the matches on the winner's path are replayed: log2(k) comparisons per row
+static void replay_loser_tree(size_t *tree, size_t num_runs, const run_cursor_t *cursors, const sort_keys_t *keys) {
+    size_t winner = tree[0];
+    for (size_t node = (winner + num_runs) / 2; node > 0; node /= 2) {
+        if (beats(cursors, keys, tree[node], winner)) {
+            size_t loser = winner;
+            winner = tree[node];
+            tree[node] = loser;
+        }
+    }
+    tree[0] = winner;
+}
+
+static SortOpStatus merge_runs(const sort_run_t *runs, size_t num_runs, header_t header, const sort_keys_t *keys,
+                               size_t memory_budget, sort_output_t *output) {
+    run_cursor_t *cursors = (run_cursor_t *) calloc(num_runs, sizeof(run_cursor_t));
+    size_t *tree = (size_t *) malloc(num_runs * sizeof(size_t));
+    size_t *key_offsets = (size_t *) malloc(num_runs * keys->num_keys * sizeof(size_t));
+    if (cursors == NULL || tree == NULL || key_offsets == NULL) {
+        free(cursors);
+        free(tree);
+        free(key_offsets);
+        return SORT_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    // The budget is shared by the runs' read buffers
+    size_t capacity = memory_budget / num_runs;
+    if (capacity < SORT_MIN_RUN_BUFFER) {
+        capacity = SORT_MIN_RUN_BUFFER;
+    }
+
+    SortOpStatus status = SORT_OP_SUCCESS;
+    for (size_t i = 0; i < num_runs && status == SORT_OP_SUCCESS; i++) {
+        run_cursor_t *cursor = &cursors[i];
+        cursor->fd = runs[i].fd;
+        cursor->header = header;
+        cursor->header.data_end = runs[i].length;
+        cursor->rows_left = runs[i].num_rows;
+        cursor->capacity = capacity;
+        cursor->key_offsets = &key_offsets[i * keys->num_keys];
+        status = advance_cursor(cursor, keys);
+    }
+
+    if (status == SORT_OP_SUCCESS) {
+        tree[0] = build_loser_tree(tree, num_runs, cursors, keys, 1);
+    }
+    while (status == SORT_OP_SUCCESS && cursors[tree[0]].row != NULL) {
+        run_cursor_t *winner = &cursors[tree[0]];
+        status = output_row(output, winner->row, winner->row_length);
+        if (status == SORT_OP_SUCCESS) {
+            status = advance_cursor(winner, keys);
+        }
+        if (status == SORT_OP_SUCCESS) {
+            replay_loser_tree(tree, num_runs, cursors, keys);
+        }
+    }
+    if (status == SORT_OP_SUCCESS) {
+        status = flush_output(output);
+    }
+
+    for (size_t i = 0; i < num_runs; i++) {
+        free(cursors[i].buffer);
+    }
+    free(cursors);
+    free(tree);
+    free(key_offsets);
+    return status;
+}
+
+static char *path_with_suffix(const char *path, const char *suffix) {
+    size_t path_length = strlen(path);
+    size_t suffix_length = strlen(suffix);
+    char *result = (char *) malloc(path_length + suffix_length + 1);
+    if (result != NULL) {
+        memcpy(result, path, path_length);
+        memcpy(&result[path_length], suffix, suffix_length + 1);
+    }
+    return result;
+}
+
+SortOpStatus sort_table(const char *filepath, int fd, header_t header, const size_t *key_cols, size_t num_keys,
+                        const char *output_path, size_t memory_budget, size_t *num_rows_out, size_t *num_runs_out) {
+    if (filepath == NULL || fd < 0 || key_cols == NULL || num_keys == 0 || num_rows_out == NULL
+        || num_runs_out == NULL) {
+        return SORT_OP_ERROR_INVALID_ARG;
+    }
+    sort_keys_t keys = {.key_cols = key_cols, .num_keys = num_keys, .max_key_col = 0, .cell_offsets = NULL};
+    for (size_t i = 0; i < num_keys; i++) {
+        if (key_cols[i] >= header.num_cols) {
+            return SORT_OP_ERROR_INVALID_ARG;
+        }
+        if (key_cols[i] > keys.max_key_col) {
+            keys.max_key_col = key_cols[i];
+        }
+    }
+    if (memory_budget < SORT_MIN_MEMORY) {
+        memory_budget = SORT_MIN_MEMORY;
+    }
+
+    tombstone_t tombstones;
+    if (load_tombstones(filepath, fd, &tombstones) != TOMBSTONE_OP_SUCCESS) {
+        return SORT_OP_TOMBSTONE_ERROR;
+    }
+
+    // In place, the sorted table is built next to the original and renamed over it like a compaction
+    char *tmp_path = output_path == NULL ? path_with_suffix(filepath, SORT_SUFFIX) : NULL;
+    const char *target_path = output_path != NULL ? output_path : tmp_path;
+    char *run_path = target_path != NULL ? path_with_suffix(target_path, ".run") : NULL;
+    keys.cell_offsets = (size_t *) malloc((keys.max_key_col + 1) * sizeof(size_t));
+    sort_buffer_t buffer = {
+        .keys = &keys,
+        .arena_capacity = SORT_MIN_RUN_BUFFER,
+        .entries_capacity = 1024,
+        .arena = (uint8_t *) malloc(SORT_MIN_RUN_BUFFER),
+        .entries = (sort_entry_t *) malloc(1024 * sizeof(sort_entry_t)),
+        .key_offsets = (size_t *) malloc(1024 * num_keys * sizeof(size_t))
+    };
+    uint8_t *output_buffer = (uint8_t *) malloc(SORT_OUTPUT_BUFFER);
+    if (target_path == NULL || run_path == NULL || keys.cell_offsets == NULL || buffer.arena == NULL
+        || buffer.entries == NULL || buffer.key_offsets == NULL || output_buffer == NULL) {
+        free(tmp_path);
+        free(run_path);
+        free(keys.cell_offsets);
+        free_sort_buffer(&buffer);
+        free(output_buffer);
+        free_tombstones(&tombstones);
+        return SORT_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    // A new table never replaces an existing file, a leftover from an interrupted in-place sort does
+    int out_fd = open(target_path, O_RDWR | O_CREAT | (output_path != NULL ? O_EXCL : O_TRUNC), 0644);
+    if (out_fd == -1) {
+        SortOpStatus status = errno == EEXIST ? SORT_OP_ERROR_EXISTS : SORT_OP_WRITE_ERROR;
+        free(tmp_path);
+        free(run_path);
+        free(keys.cell_offsets);
+        free_sort_buffer(&buffer);
+        free(output_buffer);
+        free_tombstones(&tombstones);
+        return status;
+    }
+
+    SortOpStatus status = SORT_OP_SUCCESS;
+    sort_run_t *runs = NULL;
+    size_t num_runs = 0;
+    size_t runs_capacity = 0;
+    uint8_t *block = NULL;
+    size_t block_capacity = SCAN_MORSEL_SIZE;
+    size_t num_rows = 0;
+
+    // Sorted in place, the new file takes the place of the table and keeps its permissions
+    struct stat table_stat;
+    if (output_path == NULL && (fstat(fd, &table_stat) == -1 || fchmod(out_fd, table_stat.st_mode & 07777) == -1)) {
+        status = SORT_OP_WRITE_ERROR;
+        goto cleanup;
+    }
+
+    header_t new_header = header;
+    set_current_layout(&new_header);
+    new_header.num_rows = 0;
+    new_header.data_end = header_size(new_header);
+    if (write_header(out_fd, new_header) != HEADER_OP_SUCCESS) {
+        status = SORT_OP_WRITE_ERROR;
+        goto cleanup;
+    }
+
+    // Run generation: the live rows are copied encoded, nothing is decoded but the key cells
+    uint64_t offset = header_size(header);
+    size_t row_index = 0;
+    while (row_index < header.num_rows) {
+        size_t length;
+        size_t block_rows;
+        ScanOpStatus sop_status = read_row_block(fd, header, offset, header.num_rows - row_index, &block,
+                                                 &block_capacity, &length, &block_rows);
+        if (sop_status != SCAN_OP_SUCCESS) {
+            status = sop_status == SCAN_OP_ERROR_MEMORY_ALLOCATION ? SORT_OP_ERROR_MEMORY_ALLOCATION : SORT_OP_READ_ERROR;
+            goto cleanup;
+        }
+
+        size_t pos = 0;
+        for (size_t i = 0; i < block_rows; i++, row_index++) {
+            size_t span = row_span(&block[pos], length - pos, header);
+            if (is_tombstoned(&tombstones, row_index)) {
+                pos += span;
+                continue;
+            }
+
+            if (buffer_full(&buffer, span, memory_budget)) {
+                if (num_runs == runs_capacity) {
+                    runs_capacity = runs_capacity == 0 ? 8 : runs_capacity * 2;
+                    sort_run_t *grown = (sort_run_t *) realloc(runs, runs_capacity * sizeof(sort_run_t));
+                    if (grown == NULL) {
+                        status = SORT_OP_ERROR_MEMORY_ALLOCATION;
+                        goto cleanup;
+                    }
+                    runs = grown;
+                }
+                status = spill_run(&buffer, run_path, output_buffer, &runs[num_runs]);
+                if (status != SORT_OP_SUCCESS) {
+                    goto cleanup;
+                }
+                num_runs++;
+            }
+
+            status = buffer_add(&buffer, &block[pos], span, memory_budget);
+            if (status != SORT_OP_SUCCESS) {
+                goto cleanup;
+            }
+            pos += span;
+            num_rows++;
+        }
+        offset += length;
+    }
+    free(block);
+    block = NULL;
+
+    STATS_ADD(STAT_ROWS_READ, num_rows);
+    sort_output_t output = {.fd = out_fd, .buffer = output_buffer, .length = 0, .offset = header_size(new_header)};
+    if (num_runs == 0) {
+        // Everything fit in memory, the single run goes straight to the table
+        status = output_sorted_buffer(&buffer, &output);
+    } else {
+        if (buffer.num_entries > 0) {
+            if (num_runs == runs_capacity) {
+                sort_run_t *grown = (sort_run_t *) realloc(runs, (runs_capacity + 1) * sizeof(sort_run_t));
+                if (grown == NULL) {
+                    status = SORT_OP_ERROR_MEMORY_ALLOCATION;
+                    goto cleanup;
+                }
+                runs = grown;
+                runs_capacity++;
+            }
+            status = spill_run(&buffer, run_path, output_buffer, &runs[num_runs]);
+            if (status != SORT_OP_SUCCESS) {
+                goto cleanup;
+            }
+            num_runs++;
+        }
+        // The merge gets the whole budget for its read buffers
+        free_sort_buffer(&buffer);
+        status = merge_runs(runs, num_runs, header, &keys, memory_budget, &output);
+    }
+    if (status != SORT_OP_SUCCESS) {
+        goto cleanup;
+    }
+    STATS_ADD(STAT_ROWS_WRITTEN, num_rows);
+    // Every live row is needed once in and once out, the runs' I/O is the amplification
+    STATS_LOGICAL_READ(IO_ROWS, output.offset - header_size(new_header));
+    STATS_LOGICAL_WRITTEN(IO_ROWS, output.offset - header_size(new_header));
+
+    if (update_header_num_rows(out_fd, num_rows, output.offset, &new_header) != HEADER_OP_SUCCESS
+        || fsync(out_fd) == -1) {
+        status = SORT_OP_WRITE_ERROR;
+        goto cleanup;
+    }
+    STATS_SYSCALL(IO_ROWS, IO_SYNC, 0);
+
+    if (output_path == NULL) {
+        if (reset_rollups(filepath, fd, header) != ROLLUP_OP_SUCCESS) {
+            status = SORT_OP_WRITE_ERROR;
+            goto cleanup;
+        }
+        if (rename(tmp_path, filepath) == -1) {
+            status = SORT_OP_RENAME_ERROR;
+            goto cleanup;
+        }
+
+        // The sorted table has no dead rows, its row indexes don't match the old tombstones anyway
+        char *tomb_path = tombstone_path(filepath);
+        if (tomb_path != NULL) {
+            if (unlink(tomb_path) == -1 && errno != ENOENT) {
+                status = SORT_OP_TOMBSTONE_ERROR;
+            }
+            free(tomb_path);
+        }
+    }
+    sync_parent_dir(target_path);
+
+cleanup:
+    for (size_t i = 0; i < num_runs; i++) {
+        close(runs[i].fd);
+    }
+    if (close(out_fd) == -1 && status == SORT_OP_SUCCESS) {
+        status = SORT_OP_WRITE_ERROR;
+    }
+    if (status != SORT_OP_SUCCESS && status != SORT_OP_TOMBSTONE_ERROR) {
+        unlink(target_path);
+    }
+    free(runs);
+    free(block);
+    free(tmp_path);
+    free(run_path);
+    free(keys.cell_offsets);
+    free_sort_buffer(&buffer);
+    free(output_buffer);
+    free_tombstones(&tombstones);
+
+    if (status == SORT_OP_SUCCESS) {
+        *num_rows_out = num_rows;
+        *num_runs_out = num_runs > 0 ? num_runs : 1;
+    }
+    return status;
+}
@@ -0,0 +1,201 @@
+#include <time.h>
+#include <inttypes.h>
+
+#include "stats.h"
+
+#define SUB_BUCKETS (1u << STATS_SUB_BUCKET_BITS)
+
+
+#ifdef COLLECT_STATS
+static const char *timed_op_names[STAT_NUM_TIMED_OPS] = {
+    "parse_schema", "read_header", "parse_row", "write_row", "update_header_num_rows", "read_row", "scan", "scan_block"
+};
+
+static const char *counter_names[STAT_NUM_COUNTERS] = {
+    "rows_read", "rows_written"
+};
+
+static const char *io_category_names[IO_NUM_CATEGORIES] = {
+    "header", "rows", "index"
+};
+
+static const char *io_syscall_names[IO_NUM_SYSCALLS] = {
+    "reads", "writes", "seeks", "syncs"
+};
+#endif
+
+static histogram_t histograms[STAT_NUM_TIMED_OPS] = {
+    [0 ... STAT_NUM_TIMED_OPS - 1] = { .min_ns = UINT64_MAX }
+};
+
+static uint64_t counters[STAT_NUM_COUNTERS];
+
+static io_stats_t io[IO_NUM_CATEGORIES];
+
+static size_t bucket_index(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return value;
+    }
+    unsigned exponent = 63 - __builtin_clzll(value);
+    unsigned shift = exponent - STATS_SUB_BUCKET_BITS;
+    return ((size_t) (shift + 1) << STATS_SUB_BUCKET_BITS) + ((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+#ifdef COLLECT_STATS
+// Highest value falling in the bucket
+static uint64_t bucket_value(size_t index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    unsigned shift = (index >> STATS_SUB_BUCKET_BITS) - 1;
+    uint64_t lowest = (uint64_t) (SUB_BUCKETS + (index & (SUB_BUCKETS - 1))) << shift;
+    return lowest + ((uint64_t) 1 << shift) - 1;
+}
+#endif
+
+uint64_t stats_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+void stats_record(timed_op_t op, uint64_t elapsed_ns, int failed) {
+    histogram_t *histogram = &histograms[op];
+    __atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->total_ns, elapsed_ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->buckets[bucket_index(elapsed_ns)], 1, __ATOMIC_RELAXED);
+    if (failed) {
+        __atomic_add_fetch(&histogram->errors, 1, __ATOMIC_RELAXED);
+    }
+
+    uint64_t min = __atomic_load_n(&histogram->min_ns, __ATOMIC_RELAXED);
+    while (elapsed_ns < min && !__atomic_compare_exchange_n(&histogram->min_ns, &min, elapsed_ns, 1, __ATOMIC_RELAXED,
+                                                           __ATOMIC_RELAXED)) {
+    }
+    uint64_t max = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+    while (elapsed_ns > max && !__atomic_compare_exchange_n(&histogram->max_ns, &max, elapsed_ns, 1, __ATOMIC_RELAXED,
+                                                           __ATOMIC_RELAXED)) {
+    }
+}
+
+void stats_add(stats_counter_t counter, uint64_t value) {
+    __atomic_add_fetch(&counters[counter], value, __ATOMIC_RELAXED);
+}
+
+void stats_syscall(io_category_t category, io_syscall_t syscall, int64_t bytes) {
+    __atomic_add_fetch(&io[category].syscalls[syscall], 1, __ATOMIC_RELAXED);
+    if (bytes <= 0) {
+        return;
+    }
+    if (syscall == IO_READ) {
+        __atomic_add_fetch(&io[category].physical_read, bytes, __ATOMIC_RELAXED);
+    } else if (syscall == IO_WRITE || syscall == IO_SYNC) {
+        __atomic_add_fetch(&io[category].physical_written, bytes, __ATOMIC_RELAXED);
+    }
+}
+
+void stats_logical(io_category_t category, uint64_t bytes_read, uint64_t bytes_written) {
+    __atomic_add_fetch(&io[category].logical_read, bytes_read, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&io[category].logical_written, bytes_written, __ATOMIC_RELAXED);
+}
+
+#ifdef COLLECT_STATS
+static uint64_t percentile(const histogram_t *histogram, uint64_t count, double fraction) {
+    uint64_t rank = (uint64_t) (fraction * count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < STATS_NUM_BUCKETS; i++) {
+        seen += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+        if (seen >= rank) {
+            // The bucket's top can be past the largest value actually recorded
+            uint64_t value = bucket_value(i);
+            uint64_t max = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+            return value < max ? value : max;
+        }
+    }
+    return __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+}
+
+static void write_ratio(FILE *out, const char *name, uint64_t numerator, uint64_t denominator) {
+    if (denominator == 0) {
+        fprintf(out, ", \"%s\": null", name);
+    } else {
+        fprintf(out, ", \"%s\": %.4g", name, (double) numerator / denominator);
+    }
+}
+
+static void write_io_json(FILE *out) {
+    uint64_t syscalls = 0;
+    uint64_t physical_read = 0;
+    uint64_t physical_written = 0;
+
+    fprintf(out, "\"io\": {");
+    for (size_t category = 0; category < IO_NUM_CATEGORIES; category++) {
+        const io_stats_t *stats = &io[category];
+        fprintf(out, "%s\"%s\": {", category == 0 ? "" : ", ", io_category_names[category]);
+        for (size_t syscall = 0; syscall < IO_NUM_SYSCALLS; syscall++) {
+            uint64_t count = __atomic_load_n(&stats->syscalls[syscall], __ATOMIC_RELAXED);
+            fprintf(out, "\"%s\": %" PRIu64 ", ", io_syscall_names[syscall], count);
+            syscalls += count;
+        }
+
+        uint64_t category_read = __atomic_load_n(&stats->physical_read, __ATOMIC_RELAXED);
+        uint64_t category_written = __atomic_load_n(&stats->physical_written, __ATOMIC_RELAXED);
+        uint64_t logical_read = __atomic_load_n(&stats->logical_read, __ATOMIC_RELAXED);
+        uint64_t logical_written = __atomic_load_n(&stats->logical_written, __ATOMIC_RELAXED);
+        fprintf(out, "\"physical_bytes_read\": %" PRIu64 ", \"physical_bytes_written\": %" PRIu64
+                     ", \"logical_bytes_read\": %" PRIu64 ", \"logical_bytes_written\": %" PRIu64 "}",
+                category_read, category_written, logical_read, logical_written);
+        physical_read += category_read;
+        physical_written += category_written;
+    }
+
+    // Everything the command moved, per row and per byte of row it actually needed
+    uint64_t rows = __atomic_load_n(&counters[STAT_ROWS_READ], __ATOMIC_RELAXED)
+                    + __atomic_load_n(&counters[STAT_ROWS_WRITTEN], __ATOMIC_RELAXED);
+    fprintf(out, ", \"syscalls\": %" PRIu64, syscalls);
+    write_ratio(out, "syscalls_per_row", syscalls, rows);
+    write_ratio(out, "bytes_read_per_payload_byte", physical_read,
+                __atomic_load_n(&io[IO_ROWS].logical_read, __ATOMIC_RELAXED));
+    write_ratio(out, "bytes_written_per_payload_byte", physical_written,
+                __atomic_load_n(&io[IO_ROWS].logical_written, __ATOMIC_RELAXED));
+    fprintf(out, "}");
+}
+#endif
+
+void write_stats_json(FILE *out) {
+#ifndef COLLECT_STATS
+    fprintf(out, "{\"enabled\": false}\n");
+#else
+    fprintf(out, "{\"enabled\": true, \"operations\": {");
+    for (size_t op = 0; op < STAT_NUM_TIMED_OPS; op++) {
+        const histogram_t *histogram = &histograms[op];
+        uint64_t count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+        fprintf(out, "%s\"%s\": {\"count\": %" PRIu64 ", \"errors\": %" PRIu64, op == 0 ? "" : ", ",
+                timed_op_names[op], count, __atomic_load_n(&histogram->errors, __ATOMIC_RELAXED));
+        if (count > 0) {
+            fprintf(out, ", \"mean_ns\": %" PRIu64 ", \"min_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64,
+                    __atomic_load_n(&histogram->total_ns, __ATOMIC_RELAXED) / count,
+                    __atomic_load_n(&histogram->min_ns, __ATOMIC_RELAXED),
+                    __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED));
+            fprintf(out, ", \"p50_ns\": %" PRIu64 ", \"p90_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64
+                         ", \"p999_ns\": %" PRIu64,
+                    percentile(histogram, count, 0.5), percentile(histogram, count, 0.9),
+                    percentile(histogram, count, 0.99), percentile(histogram, count, 0.999));
+        }
+        fprintf(out, "}");
+    }
+
+    fprintf(out, "}, \"counters\": {");
+    for (size_t i = 0; i < STAT_NUM_COUNTERS; i++) {
+        fprintf(out, "%s\"%s\": %" PRIu64, i == 0 ? "" : ", ", counter_names[i],
+                __atomic_load_n(&counters[i], __ATOMIC_RELAXED));
+    }
+    fprintf(out, "}, ");
+    write_io_json(out);
+    fprintf(out, "}\n");
+#endif
+}
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "threadpool.h"
+
+/*
+ * Work stealing: every worker has its own deque. Tasks submitted by a worker (a task
+ * splitting its work) go to its own deque, tasks submitted from outside are spread
+ * round robin. A worker that runs out of work steals from the others before going to
+ * sleep, so a worker stuck with a long task doesn't hold back the tasks queued behind it.
+ */
+
+static __thread threadpool_t *current_pool = NULL;
+static __thread size_t current_worker = 0;
+
+typedef struct {
+    threadpool_t *pool;
+    size_t index;
+} worker_arg_t;
+
+
+size_t default_thread_count(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (size_t) cores : 1;
+}
+
+static ThreadPoolOpStatus deque_push(task_deque_t *deque, task_t task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top == deque->capacity) {
+        size_t capacity = deque->capacity * 2;
+        task_t *tasks = (task_t *) malloc(capacity * sizeof(task_t));
+        if (tasks == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            return THREADPOOL_OP_ERROR_MEMORY_ALLOCATION;
+        }
+        for (size_t i = deque->top; i < deque->bottom; i++) {
+            tasks[i % capacity] = deque->tasks[i % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+    }
+    deque->tasks[deque->bottom % deque->capacity] = task;
+    deque->bottom++;
+    pthread_mutex_unlock(&deque->lock);
+    return THREADPOOL_OP_SUCCESS;
+}
+
+static int deque_pop(task_deque_t *deque, task_t *task_out) {
+    int found = 0;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top) {
+        deque->bottom--;
+        *task_out = deque->tasks[deque->bottom % deque->capacity];
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static int deque_steal(task_deque_t *deque, task_t *task_out) {
+    int found = 0;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top) {
+        *task_out = deque->tasks[deque->top % deque->capacity];
+        deque->top++;
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static int find_task(threadpool_t *pool, size_t index, task_t *task_out) {
+    if (deque_pop(&pool->deques[index], task_out)) {
+        return 1;
+    }
+    for (size_t i = 1; i < pool->num_threads; i++) {
+        if (deque_steal(&pool->deques[(index + i) % pool->num_threads], task_out)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *worker_loop(void *arg) {
+    worker_arg_t *worker = (worker_arg_t *) arg;
+    threadpool_t *pool = worker->pool;
+    size_t index = worker->index;
+    free(worker);
+
+    current_pool = pool;
+    current_worker = index;
+
+    for (;;) {
+        task_t task;
+        if (find_task(pool, index, &task)) {
+            __atomic_fetch_sub(&pool->queued, 1, __ATOMIC_RELAXED);
+            task.fn(task.arg);
+
+            pthread_mutex_lock(&pool->lock);
+            pool->pending--;
+            if (pool->pending == 0) {
+                pthread_cond_broadcast(&pool->idle);
+            }
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        // queued is only incremented under the lock, so checking it under the lock can't miss a wakeup
+        pthread_mutex_lock(&pool->lock);
+        while (__atomic_load_n(&pool->queued, __ATOMIC_RELAXED) == 0 && !pool->shutdown) {
+            pthread_cond_wait(&pool->has_work, &pool->lock);
+        }
+        int done = pool->shutdown && __atomic_load_n(&pool->queued, __ATOMIC_RELAXED) == 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (done) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void free_deques(threadpool_t *pool) {
+    for (size_t i = 0; i < pool->num_threads; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].tasks);
+    }
+    free(pool->deques);
+}
+
+ThreadPoolOpStatus threadpool_create(size_t num_threads, threadpool_t **pool_out) {
+    if (num_threads == 0 || pool_out == NULL) {
+        return THREADPOOL_OP_ERROR_INVALID_ARG;
+    }
+
+    threadpool_t *pool = (threadpool_t *) calloc(1, sizeof(threadpool_t));
+    if (pool == NULL) {
+        return THREADPOOL_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    pool->threads = (pthread_t *) calloc(num_threads, sizeof(pthread_t));
+    pool->deques = (task_deque_t *) calloc(num_threads, sizeof(task_deque_t));
+    if (pool->threads == NULL || pool->deques == NULL) {
+        free(pool->threads);
+        free(pool->deques);
+        free(pool);
+        return THREADPOOL_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    for (size_t i = 0; i < num_threads; i++) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+        pool->deques[i].capacity = TASK_DEQUE_INITIAL_CAPACITY;
+        pool->deques[i].tasks = (task_t *) malloc(TASK_DEQUE_INITIAL_CAPACITY * sizeof(task_t));
+        if (pool->deques[i].tasks == NULL) {
+            pool->num_threads = i + 1;
+            free_deques(pool);
+            free(pool->threads);
+            free(pool);
+            return THREADPOOL_OP_ERROR_MEMORY_ALLOCATION;
+        }
+    }
+    pool->num_threads = num_threads;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->has_work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for (size_t i = 0; i < num_threads; i++) {
+        worker_arg_t *worker = (worker_arg_t *) malloc(sizeof(worker_arg_t));
+        if (worker != NULL) {
+            worker->pool = pool;
+            worker->index = i;
+        }
+        if (worker == NULL || pthread_create(&pool->threads[i], NULL, worker_loop, worker) != 0) {
+            free(worker);
+            // Only the threads that started are joined, the deques all exist
+            size_t started = i;
+            pthread_mutex_lock(&pool->lock);
+            pool->shutdown = 1;
+            pthread_cond_broadcast(&pool->has_work);
+            pthread_mutex_unlock(&pool->lock);
+            for (size_t j = 0; j < started; j++) {
+                pthread_join(pool->threads[j], NULL);
+            }
+            free_deques(pool);
+            pthread_mutex_destroy(&pool->lock);
+            pthread_cond_destroy(&pool->has_work);
+            pthread_cond_destroy(&pool->idle);
+            free(pool->threads);
+            free(pool);
+            return THREADPOOL_OP_ERROR_THREAD;
+        }
+    }
+
+    *pool_out = pool;
+    return THREADPOOL_OP_SUCCESS;
+}
+
+ThreadPoolOpStatus threadpool_submit(threadpool_t *pool, task_fn_t fn, void *arg) {
+    if (pool == NULL || fn == NULL) {
+        return THREADPOOL_OP_ERROR_INVALID_ARG;
+    }
+
+    // Pushing under the pool lock makes sure pending is counted before a worker can finish the task
+    task_t task = {.fn = fn, .arg = arg};
+    pthread_mutex_lock(&pool->lock);
+    size_t index = current_worker;
+    if (current_pool != pool) {
+        index = pool->next_deque;
+        pool->next_deque = (pool->next_deque + 1) % pool->num_threads;
+    }
+    ThreadPoolOpStatus status = deque_push(&pool->deques[index], task);
+    if (status != THREADPOOL_OP_SUCCESS) {
+        pthread_mutex_unlock(&pool->lock);
+        return status;
+    }
+    __atomic_fetch_add(&pool->queued, 1, __ATOMIC_RELAXED);
+    pool->pending++;
+    pthread_cond_signal(&pool->has_work);
+    pthread_mutex_unlock(&pool->lock);
+
+    return THREADPOOL_OP_SUCCESS;
+}
+
+int threadpool_worker_index(const threadpool_t *pool, size_t *index_out) {
+    if (pool == NULL || current_pool != pool) {
+        return 0;
+    }
+    *index_out = current_worker;
+    return 1;
+}
+
+void threadpool_wait(threadpool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void threadpool_destroy(threadpool_t *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    // Workers drain the deques before leaving, queued tasks still run
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->has_work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    free_deques(pool);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->has_work);
+    pthread_cond_destroy(&pool->idle);
+    free(pool->threads);
+    free(pool);
+}
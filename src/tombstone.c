@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <endian.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "tombstone.h"
+#include "stats.h"
+
+/*
+ * Sidecar layout: "rfkt", the inode of the data file (big endian uint64) and
+ * then one record per block: deleted count (big endian uint32) + bitmap.
+ * The inode ties the sidecar to one incarnation of the data file, a sidecar
+ * left behind by an interrupted compaction is ignored instead of applied to
+ * the rewritten file.
+ */
+#define TOMBSTONE_HEADER_SIZE (4 + sizeof(uint64_t))
+#define TOMBSTONE_BITMAP_BYTES (TOMBSTONE_BLOCK_ROWS / 8)
+#define TOMBSTONE_RECORD_SIZE (sizeof(uint32_t) + TOMBSTONE_BITMAP_BYTES)
+
+
+char *tombstone_path(const char *filepath) {
+    size_t length = strlen(filepath);
+    char *path = (char *) malloc(length + sizeof(TOMBSTONE_SUFFIX));
+    if (path == NULL) {
+        return NULL;
+    }
+    memcpy(path, filepath, length);
+    memcpy(&path[length], TOMBSTONE_SUFFIX, sizeof(TOMBSTONE_SUFFIX));
+    return path;
+}
+
+void free_tombstones(tombstone_t *tombstones) {
+    free(tombstones->deleted_counts);
+    free(tombstones->bitmap);
+    free(tombstones->dirty);
+    tombstones->deleted_counts = NULL;
+    tombstones->bitmap = NULL;
+    tombstones->dirty = NULL;
+    tombstones->num_blocks = 0;
+}
+
+static TombstoneOpStatus grow_tombstones(tombstone_t *tombstones, size_t num_blocks) {
+    if (num_blocks <= tombstones->num_blocks) {
+        return TOMBSTONE_OP_SUCCESS;
+    }
+
+    uint32_t *counts = reallocarray(tombstones->deleted_counts, num_blocks, sizeof(uint32_t));
+    if (counts == NULL) {
+        return TOMBSTONE_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    tombstones->deleted_counts = counts;
+
+    uint8_t *bitmap = reallocarray(tombstones->bitmap, num_blocks, TOMBSTONE_BITMAP_BYTES);
+    if (bitmap == NULL) {
+        return TOMBSTONE_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    tombstones->bitmap = bitmap;
+
+    uint8_t *dirty = reallocarray(tombstones->dirty, num_blocks, sizeof(uint8_t));
+    if (dirty == NULL) {
+        return TOMBSTONE_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    tombstones->dirty = dirty;
+
+    size_t added = num_blocks - tombstones->num_blocks;
+    memset(&counts[tombstones->num_blocks], 0, added * sizeof(uint32_t));
+    memset(&bitmap[tombstones->num_blocks * TOMBSTONE_BITMAP_BYTES], 0, added * TOMBSTONE_BITMAP_BYTES);
+    memset(&dirty[tombstones->num_blocks], 1, added);
+    tombstones->num_blocks = num_blocks;
+    return TOMBSTONE_OP_SUCCESS;
+}
+
+TombstoneOpStatus load_tombstones(const char *filepath, int fd, tombstone_t *tombstones_out) {
+    if (filepath == NULL || fd < 0 || tombstones_out == NULL) {
+        return TOMBSTONE_OP_ERROR_INVALID_ARG;
+    }
+
+    tombstone_t tombstones = {0};
+
+    struct stat data_stat;
+    if (fstat(fd, &data_stat) == -1) {
+        return TOMBSTONE_OP_READ_ERROR;
+    }
+
+    char *path = tombstone_path(filepath);
+    if (path == NULL) {
+        return TOMBSTONE_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    int tfd = open(path, O_RDONLY);
+    free(path);
+    if (tfd == -1) {
+        if (errno == ENOENT) {
+            // No deletes yet, every row is alive
+            *tombstones_out = tombstones;
+            return TOMBSTONE_OP_SUCCESS;
+        }
+        return TOMBSTONE_OP_READ_ERROR;
+    }
+
+    uint8_t header[TOMBSTONE_HEADER_SIZE];
+    ssize_t bytes_read = read(tfd, header, sizeof(header));
+    STATS_SYSCALL(IO_INDEX, IO_READ, bytes_read);
+    uint64_t inode_nbo;
+    memcpy(&inode_nbo, &header[4], sizeof(uint64_t));
+    if (bytes_read != sizeof(header) || memcmp(header, "rfkt", 4) != 0 || be64toh(inode_nbo) != (uint64_t) data_stat.st_ino) {
+        // Stale or foreign sidecar: start over and rewrite it entirely on save
+        close(tfd);
+        tombstones.rewrite = 1;
+        *tombstones_out = tombstones;
+        return TOMBSTONE_OP_SUCCESS;
+    }
+
+    struct stat tomb_stat;
+    if (fstat(tfd, &tomb_stat) == -1) {
+        close(tfd);
+        return TOMBSTONE_OP_READ_ERROR;
+    }
+    size_t num_blocks = (tomb_stat.st_size - TOMBSTONE_HEADER_SIZE) / TOMBSTONE_RECORD_SIZE;
+
+    TombstoneOpStatus status = grow_tombstones(&tombstones, num_blocks);
+    if (status != TOMBSTONE_OP_SUCCESS) {
+        free_tombstones(&tombstones);
+        close(tfd);
+        return status;
+    }
+
+    uint8_t record[TOMBSTONE_RECORD_SIZE];
+    for (size_t block = 0; block < num_blocks; block++) {
+        bytes_read = read(tfd, record, sizeof(record));
+        STATS_SYSCALL(IO_INDEX, IO_READ, bytes_read);
+        if (bytes_read != sizeof(record)) {
+            free_tombstones(&tombstones);
+            close(tfd);
+            return TOMBSTONE_OP_READ_ERROR;
+        }
+        uint32_t count_nbo;
+        memcpy(&count_nbo, record, sizeof(uint32_t));
+        tombstones.deleted_counts[block] = ntohl(count_nbo);
+        memcpy(&tombstones.bitmap[block * TOMBSTONE_BITMAP_BYTES], &record[sizeof(uint32_t)], TOMBSTONE_BITMAP_BYTES);
+        tombstones.dirty[block] = 0;
+    }
+
+    close(tfd);
+    *tombstones_out = tombstones;
+    return TOMBSTONE_OP_SUCCESS;
+}
+
+TombstoneOpStatus save_tombstones(const char *filepath, int fd, tombstone_t *tombstones) {
+    if (filepath == NULL || fd < 0 || tombstones == NULL) {
+        return TOMBSTONE_OP_ERROR_INVALID_ARG;
+    }
+
+    struct stat data_stat;
+    if (fstat(fd, &data_stat) == -1) {
+        return TOMBSTONE_OP_WRITE_ERROR;
+    }
+
+    char *path = tombstone_path(filepath);
+    if (path == NULL) {
+        return TOMBSTONE_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    int flags = O_WRONLY | O_CREAT;
+    if (tombstones->rewrite) {
+        flags |= O_TRUNC;
+    }
+    int tfd = open(path, flags, 0644);
+    free(path);
+    if (tfd == -1) {
+        return TOMBSTONE_OP_WRITE_ERROR;
+    }
+
+    uint8_t header[TOMBSTONE_HEADER_SIZE];
+    uint64_t inode_nbo = htobe64((uint64_t) data_stat.st_ino);
+    memcpy(header, "rfkt", 4);
+    memcpy(&header[4], &inode_nbo, sizeof(uint64_t));
+    STATS_SYSCALL(IO_INDEX, IO_WRITE, sizeof(header));
+    if (pwrite(tfd, header, sizeof(header), 0) != sizeof(header)) {
+        close(tfd);
+        return TOMBSTONE_OP_WRITE_ERROR;
+    }
+
+    // Only the blocks touched since the last load go back to disk
+    uint8_t record[TOMBSTONE_RECORD_SIZE];
+    for (size_t block = 0; block < tombstones->num_blocks; block++) {
+        if (!tombstones->dirty[block]) {
+            continue;
+        }
+        uint32_t count_nbo = htonl(tombstones->deleted_counts[block]);
+        memcpy(record, &count_nbo, sizeof(uint32_t));
+        memcpy(&record[sizeof(uint32_t)], &tombstones->bitmap[block * TOMBSTONE_BITMAP_BYTES], TOMBSTONE_BITMAP_BYTES);
+        off_t offset = TOMBSTONE_HEADER_SIZE + block * TOMBSTONE_RECORD_SIZE;
+        STATS_SYSCALL(IO_INDEX, IO_WRITE, sizeof(record));
+        if (pwrite(tfd, record, sizeof(record), offset) != sizeof(record)) {
+            close(tfd);
+            return TOMBSTONE_OP_WRITE_ERROR;
+        }
+        tombstones->dirty[block] = 0;
+    }
+
+    if (close(tfd) == -1) {
+        return TOMBSTONE_OP_WRITE_ERROR;
+    }
+    tombstones->rewrite = 0;
+    return TOMBSTONE_OP_SUCCESS;
+}
+
+TombstoneOpStatus mark_tombstone(tombstone_t *tombstones, size_t row_index) {
+    size_t block = row_index / TOMBSTONE_BLOCK_ROWS;
+    TombstoneOpStatus status = grow_tombstones(tombstones, block + 1);
+    if (status != TOMBSTONE_OP_SUCCESS) {
+        return status;
+    }
+
+    size_t bit = row_index % TOMBSTONE_BLOCK_ROWS;
+    uint8_t *byte = &tombstones->bitmap[block * TOMBSTONE_BITMAP_BYTES + bit / 8];
+    if (!(*byte & (1u << (bit % 8)))) {
+        *byte |= (uint8_t) (1u << (bit % 8));
+        tombstones->deleted_counts[block]++;
+        tombstones->dirty[block] = 1;
+    }
+    return TOMBSTONE_OP_SUCCESS;
+}
+
+int is_tombstoned(const tombstone_t *tombstones, size_t row_index) {
+    if (tombstones == NULL) {
+        return 0;
+    }
+
+    size_t block = row_index / TOMBSTONE_BLOCK_ROWS;
+    if (block >= tombstones->num_blocks || tombstones->deleted_counts[block] == 0) {
+        return 0;
+    }
+
+    size_t bit = row_index % TOMBSTONE_BLOCK_ROWS;
+    return (tombstones->bitmap[block * TOMBSTONE_BITMAP_BYTES + bit / 8] >> (bit % 8)) & 1;
+}
+
+size_t count_tombstones(const tombstone_t *tombstones) {
+    size_t total = 0;
+    for (size_t block = 0; block < tombstones->num_blocks; block++) {
+        total += tombstones->deleted_counts[block];
+    }
+    return total;
+}
@@ -0,0 +1,338 @@
+#define _GNU_SOURCE  // qsort_r
+
+#include <stdio.h>
+#include <string.h>
+
+#include "topk.h"
+#include "file.h"
+#include "projection.h"
+#include "scan.h"
+
+#define TOPK_ROW_READ_SIZE 4096
+
+
+typedef struct {
+    cell_value_t key;  // Strings are copied, the scanned row is freed after the callback
+    size_t row_index;
+    uint64_t offset;  // Where the row starts, the winners are read back from there
+} topk_entry_t;
+
+// Ordered so that the root is the entry ranking last: a row only gets in by beating it
+typedef struct {
+    topk_entry_t *entries;
+    size_t length;
+    size_t capacity;
+    int failed;
+} topk_heap_t;
+
+typedef struct {
+    const topk_t *topk;
+    threadpool_t *pool;
+    topk_heap_t *heaps;  // One per worker, the last one for the calling thread
+    size_t num_heaps;
+} topk_scan_t;
+
+TopKOpStatus parse_topk(header_t header, const char *topk_in, topk_t *topk_out) {
+    if (topk_in == NULL || topk_out == NULL) {
+        return TOPK_OP_ERROR_INVALID_ARG;
+    }
+
+    const char *colon = strchr(topk_in, ':');
+    if (colon == NULL || colon == topk_in) {
+        return TOPK_OP_ERROR_INVALID_ARG;
+    }
+    size_t col_index;
+    if (!find_column(header, topk_in, colon - topk_in, &col_index)) {
+        return TOPK_OP_ERROR_UNKNOWN_COLUMN;
+    }
+
+    const char *k_in = colon + 1;
+    if (*k_in < '0' || *k_in > '9') {
+        return TOPK_OP_ERROR_INVALID_ARG;
+    }
+    char *end;
+    unsigned long k = strtoul(k_in, &end, 10);
+    if (k == 0 || k > TOPK_MAX_K) {
+        return TOPK_OP_ERROR_INVALID_ARG;
+    }
+
+    int ascending = 0;
+    if (*end == ':') {
+        if (strcmp(end + 1, "asc") == 0) {
+            ascending = 1;
+        } else if (strcmp(end + 1, "desc") != 0) {
+            return TOPK_OP_ERROR_INVALID_ARG;
+        }
+    } else if (*end != '\0') {
+        return TOPK_OP_ERROR_INVALID_ARG;
+    }
+
+    topk_out->col_index = col_index;
+    topk_out->data_type = header.columns[col_index].data_type;
+    topk_out->k = k;
+    topk_out->ascending = ascending;
+    return TOPK_OP_SUCCESS;
+}
+
+// Whether a comes out before b: by key in the requested direction, then in file order
+static int ranks_before(const topk_t *topk, const topk_entry_t *a, const topk_entry_t *b) {
+    int cmp = compare_cell_values(topk->data_type, &a->key, &b->key);
+    if (cmp != 0) {
+        return topk->ascending ? cmp < 0 : cmp > 0;
+    }
+    return a->row_index < b->row_index;
+}
+
+static int compare_ranks(const void *a, const void *b, void *ctx) {
+    const topk_t *topk = (const topk_t *) ctx;
+    if (ranks_before(topk, (const topk_entry_t *) a, (const topk_entry_t *) b)) {
+        return -1;
+    }
+    return ranks_before(topk, (const topk_entry_t *) b, (const topk_entry_t *) a);
+}
+
+static void sift_up(const topk_t *topk, topk_heap_t *heap, size_t i) {
+    topk_entry_t entry = heap->entries[i];
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!ranks_before(topk, &heap->entries[parent], &entry)) {
+            break;
+        }
+        heap->entries[i] = heap->entries[parent];
+        i = parent;
+    }
+    heap->entries[i] = entry;
+}
+
+static void sift_down(const topk_t *topk, topk_heap_t *heap, size_t i) {
+    topk_entry_t entry = heap->entries[i];
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= heap->length) {
+            break;
+        }
+        if (child + 1 < heap->length && ranks_before(topk, &heap->entries[child], &heap->entries[child + 1])) {
+            child++;
+        }
+        if (!ranks_before(topk, &entry, &heap->entries[child])) {
+            break;
+        }
+        heap->entries[i] = heap->entries[child];
+        i = child;
+    }
+    heap->entries[i] = entry;
+}
+
+// Inline strings came along with the copy of the cell, only the longer ones still point into the row
+static int copy_key(uint8_t data_type, cell_value_t *key) {
+    if (data_type != CELL_TYPE_STRING || key->string_cell.length <= STRING_INLINE_CAPACITY) {
+        return 0;
+    }
+    const char *string = key->string_cell.heap.string;
+    return set_string_cell(&key->string_cell, string, key->string_cell.length) == APPEND_OP_SUCCESS ? 0 : -1;
+}
+
+static void free_entries(const topk_t *topk, topk_entry_t *entries, size_t num_entries) {
+    if (topk->data_type == CELL_TYPE_STRING) {
+        for (size_t i = 0; i < num_entries; i++) {
+            free_string_cell(&entries[i].key.string_cell);
+        }
+    }
+}
+
+static int collect_row(row_t row, size_t row_index, uint64_t offset, void *ctx) {
+    topk_scan_t *scan = (topk_scan_t *) ctx;
+    const topk_t *topk = scan->topk;
+
+    // Every worker has its own heap, nothing is shared until the merge
+    size_t worker;
+    topk_heap_t *heap = &scan->heaps[threadpool_worker_index(scan->pool, &worker) ? worker : scan->num_heaps - 1];
+    topk_entry_t entry = {.key = row.cells[topk->col_index].data, .row_index = row_index, .offset = offset};
+
+    if (heap->length == topk->k) {
+        // Most rows stop here once the heap is full: one comparison and nothing copied
+        if (!ranks_before(topk, &entry, &heap->entries[0])) {
+            return 0;
+        }
+        if (copy_key(topk->data_type, &entry.key) != 0) {
+            heap->failed = 1;
+            return 1;
+        }
+        free_entries(topk, heap->entries, 1);
+        heap->entries[0] = entry;
+        sift_down(topk, heap, 0);
+        return 0;
+    }
+
+    if (heap->length == heap->capacity) {
+        size_t capacity = heap->capacity == 0 ? 64 : heap->capacity * 2;
+        if (capacity > topk->k) {
+            capacity = topk->k;
+        }
+        topk_entry_t *entries = (topk_entry_t *) realloc(heap->entries, capacity * sizeof(topk_entry_t));
+        if (entries == NULL) {
+            heap->failed = 1;
+            return 1;
+        }
+        heap->entries = entries;
+        heap->capacity = capacity;
+    }
+    if (copy_key(topk->data_type, &entry.key) != 0) {
+        heap->failed = 1;
+        return 1;
+    }
+    heap->entries[heap->length++] = entry;
+    sift_up(topk, heap, heap->length - 1);
+    return 0;
+}
+
+// Reads the row at offset, starting with a page and growing the buffer while the row doesn't fit
+static TopKOpStatus read_winner(int fd, header_t header, uint64_t offset, uint8_t **buffer_io, size_t *capacity_io,
+                                row_t *row_out) {
+    for (;;) {
+        size_t length = header.data_end - offset < *capacity_io ? header.data_end - offset : *capacity_io;
+        if (pread_full(fd, *buffer_io, length, offset) != (ssize_t) length) {
+            return TOPK_OP_READ_ERROR;
+        }
+        if (row_span(*buffer_io, length, header) != 0) {
+            break;
+        }
+        if (length < *capacity_io) {
+            return TOPK_OP_READ_ERROR;
+        }
+        uint8_t *buffer = (uint8_t *) realloc(*buffer_io, *capacity_io * 2);
+        if (buffer == NULL) {
+            return TOPK_OP_ERROR_MEMORY_ALLOCATION;
+        }
+        *buffer_io = buffer;
+        *capacity_io *= 2;
+    }
+
+    AppendOpStatus status = decode_row(*buffer_io, header, row_out);
+    if (status != APPEND_OP_SUCCESS) {
+        return status == APPEND_OP_ERROR_MEMORY_ALLOCATION ? TOPK_OP_ERROR_MEMORY_ALLOCATION : TOPK_OP_READ_ERROR;
+    }
+    return TOPK_OP_SUCCESS;
+}
+
+// Only the K winning rows are read back, one pread each at the offset the scan recorded
+static TopKOpStatus decode_winners(int fd, header_t header, const topk_entry_t *winners, size_t num_winners,
+                                   row_t *rows_out) {
+    size_t capacity = TOPK_ROW_READ_SIZE;
+    uint8_t *buffer = (uint8_t *) malloc(capacity);
+    if (buffer == NULL) {
+        return TOPK_OP_ERROR_MEMORY_ALLOCATION;
+    }
+
+    TopKOpStatus status = TOPK_OP_SUCCESS;
+    for (size_t i = 0; i < num_winners; i++) {
+        status = read_winner(fd, header, winners[i].offset, &buffer, &capacity, &rows_out[i]);
+        if (status != TOPK_OP_SUCCESS) {
+            for (size_t j = 0; j < i; j++) {
+                free_row(&rows_out[j], rows_out[j].num_cells);
+            }
+            break;
+        }
+    }
+    free(buffer);
+    return status;
+}
+
+TopKOpStatus topk_rows(int fd, header_t header, const tombstone_t *tombstones, const predicate_t *predicate,
+                       const topk_t *topk, threadpool_t *pool, row_t **rows_out, size_t *num_rows_out) {
+    if (fd < 0 || topk == NULL || topk->k == 0 || topk->col_index >= header.num_cols || rows_out == NULL
+        || num_rows_out == NULL) {
+        return TOPK_OP_ERROR_INVALID_ARG;
+    }
+
+    // The first pass only decodes the key and the predicate's column
+    uint8_t *decoded = (uint8_t *) calloc(header.num_cols, sizeof(uint8_t));
+    size_t num_heaps = (pool != NULL ? pool->num_threads : 0) + 1;
+    topk_heap_t *heaps = (topk_heap_t *) calloc(num_heaps, sizeof(topk_heap_t));
+    if (decoded == NULL || heaps == NULL) {
+        free(decoded);
+        free(heaps);
+        return TOPK_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    decoded[topk->col_index] = 1;
+    if (predicate != NULL) {
+        decoded[predicate->col_index] = 1;
+    }
+    size_t key_col = topk->col_index;
+    projection_t projection = {.num_cols = 1, .columns = &key_col, .decoded = decoded};
+
+    topk_scan_t scan = {.topk = topk, .pool = pool, .heaps = heaps, .num_heaps = num_heaps};
+    ScanOpStatus scan_status = scan_rows_parallel(fd, header, tombstones, predicate, &projection, collect_row, &scan,
+                                                  pool);
+    free(decoded);
+
+    TopKOpStatus status = TOPK_OP_SUCCESS;
+    size_t num_entries = 0;
+    for (size_t i = 0; i < num_heaps; i++) {
+        if (heaps[i].failed) {
+            status = TOPK_OP_ERROR_MEMORY_ALLOCATION;
+        }
+        num_entries += heaps[i].length;
+    }
+    if (status == TOPK_OP_SUCCESS && scan_status != SCAN_OP_SUCCESS) {
+        status = scan_status == SCAN_OP_ERROR_MEMORY_ALLOCATION ? TOPK_OP_ERROR_MEMORY_ALLOCATION : TOPK_OP_READ_ERROR;
+    }
+
+    // The merge: at most K entries per heap, the best K of all of them win
+    topk_entry_t *entries = NULL;
+    if (status == TOPK_OP_SUCCESS && num_entries > 0) {
+        entries = (topk_entry_t *) malloc(num_entries * sizeof(topk_entry_t));
+        if (entries == NULL) {
+            status = TOPK_OP_ERROR_MEMORY_ALLOCATION;
+        }
+    }
+    if (entries == NULL) {
+        for (size_t i = 0; i < num_heaps; i++) {
+            free_entries(topk, heaps[i].entries, heaps[i].length);
+            free(heaps[i].entries);
+        }
+        free(heaps);
+        if (status == TOPK_OP_SUCCESS) {
+            *rows_out = NULL;
+            *num_rows_out = 0;
+        }
+        return status;
+    }
+
+    size_t filled = 0;
+    for (size_t i = 0; i < num_heaps; i++) {
+        if (heaps[i].length > 0) {
+            memcpy(&entries[filled], heaps[i].entries, heaps[i].length * sizeof(topk_entry_t));
+            filled += heaps[i].length;
+        }
+        free(heaps[i].entries);
+    }
+    free(heaps);
+    qsort_r(entries, num_entries, sizeof(topk_entry_t), compare_ranks, (void *) topk);
+    size_t num_winners = num_entries < topk->k ? num_entries : topk->k;
+
+    row_t *rows = (row_t *) malloc(num_winners * sizeof(row_t));
+    if (rows == NULL) {
+        status = TOPK_OP_ERROR_MEMORY_ALLOCATION;
+    } else {
+        status = decode_winners(fd, header, entries, num_winners, rows);
+        if (status != TOPK_OP_SUCCESS) {
+            free(rows);
+        }
+    }
+    free_entries(topk, entries, num_entries);
+    free(entries);
+
+    if (status == TOPK_OP_SUCCESS) {
+        *rows_out = rows;
+        *num_rows_out = num_winners;
+    }
+    return status;
+}
+
+void free_topk_rows(row_t *rows, size_t num_rows) {
+    for (size_t i = 0; i < num_rows; i++) {
+        free_row(&rows[i], rows[i].num_cells);
+    }
+    free(rows);
+}
@@ -0,0 +1,315 @@
+#define _GNU_SOURCE  // fallocate
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "writer.h"
+#include "codec.h"
+#include "file.h"
+#include "tombstone.h"
+#include "stats.h"
+
+
+static WriterOpStatus reserve(append_writer_t *writer, uint64_t end) {
+    if (end <= writer->allocated) {
+        return WRITER_OP_SUCCESS;
+    }
+
+    // Grow by whole extents so the filesystem updates its metadata once per extent, not once per row
+    uint64_t new_allocated = writer->allocated + WRITER_EXTENT_SIZE;
+    while (new_allocated < end) {
+        new_allocated += WRITER_EXTENT_SIZE;
+    }
+
+    if (fallocate(writer->fd, 0, writer->allocated, new_allocated - writer->allocated) == -1) {
+        if (errno != EOPNOTSUPP) {
+            return WRITER_OP_ALLOCATE_ERROR;
+        }
+        // Not every filesystem supports it, a sparse extension still lets us map the space
+        if (ftruncate(writer->fd, new_allocated) == -1) {
+            return WRITER_OP_ALLOCATE_ERROR;
+        }
+    }
+
+    writer->allocated = new_allocated;
+    return WRITER_OP_SUCCESS;
+}
+
+static void unmap_window(append_writer_t *writer) {
+    if (writer->window != NULL) {
+        munmap(writer->window, writer->window_size);
+        writer->window = NULL;
+        writer->window_size = 0;
+    }
+}
+
+static WriterOpStatus map_window(append_writer_t *writer, size_t needed) {
+    unmap_window(writer);
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    uint64_t offset = writer->data_end - (writer->data_end % page_size);
+    size_t size = WRITER_WINDOW_SIZE;
+    while (offset + size < writer->data_end + needed) {
+        size += WRITER_WINDOW_SIZE;
+    }
+
+    WriterOpStatus status = reserve(writer, offset + size);
+    if (status != WRITER_OP_SUCCESS) {
+        return status;
+    }
+
+    void *window = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, writer->fd, offset);
+    if (window == MAP_FAILED) {
+        return WRITER_OP_MAP_ERROR;
+    }
+
+    writer->window = (uint8_t *) window;
+    writer->window_offset = offset;
+    writer->window_size = size;
+    return WRITER_OP_SUCCESS;
+}
+
+WriterOpStatus open_writer(int fd, header_t *header, append_writer_t *writer_out) {
+    if (fd < 0) {
+        return WRITER_OP_ERROR_INVALID_FD;
+    }
+    if (header == NULL || writer_out == NULL) {
+        return WRITER_OP_ERROR_INVALID_ARG;
+    }
+
+    // The header would be published in the wrong place, upgrade_table comes first
+    if (header->version != VERSION) {
+        return WRITER_OP_HEADER_ERROR;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1) {
+        return WRITER_OP_ERROR_INVALID_FD;
+    }
+
+    // A writer that never closed left its reserved space past data_end, trim it as its close would have
+    if ((uint64_t) file_stat.st_size > header->data_end) {
+        WriterOpStatus status = truncate_to_data_end(fd, *header);
+        if (status != WRITER_OP_SUCCESS) {
+            return status;
+        }
+    }
+
+    append_writer_t writer = {
+        .fd = fd,
+        .header = header,
+        .data_end = header->data_end,
+        .allocated = header->data_end,
+        .window = NULL,
+        .window_offset = 0,
+        .window_size = 0,
+        .pending_rows = 0,
+        .rollups = NULL
+    };
+
+    *writer_out = writer;
+    return WRITER_OP_SUCCESS;
+}
+
+WriterOpStatus writer_append(append_writer_t *writer, row_t row) {
+    if (writer == NULL || row.cells == NULL) {
+        return WRITER_OP_ERROR_INVALID_ARG;
+    }
+
+    size_t size = row_encoded_size(row);
+    if (writer->window == NULL || writer->data_end + size > writer->window_offset + writer->window_size) {
+        // Moving the window is a natural point to publish what's been written so far
+        WriterOpStatus status = writer_flush(writer);
+        if (status != WRITER_OP_SUCCESS) {
+            return status;
+        }
+        status = map_window(writer, size);
+        if (status != WRITER_OP_SUCCESS) {
+            return status;
+        }
+    }
+
+    uint8_t *destination = &writer->window[writer->data_end - writer->window_offset];
+    const row_codec_t *codec = writer->header->codec;
+    if (codec != NULL && row.num_cells == codec->num_cols) {
+        codec_encode_row(codec, destination, row);
+    } else {
+        encode_row(destination, row);
+    }
+    fold_rollups(writer->rollups, row);
+    writer->data_end += size;
+    writer->pending_rows++;
+    STATS_ADD(STAT_ROWS_WRITTEN, 1);
+    STATS_LOGICAL_WRITTEN(IO_ROWS, size);
+    return WRITER_OP_SUCCESS;
+}
+
+WriterOpStatus writer_flush(append_writer_t *writer) {
+    if (writer == NULL) {
+        return WRITER_OP_ERROR_INVALID_ARG;
+    }
+    if (writer->pending_rows == 0) {
+        return WRITER_OP_SUCCESS;
+    }
+
+    // Rows first, header second: a crash in between loses the rows but never exposes half of one
+    if (writer->window != NULL) {
+        // The rows reached the page cache through the mapping, without a write call
+        STATS_SYSCALL(IO_ROWS, IO_SYNC, writer->data_end - writer->header->data_end);
+        if (msync(writer->window, writer->window_size, MS_ASYNC) == -1) {
+            return WRITER_OP_WRITE_ERROR;
+        }
+    }
+    if (update_header_num_rows(writer->fd, writer->pending_rows, writer->data_end, writer->header) != HEADER_OP_SUCCESS) {
+        return WRITER_OP_HEADER_ERROR;
+    }
+
+    writer->pending_rows = 0;
+    RollupOpStatus rop_status = publish_rollups(writer->rollups, *writer->header);
+    if (rop_status == ROLLUP_OP_STALE) {
+        // A delete reset them under the writer, the next reader recomputes them
+        writer->rollups = NULL;
+    } else if (rop_status != ROLLUP_OP_SUCCESS) {
+        return WRITER_OP_ROLLUP_ERROR;
+    }
+    return WRITER_OP_SUCCESS;
+}
+
+WriterOpStatus truncate_to_data_end(int fd, header_t header) {
+    if (fd < 0) {
+        return WRITER_OP_ERROR_INVALID_FD;
+    }
+    if (ftruncate(fd, header.data_end) == -1) {
+        return WRITER_OP_WRITE_ERROR;
+    }
+    return WRITER_OP_SUCCESS;
+}
+
+WriterOpStatus close_writer(append_writer_t *writer) {
+    if (writer == NULL) {
+        return WRITER_OP_ERROR_INVALID_ARG;
+    }
+
+    WriterOpStatus status = writer_flush(writer);
+    unmap_window(writer);
+    if (status != WRITER_OP_SUCCESS) {
+        return status;
+    }
+
+    // Hand back whatever was reserved but not used
+    if (writer->allocated > writer->data_end) {
+        status = truncate_to_data_end(writer->fd, *writer->header);
+        if (status != WRITER_OP_SUCCESS) {
+            return status;
+        }
+        writer->allocated = writer->data_end;
+    }
+
+    return WRITER_OP_SUCCESS;
+}
+
+static WriterOpStatus copy_rows(int fd, header_t header, int out_fd, uint64_t out_offset) {
+    loff_t in_offset = header.data_offset;
+    loff_t copy_offset = out_offset;
+    while ((uint64_t) in_offset < header.data_end) {
+        ssize_t copied = copy_file_range(fd, &in_offset, out_fd, &copy_offset, header.data_end - in_offset, 0);
+        STATS_SYSCALL(IO_ROWS, IO_WRITE, copied);
+        if (copied == -1 && errno == EINTR) {
+            continue;
+        }
+        if (copied <= 0) {
+            return WRITER_OP_WRITE_ERROR;
+        }
+    }
+    return WRITER_OP_SUCCESS;
+}
+
+// Tables from before the generation was in the header have a shorter header: the rows are copied
+// as they are behind a current one in a new file, renamed over the table like a compaction. fd is
+// then moved to the new file, and the tombstones are bound to it since the rows keep their indices.
+WriterOpStatus upgrade_table(const char *filepath, int fd, header_t *header) {
+    if (filepath == NULL || header == NULL) {
+        return WRITER_OP_ERROR_INVALID_ARG;
+    }
+    if (fd < 0) {
+        return WRITER_OP_ERROR_INVALID_FD;
+    }
+    if (header->version == VERSION) {
+        return WRITER_OP_SUCCESS;
+    }
+
+    tombstone_t tombstones;
+    if (load_tombstones(filepath, fd, &tombstones) != TOMBSTONE_OP_SUCCESS) {
+        return WRITER_OP_WRITE_ERROR;
+    }
+
+    size_t path_length = strlen(filepath);
+    char *tmp_path = (char *) malloc(path_length + sizeof(UPGRADE_SUFFIX));
+    if (tmp_path == NULL) {
+        free_tombstones(&tombstones);
+        return WRITER_OP_ERROR_MEMORY_ALLOCATION;
+    }
+    memcpy(tmp_path, filepath, path_length);
+    memcpy(&tmp_path[path_length], UPGRADE_SUFFIX, sizeof(UPGRADE_SUFFIX));
+
+    int tmp_fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (tmp_fd == -1) {
+        free(tmp_path);
+        free_tombstones(&tombstones);
+        return WRITER_OP_WRITE_ERROR;
+    }
+
+    WriterOpStatus status = WRITER_OP_SUCCESS;
+    header_t upgraded = *header;
+    set_current_layout(&upgraded);
+    upgraded.generation = 0;
+    upgraded.data_end = header->data_end - header->data_offset + upgraded.data_offset;
+
+    struct stat table_stat;
+    if (fstat(fd, &table_stat) == -1 || fchmod(tmp_fd, table_stat.st_mode & 07777) == -1
+        || write_header(tmp_fd, upgraded) != HEADER_OP_SUCCESS) {
+        status = WRITER_OP_WRITE_ERROR;
+        goto cleanup;
+    }
+    status = copy_rows(fd, *header, tmp_fd, upgraded.data_offset);
+    if (status != WRITER_OP_SUCCESS) {
+        goto cleanup;
+    }
+    if (fsync(tmp_fd) == -1 || rename(tmp_path, filepath) == -1) {
+        status = WRITER_OP_WRITE_ERROR;
+        goto cleanup;
+    }
+
+    // Every block is written again, the sidecar now names the new inode
+    if (count_tombstones(&tombstones) > 0) {
+        memset(tombstones.dirty, 1, tombstones.num_blocks);
+        tombstones.rewrite = 1;
+        if (save_tombstones(filepath, tmp_fd, &tombstones) != TOMBSTONE_OP_SUCCESS) {
+            status = WRITER_OP_WRITE_ERROR;
+        }
+    }
+    sync_parent_dir(filepath);
+
+    if (dup2(tmp_fd, fd) == -1) {
+        status = WRITER_OP_WRITE_ERROR;
+    } else {
+        header->version = upgraded.version;
+        header->generation = upgraded.generation;
+        header->data_offset = upgraded.data_offset;
+        header->data_end = upgraded.data_end;
+    }
+
+cleanup:
+    close(tmp_fd);
+    if (status != WRITER_OP_SUCCESS) {
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+    free_tombstones(&tombstones);
+    return status;
+}
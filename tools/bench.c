@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+
+#include "file.h"
+#include "schema.h"
+#include "header.h"
+#include "append.h"
+#include "writer.h"
+#include "scan.h"
+#include "threadpool.h"
+#include "stats.h"
+
+#define BENCH_DEFAULT_ROWS 100000
+#define BENCH_SCHEMA_ITERATIONS 10000
+#define BENCH_HEADER_ITERATIONS 10000
+#define BENCH_SCAN_REPETITIONS 5
+#define BENCH_ROW_TEXT_SIZE 8192
+
+
+/*
+ * Prints one JSON object per line and benchmark, for instance
+ *
+ *     {"benchmark": "parse_row", "schema": "narrow", "ops": 100000, "ns_per_op": 412.3,
+ *      "ops_per_s": 2425376.0, "p50_ns": 390, "p99_ns": 702}
+ *
+ * End-to-end benchmarks count rows instead of ops, the throughput in MB/s is of encoded
+ * rows. The scan percentiles are those of whole scans. `make bench` builds and runs it.
+ */
+typedef struct {
+    const char *name;
+    const char *schema;
+    size_t string_length;
+} bench_schema_t;
+
+static const bench_schema_t schemas[] = {
+    {"narrow", "(id:int score:float)", 0},
+    {"int_heavy", "(i0:int i1:int i2:int i3:int i4:int i5:int i6:int i7:int i8:int i9:int i10:int i11:int i12:int "
+                  "i13:int i14:int i15:int)", 0},
+    {"string_heavy", "(s0:string s1:string s2:string s3:string s4:string s5:string s6:string s7:string)", 32},
+    {"short_string", "(s0:string s1:string s2:string s3:string s4:string s5:string s6:string s7:string)", 8},
+    {"int64_double", "(ts:int64 id:int64 user:int64 price:double qty:double)", 0},
+    {"wide", NULL, 8},  // 96 columns cycling through int, float and string, built at startup
+};
+
+typedef struct {
+    size_t rows;
+} count_ctx_t;
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// The percentiles are read from the sorted samples, one per op or per run
+static void report(const char *benchmark, const char *schema, const char *unit, size_t ops, uint64_t total_ns,
+                   uint64_t *samples, size_t num_samples, uint64_t bytes) {
+    qsort(samples, num_samples, sizeof(uint64_t), compare_u64);
+    double seconds = total_ns / 1e9;
+    printf("{\"benchmark\": \"%s\", \"schema\": \"%s\", \"%s\": %zu, \"ns_per_op\": %.1f, \"%s_per_s\": %.1f",
+           benchmark, schema, unit, ops, (double) total_ns / ops, unit, ops / seconds);
+    if (bytes > 0) {
+        printf(", \"mb_per_s\": %.1f", bytes / seconds / (1024 * 1024));
+    }
+    printf(", \"p50_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64 "}\n",
+           samples[(num_samples - 1) / 2], samples[(num_samples - 1) * 99 / 100]);
+    fflush(stdout);
+}
+
+static char *build_wide_schema(void) {
+    static const char *types[] = {"int", "float", "string"};
+    size_t capacity = 2048;
+    char *schema = (char *) malloc(capacity);
+    if (schema == NULL) {
+        return NULL;
+    }
+    size_t length = 0;
+    schema[length++] = '(';
+    for (size_t i = 0; i < 96; i++) {
+        length += snprintf(&schema[length], capacity - length, "%sc%zu:%s", i == 0 ? "" : " ", i, types[i % 3]);
+    }
+    schema[length++] = ')';
+    schema[length] = '\0';
+    return schema;
+}
+
+// Deterministic values, strings are lowercase letters so they never look like numbers
+static void format_row(header_t header, size_t row_index, size_t string_length, char *buffer) {
+    size_t length = 0;
+    buffer[length++] = '(';
+    for (size_t i = 0; i < header.num_cols; i++) {
+        if (i > 0) {
+            memcpy(&buffer[length], " && ", 4);
+            length += 4;
+        }
+        uint8_t data_type = header.columns[i].data_type;
+        if (data_type == CELL_TYPE_INT) {
+            length += sprintf(&buffer[length], "%zu", (row_index * 7919 + i) % 1000000);
+        } else if (data_type == CELL_TYPE_FLOAT) {
+            length += sprintf(&buffer[length], "%zu.25", (row_index + i) % 10000);
+        } else if (data_type == CELL_TYPE_INT64) {
+            length += sprintf(&buffer[length], "%zu", 1700000000000 + row_index * 7919 + i);
+        } else if (data_type == CELL_TYPE_DOUBLE) {
+            length += sprintf(&buffer[length], "%zu.125", (row_index + i) % 1000000);
+        } else {
+            for (size_t k = 0; k < string_length; k++) {
+                buffer[length++] = (char) ('a' + (row_index + i * 3 + k) % 26);
+            }
+        }
+    }
+    buffer[length++] = ')';
+    buffer[length] = '\0';
+}
+
+static int create_table(const char *path, const char *schema_text, header_t *header_out, int *fd_out) {
+    unlink(path);
+    int fd;
+    if (create_file(path, &fd) != FILE_SUCCESS) {
+        return -1;
+    }
+
+    column_t *columns;
+    size_t num_cols;
+    header_t header;
+    if (parse_schema((char *) schema_text, &columns, &num_cols) != SCHEMA_OP_SUCCESS) {
+        close(fd);
+        return -1;
+    }
+    int failed = initialize_header(columns, num_cols, &header) != HEADER_OP_SUCCESS
+                 || write_header(fd, header) != HEADER_OP_SUCCESS;
+    free_columns(columns, num_cols);
+
+    // Benchmarks work on a loaded header, with its codec, like the CLI does
+    if (failed || lseek(fd, 0, SEEK_SET) == -1 || read_header(fd, header_out) != HEADER_OP_SUCCESS) {
+        close(fd);
+        return -1;
+    }
+    *fd_out = fd;
+    return 0;
+}
+
+static int count_rows(row_t row, size_t row_index, uint64_t offset, void *ctx) {
+    __atomic_add_fetch(&((count_ctx_t *) ctx)->rows, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int bench_schema(const bench_schema_t *bench, const char *schema_text, const char *dir, size_t num_rows,
+                        threadpool_t *pool) {
+    size_t max_samples = num_rows > BENCH_SCHEMA_ITERATIONS ? num_rows : BENCH_SCHEMA_ITERATIONS;
+    uint64_t *samples = (uint64_t *) malloc(max_samples * sizeof(uint64_t));
+    char *text = (char *) malloc(BENCH_ROW_TEXT_SIZE);
+    char path[4096];
+    if (samples == NULL || text == NULL) {
+        free(samples);
+        free(text);
+        return -1;
+    }
+
+    int ret = -1;
+    int fd = -1;
+    header_t header = {0};
+    uint64_t begin, start, total;
+
+    // parse_schema
+    begin = stats_now();
+    for (size_t i = 0; i < BENCH_SCHEMA_ITERATIONS; i++) {
+        column_t *columns;
+        size_t num_cols;
+        start = stats_now();
+        SchemaOpStatus status = parse_schema((char *) schema_text, &columns, &num_cols);
+        samples[i] = stats_now() - start;
+        if (status != SCHEMA_OP_SUCCESS) {
+            goto cleanup;
+        }
+        free_columns(columns, num_cols);
+    }
+    report("parse_schema", bench->name, "ops", BENCH_SCHEMA_ITERATIONS, stats_now() - begin, samples,
+           BENCH_SCHEMA_ITERATIONS, 0);
+
+    snprintf(path, sizeof(path), "%s/picodb-bench-%s", dir, bench->name);
+    if (create_table(path, schema_text, &header, &fd) != 0) {
+        goto cleanup;
+    }
+
+    // parse_row
+    total = 0;
+    for (size_t i = 0; i < num_rows; i++) {
+        format_row(header, i, bench->string_length, text);
+        row_t row;
+        start = stats_now();
+        AppendOpStatus status = parse_row(header, text, &row);
+        samples[i] = stats_now() - start;
+        total += samples[i];
+        if (status != APPEND_OP_SUCCESS) {
+            goto cleanup;
+        }
+        free_row(&row, row.num_cells);
+    }
+    report("parse_row", bench->name, "ops", num_rows, total, samples, num_rows, 0);
+
+    // write_row, the rows are parsed outside of the timed section
+    if (lseek(fd, header.data_end, SEEK_SET) == -1) {
+        goto cleanup;
+    }
+    total = 0;
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < num_rows; i++) {
+        format_row(header, i, bench->string_length, text);
+        row_t row;
+        if (parse_row(header, text, &row) != APPEND_OP_SUCCESS) {
+            goto cleanup;
+        }
+        bytes += row_encoded_size(row);
+        start = stats_now();
+        AppendOpStatus status = write_row(fd, header, row);
+        samples[i] = stats_now() - start;
+        total += samples[i];
+        free_row(&row, row.num_cells);
+        if (status != APPEND_OP_SUCCESS) {
+            goto cleanup;
+        }
+    }
+    report("write_row", bench->name, "ops", num_rows, total, samples, num_rows, bytes);
+    if (update_header_num_rows(fd, num_rows, header.data_end + bytes, &header) != HEADER_OP_SUCCESS) {
+        goto cleanup;
+    }
+
+    // read_row
+    if (lseek(fd, header_size(header), SEEK_SET) == -1) {
+        goto cleanup;
+    }
+    total = 0;
+    for (size_t i = 0; i < num_rows; i++) {
+        row_t row;
+        start = stats_now();
+        AppendOpStatus status = read_row(fd, header, &row);
+        samples[i] = stats_now() - start;
+        total += samples[i];
+        if (status != APPEND_OP_SUCCESS) {
+            goto cleanup;
+        }
+        free_row(&row, row.num_cells);
+    }
+    report("read_row", bench->name, "ops", num_rows, total, samples, num_rows, bytes);
+
+    // read_header
+    total = 0;
+    for (size_t i = 0; i < BENCH_HEADER_ITERATIONS; i++) {
+        if (lseek(fd, 0, SEEK_SET) == -1) {
+            goto cleanup;
+        }
+        header_t loaded;
+        start = stats_now();
+        HeaderOpStatus status = read_header(fd, &loaded);
+        samples[i] = stats_now() - start;
+        total += samples[i];
+        if (status != HEADER_OP_SUCCESS) {
+            goto cleanup;
+        }
+        free_header(&loaded);
+    }
+    report("read_header", bench->name, "ops", BENCH_HEADER_ITERATIONS, total, samples, BENCH_HEADER_ITERATIONS, 0);
+
+    // End to end ingest: parse and append through the bulk writer, like -i
+    close(fd);
+    free_header(&header);
+    fd = -1;
+    if (create_table(path, schema_text, &header, &fd) != 0) {
+        goto cleanup;
+    }
+    append_writer_t writer;
+    if (open_writer(fd, &header, &writer) != WRITER_OP_SUCCESS) {
+        goto cleanup;
+    }
+    uint64_t data_start = header.data_end;
+    begin = stats_now();
+    for (size_t i = 0; i < num_rows; i++) {
+        format_row(header, i, bench->string_length, text);
+        row_t row;
+        start = stats_now();
+        if (parse_row(header, text, &row) != APPEND_OP_SUCCESS) {
+            close_writer(&writer);
+            goto cleanup;
+        }
+        WriterOpStatus status = writer_append(&writer, row);
+        samples[i] = stats_now() - start;
+        free_row(&row, row.num_cells);
+        if (status != WRITER_OP_SUCCESS) {
+            close_writer(&writer);
+            goto cleanup;
+        }
+    }
+    if (close_writer(&writer) != WRITER_OP_SUCCESS) {
+        goto cleanup;
+    }
+    // Formatting the text rows isn't part of the ingest
+    total = 0;
+    for (size_t i = 0; i < num_rows; i++) {
+        total += samples[i];
+    }
+    report("ingest", bench->name, "rows", num_rows, total, samples, num_rows, header.data_end - data_start);
+
+    // End to end scans, sequential then on the pool
+    for (int parallel = 0; parallel <= (pool != NULL); parallel++) {
+        begin = stats_now();
+        for (size_t i = 0; i < BENCH_SCAN_REPETITIONS; i++) {
+            count_ctx_t ctx = {0};
+            start = stats_now();
+            ScanOpStatus status = parallel ? scan_rows_parallel(fd, header, NULL, NULL, NULL, count_rows, &ctx, pool)
+                                           : scan_rows(fd, header, NULL, NULL, NULL, count_rows, &ctx);
+            samples[i] = stats_now() - start;
+            if (status != SCAN_OP_SUCCESS || ctx.rows != num_rows) {
+                goto cleanup;
+            }
+        }
+        report(parallel ? "scan_parallel" : "scan", bench->name, "rows", num_rows * BENCH_SCAN_REPETITIONS,
+               stats_now() - begin, samples, BENCH_SCAN_REPETITIONS,
+               (header.data_end - data_start) * BENCH_SCAN_REPETITIONS);
+    }
+
+    ret = 0;
+
+cleanup:
+    if (fd != -1) {
+        close(fd);
+        unlink(path);
+    }
+    free_header(&header);
+    free(samples);
+    free(text);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    size_t num_rows = BENCH_DEFAULT_ROWS;
+    const char *dir = "/tmp";
+    size_t num_threads = default_thread_count();
+
+    int opt;
+    while ((opt = getopt(argc, argv, ":n:d:j:")) != -1) {
+        switch (opt) {
+            case 'n':
+                num_rows = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                dir = optarg;
+                break;
+            case 'j':
+                num_threads = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n <rows>] [-d <directory>] [-j <threads>]\n", argv[0]);
+                return -1;
+        }
+    }
+    if (num_rows == 0 || num_threads == 0) {
+        fprintf(stderr, "The number of rows and threads must be positive integers.\n");
+        return -1;
+    }
+
+    threadpool_t *pool = NULL;
+    if (num_threads > 1 && threadpool_create(num_threads, &pool) != THREADPOOL_OP_SUCCESS) {
+        fprintf(stderr, "Failed to start the worker threads.\n");
+        return -1;
+    }
+
+    char *wide_schema = build_wide_schema();
+    int ret = wide_schema == NULL ? -1 : 0;
+    for (size_t i = 0; ret == 0 && i < sizeof(schemas) / sizeof(schemas[0]); i++) {
+        const char *schema_text = schemas[i].schema != NULL ? schemas[i].schema : wide_schema;
+        if (bench_schema(&schemas[i], schema_text, dir, num_rows, pool) != 0) {
+            fprintf(stderr, "The %s benchmarks failed.\n", schemas[i].name);
+            ret = -1;
+        }
+    }
+
+    free(wide_schema);
+    threadpool_destroy(pool);
+    return ret;
+}
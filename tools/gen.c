@@ -0,0 +1,583 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "file.h"
+#include "schema.h"
+#include "header.h"
+#include "append.h"
+#include "writer.h"
+#include "ingest.h"
+#include "scan.h"
+#include "stats.h"
+
+#define GEN_DEFAULT_CARDINALITY 1000000
+#define GEN_DEFAULT_MIN_LENGTH 8
+#define GEN_DEFAULT_MAX_LENGTH 32
+#define GEN_MAX_THREADS 64
+#define GEN_INT64_BASE 1700000000000ULL
+
+
+/*
+ * Generates rows for a schema, either printed in the -a format (one per line, to be piped
+ * into edu-picodb -i) or appended to a table through the append writer, then optionally
+ * drives concurrent appends and scans against the table for a fixed duration.
+ *
+ * Every column draws a rank in [0, cardinality): uniformly, or from a Zipf distribution
+ * with -z, rank 0 being the most frequent. With -o, the first column follows the row
+ * index for that fraction of the rows so the table is (partly) sorted on it. Ranks map
+ * to values that keep their order: the rank itself for ints, rank + 0.5 for floats, and
+ * for strings the rank in base 26 followed by filler letters up to a length drawn in
+ * [min, max] from the rank, so equal ranks give equal strings.
+ */
+typedef struct {
+    size_t rows;  // 0 in the load phase, where the row count isn't known in advance
+    uint64_t cardinality;
+    size_t min_length;
+    size_t max_length;
+    size_t key_width;  // Base 26 digits of the largest rank
+    double sortedness;
+    double skew;
+    double zeta_n;  // Zipf constants, see Gray et al., "Quickly Generating Billion-Record Synthetic Databases"
+    double alpha;
+    double eta;
+} gen_params_t;
+
+typedef struct {
+    const gen_params_t *params;
+    const header_t *header;
+    ingest_queue_t *queue;
+    size_t *next_row;
+    uint64_t seed;
+    uint64_t deadline;
+    size_t appended;
+    int failed;
+} producer_ctx_t;
+
+typedef struct {
+    const char *filepath;
+    uint64_t deadline;
+    uint64_t *samples;
+    size_t num_samples;
+    size_t capacity;
+    size_t rows_scanned;
+    int failed;
+} scanner_ctx_t;
+
+typedef struct {
+    size_t rows;
+} count_ctx_t;
+
+static uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+// xorshift64*, one state per thread
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1d;
+}
+
+static double next_unit(uint64_t *state) {
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int init_params(gen_params_t *params) {
+    if (params->cardinality == 0 || params->cardinality > INT32_MAX) {
+        fprintf(stderr, "The cardinality must be between 1 and %d.\n", INT32_MAX);
+        return -1;
+    }
+    if (params->min_length == 0 || params->min_length > params->max_length) {
+        fprintf(stderr, "The string lengths must be given as <min>:<max> with 0 < min <= max.\n");
+        return -1;
+    }
+    if (params->sortedness < 0 || params->sortedness > 1) {
+        fprintf(stderr, "The sortedness must be between 0 and 1.\n");
+        return -1;
+    }
+    if (params->skew < 0 || params->skew >= 1) {
+        fprintf(stderr, "The skew must be in [0, 1).\n");
+        return -1;
+    }
+
+    params->key_width = 1;
+    for (uint64_t max = params->cardinality - 1; max >= 26; max /= 26) {
+        params->key_width++;
+    }
+
+    if (params->skew > 0) {
+        double theta = params->skew;
+        params->zeta_n = 0;
+        for (uint64_t i = 1; i <= params->cardinality; i++) {
+            params->zeta_n += 1.0 / pow((double) i, theta);
+        }
+        double zeta_2 = 1.0 + 1.0 / pow(2.0, theta);
+        params->alpha = 1.0 / (1.0 - theta);
+        params->eta = (1.0 - pow(2.0 / params->cardinality, 1.0 - theta)) / (1.0 - zeta_2 / params->zeta_n);
+    }
+    return 0;
+}
+
+static uint64_t draw_rank(const gen_params_t *params, size_t column, size_t row_index, uint64_t *state) {
+    if (column == 0 && params->sortedness > 0 && next_unit(state) < params->sortedness) {
+        if (params->rows > 0) {
+            return (uint64_t) ((double) row_index / params->rows * params->cardinality);
+        }
+        return row_index % params->cardinality;
+    }
+    if (params->skew == 0) {
+        return next_random(state) % params->cardinality;
+    }
+
+    double u = next_unit(state);
+    double uz = u * params->zeta_n;
+    if (uz < 1.0) {
+        return 0;
+    }
+    if (uz < 1.0 + pow(0.5, params->skew)) {
+        return 1;
+    }
+    uint64_t rank = (uint64_t) (params->cardinality * pow(params->eta * u - params->eta + 1.0, params->alpha));
+    return rank < params->cardinality ? rank : params->cardinality - 1;
+}
+
+static int rank_string(const gen_params_t *params, uint64_t rank, string_cell_t *cell_out) {
+    uint64_t hash = splitmix64(rank);
+    size_t length = params->min_length + hash % (params->max_length - params->min_length + 1);
+    if (length < params->key_width) {
+        length = params->key_width;
+    }
+
+    char *string = alloc_string_cell(cell_out, length);
+    if (string == NULL) {
+        return -1;
+    }
+    uint64_t digits = rank;
+    for (size_t i = params->key_width; i > 0; i--) {
+        string[i - 1] = (char) ('a' + digits % 26);
+        digits /= 26;
+    }
+    for (size_t i = params->key_width; i < length; i++) {
+        hash = splitmix64(hash);
+        string[i] = (char) ('a' + hash % 26);
+    }
+    return 0;
+}
+
+// The row is allocated like parse_row does, it's released with free_row
+static int generate_row(const gen_params_t *params, header_t header, size_t row_index, uint64_t *state, row_t *row_out) {
+    row_t row;
+    row.num_cells = header.num_cols;
+    row.cells = (cell_t *) calloc(header.num_cols, sizeof(cell_t));
+    if (row.cells == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < header.num_cols; i++) {
+        uint64_t rank = draw_rank(params, i, row_index, state);
+        row.cells[i].type = (cell_type_t) header.columns[i].data_type;
+        if (row.cells[i].type == CELL_TYPE_INT) {
+            row.cells[i].data.int_value = (int32_t) rank;
+        } else if (row.cells[i].type == CELL_TYPE_FLOAT) {
+            row.cells[i].data.float_value = (float) rank + 0.5f;
+        } else if (row.cells[i].type == CELL_TYPE_INT64) {
+            // Past the range of an int, like the millisecond timestamps and ids they stand for
+            row.cells[i].data.int64_value = (int64_t) (GEN_INT64_BASE + rank);
+        } else if (row.cells[i].type == CELL_TYPE_DOUBLE) {
+            row.cells[i].data.double_value = (double) rank + 0.25;
+        } else if (rank_string(params, rank, &row.cells[i].data.string_cell) != 0) {
+            free_row(&row, i);
+            return -1;
+        }
+    }
+    *row_out = row;
+    return 0;
+}
+
+static int generate_rows(const gen_params_t *params, header_t *header, append_writer_t *writer, uint64_t seed) {
+    uint64_t state = splitmix64(seed) | 1;
+    for (size_t i = 0; i < params->rows; i++) {
+        row_t row;
+        if (generate_row(params, *header, i, &state, &row) != 0) {
+            fprintf(stderr, "Failed to allocate row %zu.\n", i);
+            return -1;
+        }
+        int failed = 0;
+        if (writer != NULL) {
+            failed = writer_append(writer, row) != WRITER_OP_SUCCESS;
+        } else {
+            print_row_values(row);
+        }
+        free_row(&row, row.num_cells);
+        if (failed) {
+            fprintf(stderr, "Failed to append row %zu.\n", i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void *producer_thread(void *arg) {
+    producer_ctx_t *ctx = (producer_ctx_t *) arg;
+    uint64_t state = splitmix64(ctx->seed) | 1;
+    while (stats_now() < ctx->deadline) {
+        // Sorted first columns stay roughly sorted across the producers
+        size_t row_index = __atomic_fetch_add(ctx->next_row, 1, __ATOMIC_RELAXED);
+        row_t row;
+        if (generate_row(ctx->params, *ctx->header, row_index, &state, &row) != 0) {
+            ctx->failed = 1;
+            break;
+        }
+        if (ingest_enqueue(ctx->queue, row) != INGEST_OP_SUCCESS) {
+            free_row(&row, row.num_cells);
+            ctx->failed = 1;
+            break;
+        }
+        ctx->appended++;
+    }
+    return NULL;
+}
+
+static int count_rows(row_t row, size_t row_index, uint64_t offset, void *ctx) {
+    ((count_ctx_t *) ctx)->rows++;
+    return 0;
+}
+
+// Each scan reloads the header, so it sees the rows the producers published since the last one
+static void *scanner_thread(void *arg) {
+    scanner_ctx_t *ctx = (scanner_ctx_t *) arg;
+    int fd;
+    if (open_file(ctx->filepath, &fd) != FILE_SUCCESS) {
+        ctx->failed = 1;
+        return NULL;
+    }
+
+    while (stats_now() < ctx->deadline) {
+        uint64_t start = stats_now();
+        header_t header;
+        if (lseek(fd, 0, SEEK_SET) == -1 || read_header(fd, &header) != HEADER_OP_SUCCESS) {
+            ctx->failed = 1;
+            break;
+        }
+        count_ctx_t count = {0};
+        ScanOpStatus status = scan_rows(fd, header, NULL, NULL, NULL, count_rows, &count);
+        free_header(&header);
+        if (status != SCAN_OP_SUCCESS) {
+            ctx->failed = 1;
+            break;
+        }
+
+        if (ctx->num_samples == ctx->capacity) {
+            size_t capacity = ctx->capacity == 0 ? 64 : ctx->capacity * 2;
+            uint64_t *samples = (uint64_t *) realloc(ctx->samples, capacity * sizeof(uint64_t));
+            if (samples == NULL) {
+                ctx->failed = 1;
+                break;
+            }
+            ctx->samples = samples;
+            ctx->capacity = capacity;
+        }
+        ctx->samples[ctx->num_samples++] = stats_now() - start;
+        ctx->rows_scanned += count.rows;
+    }
+    close(fd);
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// Prints a single JSON object with the append and scan throughput and the scan latencies
+static int run_load(const char *filepath, int fd, header_t *header, const gen_params_t *params, double seconds,
+                    size_t num_producers, size_t num_scanners, uint64_t seed) {
+    // The flusher moves the header's row count, the producers only need the columns
+    header_t columns = *header;
+    append_writer_t writer;
+    if (open_writer(fd, header, &writer) != WRITER_OP_SUCCESS) {
+        fprintf(stderr, "Failed to open the append writer.\n");
+        return -1;
+    }
+    ingest_queue_t *queue = NULL;
+    if (num_producers > 0 && open_ingest_queue(&writer, INGEST_QUEUE_CAPACITY, INGEST_BLOCK, &queue) != INGEST_OP_SUCCESS) {
+        fprintf(stderr, "Failed to start the ingest queue.\n");
+        close_writer(&writer);
+        return -1;
+    }
+
+    producer_ctx_t producers[GEN_MAX_THREADS];
+    scanner_ctx_t scanners[GEN_MAX_THREADS];
+    pthread_t producer_threads[GEN_MAX_THREADS];
+    pthread_t scanner_threads[GEN_MAX_THREADS];
+    size_t next_row = header->num_rows;
+    size_t started_producers = 0;
+    size_t started_scanners = 0;
+    int ret = 0;
+
+    uint64_t begin = stats_now();
+    uint64_t deadline = begin + (uint64_t) (seconds * 1e9);
+    for (; started_producers < num_producers; started_producers++) {
+        producers[started_producers] = (producer_ctx_t) {
+            .params = params, .header = &columns, .queue = queue, .next_row = &next_row,
+            .seed = seed + 1 + started_producers, .deadline = deadline
+        };
+        if (pthread_create(&producer_threads[started_producers], NULL, producer_thread,
+                           &producers[started_producers]) != 0) {
+            ret = -1;
+            break;
+        }
+    }
+    for (; ret == 0 && started_scanners < num_scanners; started_scanners++) {
+        scanners[started_scanners] = (scanner_ctx_t) { .filepath = filepath, .deadline = deadline };
+        if (pthread_create(&scanner_threads[started_scanners], NULL, scanner_thread,
+                           &scanners[started_scanners]) != 0) {
+            ret = -1;
+            break;
+        }
+    }
+
+    size_t appended = 0;
+    for (size_t i = 0; i < started_producers; i++) {
+        pthread_join(producer_threads[i], NULL);
+        appended += producers[i].appended;
+        ret |= -producers[i].failed;
+    }
+    if (queue != NULL && close_ingest_queue(queue) != INGEST_OP_SUCCESS) {
+        ret = -1;
+    }
+    uint64_t append_ns = stats_now() - begin;
+
+    size_t num_samples = 0;
+    size_t rows_scanned = 0;
+    for (size_t i = 0; i < started_scanners; i++) {
+        pthread_join(scanner_threads[i], NULL);
+        num_samples += scanners[i].num_samples;
+        rows_scanned += scanners[i].rows_scanned;
+        ret |= -scanners[i].failed;
+    }
+    uint64_t elapsed_ns = stats_now() - begin;
+
+    uint64_t *samples = (uint64_t *) malloc((num_samples > 0 ? num_samples : 1) * sizeof(uint64_t));
+    size_t filled = 0;
+    for (size_t i = 0; i < started_scanners; i++) {
+        if (samples != NULL) {
+            memcpy(&samples[filled], scanners[i].samples, scanners[i].num_samples * sizeof(uint64_t));
+            filled += scanners[i].num_samples;
+        }
+        free(scanners[i].samples);
+    }
+
+    if (close_writer(&writer) != WRITER_OP_SUCCESS || samples == NULL) {
+        ret = -1;
+    }
+    if (ret != 0) {
+        fprintf(stderr, "The load failed.\n");
+        free(samples);
+        return -1;
+    }
+
+    qsort(samples, num_samples, sizeof(uint64_t), compare_u64);
+    printf("{\"seconds\": %.3f, \"producers\": %zu, \"scanners\": %zu, \"rows_appended\": %zu, "
+           "\"appended_rows_per_s\": %.1f, \"scans\": %zu, \"scanned_rows_per_s\": %.1f",
+           elapsed_ns / 1e9, num_producers, num_scanners, appended, appended / (append_ns / 1e9), num_samples,
+           rows_scanned / (elapsed_ns / 1e9));
+    if (num_samples > 0) {
+        printf(", \"scan_p50_ns\": %" PRIu64 ", \"scan_p99_ns\": %" PRIu64, samples[(num_samples - 1) / 2],
+               samples[(num_samples - 1) * 99 / 100]);
+    }
+    printf(", \"num_rows\": %zu}\n", header->num_rows);
+    free(samples);
+    return 0;
+}
+
+static int parse_size(const char *text, size_t *value_out) {
+    char *end;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text || *end != '\0') {
+        return -1;
+    }
+    *value_out = value;
+    return 0;
+}
+
+static int parse_double(const char *text, double *value_out) {
+    char *end;
+    *value_out = strtod(text, &end);
+    return end == text || *end != '\0' ? -1 : 0;
+}
+
+static void print_usage(const char *name) {
+    fprintf(stderr, "Usage: %s -s <schema> [-r <rows>] [options]            print the rows on stdout\n"
+                    "       %s -f <file> [-s <schema>] [-r <rows>] [options]  append them to the table, created "
+                    "when -s is given\n\n"
+                    "  -c <cardinality>   distinct values per column (default: rows, or %d)\n"
+                    "  -l <min>:<max>     string lengths (default: %d:%d)\n"
+                    "  -o <fraction>      fraction of rows sorted on the first column (default: 0)\n"
+                    "  -z <skew>          Zipf exponent in [0, 1), 0 for uniform values (default: 0)\n"
+                    "  -x <seed>          random seed (default: 1)\n"
+                    "  -L <seconds>       then run concurrent appends and scans against the table\n"
+                    "  -W <threads>       appending threads of the load (default: 1)\n"
+                    "  -R <threads>       scanning threads of the load (default: 1)\n",
+            name, name, GEN_DEFAULT_CARDINALITY, GEN_DEFAULT_MIN_LENGTH, GEN_DEFAULT_MAX_LENGTH);
+}
+
+int main(int argc, char *argv[]) {
+    const char *filepath = NULL;
+    char *schema = NULL;
+    gen_params_t params = {
+        .min_length = GEN_DEFAULT_MIN_LENGTH, .max_length = GEN_DEFAULT_MAX_LENGTH
+    };
+    size_t cardinality = 0;
+    size_t seed = 1;
+    double seconds = 0;
+    size_t num_producers = 1;
+    size_t num_scanners = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, ":f:s:r:c:l:o:z:x:L:W:R:")) != -1) {
+        int invalid = 0;
+        switch (opt) {
+            case 'f':
+                filepath = optarg;
+                break;
+            case 's':
+                schema = optarg;
+                break;
+            case 'r':
+                invalid = parse_size(optarg, &params.rows);
+                break;
+            case 'c':
+                invalid = parse_size(optarg, &cardinality) || cardinality == 0;
+                break;
+            case 'l':
+                invalid = sscanf(optarg, "%zu:%zu", &params.min_length, &params.max_length) != 2;
+                break;
+            case 'o':
+                invalid = parse_double(optarg, &params.sortedness);
+                break;
+            case 'z':
+                invalid = parse_double(optarg, &params.skew);
+                break;
+            case 'x':
+                invalid = parse_size(optarg, &seed);
+                break;
+            case 'L':
+                invalid = parse_double(optarg, &seconds) || seconds <= 0;
+                break;
+            case 'W':
+                invalid = parse_size(optarg, &num_producers) || num_producers > GEN_MAX_THREADS;
+                break;
+            case 'R':
+                invalid = parse_size(optarg, &num_scanners) || num_scanners > GEN_MAX_THREADS;
+                break;
+            default:
+                invalid = 1;
+                break;
+        }
+        if (invalid) {
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    if (schema == NULL && filepath == NULL) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    if (seconds > 0 && filepath == NULL) {
+        fprintf(stderr, "The load needs a table (-f).\n");
+        return -1;
+    }
+
+    params.cardinality = cardinality > 0 ? cardinality : params.rows > 0 ? params.rows : GEN_DEFAULT_CARDINALITY;
+    if (init_params(&params) != 0) {
+        return -1;
+    }
+
+    int fd = -1;
+    header_t header = {0};
+    if (schema != NULL) {
+        column_t *columns;
+        size_t num_cols;
+        if (parse_schema(schema, &columns, &num_cols) != SCHEMA_OP_SUCCESS) {
+            fprintf(stderr, "Failed to parse the schema.\n");
+            return -1;
+        }
+        if (initialize_header(columns, num_cols, &header) != HEADER_OP_SUCCESS) {
+            fprintf(stderr, "Failed to initialize the header.\n");
+            free_columns(columns, num_cols);
+            return -1;
+        }
+        if (filepath != NULL) {
+            FileOpStatus status = create_file(filepath, &fd);
+            int failed = status != FILE_SUCCESS || write_header(fd, header) != HEADER_OP_SUCCESS;
+            free_header(&header);
+            if (failed) {
+                fprintf(stderr, status == FILE_ERROR_EXISTS ? "The file already exists.\n"
+                                                            : "Failed to create the table.\n");
+                if (fd != -1) {
+                    close(fd);
+                }
+                return -1;
+            }
+        }
+    } else if (open_file(filepath, &fd) != FILE_SUCCESS) {
+        fprintf(stderr, "Failed to open the table.\n");
+        return -1;
+    }
+
+    // The writer needs a loaded header
+    if (fd != -1 && (lseek(fd, 0, SEEK_SET) == -1 || read_header(fd, &header) != HEADER_OP_SUCCESS)) {
+        fprintf(stderr, "Failed to read the header.\n");
+        close(fd);
+        return -1;
+    }
+    // Tables written by older versions get the current header before anything is appended
+    if (fd != -1 && upgrade_table(filepath, fd, &header) != WRITER_OP_SUCCESS) {
+        fprintf(stderr, "Failed to upgrade the table to the current header.\n");
+        free_header(&header);
+        close(fd);
+        return -1;
+    }
+
+    int ret = 0;
+    if (fd == -1) {
+        ret = generate_rows(&params, &header, NULL, seed);
+    } else if (params.rows > 0) {
+        append_writer_t writer;
+        if (open_writer(fd, &header, &writer) != WRITER_OP_SUCCESS) {
+            fprintf(stderr, "Failed to open the append writer.\n");
+            ret = -1;
+        } else {
+            ret = generate_rows(&params, &header, &writer, seed);
+            if (close_writer(&writer) != WRITER_OP_SUCCESS) {
+                fprintf(stderr, "Failed to close the append writer.\n");
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0 && seconds > 0) {
+        params.rows = 0;
+        ret = run_load(filepath, fd, &header, &params, seconds, num_producers, num_scanners, seed);
+    }
+
+    free_header(&header);
+    if (fd != -1 && close(fd) == -1) {
+        fprintf(stderr, "Failed to close the file.\n");
+        return -1;
+    }
+    return ret;
+}